@@ -0,0 +1,317 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* accounting.c
+
+   What each connection child cost, from the rusage wait4() returns when
+   dead_child() reaps it: CPU user and system time, peak RSS, minor and
+   major page faults, context switches, and the wall-clock time from
+   fork() to reaping as seen by the master.
+
+   Every child goes into the MH_CHILD_xx histograms of the statistics
+   segment (see stats.h), so they show up with the other metrics. Sums
+   are also kept per client address prefix of rusageprefix bits, so that
+   expensive clients stand out; with rusageprefix 0, the default, there
+   is one prefix covering everyone. Once ACCOUNTING_PREFIXES prefixes
+   have been seen, new ones are lumped together as "other". UDP workers
+   serve many clients each, so they have their own "udp-workers" sums
+   rather than counting as 0.0.0.0.
+
+   Every rusagesummary seconds in which children were reaped, one line
+   gives percentiles over the interval, and another the prefixes that
+   have used most CPU. The admin command "rusage" gives the whole table.
+
+   accounting_reaped() runs in the SIGCHLD handler, so the main loop
+   blocks SIGCHLD while it reads the sums.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "accounting.h"
+#include "childtab.h"
+#include "metrics.h"
+#include "log.h"
+
+typedef struct
+{
+  in_addr_t prefix;          /* host byte order, already masked */
+  const char *label;         /* for ACCOUNT_OTHER and ACCOUNT_UDP, else
+                                NULL */
+  unsigned long long children;
+  unsigned long long user_us;
+  unsigned long long sys_us;
+  unsigned long long minflt;
+  unsigned long long majflt;
+  unsigned long long csw;
+  unsigned long long wall_us;
+  long maxrss;               /* largest seen, kB */
+}
+prefix_account;
+
+#define ACCOUNT_OTHER ACCOUNTING_PREFIXES      /* the catch-all */
+#define ACCOUNT_UDP (ACCOUNTING_PREFIXES + 1)  /* all the UDP workers */
+#define ACCOUNT_ENTRIES (ACCOUNTING_PREFIXES + 2)
+
+static prefix_account prefixes[ACCOUNT_ENTRIES];
+static int nprefixes = 0;  /* not counting the last two */
+
+/* histogram buckets as they were at the last summary */
+static unsigned long long last_buckets[METRIC_HISTOGRAMS][METRIC_BUCKETS];
+static unsigned long long last_summary_us = 0;
+static unsigned long long reaped_since = 0;
+
+static unsigned long long tv_us(const struct timeval *tv)
+{
+  return (unsigned long long)tv->tv_sec * 1000000 + tv->tv_usec;
+} /* tv_us */
+
+static prefix_account* find_prefix(in_addr_t peer)
+{
+  in_addr_t mask = 0;
+  in_addr_t prefix;
+  int i;
+
+  if (global_options->rusageprefix > 0)
+  {
+    mask = 0xffffffffU << (32 - global_options->rusageprefix);
+  }
+  prefix = ntohl(peer) & mask;
+  for (i = 0; i < nprefixes; i++)
+  {
+    if (prefixes[i].prefix == prefix)
+    {
+      return &prefixes[i];
+    }
+  }
+  if (nprefixes < ACCOUNTING_PREFIXES)
+  {
+    prefixes[nprefixes].prefix = prefix;
+    prefixes[nprefixes].label = NULL;
+    return &prefixes[nprefixes++];
+  }
+  prefixes[ACCOUNT_OTHER].label = "other";
+  return &prefixes[ACCOUNT_OTHER];
+} /* find_prefix */
+
+/* Called by dead_child() for each child it reaps */
+void accounting_reaped(pid_t pid, const struct rusage *ru)
+{
+  child_entry child;
+  prefix_account *p;
+  unsigned long long user = tv_us(&ru->ru_utime);
+  unsigned long long sys = tv_us(&ru->ru_stime);
+  unsigned long long csw = ru->ru_nvcsw + ru->ru_nivcsw;
+  unsigned long long wall = 0;
+  int udp = FALSE;  /* a UDP worker, which has no one client */
+
+  if (childtab_remove(pid, &child) == TRUE)
+  {
+    wall = metrics_now() - child.forked_us;
+    metrics_record(MH_CHILD_WALL, wall);
+    udp = (child.accepted_us == 0) ? TRUE : FALSE;
+  }
+  else
+  {
+    child.peer = 0;  /* forked by someone else, eg become_daemon() */
+  }
+  metrics_record(MH_CHILD_USER, user);
+  metrics_record(MH_CHILD_SYS, sys);
+  metrics_record(MH_CHILD_MAXRSS, ru->ru_maxrss);
+  metrics_record(MH_CHILD_MINFLT, ru->ru_minflt);
+  metrics_record(MH_CHILD_MAJFLT, ru->ru_majflt);
+  metrics_record(MH_CHILD_CSW, csw);
+
+  if (udp == TRUE)
+  {
+    p = &prefixes[ACCOUNT_UDP];
+    p->label = "udp-workers";
+  }
+  else
+  {
+    p = find_prefix(child.peer);
+  }
+  p->children++;
+  p->user_us += user;
+  p->sys_us += sys;
+  p->minflt += ru->ru_minflt;
+  p->majflt += ru->ru_majflt;
+  p->csw += csw;
+  p->wall_us += wall;
+  if (ru->ru_maxrss > p->maxrss)
+  {
+    p->maxrss = ru->ru_maxrss;
+  }
+  reaped_since++;
+} /* accounting_reaped */
+
+static void prefix_name(const prefix_account *p, char *buf, size_t len)
+{
+  struct in_addr a;
+
+  if (p->label != NULL)
+  {
+    snprintf(buf, len, "%s", p->label);
+    return;
+  }
+  a.s_addr = htonl(p->prefix);
+  snprintf(buf, len, "%s/%u", inet_ntoa(a), global_options->rusageprefix);
+} /* prefix_name */
+
+/* qsort order, most CPU first */
+static int by_cpu(const void *a, const void *b)
+{
+  const prefix_account *pa = a;
+  const prefix_account *pb = b;
+  unsigned long long ca = pa->user_us + pa->sys_us;
+  unsigned long long cb = pb->user_us + pb->sys_us;
+
+  return (ca < cb) ? 1 : ((ca > cb) ? -1 : 0);
+} /* by_cpu */
+
+/* Copies the table, sorted by CPU, into sorted. Returns the entries. */
+static int sorted_prefixes(prefix_account *sorted)
+{
+  int n;
+
+  childtab_block();
+  n = nprefixes;
+  memcpy(sorted, prefixes, n * sizeof(prefix_account));
+  if (prefixes[ACCOUNT_OTHER].children > 0)
+  {
+    sorted[n++] = prefixes[ACCOUNT_OTHER];
+  }
+  if (prefixes[ACCOUNT_UDP].children > 0)
+  {
+    sorted[n++] = prefixes[ACCOUNT_UDP];
+  }
+  childtab_unblock();
+  qsort(sorted, n, sizeof(prefix_account), by_cpu);
+  return n;
+} /* sorted_prefixes */
+
+/* q-th quantile of histogram h since the last summary */
+static unsigned long long interval_quantile(int h, double q)
+{
+  const stats_histogram *hist = metrics_histogram(h);
+  unsigned long long delta[METRIC_BUCKETS];
+  unsigned long long n = 0;
+  unsigned b;
+
+  for (b = 0; b < METRIC_BUCKETS; b++)
+  {
+    delta[b] = hist->bucket[b] - last_buckets[h][b];
+    n += delta[b];
+  }
+  return stats_quantile(delta, n, q);
+} /* interval_quantile */
+
+static void summarise(long secs)
+{
+  prefix_account sorted[ACCOUNT_ENTRIES];
+  char name[32];
+  char line[256];
+  int n;
+  int i;
+  int h;
+
+  childtab_block();
+  LOG(1, ("rusage of %llu children in %lds: user p50/p99 %llu/%llu us, "
+          "sys p50/p99 %llu/%llu us, maxrss p99 %llu kB, minflt p50/p99 "
+          "%llu/%llu, majflt p99 %llu, csw p99 %llu, wall p50/p99 "
+          "%llu/%llu us\n", reaped_since, secs,
+          interval_quantile(MH_CHILD_USER, 0.5),
+          interval_quantile(MH_CHILD_USER, 0.99),
+          interval_quantile(MH_CHILD_SYS, 0.5),
+          interval_quantile(MH_CHILD_SYS, 0.99),
+          interval_quantile(MH_CHILD_MAXRSS, 0.99),
+          interval_quantile(MH_CHILD_MINFLT, 0.5),
+          interval_quantile(MH_CHILD_MINFLT, 0.99),
+          interval_quantile(MH_CHILD_MAJFLT, 0.99),
+          interval_quantile(MH_CHILD_CSW, 0.99),
+          interval_quantile(MH_CHILD_WALL, 0.5),
+          interval_quantile(MH_CHILD_WALL, 0.99)));
+  for (h = MH_CHILD_USER; h <= MH_CHILD_WALL; h++)
+  {
+    memcpy(last_buckets[h], metrics_histogram(h)->bucket,
+           sizeof(last_buckets[h]));
+  }
+  reaped_since = 0;
+  childtab_unblock();
+
+  if (global_options->rusageprefix == 0)
+  {
+    return;
+  }
+  n = sorted_prefixes(sorted);
+  line[0] = '\0';
+  for (i = 0; (i < n) && (i < ACCOUNTING_TOP); i++)
+  {
+    prefix_name(&sorted[i], name, sizeof(name));
+    snprintf(line + strlen(line), sizeof(line) - strlen(line),
+             "%s%s %llu us (%llu children)", (i > 0) ? ", " : "", name,
+             sorted[i].user_us + sorted[i].sys_us, sorted[i].children);
+  }
+  LOG(1, ("most CPU since start: %s\n", line));
+} /* summarise */
+
+/* Called from the main loop, writes the periodic summary when due */
+void accounting_tick()
+{
+  unsigned long long now;
+
+  if ((global_options->rusagesummary == 0) || (metrics_histogram(0) == NULL))
+  {
+    return;
+  }
+  now = metrics_now();
+  if (last_summary_us == 0)
+  {
+    last_summary_us = now;
+    return;
+  }
+  if (now - last_summary_us < 1000000ULL * global_options->rusagesummary)
+  {
+    return;
+  }
+  if (reaped_since > 0)
+  {
+    summarise((long)((now - last_summary_us + 500000) / 1000000));
+  }
+  last_summary_us = now;
+} /* accounting_tick */
+
+/* Admin command "rusage": the table of prefixes, most CPU first */
+void accounting_write(FILE *out, const char *args)
+{
+  prefix_account sorted[ACCOUNT_ENTRIES];
+  char name[32];
+  int n;
+  int i;
+
+  n = sorted_prefixes(sorted);
+  fprintf(out, "# %-18s %8s %12s %12s %10s %9s %10s %8s %10s %12s\n",
+          "prefix", "children", "user_us", "sys_us", "cpu/child", "maxrss_kb",
+          "minflt", "majflt", "csw", "wall_us");
+  for (i = 0; i < n; i++)
+  {
+    prefix_name(&sorted[i], name, sizeof(name));
+    fprintf(out, "%-20s %8llu %12llu %12llu %10llu %9ld %10llu %8llu %10llu"
+            " %12llu\n", name, sorted[i].children, sorted[i].user_us,
+            sorted[i].sys_us,
+            (sorted[i].user_us + sorted[i].sys_us) / sorted[i].children,
+            sorted[i].maxrss, sorted[i].minflt, sorted[i].majflt,
+            sorted[i].csw, sorted[i].wall_us);
+  }
+} /* accounting_write */
@@ -0,0 +1,24 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* accounting.h
+
+*/
+
+#include <stdio.h>
+#include <sys/resource.h>
+
+#define ACCOUNTING_PREFIXES 64  /* client prefixes tracked separately */
+#define ACCOUNTING_TOP 3        /* prefixes named in the periodic summary */
+
+void accounting_reaped(pid_t pid, const struct rusage *ru);
+void accounting_tick();
+void accounting_write(FILE *out, const char *args);
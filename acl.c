@@ -0,0 +1,719 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* acl.c
+
+   Allow and deny rules for client addresses, checked by the master
+   before it forks, so a refused client costs an accept() and a close()
+   rather than a child. The rules are in the file named by the aclfile
+   option, one to a line:
+
+       # comments and blank lines are ignored
+       deny  10.0.0.0/8
+       allow 10.1.0.0/16
+       deny  2001:db8::/32
+       allow 192.0.2.7          a host, the same as /32
+
+   The rule with the longest prefix containing the client decides, so
+   the order of lines doesn't matter. A client no rule matches gets
+   acldefault. If the same prefix is given twice the later line wins.
+
+   The rules are kept in a path-compressed binary trie (PATRICIA), one
+   for IPv4 and one for IPv6. A node only exists where prefixes branch,
+   so 100k prefixes take a few MB. Nodes are in one array, so building a
+   trie is a few reallocs and freeing it is one free(). A lookup starts
+   from a table indexed by the first 16 bits of the address, which says
+   where in the trie those bits lead, so it only visits the few nodes
+   below that; without it a big trie costs a cache miss per level.
+
+   A reload builds a complete new trie with acl_build(), and only if the
+   file was entirely good does acl_use() put it in place of the old one;
+   the master is single threaded so nothing is looking at the old one by
+   then. Each rule counts the clients it decided, shown by the admin
+   command "acl". Counts start again from 0 after a reload.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "acl.h"
+#include "util.h"
+#define LOG_SUBSYS LOGSUB_SOCKET
+#include "log.h"
+
+#define ACL_V4 0
+#define ACL_V6 1
+#define ACL_NONE -1  /* no child, or no rule */
+#define ACL_JUMP_BITS 16
+#define ACL_JUMPS (1 << ACL_JUMP_BITS)
+
+typedef unsigned long long acl_key[2];  /* address, most significant first */
+
+typedef struct
+{
+  acl_key key;           /* prefix, host bits zero */
+  int child[2];          /* by the bit after the prefix */
+  int rule;              /* ACL_NONE if only a branch point */
+  unsigned bits;         /* prefix length */
+}
+acl_node;
+
+/* where a lookup of an address starting with these ACL_JUMP_BITS bits
+   would be by the time it needed to look at any more of them */
+typedef struct
+{
+  int node;
+  int rule;              /* the best match so far */
+}
+acl_jump;
+
+typedef struct
+{
+  acl_key key;
+  unsigned bits;
+  int family;            /* ACL_V4 or ACL_V6 */
+  unsigned action;       /* ACL_ALLOW or ACL_DENY */
+  int line;
+  unsigned long long hits;
+}
+acl_rule;
+
+struct acl
+{
+  acl_node *node;        /* node[ACL_V4] and node[ACL_V6] are the roots */
+  int nodes;
+  int nodecap;
+  acl_rule *rule;
+  int rules;
+  int rulecap;
+  acl_jump *jump[2];     /* by family, then the first ACL_JUMP_BITS bits */
+  unsigned dflt;         /* ACL_xx for clients no rule matches */
+  unsigned long long default_hits;
+};
+
+static acl *current = NULL;  /* NULL lets everyone in */
+
+static const unsigned family_bits[2] = { 32, 128 };
+
+/* returns bit i of key, counting from the most significant */
+static unsigned key_bit(const acl_key key, unsigned i)
+{
+  return (i < 64) ? (unsigned)(key[0] >> (63 - i)) & 1 :
+         (unsigned)(key[1] >> (127 - i)) & 1;
+} /* key_bit */
+
+static unsigned long long top_mask(unsigned bits)
+{
+  return (bits == 0) ? 0 : ~0ULL << (64 - bits);
+} /* top_mask */
+
+/* TRUE if the first bits bits of a and b are the same */
+static int key_match(const acl_key a, const acl_key b, unsigned bits)
+{
+  if (bits <= 64)
+  {
+    return (((a[0] ^ b[0]) & top_mask(bits)) == 0) ? TRUE : FALSE;
+  }
+  return ((a[0] == b[0]) &&
+          (((a[1] ^ b[1]) & top_mask(bits - 64)) == 0)) ? TRUE : FALSE;
+} /* key_match */
+
+/* how many leading bits a and b have in common */
+static unsigned key_common(const acl_key a, const acl_key b)
+{
+  if (a[0] != b[0])
+  {
+    return __builtin_clzll(a[0] ^ b[0]);
+  }
+  if (a[1] != b[1])
+  {
+    return 64 + __builtin_clzll(a[1] ^ b[1]);
+  }
+  return 128;
+} /* key_common */
+
+static int new_node(acl *a, const acl_key key, unsigned bits, int rule)
+{
+  acl_node *n;
+
+  if (a->nodes == a->nodecap)
+  {
+    a->nodecap = (a->nodecap == 0) ? 256 : a->nodecap * 2;
+    n = realloc(a->node, a->nodecap * sizeof(acl_node));
+    if (n == NULL)
+    {
+      PANIC(("Out of memory building ACL trie of %d nodes\n", a->nodecap));
+    }
+    a->node = n;
+  }
+  n = &a->node[a->nodes];
+  n->key[0] = key[0];
+  n->key[1] = key[1];
+  n->bits = bits;
+  n->rule = rule;
+  n->child[0] = ACL_NONE;
+  n->child[1] = ACL_NONE;
+  return a->nodes++;
+} /* new_node */
+
+/* Puts rule r into the trie for its family. Returns the rule it
+   replaced, if the same prefix was there already, or ACL_NONE. */
+static int trie_insert(acl *a, int r)
+{
+  const acl_rule *rule = &a->rule[r];
+  unsigned len = rule->bits;
+  int n = rule->family;  /* the root */
+  int c;
+  int m;
+  int leaf;
+  int old;
+  unsigned b;
+  unsigned common;
+
+  for (;;)
+  {
+    /* the prefix of node n is a prefix of the rule's */
+    if (a->node[n].bits == len)
+    {
+      old = a->node[n].rule;
+      a->node[n].rule = r;
+      return old;
+    }
+    b = key_bit(rule->key, a->node[n].bits);
+    c = a->node[n].child[b];
+    if (c == ACL_NONE)
+    {
+      m = new_node(a, rule->key, len, r);
+      a->node[n].child[b] = m;
+      return ACL_NONE;
+    }
+    common = key_common(rule->key, a->node[c].key);
+    if (common > len)
+      common = len;
+    if (common >= a->node[c].bits)
+    {
+      n = c;
+      continue;
+    }
+    /* the rule and c part company before c's prefix ends, so a new node
+       goes between n and c, at the rule if it is that short */
+    if (common == len)
+    {
+      m = new_node(a, rule->key, len, r);
+    }
+    else
+    {
+      acl_key k;
+
+      k[0] = rule->key[0];
+      k[1] = rule->key[1];
+      if (common < 64)
+      {
+        k[0] &= top_mask(common);
+        k[1] = 0;
+      }
+      else
+      {
+        k[1] &= top_mask(common - 64);
+      }
+      m = new_node(a, k, common, ACL_NONE);
+      leaf = new_node(a, rule->key, len, r);  /* may move a->node */
+      a->node[m].child[key_bit(rule->key, common)] = leaf;
+    }
+    a->node[m].child[key_bit(a->node[c].key, common)] = c;
+    a->node[n].child[b] = m;
+    return ACL_NONE;
+  }
+} /* trie_insert */
+
+/* Fills in the jump table of a family, by going as far down the trie as
+   the first ACL_JUMP_BITS bits of each address decide. The top levels of
+   a big trie are full, so this saves most of the nodes a lookup visits,
+   and they are each a cache miss. */
+static void trie_jumps(acl *a, int family)
+{
+  const acl_node *node = a->node;
+  acl_jump *jump;
+  acl_key key;
+  unsigned v;
+  int n;
+  int c;
+  int best;
+
+  jump = malloc(ACL_JUMPS * sizeof(acl_jump));
+  if (jump == NULL)
+  {
+    PANIC(("Out of memory building ACL jump table\n"));
+  }
+  key[1] = 0;
+  for (v = 0; v < ACL_JUMPS; v++)
+  {
+    key[0] = (unsigned long long)v << (64 - ACL_JUMP_BITS);
+    n = family;
+    best = node[n].rule;
+    while (node[n].bits < ACL_JUMP_BITS)
+    {
+      c = node[n].child[key_bit(key, node[n].bits)];
+      if ((c == ACL_NONE) || (node[c].bits > ACL_JUMP_BITS) ||
+          (key_match(key, node[c].key, node[c].bits) == FALSE))
+      {
+        break;
+      }
+      if (node[c].rule != ACL_NONE)
+      {
+        best = node[c].rule;
+      }
+      n = c;
+    }
+    jump[v].node = n;
+    jump[v].rule = best;
+  }
+  a->jump[family] = jump;
+} /* trie_jumps */
+
+/* Returns the rule with the longest prefix containing key, or ACL_NONE */
+static int trie_lookup(const acl *a, int family, const acl_key key)
+{
+  const acl_node *node = a->node;
+  const acl_jump *jump = &a->jump[family][key[0] >> (64 - ACL_JUMP_BITS)];
+  unsigned maxbits = family_bits[family];
+  int best = jump->rule;
+  int n = jump->node;
+  int c;
+
+  while (node[n].bits < maxbits)
+  {
+    c = node[n].child[key_bit(key, node[n].bits)];
+    if ((c == ACL_NONE) || (key_match(key, node[c].key, node[c].bits) == FALSE))
+    {
+      break;
+    }
+    if (node[c].rule != ACL_NONE)
+    {
+      best = node[c].rule;
+    }
+    n = c;
+  }
+  return best;
+} /* trie_lookup */
+
+static void key_from_v4(acl_key key, const struct in_addr *in)
+{
+  key[0] = (unsigned long long)ntohl(in->s_addr) << 32;
+  key[1] = 0;
+} /* key_from_v4 */
+
+static void key_from_v6(acl_key key, const struct in6_addr *in6)
+{
+  int i;
+
+  key[0] = 0;
+  key[1] = 0;
+  for (i = 0; i < 8; i++)
+  {
+    key[0] = (key[0] << 8) | in6->s6_addr[i];
+    key[1] = (key[1] << 8) | in6->s6_addr[i + 8];
+  }
+} /* key_from_v6 */
+
+/* ::ffff:a.b.c.d is how an IPv6 socket sees an IPv4 client */
+static int key_is_v4mapped(const acl_key key)
+{
+  return ((key[0] == 0) && ((key[1] >> 32) == 0xffffULL)) ? TRUE : FALSE;
+} /* key_is_v4mapped */
+
+/* Parses "address[/bits]" of length len into rule. Returns 0, or the
+   offset into text of what was wrong with it. */
+static int parse_prefix(const char *text, size_t len, acl_rule *rule)
+{
+  char buf[INET6_ADDRSTRLEN + 1];
+  struct in_addr in;
+  struct in6_addr in6;
+  const char *slash;
+  size_t alen;
+  size_t i;
+  unsigned bits = 0;
+
+  slash = memchr(text, '/', len);
+  alen = (slash == NULL) ? len : (size_t)(slash - text);
+  if ((alen == 0) || (alen >= sizeof(buf)))
+  {
+    return 1;
+  }
+  memcpy(buf, text, alen);
+  buf[alen] = '\0';
+
+  if (memchr(buf, ':', alen) != NULL)
+  {
+    if (inet_pton(AF_INET6, buf, &in6) != 1)
+    {
+      return 1;
+    }
+    rule->family = ACL_V6;
+    key_from_v6(rule->key, &in6);
+  }
+  else
+  {
+    if (inet_pton(AF_INET, buf, &in) != 1)
+    {
+      return 1;
+    }
+    rule->family = ACL_V4;
+    key_from_v4(rule->key, &in);
+  }
+
+  rule->bits = family_bits[rule->family];
+  if (slash != NULL)
+  {
+    for (i = alen + 1; i < len; i++)
+    {
+      if ((text[i] < '0') || (text[i] > '9') || (bits > 128))
+      {
+        return (int)i + 1;
+      }
+      bits = bits * 10 + (text[i] - '0');
+    }
+    if ((i == alen + 1) || (bits > rule->bits))
+    {
+      return (int)alen + 2;
+    }
+    rule->bits = bits;
+  }
+
+  if ((rule->family == ACL_V6) && (rule->bits >= 96) &&
+      (key_is_v4mapped(rule->key) == TRUE))
+  {
+    rule->family = ACL_V4;
+    rule->key[0] = rule->key[1] << 32;
+    rule->key[1] = 0;
+    rule->bits -= 96;
+  }
+
+  /* 10.1.2.3/8 means 10.0.0.0/8 */
+  if (rule->bits < 64)
+  {
+    rule->key[0] &= top_mask(rule->bits);
+    rule->key[1] = 0;
+  }
+  else
+  {
+    rule->key[1] &= top_mask(rule->bits - 64);
+  }
+  return 0;
+} /* parse_prefix */
+
+static int is_blank(char c)
+{
+  return ((c == ' ') || (c == '\t') || (c == '\r')) ? TRUE : FALSE;
+} /* is_blank */
+
+/* Parses one line of an ACL file into a new rule. Returns TRUE if it
+   was a rule, FALSE if it was blank or a comment, and UNSET if it was
+   wrong, after logging why. */
+static int parse_line(acl *a, const char *fn, int line, const char *ls,
+                      const char *le)
+{
+  const char *p = ls;
+  const char *q;
+  acl_rule rule;
+  acl_rule *grown;
+  int bad;
+
+  while ((p < le) && (is_blank(*p) == TRUE))
+    p++;
+  if ((p == le) || (*p == '#'))
+  {
+    return FALSE;
+  }
+
+  q = p;
+  while ((q < le) && (is_blank(*q) == FALSE))
+    q++;
+  if ((q - p == 5) && (strncasecmp(p, "allow", 5) == 0))
+  {
+    rule.action = ACL_ALLOW;
+  }
+  else if ((q - p == 4) && (strncasecmp(p, "deny", 4) == 0))
+  {
+    rule.action = ACL_DENY;
+  }
+  else
+  {
+    LOG(1, ("%s: line %d col %d: expected allow or deny\n", fn, line,
+            (int)(p - ls + 1)));
+    return UNSET;
+  }
+
+  p = q;
+  while ((p < le) && (is_blank(*p) == TRUE))
+    p++;
+  q = p;
+  while ((q < le) && (is_blank(*q) == FALSE) && (*q != '#'))
+    q++;
+  if (p == q)
+  {
+    LOG(1, ("%s: line %d col %d: expected an address or prefix\n", fn, line,
+            (int)(p - ls + 1)));
+    return UNSET;
+  }
+  bad = parse_prefix(p, q - p, &rule);
+  if (bad != 0)
+  {
+    LOG(1, ("%s: line %d col %d: bad address or prefix '%.*s'\n", fn, line,
+            (int)(p - ls + bad), (int)(q - p), p));
+    return UNSET;
+  }
+
+  if (a->rules == a->rulecap)
+  {
+    a->rulecap = (a->rulecap == 0) ? 64 : a->rulecap * 2;
+    grown = realloc(a->rule, a->rulecap * sizeof(acl_rule));
+    if (grown == NULL)
+    {
+      PANIC(("Out of memory reading ACL of %d rules\n", a->rulecap));
+    }
+    a->rule = grown;
+  }
+  rule.line = line;
+  rule.hits = 0;
+  a->rule[a->rules++] = rule;
+  return TRUE;
+} /* parse_line */
+
+void acl_free(acl *a)
+{
+  if (a == NULL)
+  {
+    return;
+  }
+  free(a->node);
+  free(a->rule);
+  free(a->jump[ACL_V4]);
+  free(a->jump[ACL_V6]);
+  free(a);
+} /* acl_free */
+
+/* Reads the rules in filename into a new trie, to be put into use with
+   acl_use(). Returns TRUE and sets *out if every line was good, leaving
+   *out NULL if filename is "" because there are no rules. Returns FALSE
+   after logging what was wrong otherwise. */
+int acl_build(const char *filename, unsigned dflt, acl **out)
+{
+  acl *a;
+  acl_key zero = { 0, 0 };
+  struct stat st;
+  char *text = NULL;
+  size_t size = 0;
+  const char *ls;
+  const char *le;
+  const char *end;
+  int fd;
+  int line = 0;
+  int bad = 0;
+  int old;
+  int r;
+
+  *out = NULL;
+  if (filename[0] == '\0')
+  {
+    return TRUE;
+  }
+
+  fd = open(filename, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) < 0))
+  {
+    LOG(1, ("ACL file \"%s\" failed open with error %s\n", filename,
+            strerror(errno)));
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return FALSE;
+  }
+  /* read, not mapped: a reload is usually because the file is being
+     changed, and a mapping of a file truncated meanwhile is SIGBUS */
+  if (st.st_size > 0)
+  {
+    text = read_file(fd, st.st_size, &size);
+    if (text == NULL)
+    {
+      LOG(1, ("ACL file \"%s\" failed read with error %s\n", filename,
+              strerror(errno)));
+      close(fd);
+      return FALSE;
+    }
+  }
+  close(fd);
+
+  a = calloc(1, sizeof(acl));
+  if (a == NULL)
+  {
+    PANIC(("Out of memory reading ACL\n"));
+  }
+  a->dflt = dflt;
+  (void)new_node(a, zero, 0, ACL_NONE);  /* ACL_V4 root */
+  (void)new_node(a, zero, 0, ACL_NONE);  /* ACL_V6 root */
+
+  end = (text == NULL) ? NULL : text + size;
+  for (ls = text; ls < end; ls = le + 1)
+  {
+    le = memchr(ls, '\n', end - ls);
+    if (le == NULL)
+    {
+      le = end;
+    }
+    line++;
+    if (parse_line(a, filename, line, ls, le) == UNSET)
+    {
+      bad++;
+    }
+  }
+  free(text);
+
+  if (bad > 0)
+  {
+    LOG(1, ("ACL file \"%s\": %d bad line%s, not used\n", filename, bad,
+            (bad == 1) ? "" : "s"));
+    acl_free(a);
+    return FALSE;
+  }
+
+  for (r = 0; r < a->rules; r++)
+  {
+    old = trie_insert(a, r);
+    if (old != ACL_NONE)
+    {
+      LOG(2, ("%s: line %d: same prefix as line %d, which is ignored\n",
+              filename, a->rule[r].line, a->rule[old].line));
+    }
+  }
+  trie_jumps(a, ACL_V4);
+  trie_jumps(a, ACL_V6);
+  LOG(2, ("ACL file \"%s\": %d rules in %d trie nodes, %lu kB\n", filename,
+          a->rules, a->nodes, (unsigned long)
+          ((a->nodecap * sizeof(acl_node) + a->rulecap * sizeof(acl_rule) +
+            2 * ACL_JUMPS * sizeof(acl_jump)) / 1024)));
+  *out = a;
+  return TRUE;
+} /* acl_build */
+
+/* Makes a, which may be NULL for none, the ACL connections are checked
+   against, and frees the one before */
+void acl_use(acl *a)
+{
+  acl *old = current;
+
+  current = a;
+  acl_free(old);
+} /* acl_use */
+
+/* TRUE if the client at addr may connect. Called by the master for each
+   connection, before fork() */
+int acl_check(const struct sockaddr *addr)
+{
+  acl_key key;
+  int family;
+  int r;
+
+  if (current == NULL)
+  {
+    return TRUE;
+  }
+
+  if (addr->sa_family == AF_INET)
+  {
+    key_from_v4(key, &((const struct sockaddr_in *)addr)->sin_addr);
+    family = ACL_V4;
+  }
+  else if (addr->sa_family == AF_INET6)
+  {
+    key_from_v6(key, &((const struct sockaddr_in6 *)addr)->sin6_addr);
+    family = ACL_V6;
+    if (key_is_v4mapped(key) == TRUE)
+    {
+      key[0] = key[1] << 32;
+      key[1] = 0;
+      family = ACL_V4;
+    }
+  }
+  else
+  {
+    return TRUE;  /* eg AF_UNIX, which has no address to check */
+  }
+
+  r = trie_lookup(current, family, key);
+  if (r == ACL_NONE)
+  {
+    current->default_hits++;
+    return (current->dflt == ACL_ALLOW) ? TRUE : FALSE;
+  }
+  current->rule[r].hits++;
+  return (current->rule[r].action == ACL_ALLOW) ? TRUE : FALSE;
+} /* acl_check */
+
+/* the number of rules in use */
+int acl_rules()
+{
+  return (current == NULL) ? 0 : current->rules;
+} /* acl_rules */
+
+static void write_rule(FILE *out, const acl_rule *rule)
+{
+  char text[INET6_ADDRSTRLEN];
+  unsigned char bytes[16];
+  int i;
+
+  for (i = 0; i < 8; i++)
+  {
+    bytes[i] = (unsigned char)(rule->key[0] >> (56 - 8 * i));
+    bytes[i + 8] = (unsigned char)(rule->key[1] >> (56 - 8 * i));
+  }
+  (void)inet_ntop((rule->family == ACL_V4) ? AF_INET : AF_INET6, bytes, text,
+                  sizeof(text));
+  fprintf(out, "%-5s %s/%u line %d hits %llu\n",
+          (rule->action == ACL_ALLOW) ? "allow" : "deny", text, rule->bits,
+          rule->line, rule->hits);
+} /* write_rule */
+
+/* Handler for the admin command "acl": the rules which have matched a
+   client, or with "acl all" every rule */
+void acl_write(FILE *out, const char *args)
+{
+  int all = ((args != NULL) && (strcmp(args, "all") == 0)) ? TRUE : FALSE;
+  int r;
+
+  if (current == NULL)
+  {
+    fprintf(out, "no ACL, every client is allowed\n");
+    return;
+  }
+  fprintf(out, "%s: %d rules, %d trie nodes\n", global_options->aclfile,
+          current->rules, current->nodes);
+  fprintf(out, "default %s hits %llu\n",
+          (current->dflt == ACL_ALLOW) ? "allow" : "deny",
+          current->default_hits);
+  for (r = 0; r < current->rules; r++)
+  {
+    if ((all == TRUE) || (current->rule[r].hits > 0))
+    {
+      write_rule(out, &current->rule[r]);
+    }
+  }
+} /* acl_write */
@@ -0,0 +1,26 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* acl.h
+
+*/
+
+#include <stdio.h>
+#include <sys/socket.h>
+
+typedef struct acl acl;
+
+int acl_build(const char *filename, unsigned dflt, acl **out);
+void acl_use(acl *a);
+void acl_free(acl *a);
+int acl_check(const struct sockaddr *addr);
+int acl_rules();
+void acl_write(FILE *out, const char *args);
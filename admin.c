@@ -0,0 +1,394 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* admin.c
+
+   The admin socket: a Unix domain stream socket at GLOBAL_ADMIN_NAME,
+   only usable by the daemon's own user. A client connects, sends one
+   line "command [args]", reads the reply as plain text and is
+   disconnected. "./daemon -a command" is such a client.
+
+   The master answers requests itself, from the main loop, so handlers
+   must be quick and must not block. Other modules add commands with
+   admin_register(); "help" is built in. A handler that couldn't do what
+   was asked calls admin_failed(), and the reply then starts with the
+   line ADMIN_FAILED, so "./daemon -a" can exit non-zero.
+
+   Nor may a client hold the master up: the command line must arrive
+   within ADMIN_READ_MS, and the reply, which a handler writes to memory,
+   is sent without blocking and dropped if the client hasn't taken it
+   within ADMIN_WRITE_MS. A client that goes away gets EPIPE, not
+   SIGPIPE.
+
+*/
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+
+#include "global.h"
+#include "admin.h"
+#include "metrics.h"
+#include "accounting.h"
+#include "confdata.h"
+#include "acl.h"
+#include "socket.h"
+#include "placement.h"
+#include "profile.h"
+#include "flight.h"
+#define LOG_SUBSYS LOGSUB_SOCKET
+#include "log.h"
+
+typedef struct
+{
+  const char *name;
+  admin_handler fn;
+  const char *help;
+}
+admin_command;
+
+static admin_command commands[ADMIN_COMMANDS];
+static int ncommands = 0;
+static int admin_sock = -1;
+static int admin_status = TRUE;  /* of the command being answered */
+
+static void admin_help(FILE *out, const char *args)
+{
+  int i;
+
+  for (i = 0; i < ncommands; i++)
+  {
+    fprintf(out, "%-12s %s\n", commands[i].name, commands[i].help);
+  }
+} /* admin_help */
+
+static void admin_metrics(FILE *out, const char *args)
+{
+  metrics_write(out);
+} /* admin_metrics */
+
+static void admin_reload(FILE *out, const char *args)
+{
+  if (reload_configfile(out) != TRUE)
+  {
+    admin_failed();
+  }
+} /* admin_reload */
+
+void admin_register(const char *command, admin_handler fn, const char *help)
+{
+  if (ncommands >= ADMIN_COMMANDS)
+  {
+    PANIC(("Programming error: too many admin commands, raise "
+           "ADMIN_COMMANDS\n"));
+  }
+  commands[ncommands].name = command;
+  commands[ncommands].fn = fn;
+  commands[ncommands].help = help;
+  ncommands++;
+} /* admin_register */
+
+/* Creates the admin socket. Call after get_lock_or_die(), because any
+   socket already there is taken to be left over from a dead daemon.
+   Returns the socket, or -1 if there isn't one; not fatal. */
+int admin_start()
+{
+  struct sockaddr_un sun;
+  mode_t oldmask;
+
+  if (ncommands == 0)
+  {
+    admin_register("help", admin_help, "list admin commands");
+    admin_register("metrics", admin_metrics,
+                   "counters, gauges and latency histograms");
+    admin_register("rusage", accounting_write,
+                   "resources used by children, by client prefix");
+    admin_register("reload", admin_reload,
+                   "reread the config file, as SIGHUP does");
+    admin_register("acl", acl_write,
+                   "ACL rules that have matched clients, \"acl all\" for all");
+    admin_register("placement", placement_write,
+                   "children placed on each CPU, see the placement option");
+    admin_register("profile", profile_write,
+                   "\"profile <seconds>\" samples stacks, then shows them");
+    admin_register("flight", flight_write,
+                   "the master's flight recorder, its latest events");
+  }
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, GLOBAL_ADMIN_NAME, sizeof(sun.sun_path) - 1);
+  (void)unlink(GLOBAL_ADMIN_NAME);
+
+  admin_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (admin_sock < 0)
+  {
+    LOG(1, ("No admin socket: socket() gave error %d, %s\n", errno,
+            strerror(errno)));
+    return -1;
+  }
+  oldmask = umask(077);
+  if ((bind(admin_sock, (struct sockaddr *)&sun, sizeof(sun)) < 0) ||
+      (listen(admin_sock, 5) < 0) ||
+      (fcntl(admin_sock, F_SETFL, O_NONBLOCK) < 0))
+  {
+    LOG(1, ("No admin socket: %s gave error %d, %s\n", GLOBAL_ADMIN_NAME,
+            errno, strerror(errno)));
+    close(admin_sock);
+    admin_sock = -1;
+  }
+  umask(oldmask);
+  if (admin_sock >= 0)
+  {
+    LOG(2, ("Admin socket listening on %s\n", GLOBAL_ADMIN_NAME));
+  }
+  return admin_sock;
+} /* admin_start */
+
+int admin_fd()
+{
+  return admin_sock;
+} /* admin_fd */
+
+/* For handlers, to say the command failed */
+void admin_failed()
+{
+  admin_status = FALSE;
+} /* admin_failed */
+
+/* Milliseconds left until deadline, by metrics_now(), or 0 */
+static int admin_left_ms(unsigned long long deadline)
+{
+  unsigned long long now = metrics_now();
+
+  return (now < deadline) ? (int)((deadline - now + 999) / 1000) : 0;
+} /* admin_left_ms */
+
+/* Reads a line from non-blocking fd into buf, waiting no more than
+   ADMIN_READ_MS in all. Returns FALSE if no whole line arrived. */
+static int admin_read_line(int fd, char *buf, size_t len)
+{
+  unsigned long long deadline = metrics_now() + ADMIN_READ_MS * 1000ULL;
+  struct pollfd pfd;
+  size_t used = 0;
+  ssize_t n;
+  char *nl;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while (used < len - 1)
+  {
+    n = read(fd, buf + used, len - 1 - used);
+    if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+    {
+      if ((admin_left_ms(deadline) == 0) ||
+          (poll(&pfd, 1, admin_left_ms(deadline)) < 0))
+      {
+        return FALSE;
+      }
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+    used += n;
+    buf[used] = '\0';
+    nl = strchr(buf, '\n');
+    if (nl != NULL)
+    {
+      *nl = '\0';
+      if ((nl > buf) && (*(nl - 1) == '\r'))
+      {
+        *(nl - 1) = '\0';
+      }
+      return TRUE;
+    }
+  }
+  buf[used] = '\0';
+  return (used > 0) ? TRUE : FALSE; /* no newline before EOF is fine */
+} /* admin_read_line */
+
+/* Sends len bytes of reply to non-blocking fd, giving up after
+   ADMIN_WRITE_MS or if the client goes away */
+static void admin_send(int fd, const char *reply, size_t len)
+{
+  unsigned long long deadline = metrics_now() + ADMIN_WRITE_MS * 1000ULL;
+  struct pollfd pfd;
+  ssize_t n;
+
+  pfd.fd = fd;
+  pfd.events = POLLOUT;
+  while (len > 0)
+  {
+    n = send(fd, reply, len, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      reply += n;
+      len -= n;
+      continue;
+    }
+    if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+    {
+      return;
+    }
+    if ((admin_left_ms(deadline) == 0) ||
+        (poll(&pfd, 1, admin_left_ms(deadline)) < 0))
+    {
+      LOG(2, ("Admin client didn't take its reply, %lu bytes dropped\n",
+              (unsigned long)len));
+      return;
+    }
+  }
+} /* admin_send */
+
+/* Answers one request on the admin socket, if there is one */
+void admin_serve()
+{
+  char line[ADMIN_LINE_LEN];
+  char *reply = NULL;
+  size_t len = 0;
+  char *args;
+  FILE *out;
+  int fd;
+  int i;
+
+  fd = accept(admin_sock, NULL, NULL);
+  if (fd < 0)
+  {
+    /* out of descriptors, turn the client away rather than spin */
+    (void)socket_shed(admin_sock, errno);
+    return;
+  }
+  (void)fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  metrics_count(MC_ADMIN);
+  flight_record(FL_ADMIN, 0, fd, 0);
+
+  if (admin_read_line(fd, line, sizeof(line)) == FALSE)
+  {
+    close(fd);
+    return;
+  }
+  out = open_memstream(&reply, &len);
+  if (out == NULL)
+  {
+    close(fd);
+    return;
+  }
+
+  args = line + strcspn(line, WHITESPACE);
+  if (*args != '\0')
+  {
+    *args++ = '\0';
+    args += strspn(args, WHITESPACE);
+  }
+  admin_status = TRUE;
+  for (i = 0; i < ncommands; i++)
+  {
+    if (strcmp(line, commands[i].name) == 0)
+    {
+      LOG(9, ("Admin command '%s'\n", line));
+      commands[i].fn(out, args);
+      break;
+    }
+  }
+  if (i == ncommands)
+  {
+    fprintf(out, "unknown command '%s', try help\n", line);
+    admin_failed();
+  }
+  fclose(out);
+  if (admin_status != TRUE)
+  {
+    admin_send(fd, ADMIN_FAILED, strlen(ADMIN_FAILED));
+  }
+  admin_send(fd, reply, len);
+  free(reply);
+  close(fd);
+} /* admin_serve */
+
+/* Children don't answer admin requests */
+void admin_forked()
+{
+  if (admin_sock >= 0)
+  {
+    close(admin_sock);
+    admin_sock = -1;
+  }
+} /* admin_forked */
+
+/* Called by the master on shutdown */
+void admin_finish()
+{
+  if (admin_sock >= 0)
+  {
+    close(admin_sock);
+    admin_sock = -1;
+    if (unlink(GLOBAL_ADMIN_NAME) != 0)
+    {
+      LOG(1, ("Couldn't remove %s, error %d, %s\n", GLOBAL_ADMIN_NAME,
+              errno, strerror(errno)));
+    }
+  }
+} /* admin_finish */
+
+/* Sends command to the running daemon's admin socket and copies the
+   reply to stdout. For -a, so it runs before logging is set up and
+   reports errors on stderr. Returns FALSE on failure, or if the daemon
+   says the command failed. */
+int admin_request(const char *command)
+{
+  struct sockaddr_un sun;
+  char head[sizeof(ADMIN_FAILED)];
+  size_t nhead = 0;
+  size_t take;
+  char buf[4096];
+  ssize_t n;
+  int fd;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  strncpy(sun.sun_path, GLOBAL_ADMIN_NAME, sizeof(sun.sun_path) - 1);
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if ((fd < 0) || (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) < 0))
+  {
+    fprintf(stderr, "Can't connect to %s: %s\n", GLOBAL_ADMIN_NAME,
+            strerror(errno));
+    return FALSE;
+  }
+  if ((write(fd, command, strlen(command)) < 0) || (write(fd, "\n", 1) < 0))
+  {
+    fprintf(stderr, "Can't send to %s: %s\n", GLOBAL_ADMIN_NAME,
+            strerror(errno));
+    close(fd);
+    return FALSE;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    take = sizeof(head) - 1 - nhead;
+    take = ((size_t)n < take) ? (size_t)n : take;
+    memcpy(head + nhead, buf, take);
+    nhead += take;
+    fwrite(buf, 1, n, stdout);
+  }
+  close(fd);
+  head[nhead] = '\0';
+  return (strcmp(head, ADMIN_FAILED) == 0) ? FALSE : TRUE;
+} /* admin_request */
@@ -0,0 +1,34 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* admin.h
+
+*/
+
+#include <stdio.h>
+
+#define ADMIN_READ_MS 200    /* longest wait for a client's command */
+#define ADMIN_WRITE_MS 500   /* longest wait for it to take the reply */
+#define ADMIN_COMMANDS 32
+#define ADMIN_FAILED "failed\n"  /* first line of a failed command's reply */
+
+/* writes the reply to out. args is the rest of the line, maybe "" */
+typedef void (*admin_handler)(FILE *out, const char *args);
+
+int admin_start();
+int admin_fd();
+void admin_register(const char *command, admin_handler fn,
+                    const char *help);
+void admin_failed();
+void admin_serve();
+void admin_forked();
+void admin_finish();
+int admin_request(const char *command);
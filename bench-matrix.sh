@@ -0,0 +1,215 @@
+#!/bin/sh
+#
+# (C) Dan Shearer 2003-2008
+#
+# This program is open source software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# as published by the Free Software Foundation; either version
+# 3 of the License, or (at your option) any later version. You
+# should have received a copy of the license with this program; if
+# not, go to http://www.fsf.org.
+
+# bench-matrix.sh
+#
+# Runs daevel-bench against ./daemon in every serving mode, over a
+# matrix of maxchild, closed-loop concurrency and open-loop rate, and
+# writes one line of JSON per run to the output file (default
+# bench-matrix.json). Each line is daevel-bench -j output with the
+# serving mode and maxchild added. The unix mode is the fork mode with
+# clients connecting to the AF_UNIX listener (unixpath) instead. The udp
+# mode is loaded by daevel-udpbench instead, over windows of datagrams
+# outstanding and datagram rates, and its lines have pkt/s where the
+# others have conn/s. The udphash and udpsteer modes are the same with a
+# worker pinned to each CPU (at least two) and a socket each, the
+# datagrams shared out by the kernel's hash or steered to the worker on
+# the CPU that received them (udpsteer). Lines for UDP modes also have
+# cross_cpu_pct, the share of batches a worker read on a CPU other than
+# the one they came in on.
+#
+# usage: bench-matrix.sh [-o output] [-b baseline] [-d secs] [-p port]
+#
+# With -b, each run is compared with the same run in an earlier output
+# file, and any where conn/s fell, or p99 rose, by more than
+# REGRESSION_PCT percent are listed. The exit status is then 1 if there
+# were any, so it can gate a build.
+
+OUT=bench-matrix.json
+BASELINE=
+SECS=5
+PORT=3700
+REGRESSION_PCT=${REGRESSION_PCT:-10}
+
+MODES="fork unix udp udphash udpsteer" # serving modes, see start_daemon
+MAXCHILDS="16 200"
+CONCURRENCY="1 8 64"    # closed loop
+RATES="200 1000 4000"   # open loop, connections a second
+PAYLOAD=64
+UDP_WINDOWS="1 8 64"    # udp closed loop, datagrams outstanding
+UDP_RATES="10000 50000 100000" # udp open loop, datagrams a second
+UDP_CONF=/tmp/bench-matrix-udp.$$.conf
+NCPU=`nproc 2>/dev/null || echo 1`
+[ $NCPU -gt 64 ] && NCPU=64   # UDP_MAX_WORKERS
+UDP_WORKERS=$NCPU             # for udphash and udpsteer, a CPU each ...
+[ $UDP_WORKERS -lt 2 ] && UDP_WORKERS=2  # ... but one worker isn't steered
+UNIX_CONF=/tmp/bench-matrix-unix.$$.conf
+UNIX_PATH=/tmp/bench-matrix.$$.sock
+
+while getopts "o:b:d:p:" opt
+do
+  case $opt in
+  o) OUT=$OPTARG ;;
+  b) BASELINE=$OPTARG ;;
+  d) SECS=$OPTARG ;;
+  p) PORT=$OPTARG ;;
+  *) echo "usage: $0 [-o output] [-b baseline] [-d secs] [-p port]" >&2
+     exit 2 ;;
+  esac
+done
+
+for prog in ./daemon ./daevel-bench ./daevel-udpbench
+do
+  if [ ! -x $prog ]
+  then
+    echo "$0: no $prog, run make first" >&2
+    exit 2
+  fi
+done
+
+# start_daemon mode maxchild: runs the daemon in the foreground, in the
+# background of this script, and waits until it is listening
+start_daemon()
+{
+  case $1 in
+  fork) ./daemon -F -p $PORT -m $2 -d 0 >/dev/null 2>&1 & ;;
+  unix) printf "unixpath=$UNIX_PATH\n" > $UNIX_CONF
+        ./daemon -F -p $PORT -m $2 -d 0 -c $UNIX_CONF >/dev/null 2>&1 & ;;
+  udp) printf "protocol=udp\nudpworkers=2\nudpreuseport=TRUE\n" > $UDP_CONF
+       ./daemon -F -p $PORT -m $2 -d 0 -c $UDP_CONF >/dev/null 2>&1 & ;;
+  udphash|udpsteer)
+       printf "protocol=udp\nudpworkers=$UDP_WORKERS\nudpreuseport=TRUE\n" \
+         > $UDP_CONF
+       printf "placement=roundrobin\n" >> $UDP_CONF
+       [ $1 = udpsteer ] && printf "udpsteer=TRUE\n" >> $UDP_CONF
+       ./daemon -F -p $PORT -m $2 -d 0 -c $UDP_CONF >/dev/null 2>&1 & ;;
+  *) echo "$0: unknown serving mode $1" >&2; exit 2 ;;
+  esac
+  sleep 1
+}
+
+stop_daemon()
+{
+  ./daemon -t >/dev/null 2>&1
+  wait
+  PORT=`expr $PORT + 1`    # don't wait for TIME_WAIT to clear
+}
+
+# counter name: the daemon's total for one of its metrics
+counter()
+{
+  ./daemon -a metrics 2>/dev/null | awk -v n=$1 '$1 == n { print $2 }'
+}
+
+# run mode maxchild daevel-bench-args...
+run()
+{
+  mode=$1
+  max=$2
+  shift 2
+  bench=./daevel-bench
+  extra=
+  case $mode in
+  udp*) bench=./daevel-udpbench
+        batches=`counter daevel_udp_batches_total`
+        cross=`counter daevel_udp_cross_cpu_batches_total` ;;
+  unix) set -- -u $UNIX_PATH "$@" ;;
+  esac
+  json=`$bench -p $PORT -d $SECS -s $PAYLOAD -j "$@"`
+  case $mode in
+  udp*) batches="$batches `counter daevel_udp_batches_total`"
+        cross="$cross `counter daevel_udp_cross_cpu_batches_total`"
+        extra=`echo $batches $cross | awk '{ b = $2 - $1
+          printf "\"cross_cpu_pct\":%.1f,", (b > 0) ? 100 * ($4 - $3) / b : 0 }'`
+        ;;
+  esac
+  echo "$json" | \
+    sed "s/^{/{\"serving\":\"$mode\",\"maxchild\":$max,$extra/" >> $OUT
+  tail -1 $OUT
+}
+
+: > $OUT
+for mode in $MODES
+do
+  for max in $MAXCHILDS
+  do
+    start_daemon $mode $max
+    case $mode in
+    udp*)
+      for c in $UDP_WINDOWS
+      do
+        run $mode $max -c $c
+      done
+      for r in $UDP_RATES
+      do
+        run $mode $max -c 1024 -r $r
+      done ;;
+    *)
+      for c in $CONCURRENCY
+      do
+        run $mode $max -c $c
+      done
+      for r in $RATES
+      do
+        run $mode $max -c 256 -r $r
+      done ;;
+    esac
+    stop_daemon
+  done
+done
+rm -f $UDP_CONF $UNIX_CONF
+
+[ -z "$BASELINE" ] && exit 0
+
+# lines are matched on everything that says what was run
+awk -v pct=$REGRESSION_PCT '
+function field(line, name,    v)
+{
+  if (match(line, "\"" name "\":[^,}]*") == 0)
+    return ""
+  v = substr(line, RSTART + length(name) + 3, RLENGTH - length(name) - 3)
+  gsub(/"/, "", v)
+  return v
+}
+function rate(line)
+{
+  if (field(line, "conn_per_s") != "")
+    return field(line, "conn_per_s") + 0
+  return field(line, "pkt_per_s") + 0
+}
+function key(line)
+{
+  return field(line, "serving") "/" field(line, "maxchild") "/" \
+         field(line, "mode") "/" field(line, "conns") \
+         field(line, "window") "/" \
+         field(line, "rate") "/" field(line, "payload")
+}
+FNR == NR { base[key($0)] = $0; next }
+{
+  k = key($0)
+  if (!(k in base))
+    next
+  was = rate(base[k])
+  now = rate($0)
+  was99 = field(base[k], "p99_us") + 0
+  now99 = field($0, "p99_us") + 0
+  if ((was > 0) && (now < was * (100 - pct) / 100))
+  {
+    printf "REGRESSION %s rate %.1f/s -> %.1f/s\n", k, was, now
+    bad++
+  }
+  if ((was99 > 0) && (now99 > was99 * (100 + pct) / 100))
+  {
+    printf "REGRESSION %s p99 %dus -> %dus\n", k, was99, now99
+    bad++
+  }
+}
+END { exit (bad > 0) }' $BASELINE $OUT
@@ -0,0 +1,625 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* bench.c
+
+   daevel-bench: load generator for the echo protocol of
+   daemon_child_function(). Each connection reads the "Hello" line, sends
+   a payload followed by '1', reads the payload echoed back and waits for
+   the daemon to close. Latency is from the start of the connection to
+   that close.
+
+   usage: daevel-bench [-h host] [-p port] [-u path] [-t threads]
+                       [-c conns] [-r rate] [-d secs] [-s bytes] [-j]
+
+   -u connects to the daemon's AF_UNIX listener (unixpath) instead of
+   host and port, "@name" for one in the abstract namespace.
+
+   Closed loop (the default): conns connections are kept open all the
+   time, each started as soon as the one before it finished, so the
+   daemon sets the pace and latency is as each connection saw it.
+
+   Open loop (-r rate): connections start at a fixed rate, whether or
+   not earlier ones have finished, up to conns of them at once. Latency
+   is measured from when a connection should have started, not when it
+   did, so a daemon that falls behind can't hide it by slowing the load
+   down (the "coordinated omission" problem). conns is then only a limit
+   on what the client itself will hold open.
+
+   Every thread has its own epoll set, connections and histogram, and
+   they are only added together at the end. Histograms are the same
+   HDR-style ones as the daemon's, from stats.c.
+
+   Prints connections and bytes echoed per second, errors, and latency
+   percentiles in microseconds. -j prints one line of JSON instead, for
+   bench-matrix.sh.
+
+   A connection that fails is counted in errors, not reported; only bad
+   arguments or a host that doesn't resolve stop it, with a line on
+   stderr.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <stddef.h>     /* offsetof */
+
+#include "global.h"
+#include "stats.h"
+
+#define BENCH_MAX_THREADS 256
+#define BENCH_MAX_PAYLOAD 65536
+#define BENCH_DRAIN_SECS 2   /* wait for stragglers at the end */
+#define BENCH_EVENTS 256
+
+/* connection states */
+#define BC_FREE 0
+#define BC_CONNECTING 1
+#define BC_HELLO 2       /* reading the greeting */
+#define BC_ECHO 3        /* writing payload, reading it back */
+
+/* conn_read() results, besides 0 for not finished */
+#define BR_EOF 1
+#define BR_ERROR -1
+#define BR_MISMATCH -2   /* echo wasn't the payload */
+#define BR_REFUSED -3    /* not greeted with "Hello", so turned away */
+
+#define BENCH_GREETING "Hello "
+
+typedef struct
+{
+  int fd;
+  int state;
+  unsigned long long start_us;   /* intended start, for latency */
+  size_t sent;                   /* of payload and the '1' */
+  size_t echoed;                 /* payload bytes read back */
+  char greeting[8];              /* start of the first line */
+  size_t greeted;
+}
+bench_conn;
+
+typedef struct
+{
+  pthread_t thread;
+  int id;
+  int nconns;                    /* slots */
+  double rate;                   /* connections a second, 0 closed loop */
+  bench_conn *conns;
+  int epfd;
+  /* results */
+  unsigned long long done;
+  unsigned long long errors;
+  unsigned long long refused;
+  unsigned long long mismatched;
+  unsigned long long bytes;      /* payload echoed back */
+  unsigned long long late;       /* open loop starts that had to wait */
+  unsigned long long bucket[METRIC_BUCKETS];
+}
+bench_thread;
+
+static struct sockaddr_in target;
+static struct sockaddr_un local_target;  /* with -u */
+static socklen_t local_len = 0;          /* 0 without -u */
+static char payload[BENCH_MAX_PAYLOAD + 1];
+static size_t payload_len = 64;
+static int nthreads = 4;
+static unsigned long long stop_us;       /* no new connections after */
+static unsigned long long drain_us;      /* abandon the rest after */
+
+static unsigned long long now_us()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* now_us */
+
+static void conn_close(bench_thread *t, bench_conn *c)
+{
+  close(c->fd);
+  c->fd = -1;
+  c->state = BC_FREE;
+} /* conn_close */
+
+static void conn_fail(bench_thread *t, bench_conn *c)
+{
+  t->errors++;
+  conn_close(t, c);
+} /* conn_fail */
+
+/* Starts slot c connecting. start is when it should have started.
+   Returns FALSE, with the error counted and the slot still free, if it
+   failed straight away */
+static int conn_start(bench_thread *t, bench_conn *c, unsigned long long start)
+{
+  struct epoll_event ev;
+  int one = 1;
+
+  memset(c, 0, sizeof(bench_conn));
+  c->start_us = start;
+  c->fd = socket((local_len > 0) ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+  if (c->fd < 0)
+  {
+    t->errors++;
+    c->state = BC_FREE;
+    return FALSE;
+  }
+  (void)fcntl(c->fd, F_SETFL, O_NONBLOCK);
+  if (local_len > 0)
+  {
+    /* completes at once, or fails with EAGAIN if the backlog is full */
+    if (connect(c->fd, (struct sockaddr *)&local_target, local_len) < 0)
+    {
+      conn_fail(t, c);
+      return FALSE;
+    }
+  }
+  else
+  {
+    (void)setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if ((connect(c->fd, (struct sockaddr *)&target, sizeof(target)) < 0) &&
+        (errno != EINPROGRESS))
+    {
+      conn_fail(t, c);
+      return FALSE;
+    }
+  }
+  c->state = BC_CONNECTING;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+  ev.data.ptr = c;
+  if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+  {
+    conn_fail(t, c);
+    return FALSE;
+  }
+  return TRUE;
+} /* conn_start */
+
+static void conn_finish(bench_thread *t, bench_conn *c)
+{
+  if (c->echoed != payload_len)
+  {
+    t->mismatched++;
+  }
+  else
+  {
+    t->done++;
+    t->bucket[stats_bucket(now_us() - c->start_us)]++;
+  }
+  t->bytes += c->echoed;
+  conn_close(t, c);
+} /* conn_finish */
+
+/* Sends what is left of payload and its terminating '1' */
+static int conn_write(bench_thread *t, bench_conn *c)
+{
+  struct epoll_event ev;
+  ssize_t n;
+
+  while (c->sent < payload_len + 1)
+  {
+    n = write(c->fd, payload + c->sent, payload_len + 1 - c->sent);
+    if (n < 0)
+    {
+      return (errno == EAGAIN) ? 0 : -1;
+    }
+    c->sent += n;
+  }
+  ev.events = EPOLLIN | EPOLLRDHUP;  /* nothing more to write */
+  ev.data.ptr = c;
+  return epoll_ctl(t->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+} /* conn_write */
+
+/* Reads whatever has arrived. Returns a BR_xx, or 0 if there is more */
+static int conn_read(bench_thread *t, bench_conn *c)
+{
+  char buf[4096];
+  ssize_t n;
+  ssize_t i;
+
+  for (;;)
+  {
+    n = read(c->fd, buf, sizeof(buf));
+    if (n == 0)
+    {
+      return (c->state == BC_ECHO) ? BR_EOF : BR_REFUSED;
+    }
+    if (n < 0)
+    {
+      return (errno == EAGAIN) ? 0 : BR_ERROR;
+    }
+    for (i = 0; i < n; i++)
+    {
+      if (c->state != BC_ECHO)
+      {
+        if (c->greeted < sizeof(c->greeting))
+        {
+          c->greeting[c->greeted++] = buf[i];
+        }
+        if (buf[i] == '\n')
+        {
+          if (strncmp(c->greeting, BENCH_GREETING,
+                      strlen(BENCH_GREETING)) != 0)
+          {
+            return BR_REFUSED;
+          }
+          c->state = BC_ECHO;
+        }
+        continue;
+      }
+      if ((c->echoed >= payload_len) || (buf[i] != payload[c->echoed]))
+      {
+        return BR_MISMATCH;
+      }
+      c->echoed++;
+    }
+  }
+} /* conn_read */
+
+static void conn_event(bench_thread *t, bench_conn *c, unsigned events)
+{
+  int err = 0;
+  socklen_t len = sizeof(err);
+  int r;
+
+  if (c->state == BC_CONNECTING)
+  {
+    if ((getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) ||
+        (err != 0))
+    {
+      conn_fail(t, c);
+      return;
+    }
+    c->state = BC_HELLO;
+  }
+  if ((events & EPOLLOUT) && (conn_write(t, c) < 0))
+  {
+    conn_fail(t, c);
+    return;
+  }
+  if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+  {
+    r = conn_read(t, c);
+    switch (r)
+    {
+    case BR_EOF:
+      conn_finish(t, c);
+      break;
+    case BR_REFUSED:
+      t->refused++;  /* maxchild reached, most likely */
+      conn_close(t, c);
+      break;
+    case BR_MISMATCH:
+      t->mismatched++;
+      conn_close(t, c);
+      break;
+    case BR_ERROR:
+      conn_fail(t, c);
+      break;
+    }
+  }
+} /* conn_event */
+
+static bench_conn* free_slot(bench_thread *t)
+{
+  int i;
+
+  for (i = 0; i < t->nconns; i++)
+  {
+    if (t->conns[i].state == BC_FREE)
+    {
+      return &t->conns[i];
+    }
+  }
+  return NULL;
+} /* free_slot */
+
+static void* bench_run(void *arg)
+{
+  bench_thread *t = arg;
+  struct epoll_event ev[BENCH_EVENTS];
+  unsigned long long next = now_us();  /* open loop: next start due */
+  unsigned long long interval = 0;
+  unsigned long long now;
+  bench_conn *c;
+  int started;
+  int timeout;
+  int busy;
+  int n;
+  int i;
+
+  if (t->rate > 0)
+  {
+    interval = (unsigned long long)(1e6 / t->rate);
+    if (interval == 0)
+    {
+      interval = 1;
+    }
+    next += interval * t->id / nthreads;  /* don't all start at once */
+  }
+  for (;;)
+  {
+    now = now_us();
+    if (now < stop_us)
+    {
+      /* a start that fails at once leaves its slot free, so stop until
+         the next tick rather than try the same slot forever, as happens
+         when out of fds or the AF_UNIX backlog is full */
+      if (t->rate > 0)
+      {
+        /* every start that is due, as if they had started on time */
+        while ((next <= now) && ((c = free_slot(t)) != NULL))
+        {
+          if (now - next > 1000)
+          {
+            t->late++;  /* waited over a millisecond for a free slot */
+          }
+          started = conn_start(t, c, next);
+          next += interval;
+          if (started != TRUE)
+          {
+            break;
+          }
+        }
+      }
+      else
+      {
+        while ((c = free_slot(t)) != NULL)
+        {
+          if (conn_start(t, c, now) != TRUE)
+          {
+            break;
+          }
+        }
+      }
+    }
+    busy = 0;
+    for (i = 0; i < t->nconns; i++)
+    {
+      if (t->conns[i].state != BC_FREE)
+      {
+        busy++;
+      }
+    }
+    if ((now >= stop_us) && ((busy == 0) || (now >= drain_us)))
+    {
+      break;
+    }
+
+    timeout = 10;
+    if ((t->rate > 0) && (now < stop_us) && (next > now))
+    {
+      timeout = (int)((next - now) / 1000);
+    }
+    else if ((t->rate > 0) && (now < stop_us))
+    {
+      timeout = 1;  /* behind, and waiting for a free slot */
+    }
+    n = epoll_wait(t->epfd, ev, BENCH_EVENTS, timeout);
+    for (i = 0; i < n; i++)
+    {
+      conn_event(t, ev[i].data.ptr, ev[i].events);
+    }
+  }
+  for (i = 0; i < t->nconns; i++)
+  {
+    if (t->conns[i].state != BC_FREE)
+    {
+      conn_fail(t, &t->conns[i]);  /* still going after the drain */
+    }
+  }
+  return NULL;
+} /* bench_run */
+
+static void usage()
+{
+  fprintf(stderr, "usage: daevel-bench [-h host] [-p port] [-u path]"
+          " [-t threads] [-c conns] [-r rate] [-d secs] [-s bytes] [-j]\n");
+  fprintf(stderr, "       -h host     daemon to load, default 127.0.0.1\n");
+  fprintf(stderr, "       -p port     default 3000\n");
+  fprintf(stderr, "       -u path     its AF_UNIX listener instead,"
+          " @name if abstract\n");
+  fprintf(stderr, "       -t threads  default 4\n");
+  fprintf(stderr, "       -c conns    connections open at once, default 16\n");
+  fprintf(stderr, "       -r rate     open loop at rate connections/s,"
+          " default closed loop\n");
+  fprintf(stderr, "       -d secs     how long to run, default 10\n");
+  fprintf(stderr, "       -s bytes    payload echoed per connection,"
+          " default 64\n");
+  fprintf(stderr, "       -j          print results as one line of JSON\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  static bench_thread threads[BENCH_MAX_THREADS];
+  static unsigned long long bucket[METRIC_BUCKETS];
+  struct hostent *he;
+  const char *host = "127.0.0.1";
+  const char *path = NULL;
+  unsigned long long start;
+  unsigned long long done = 0;
+  unsigned long long errors = 0;
+  unsigned long long refused = 0;
+  unsigned long long mismatched = 0;
+  unsigned long long bytes = 0;
+  unsigned long long late = 0;
+  double secs = 10;
+  double elapsed;
+  double rate = 0;
+  int port = 3000;
+  int nconns = 16;
+  int json = FALSE;
+  size_t i;
+  int t;
+  int b;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "h:p:u:t:c:r:d:s:j")) != -1)
+  {
+    switch (ch)
+    {
+    case 'h':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'u':
+      path = optarg;
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'c':
+      nconns = atoi(optarg);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'd':
+      secs = atof(optarg);
+      break;
+    case 's':
+      payload_len = (size_t)atol(optarg);
+      break;
+    case 'j':
+      json = TRUE;
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((port <= 0) || (port > 65535) || (nthreads <= 0) ||
+      (nthreads > BENCH_MAX_THREADS) || (nconns <= 0) || (rate < 0) ||
+      (secs <= 0) || (payload_len > BENCH_MAX_PAYLOAD))
+  {
+    usage();
+  }
+  if (nconns < nthreads)
+  {
+    nthreads = nconns;
+  }
+
+  if (path != NULL)
+  {
+    if (strlen(path) >= sizeof(local_target.sun_path))
+    {
+      usage();
+    }
+    local_target.sun_family = AF_UNIX;
+    memcpy(local_target.sun_path, path, strlen(path));
+    local_len = sizeof(local_target);
+    if (path[0] == '@')
+    {
+      local_target.sun_path[0] = '\0';  /* abstract, exactly that long */
+      local_len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+    }
+  }
+
+  he = gethostbyname(host);
+  if ((he == NULL) || (he->h_addrtype != AF_INET))
+  {
+    fprintf(stderr, "daevel-bench: can't resolve %s\n", host);
+    exit(EXIT_FAILURE);
+  }
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(port);
+  memcpy(&target.sin_addr, he->h_addr_list[0], sizeof(target.sin_addr));
+
+  /* no '1' (the terminator) or NUL (getc() > 0) in the payload */
+  for (i = 0; i < payload_len; i++)
+  {
+    payload[i] = 'a' + (i % 26);
+  }
+  payload[payload_len] = '1';
+
+  start = now_us();
+  stop_us = start + (unsigned long long)(secs * 1e6);
+  drain_us = stop_us + BENCH_DRAIN_SECS * 1000000ULL;
+  for (t = 0; t < nthreads; t++)
+  {
+    threads[t].id = t;
+    threads[t].nconns = nconns / nthreads + ((t < nconns % nthreads) ? 1 : 0);
+    threads[t].rate = rate / nthreads;
+    threads[t].conns = calloc(threads[t].nconns, sizeof(bench_conn));
+    threads[t].epfd = epoll_create1(0);
+    if ((threads[t].conns == NULL) || (threads[t].epfd < 0) ||
+        (pthread_create(&threads[t].thread, NULL, bench_run, &threads[t]) != 0))
+    {
+      fprintf(stderr, "daevel-bench: can't start thread %d: %s\n", t,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (t = 0; t < nthreads; t++)
+  {
+    pthread_join(threads[t].thread, NULL);
+    done += threads[t].done;
+    errors += threads[t].errors;
+    refused += threads[t].refused;
+    mismatched += threads[t].mismatched;
+    bytes += threads[t].bytes;
+    late += threads[t].late;
+    for (b = 0; b < METRIC_BUCKETS; b++)
+    {
+      bucket[b] += threads[t].bucket[b];
+    }
+  }
+  elapsed = secs;  /* what the rates are over; the drain doesn't count */
+
+  if (json == TRUE)
+  {
+    printf("{\"mode\":\"%s\",\"threads\":%d,\"conns\":%d,\"rate\":%.0f,"
+           "\"secs\":%.1f,\"payload\":%lu,\"done\":%llu,\"conn_per_s\":%.1f,"
+           "\"bytes_per_s\":%.0f,\"errors\":%llu,\"refused\":%llu,"
+           "\"mismatched\":%llu,\"late\":%llu,\"p50_us\":%llu,"
+           "\"p99_us\":%llu,\"p999_us\":%llu}\n",
+           (rate > 0) ? "open" : "closed", nthreads, nconns, rate, secs,
+           (unsigned long)payload_len, done, done / elapsed, bytes / elapsed,
+           errors, refused, mismatched, late,
+           stats_quantile(bucket, done, 0.5), stats_quantile(bucket, done, 0.99),
+           stats_quantile(bucket, done, 0.999));
+    return 0;
+  }
+  printf("%s loop, %d threads, %d connections%s, %.1fs, %lu byte payload\n",
+         (rate > 0) ? "open" : "closed", nthreads, nconns,
+         (rate > 0) ? " at most" : "", secs, (unsigned long)payload_len);
+  if (rate > 0)
+  {
+    printf("target rate      %10.1f conn/s (%llu times a start was late)\n",
+           rate, late);
+  }
+  printf("completed        %10llu (%.1f conn/s)\n", done, done / elapsed);
+  printf("echoed           %10.1f kB/s\n", bytes / elapsed / 1024);
+  printf("errors           %10llu (refused %llu, bad echo %llu)\n",
+         errors + refused + mismatched, refused, mismatched);
+  printf("latency us  p50  %10llu\n", stats_quantile(bucket, done, 0.5));
+  printf("            p99  %10llu\n", stats_quantile(bucket, done, 0.99));
+  printf("            p99.9%10llu\n", stats_quantile(bucket, done, 0.999));
+  return 0;
+
+} /* main */
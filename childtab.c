@@ -0,0 +1,277 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* childtab.c
+
+   The master's table of running connection children, filled in by the
+   main loop as it forks them and emptied by dead_child() as it reaps
+   them.
+
+   dead_child() runs as the SIGCHLD handler, so anything in the main loop
+   that looks at the table, or forks a child and then adds it, holds off
+   SIGCHLD with childtab_block() while it does. Otherwise a child that
+   died at once could be reaped before it was in the table.
+
+   The table is also the watchdog's list of children to look at. Once a
+   second childtab_tick() sends SIGTERM to any child that has been
+   running longer than childdeadline seconds, or has used more than
+   childcpu seconds of CPU, and SIGKILL to any still there childgrace
+   seconds after that. CPU time comes from /proc, so elsewhere only
+   RLIMIT_CPU, set by childtab_forked() in each child a little over
+   childcpu plus childgrace, stops a child spinning, with SIGKILL and no
+   SIGTERM first.
+
+*/
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "childtab.h"
+#include "metrics.h"
+#include "flight.h"
+#include "log.h"
+
+static child_entry table[ABSOLUTE_MAX_CHILDREN];
+
+void childtab_block()
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, NULL);
+} /* childtab_block */
+
+void childtab_unblock()
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_UNBLOCK, &set, NULL);
+} /* childtab_unblock */
+
+/* Call with SIGCHLD blocked */
+void childtab_add(pid_t pid, in_addr_t peer, unsigned long long accepted_us,
+                  unsigned long long forked_us, int cpu)
+{
+  int i;
+
+  for (i = 0; i < ABSOLUTE_MAX_CHILDREN; i++)
+  {
+    if (table[i].pid == 0)
+    {
+      table[i].pid = pid;
+      table[i].peer = peer;
+      table[i].accepted_us = accepted_us;
+      table[i].forked_us = forked_us;
+      table[i].term_us = 0;
+      table[i].signalled = 0;
+      table[i].cpu = cpu;
+      return;
+    }
+  }
+  /* can't happen while maxchild <= ABSOLUTE_MAX_CHILDREN */
+  LOG(1, ("Child table full, not tracking pid %d\n", pid));
+} /* childtab_add */
+
+/* Copies the entry for pid to out and frees it. Returns FALSE if pid
+   isn't in the table. */
+int childtab_remove(pid_t pid, child_entry *out)
+{
+  int i;
+
+  for (i = 0; i < ABSOLUTE_MAX_CHILDREN; i++)
+  {
+    if (table[i].pid == pid)
+    {
+      *out = table[i];
+      memset(&table[i], 0, sizeof(child_entry));
+      return TRUE;
+    }
+  }
+  return FALSE;
+} /* childtab_remove */
+
+/* Counts children by the CPU placement put them on, into load[ncpus].
+   Call with SIGCHLD blocked */
+void childtab_load(unsigned *load, int ncpus)
+{
+  int i;
+
+  memset(load, 0, ncpus * sizeof(unsigned));
+  for (i = 0; i < ABSOLUTE_MAX_CHILDREN; i++)
+  {
+    if ((table[i].pid != 0) && (table[i].cpu >= 0) &&
+        (table[i].cpu < ncpus))
+    {
+      load[table[i].cpu]++;
+    }
+  }
+} /* childtab_load */
+
+/* Sends signum to every child. Call with SIGCHLD blocked */
+void childtab_kill(int signum)
+{
+  int i;
+
+  for (i = 0; i < ABSOLUTE_MAX_CHILDREN; i++)
+  {
+    if (table[i].pid != 0)
+    {
+      (void)kill(table[i].pid, signum);
+    }
+  }
+} /* childtab_kill */
+
+/* Called in each new child, sets the kernel's backstop CPU limit */
+void childtab_forked()
+{
+  struct rlimit rl;
+
+  if (global_options->childcpu == 0)
+  {
+    return;
+  }
+  /* soft == hard means SIGKILL at the limit rather than SIGXCPU. The
+     extra is for the watchdog only looking once a second, so that it
+     usually gets there first and says so */
+  rl.rlim_cur = global_options->childcpu + global_options->childgrace + 2;
+  rl.rlim_max = rl.rlim_cur;
+  if (setrlimit(RLIMIT_CPU, &rl) < 0)
+  {
+    LOG(1, ("Can't set RLIMIT_CPU to %lu\n", (unsigned long)rl.rlim_cur));
+  }
+} /* childtab_forked */
+
+/* Returns the CPU seconds pid has used, or -1 if that can't be found */
+static long child_cpu(pid_t pid)
+{
+  char path[32];
+  char buf[512];
+  unsigned long utime;
+  unsigned long stime;
+  long hz;
+  FILE *f;
+  char *p;
+  size_t n;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  f = fopen(path, "r");
+  if (f == NULL)
+  {
+    return -1;
+  }
+  n = fread(buf, 1, sizeof(buf) - 1, f);
+  fclose(f);
+  buf[n] = '\0';
+
+  /* the command name can hold anything, so start after its ')' */
+  p = strrchr(buf, ')');
+  hz = sysconf(_SC_CLK_TCK);
+  if ((p == NULL) || (hz <= 0) ||
+      (sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+              &utime, &stime) != 2))
+  {
+    return -1;
+  }
+  return (long)((utime + stime) / hz);
+} /* child_cpu */
+
+/* The watchdog, see the top of this file. Called from the main loop,
+   does nothing unless CHILDTAB_TICK_US have passed since it last looked */
+void childtab_tick()
+{
+  static unsigned long long last_us = 0;
+  unsigned long long now = metrics_now();
+  unsigned long long deadline_us;
+  unsigned long long grace_us;
+  struct in_addr peer;
+  long cpu;
+  int i;
+
+  if ((now - last_us < CHILDTAB_TICK_US) ||
+      ((global_options->childdeadline == 0) &&
+       (global_options->childcpu == 0)))
+  {
+    return;
+  }
+  last_us = now;
+  deadline_us = 1000000ULL * global_options->childdeadline;
+  grace_us = 1000000ULL * global_options->childgrace;
+
+  /* a child can't be reaped, and its pid reused, while we look */
+  childtab_block();
+  for (i = 0; i < ABSOLUTE_MAX_CHILDREN; i++)
+  {
+    if ((table[i].pid == 0) || (table[i].accepted_us == 0))
+    {
+      continue;  /* free, or a UDP worker, which runs for ever */
+    }
+    peer.s_addr = table[i].peer;
+
+    if (table[i].signalled == SIGKILL)
+    {
+      continue;  /* will be reaped soon */
+    }
+    if (table[i].signalled == SIGTERM)
+    {
+      if (now - table[i].term_us >= grace_us)
+      {
+        kill(table[i].pid, SIGKILL);
+        flight_record(FL_KILL, 0, table[i].pid, SIGKILL);
+        metrics_count(MC_WATCHDOG_KILL);
+        LOG(1, ("child pid %d for %s still running %us after SIGTERM, "
+                "sent SIGKILL\n", table[i].pid, inet_ntoa(peer),
+                global_options->childgrace));
+        table[i].signalled = SIGKILL;
+      }
+      continue;
+    }
+
+    if ((deadline_us > 0) && (now - table[i].forked_us > deadline_us))
+    {
+      kill(table[i].pid, SIGTERM);
+      flight_record(FL_KILL, 0, table[i].pid, SIGTERM);
+      metrics_count(MC_DEADLINE);
+      LOG(1, ("child pid %d for %s over childdeadline of %us, "
+              "sent SIGTERM\n", table[i].pid, inet_ntoa(peer),
+              global_options->childdeadline));
+      table[i].signalled = SIGTERM;
+      table[i].term_us = now;
+      continue;
+    }
+
+    if (global_options->childcpu > 0)
+    {
+      cpu = child_cpu(table[i].pid);
+      if (cpu >= (long)global_options->childcpu)
+      {
+        kill(table[i].pid, SIGTERM);
+        flight_record(FL_KILL, 0, table[i].pid, SIGTERM);
+        metrics_count(MC_CPU_BUDGET);
+        LOG(1, ("child pid %d for %s used %lds CPU, over childcpu of %us, "
+                "sent SIGTERM\n", table[i].pid, inet_ntoa(peer), cpu,
+                global_options->childcpu));
+        table[i].signalled = SIGTERM;
+        table[i].term_us = now;
+      }
+    }
+  }
+  childtab_unblock();
+} /* childtab_tick */
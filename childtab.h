@@ -0,0 +1,44 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* childtab.h
+
+*/
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/* what the master knows about one of its connection children, or UDP
+   workers */
+typedef struct
+{
+  pid_t pid;                       /* 0 if the entry is free */
+  in_addr_t peer;                  /* client address, network order */
+  unsigned long long accepted_us;  /* metrics_now() at accept(), 0 for
+                                      a UDP worker */
+  unsigned long long forked_us;    /* metrics_now() after fork() */
+  unsigned long long term_us;      /* when the watchdog sent SIGTERM */
+  int signalled;                   /* last signal the watchdog sent, or 0 */
+  int cpu;                         /* where placement put it, or -1 */
+}
+child_entry;
+
+#define CHILDTAB_TICK_US 1000000ULL  /* how often the watchdog looks */
+
+void childtab_block();
+void childtab_unblock();
+void childtab_add(pid_t pid, in_addr_t peer, unsigned long long accepted_us,
+                  unsigned long long forked_us, int cpu);
+int childtab_remove(pid_t pid, child_entry *out);
+void childtab_forked();
+void childtab_tick();
+void childtab_load(unsigned *load, int ncpus);
+void childtab_kill(int signum);
@@ -24,6 +24,10 @@
       2.  configuration file (if one is specified in the commandline, or
                               maybe in the default options)
 
+   and the configuration file can be read again later, on SIGHUP or the
+   "reload" admin command, in which case 0 and 1 are remembered from
+   startup rather than repeated. See reload_configfile().
+
    Things related to options are also handled here, including:
 
        - commandline usage help message
@@ -74,11 +78,23 @@
 #include <string.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "global.h"
 #include "confdata.h"
+#define LOG_SUBSYS LOGSUB_CONFDATA
 #include "log.h"
 #include "util.h"
+#include "metrics.h"
+#include "acl.h"
+#include "fds.h"
+#include "placement.h"
+#include "udp.h"
 
 /* tokens */
 typedef enum
@@ -94,6 +110,51 @@ typedef enum
   oDumpcore,
   oTerminate,
   oCheckcfg,
+  oLogsync,
+  oLogbatch,
+  oLogflushms,
+  oLogoverflow,
+  oLogformat,
+  oLoglevelDaemon,  /* these five in LOGSUB_xx order */
+  oLoglevelSocket,
+  oLoglevelConfdata,
+  oLoglevelLockfile,
+  oLoglevelChild,
+  oLograteConnect,  /* these four in LOGCLASS_xx order */
+  oLograteRefuse,
+  oLograteReap,
+  oLograteAccept,
+  oLogsampleConnect,  /* these four in LOGCLASS_xx order */
+  oLogsampleRefuse,
+  oLogsampleReap,
+  oLogsampleAccept,
+  oLogsummary,
+  oRusageprefix,
+  oRusagesummary,
+  oAclfile,
+  oAcldefault,
+  oFdbudget,
+  oChilddeadline,
+  oChildcpu,
+  oChildgrace,
+  oPlacement,
+  oCpulist,
+  oProfilehz,
+  oProfilesamples,
+  oProfilefile,
+  oProtocol,
+  oUdpworkers,
+  oUdpreuseport,
+  oUdpgso,
+  oUdpgro,
+  oUdpsteer,
+  oUnixpath,
+  oUnixonly,
+  oUnixmode,
+  oUnixgroup,
+  oBusypoll,
+  oBusyspin,
+  oBusycpus,
 } confoptions;
 
 /* Text representation of the tokens. */
@@ -115,10 +176,186 @@ keywords[] =
   { "dumpcore", oDumpcore },
   { "terminate", oTerminate },
   { "checkcfg", oCheckcfg },
+  { "logsync", oLogsync },
+  { "logbatch", oLogbatch },
+  { "logflushms", oLogflushms },
+  { "logoverflow", oLogoverflow },
+  { "logformat", oLogformat },
+  { "loglevel_daemon", oLoglevelDaemon },
+  { "loglevel_socket", oLoglevelSocket },
+  { "loglevel_confdata", oLoglevelConfdata },
+  { "loglevel_lockfile", oLoglevelLockfile },
+  { "loglevel_child", oLoglevelChild },
+  { "lograte_connect", oLograteConnect },
+  { "lograte_refuse", oLograteRefuse },
+  { "lograte_reap", oLograteReap },
+  { "lograte_accept", oLograteAccept },
+  { "logsample_connect", oLogsampleConnect },
+  { "logsample_refuse", oLogsampleRefuse },
+  { "logsample_reap", oLogsampleReap },
+  { "logsample_accept", oLogsampleAccept },
+  { "logsummary", oLogsummary },
+  { "rusageprefix", oRusageprefix },
+  { "rusagesummary", oRusagesummary },
+  { "aclfile", oAclfile },
+  { "acldefault", oAcldefault },
+  { "fdbudget", oFdbudget },
+  { "childdeadline", oChilddeadline },
+  { "childcpu", oChildcpu },
+  { "childgrace", oChildgrace },
+  { "placement", oPlacement },
+  { "cpulist", oCpulist },
+  { "profilehz", oProfilehz },
+  { "profilesamples", oProfilesamples },
+  { "profilefile", oProfilefile },
+  { "protocol", oProtocol },
+  { "udpworkers", oUdpworkers },
+  { "udpreuseport", oUdpreuseport },
+  { "udpgso", oUdpgso },
+  { "udpgro", oUdpgro },
+  { "udpsteer", oUdpsteer },
+  { "unixpath", oUnixpath },
+  { "unixonly", oUnixonly },
+  { "unixmode", oUnixmode },
+  { "unixgroup", oUnixgroup },
+  { "busypoll", oBusypoll },
+  { "busyspin", oBusyspin },
+  { "busycpus", oBusycpus },
+  { NULL, 0 }
+};
+
+/* Text representation of options which take one of a set of named values */
+typedef struct
+{
+  const char *name;
+  unsigned value;
+}
+choice;
+
+static choice logsync_choices[] =
+{
+  { "none", LOGSYNC_NONE },
+  { "group", LOGSYNC_GROUP },
+  { "panic", LOGSYNC_PANIC },
+  { NULL, 0 }
+};
+
+static choice logformat_choices[] =
+{
+  { "text", LOGFORMAT_TEXT },
+  { "binary", LOGFORMAT_BINARY },
   { NULL, 0 }
 };
 
-static FILE* conffile; /* file descriptor */
+static choice logoverflow_choices[] =
+{
+  { "drop", LOGOVERFLOW_DROP },
+  { "block", LOGOVERFLOW_BLOCK },
+  { NULL, 0 }
+};
+
+static choice acl_choices[] =
+{
+  { "allow", ACL_ALLOW },
+  { "deny", ACL_DENY },
+  { NULL, 0 }
+};
+
+static choice placement_choices[] =
+{
+  { "none", PLACEMENT_NONE },
+  { "roundrobin", PLACEMENT_ROUNDROBIN },
+  { "leastloaded", PLACEMENT_LEASTLOADED },
+  { "incoming", PLACEMENT_INCOMING },
+  { NULL, 0 }
+};
+
+static choice protocol_choices[] =
+{
+  { "tcp", PROTOCOL_TCP },
+  { "udp", PROTOCOL_UDP },
+  { NULL, 0 }
+};
+
+/* A line of the config file as found by next_entry(). The option and
+   expression point into the mapped file and aren't NUL terminated.
+   Columns count from 1, in bytes. */
+typedef struct
+{
+  const char *fn;
+  int line;
+  const char *option;
+  size_t optlen;
+  int optcol;
+  const char *expr;   /* inside the quotes, if quoted */
+  size_t exprlen;
+  int exprcol;
+  int quoted;
+}
+cfentry;
+
+typedef struct
+{
+  const char *fn;
+  const char *cur;    /* start of the next line */
+  const char *end;
+  int line;
+}
+cfscan;
+
+#define IS_BLANK(c) (((c) == ' ') || ((c) == '\t') || ((c) == '\r') || \
+                     ((c) == '\f') || ((c) == '\v'))
+
+/* keywords[] is looked up through a perfect hash built at startup, see
+   keyword_table_build() */
+#define KEYWORD_SLOTS 1024
+#define KEYWORD_SEEDS 100000
+static short keyword_slot[KEYWORD_SLOTS];
+static unsigned keyword_seed = 0;
+static unsigned keyword_mask = 0;
+
+static options cmdline_options; /* defaults plus commandline, for reloads */
+static char start_dir[PATH_MAX] = "";  /* cwd before become_daemon() */
+
+/* Makes the file name in path, of size len, absolute, taking a relative
+   one from start_dir as it would have been before become_daemon() moved
+   to /. A reload can then still find it. The directory is resolved with
+   realpath(), but not the name itself, so a config file that is a
+   symlink can be repointed between reloads. path is left alone if it
+   won't fit. */
+static void absolute_path(char *path, size_t len)
+{
+  char joined[PATH_MAX];
+  char dir[PATH_MAX];
+  char *slash;
+
+  if ((path[0] == '\0') || (path[0] == '/') || (start_dir[0] == '\0'))
+  {
+    return;
+  }
+  if ((size_t)snprintf(joined, sizeof(joined), "%s/%s", start_dir, path) >=
+      sizeof(joined))
+  {
+    return;
+  }
+  slash = strrchr(joined, '/');
+  *slash = '\0';
+  if ((realpath(joined, dir) != NULL) &&
+      (strlen(dir) + strlen(slash + 1) + 2 <= sizeof(joined)))
+  {
+    strcat(dir, "/");
+    strcat(dir, slash + 1);
+    strcpy(joined, dir);
+  }
+  else
+  {
+    *slash = '/';
+  }
+  if (strlen(joined) < len)
+  {
+    strcpy(path, joined);
+  }
+} /* absolute_path */
 
 /* sets the global options structure to values which indicate that they have
    not been set yet. Every option must have this value cleared, either by
@@ -127,6 +364,7 @@ static FILE* conffile; /* file descriptor */
 */
 void initialise_options(options *my_options)
 {
+  int i;
 
   my_options->loglevel = 999999;
   my_options->portnum = 0;   /* invalid port - 1 is lowest IPv4 port */
@@ -138,10 +376,52 @@ void initialise_options(options *my_options)
   my_options->dumpcore = UNSET;
   my_options->terminate = UNSET;
   my_options->checkcfg = UNSET;
+  my_options->logsync = 999999;
+  my_options->logbatch = 0;
+  my_options->logflushms = 0;
+  my_options->logoverflow = 999999;
+  my_options->logformat = 999999;
+  memset(my_options->sublevel, 0, sizeof(my_options->sublevel));
+  my_options->setlevels = UNSET;
+  memset(my_options->admincommand, 0, sizeof(my_options->admincommand));
+  for (i = 0; i < LOG_CLASSES; i++)
+  {
+    my_options->lograte[i] = 999999;
+    my_options->logsample[i] = 0;
+  }
+  my_options->logsummary = 0;
+  my_options->rusageprefix = 999999;
+  my_options->rusagesummary = 999999;
+  memset(my_options->aclfile, 0, sizeof(my_options->aclfile));
+  my_options->acldefault = 999999;
+  my_options->fdbudget = 999999;
+  my_options->childdeadline = 999999;
+  my_options->childcpu = 999999;
+  my_options->childgrace = 999999;
+  my_options->placement = 999999;
+  memset(my_options->cpulist, 0, sizeof(my_options->cpulist));
+  my_options->profilehz = 999999;
+  my_options->profilesamples = 999999;
+  memset(my_options->profilefile, 0, sizeof(my_options->profilefile));
+  my_options->protocol = 999999;
+  my_options->udpworkers = 999999;
+  my_options->udpreuseport = UNSET;
+  my_options->udpgso = 999999;
+  my_options->udpgro = UNSET;
+  my_options->udpsteer = UNSET;
+  memset(my_options->unixpath, 0, sizeof(my_options->unixpath));
+  my_options->unixonly = UNSET;
+  my_options->unixmode = 999999;
+  memset(my_options->unixgroup, 0, sizeof(my_options->unixgroup));
+  my_options->busypoll = 999999;
+  my_options->busyspin = 999999;
+  memset(my_options->busycpus, 0, sizeof(my_options->busycpus));
 } /* initialise_options */
 
 void fill_default_options(options *my_options)
 {
+  int i;
+
   my_options->loglevel = 1;
   my_options->portnum = 3000;    /* port to listen on */
   /* can be expensive, depends on what daemon does */
@@ -157,6 +437,64 @@ void fill_default_options(options *my_options)
   my_options->terminate = FALSE;
   /* check all config options then terminate */
   my_options->checkcfg = FALSE;
+  /* fdatasync() after every batch of log records */
+  my_options->logsync = LOGSYNC_GROUP;
+  /* write log batches of up to 32 records, at least every 100ms */
+  my_options->logbatch = 32;
+  my_options->logflushms = 100;
+  /* never lose a log message, even if the accept loop has to wait */
+  my_options->logoverflow = LOGOVERFLOW_BLOCK;
+  /* human-readable logfile */
+  my_options->logformat = LOGFORMAT_TEXT;
+  /* sublevel[] stays 0, so every subsystem follows loglevel */
+  /* -L sets subsystem log levels of running copy of myself */
+  my_options->setlevels = FALSE;
+  /* admincommand stays "", not talking to running copy of myself */
+  /* a flood of connections logs at most 100 lines a second per class, and
+     says every 10 seconds how many more there were */
+  for (i = 0; i < LOG_CLASSES; i++)
+  {
+    my_options->lograte[i] = 100;
+    my_options->logsample[i] = 1;
+  }
+  my_options->logsummary = 10;
+  /* child resource use all lumped together, summarised every minute */
+  my_options->rusageprefix = 0;
+  my_options->rusagesummary = 60;
+  /* aclfile stays "", so every client is allowed */
+  my_options->acldefault = ACL_ALLOW;
+  /* descriptors limited only by however the daemon was started */
+  my_options->fdbudget = 0;
+  /* children run as long as they like, but once told to stop have 5s */
+  my_options->childdeadline = 0;
+  my_options->childcpu = 0;
+  my_options->childgrace = 5;
+  /* children go wherever the scheduler puts them */
+  my_options->placement = PLACEMENT_NONE;
+  /* cpulist stays "", so placement can use every CPU the daemon can */
+  /* 99Hz, not 100, so as not to keep step with anything periodic; room
+     for a minute of the master and a busy child or two */
+  my_options->profilehz = 99;
+  my_options->profilesamples = 16384;
+  strcpy(my_options->profilefile, "/tmp/daevel.folded");
+  /* a TCP daemon. In UDP mode, one worker reading one shared socket,
+     replies sent a datagram at a time, and with udpreuseport, datagrams
+     shared out by the kernel's hash */
+  my_options->protocol = PROTOCOL_TCP;
+  my_options->udpworkers = 1;
+  my_options->udpreuseport = FALSE;
+  my_options->udpgso = 0;
+  my_options->udpgro = FALSE;
+  my_options->udpsteer = FALSE;
+  /* unixpath stays "", so no AF_UNIX listener. If there is one, anyone
+     on the host may connect, as they may to the TCP port, and unixgroup
+     stays "" so it keeps the daemon's group */
+  my_options->unixonly = FALSE;
+  my_options->unixmode = 0666;
+  /* everyone sleeps until there is something to do, and busycpus stays
+     "" so nobody is pinned for it */
+  my_options->busypoll = 0;
+  my_options->busyspin = 0;
 } /* fill_default_options */
 
 
@@ -170,7 +508,11 @@ void process_cmdline(int argc, char **argv)
 
   opterr = 0; /* ie all getopt error handling is done by this program */
   /* getopt now returns -1 not EOF, IEEE Std 1003.2-1992 (POSIX.2)*/
-  while ((ch = getopt(argc, argv, "hFd:l:c:m:p:wkto")) != -1)
+  char *eq = NULL;
+  int subsys = -1;
+  int level = 0;
+
+  while ((ch = getopt(argc, argv, "hFd:l:c:m:p:wktoL:a:")) != -1)
     switch (ch)
     {
 
@@ -208,6 +550,54 @@ void process_cmdline(int argc, char **argv)
                  global_options->loglevel, MIN_LOGLEVEL);
           global_options->loglevel = MIN_LOGLEVEL;
         }
+        if (global_options->loglevel > LOG_COMPILED_LEVEL)
+        {
+          printf("loglevel %d, but this build only has lines up to"
+                 " level %d\n", global_options->loglevel, LOG_COMPILED_LEVEL);
+        }
+      }
+      break;
+
+    case 'a':
+
+      if (optarg != NULL)
+      {
+        if (strlen(optarg) >= sizeof(global_options->admincommand))
+        {
+          fprintf(stderr, "%s: admin command too long\n", argv[0]);
+          fatal = TRUE;
+        }
+        else
+        {
+          strcpy(global_options->admincommand, optarg);
+        }
+      }
+      break;
+
+    case 'L':
+
+      /* subsys=n */
+      if (optarg != NULL)
+      {
+        eq = strchr(optarg, '=');
+        if (eq != NULL)
+        {
+          *eq = '\0';
+          subsys = log_subsys(optarg);
+          level = atoi(eq + 1);
+        }
+        if ((eq == NULL) || (subsys < 0) || (level < MIN_LOGLEVEL) ||
+            (level > MAX_LOGLEVEL))
+        {
+          fprintf(stderr, "%s: -L wants subsystem=level, eg -L socket=9\n",
+                  argv[0]);
+          fatal = TRUE;
+        }
+        else
+        {
+          global_options->sublevel[subsys] = level;
+          global_options->setlevels = TRUE;
+        }
       }
       break;
 
@@ -308,402 +698,1126 @@ void process_cmdline(int argc, char **argv)
     fprintf(stderr, "       -k        dump core on panic rather than exit"
             " with error\n");
     fprintf(stderr, "       -t        terminate running copy of daemon\n");
+    fprintf(stderr, "       -L s=n    set loglevel of subsystem s to n in"
+            " running copy of daemon.\n");
+    fprintf(stderr, "                 s is one of daemon, socket, confdata,"
+            " lockfile, child\n");
+    fprintf(stderr, "       -a cmd    send cmd to admin socket of running"
+            " copy of daemon, eg -a help\n");
     fprintf(stderr, "       -o        check config options & exit. Also sets"
             " -F and -d %d\n", MAX_LOGLEVEL);
     exit(EXIT_FAILURE);
 
   }
 
+  /* relative names would be lost when become_daemon() moves to / */
+  if (getcwd(start_dir, sizeof(start_dir)) == NULL)
+  {
+    start_dir[0] = '\0';
+  }
+  absolute_path(global_options->configfilename,
+                sizeof(global_options->configfilename));
+
+  /* a reload starts again from here, so the commandline still wins over
+     the defaults, and the file over both */
+  memcpy(&cmdline_options, global_options, sizeof(options));
+
 } /* process_cmdline */
 
-/* Returns non-whitespace chars to left of '=' sign in a line, NULL for
-   blank line or comment. Logs specific errors. */
-static char* extract_option(const char *lp, const char *filename, int linenum)
+/* Finds the next option line in the mapped config file. option and expr
+   are left pointing into the map rather than copied, and are not NUL
+   terminated. Returns 1 for an option line, 0 at the end of the file,
+   or -1 for a line which is wrong, after logging where it went wrong. */
+static int next_entry(cfscan *sc, cfentry *e)
 {
-  char* ret = NULL;
-  size_t lw = 0; /* whitespace len */
-  size_t lo = 0; /* option len */
+  const char *ls;  /* line start */
+  const char *le;  /* line end, not including the '\n' */
+  const char *p;
+  const char *q;
 
-  if (lp == NULL)
-    return NULL;
+  while (sc->cur < sc->end)
+  {
+    ls = sc->cur;
+    le = memchr(ls, '\n', sc->end - ls);
+    if (le == NULL)
+    {
+      le = sc->end;  /* the last line needn't have a '\n' */
+    }
+    sc->cur = (le < sc->end) ? le + 1 : le;
+    sc->line++;
+    if ((le > ls) && (le[-1] == '\r'))
+    {
+      le--;
+    }
 
-  lw = strspn(lp, WHITESPACE);
-  /* LOG(9,("lp=%s\n",lp)); */
-  /* LOG(9,("lw=%d\n",lw)); */
+    e->line = sc->line;
+    e->quoted = FALSE;
+    p = ls;
+    while ((p < le) && IS_BLANK(*p))
+      p++;
+    if (p == le)
+    {
+      LOG(9, ("%s: line %d: blank line.\n", sc->fn, sc->line));
+      continue;
+    }
+    if (*p == '#')
+    {
+      LOG(9, ("%s: line %d: comment.\n", sc->fn, sc->line));
+      continue;
+    }
 
-  if (*(lp + lw) == '#')
-  {
-    LOG(9, ("%s: line %d: comment.\n", filename, linenum));
-    return NULL;
-  }
+    q = p;
+    while ((q < le) && !IS_BLANK(*q) && (*q != '='))
+      q++;
+    e->option = p;
+    e->optlen = q - p;
+    e->optcol = p - ls + 1;
+
+    p = q;
+    while ((p < le) && IS_BLANK(*p))
+      p++;
+    if ((p == le) || (*p != '='))
+    {
+      LOG(1, ("%s: line %d col %d: no '=' present in option.\n",
+              sc->fn, sc->line, (int)(p - ls + 1)));
+      return -1;
+    }
+    if (e->optlen == 0)
+    {
+      LOG(1, ("%s: line %d col %d: no option before '='.\n",
+              sc->fn, sc->line, (int)(p - ls + 1)));
+      return -1;
+    }
 
-  if (strlen(lp) == 0)
-  {
-    LOG(9, ("%s: line %d: blank line.\n", filename, linenum));
-    return NULL;
+    p++;
+    while ((p < le) && IS_BLANK(*p))
+      p++;
+    e->exprcol = p - ls + 1;
+    if (p == le)
+    {
+      LOG(1, ("%s: line %d col %d: no expression after '='.\n",
+              sc->fn, sc->line, e->exprcol));
+      return -1;
+    }
+
+    if (*p == '"')
+    {
+      /* the string is everything up to the next unescaped '"' */
+      q = p + 1;
+      while ((q < le) && (*q != '"'))
+      {
+        q += ((*q == '\\') && (q + 1 < le)) ? 2 : 1;
+      }
+      if (q >= le)
+      {
+        LOG(1, ("%s: line %d col %d: quoted string has no closing '\"'.\n",
+                sc->fn, sc->line, e->exprcol));
+        return -1;
+      }
+      e->expr = p + 1;
+      e->exprlen = q - p - 1;
+      e->exprcol++;
+      e->quoted = TRUE;
+      p = q + 1;
+      while ((p < le) && IS_BLANK(*p))
+        p++;
+      if (p < le)
+      {
+        LOG(1, ("%s: line %d col %d: text after the closing '\"'.\n",
+                sc->fn, sc->line, (int)(p - ls + 1)));
+        return -1;
+      }
+    }
+    else
+    {
+      /* the expression is regarded as delimited by whitespace */
+      q = p;
+      while ((q < le) && !IS_BLANK(*q))
+        q++;
+      e->expr = p;
+      e->exprlen = q - p;
+    }
+    return 1;
   }
+  return 0;
+
+} /* next_entry */
+
+/* Case-insensitive FNV-1a, so "LogLevel" finds loglevel */
+static unsigned keyword_hash(unsigned seed, const char *s, size_t len)
+{
+  unsigned h = 2166136261U ^ seed;
+  size_t i;
 
-  if (strchr(lp, '=') == NULL)
+  for (i = 0; i < len; i++)
   {
-    LOG(1, ("%s: line %d: no '=' present in option.\n",
-            filename, linenum));
-    return NULL;
+    h ^= (unsigned char)tolower((unsigned char)s[i]);
+    h *= 16777619U;
   }
+  return h ^ (h >> 16);
+} /* keyword_hash */
+
+/* Searches for a seed which puts every keyword in a slot of its own, so
+   parse_option() does one hash and one compare. Done once, the first
+   time a config file is read. With n keywords in 4n or more slots about
+   one seed in a thousand is perfect, so it starts there rather than
+   trying sizes where a perfect hash is hopeless, and takes well under a
+   millisecond. */
+static void keyword_table_build()
+{
+  unsigned size;
+  unsigned seed;
+  unsigned n;
+  unsigned h;
+  unsigned i;
+  int clash;
 
-  lo = strcspn(lp + lw, WHITESPACE "=");
-  /* LOG(9,("lo=%d\n",lo)); */
-  ret = (char *)malloc(strlen(lp) + 1);
-  memset(ret, 0, strlen(lp) + 1);
-  if (ret == NULL)
+  for (n = 0; keywords[n].name != NULL; n++)
+    ;
+  for (size = 1; size < 4 * n; size *= 2)
+    ;
+  for (; size <= KEYWORD_SLOTS; size *= 2)
   {
-    PANIC(("Out of memory in extract_option() !\n"));
+    for (seed = 1; seed <= KEYWORD_SEEDS; seed++)
+    {
+      memset(keyword_slot, 0xff, size * sizeof(keyword_slot[0]));
+      clash = FALSE;
+      for (i = 0; (keywords[i].name != NULL) && (clash == FALSE); i++)
+      {
+        h = keyword_hash(seed, keywords[i].name,
+                         strlen(keywords[i].name)) & (size - 1);
+        if (keyword_slot[h] >= 0)
+        {
+          clash = TRUE;
+        }
+        keyword_slot[h] = i;
+      }
+      if (clash == FALSE)
+      {
+        keyword_seed = seed;
+        keyword_mask = size - 1;
+        LOG(9, ("config keywords hashed into %u slots with seed %u\n",
+                size, seed));
+        return;
+      }
+    }
   }
-  strncat(ret, (lp + lw), lo);
-
-  return ret;
-
-} /* extract_option */
+  PANIC(("Programming error: no perfect hash for config keywords, raise "
+         "KEYWORD_SLOTS\n"));
+} /* keyword_table_build */
 
-/* Returns the opcode of the token pointed at by cp, or oBadoption. */
+/* Returns the opcode of the option named by e, or oBadoption. */
 static confoptions
-parse_option(const char *cp)
+parse_option(const cfentry *e)
 {
-  unsigned i;
-  confoptions ret = oBadoption;
+  int i;
 
-  if ((cp == NULL) || (strlen(cp) == 0))
+  if (keyword_mask == 0)
   {
-    return ret;
+    keyword_table_build();
   }
-
-  for (i = 0; keywords[i].name; i++)
+  i = keyword_slot[keyword_hash(keyword_seed, e->option, e->optlen) &
+                   keyword_mask];
+  if ((i < 0) || (strlen(keywords[i].name) != e->optlen) ||
+      (strncasecmp(e->option, keywords[i].name, e->optlen) != 0))
   {
-    if (strcasecmp(cp, keywords[i].name) == 0)
-    {
-      ret = keywords[i].opcode;
-    }
+    return oBadoption;
   }
-
-  return ret;
+  return keywords[i].opcode;
 } /* parse_option */
 
-/* returns the expression to the right of the '=' sign in a line from the
-   config file, stripping whitespace from beginning and end. This is where
-   clever interpretive stuff can go one day. Warning: doesn't yet handle
-   quoted strings. The expression is regarded as delimited by whitespace */
-static char* extract_expr(const char *lp, const char *filename, int linenum)
+/* parses an expression into an integer, putting the result in target and
+   returning TRUE on success, and logging the results as we go. Like atoi,
+   anything after the digits is ignored */
+int parseint(confoptions opcode, const cfentry *e, const int min,
+             const int max, int* target)
 {
-  char* ret = NULL;
-  char* es = 0; /* expression start */
-  size_t el = 0; /* expression len */
-  size_t sk = 0; /* skip len */
+  long i = 0;
+  size_t n = 0;
+  int neg = FALSE;
 
-  if (lp == NULL)
-    return NULL;
-
-  es = strchr(lp, '=') + 1;
-
-  if (es == NULL)
+  if ((n < e->exprlen) && ((e->expr[n] == '-') || (e->expr[n] == '+')))
   {
-    LOG(1, ("%s: line %d: no '=' present in expression.\n",
-            filename, linenum));
-    return NULL;
+    neg = (e->expr[n] == '-') ? TRUE : FALSE;
+    n++;
   }
-
-  /* expr may contain '=', that's quite ok */
-  sk = strspn(es, WHITESPACE);
-  /* LOG(9,("sk=%d\n",sk)); */
-  el = strcspn(es + sk, WHITESPACE);
-  /* LOG(9,("el=%d\n",el)); */
-  ret = (char *)malloc(strlen(lp) + 1);
-  if (ret == NULL)
+  if ((n == e->exprlen) || !isdigit((unsigned char)e->expr[n]))
   {
-    PANIC(("Out of memory in extract_expr() !\n"));
+    LOG(9, ("%s: line %d col %d %s='%.*s': not integer\n", e->fn, e->line,
+            e->exprcol, keywords[opcode].name, (int)e->exprlen, e->expr));
+    return FALSE;
   }
-  memset(ret, 0, strlen(lp) + 1);
-  strncat(ret, es + sk, el);
-  /* LOG(9,("ret=%s\n",ret)); */
-
-  if (strlen(ret) == 0)
+  while ((n < e->exprlen) && isdigit((unsigned char)e->expr[n]))
   {
-    free(ret);
-    ret = NULL;
+    if (i <= INT_MAX)  /* stop before overflow, it's out of range anyway */
+    {
+      i = i * 10 + (e->expr[n] - '0');
+    }
+    n++;
+  }
+  if (neg == TRUE)
+  {
+    i = -i;
   }
 
-  return ret;
-
-} /* extract_expr */
+  if ((i < min) || (i > max))
+  {
+    LOG(9, ("%s: line %d col %d %s='%.*s': not >%d & <%d\n", e->fn, e->line,
+            e->exprcol, keywords[opcode].name, (int)e->exprlen, e->expr,
+            min, max));
+    return FALSE;
+  }
+  LOG(9, ("%s: line %d %s=%ld\n", e->fn, e->line, keywords[opcode].name, i));
+  *target = (int)i;
+  return TRUE;
+} /* parseint */
 
-/* parses a string into an integer, putting the result in target and
-   returning TRUE on success, and logging the results as we go */
-int parseint(confoptions opcode, const char *expr, const int min,
-             const int max, const char *fn, const int linenum,
-             int* target)
+/* Like parseint(), for file permissions written in octal, eg 660 */
+int parsemode(confoptions opcode, const cfentry *e, int* target)
 {
-  int s = FALSE;
-  int i = 0;
+  int mode = 0;
+  size_t n;
 
-  if (strspn(expr, INT_BASE10) > 0)
+  for (n = 0; n < e->exprlen; n++)
   {
-    /* NB atoi doesn't do any error checking */
-    i = atoi(expr);
-    if ((i >= min) && (i <= max))
-    {
-      LOG(9, ("%s: line %d %s=%d\n", fn, linenum, keywords[opcode].name,
-              i));
-      s = TRUE;
-      *target = i;
-    }
-    else
+    if ((e->expr[n] < '0') || (e->expr[n] > '7') || (mode > 0777))
     {
-      LOG(9, ("%s: line %d %s='%s': not integer or not >%d & <%d\n", fn, linenum,
-              keywords[opcode].name, expr, min, max));
+      break;
     }
+    mode = mode * 8 + (e->expr[n] - '0');
   }
-  return s;
-} /* parseint */
+  if ((n == 0) || (n < e->exprlen) || (mode > 0777))
+  {
+    LOG(9, ("%s: line %d col %d %s='%.*s': not permissions in octal, "
+            "like 660\n", e->fn, e->line, e->exprcol, keywords[opcode].name,
+            (int)e->exprlen, e->expr));
+    return FALSE;
+  }
+  LOG(9, ("%s: line %d %s=%o\n", e->fn, e->line, keywords[opcode].name, mode));
+  *target = mode;
+  return TRUE;
+} /* parsemode */
 
-/* parses a string into a boolean integer, putting the result in target
-   and returning TRUE on success, and logging the results as we go */
-int parsebool(confoptions opcode, const char *expr, const char *fn,
-              const int linenum, int* target)
+/* TRUE if the expression starts with word, ignoring case */
+static int expr_starts(const cfentry *e, const char *word)
+{
+  size_t len = strlen(word);
+
+  return ((e->exprlen >= len) &&
+          (strncasecmp(e->expr, word, len) == 0)) ? TRUE : FALSE;
+} /* expr_starts */
+
+/* parses an expression into a boolean integer, putting the result in
+   target and returning TRUE on success, and logging the results as we go */
+int parsebool(confoptions opcode, const cfentry *e, int* target)
 {
   int s = FALSE;
 
   /* handle in separate blocks to cope with whatever weird booleans come
      along in the future */
-  if ((strncasecmp(expr, "TRUE", 4) == 0) || (strncasecmp(expr, "YES", 3) == 0))
+  if ((expr_starts(e, "TRUE") == TRUE) || (expr_starts(e, "YES") == TRUE))
   {
-    LOG(1, ("%s: line %d %s=%s\n", fn, linenum, keywords[opcode].name,
+    LOG(1, ("%s: line %d %s=%s\n", e->fn, e->line, keywords[opcode].name,
             "TRUE"));
     *target = TRUE;
     s = TRUE;
   }
 
-  if ((strncasecmp(expr, "FALSE", 5) == 0) || (strncasecmp(expr, "NO", 2) == 0))
+  if ((expr_starts(e, "FALSE") == TRUE) || (expr_starts(e, "NO") == TRUE))
   {
-    LOG(1, ("%s: line %d %s=%s\n", fn, linenum, keywords[opcode].name,
+    LOG(1, ("%s: line %d %s=%s\n", e->fn, e->line, keywords[opcode].name,
             "FALSE"));
     *target = FALSE;
     s = TRUE;
   }
   if (s == FALSE)
   {
-    LOG(9, ("%s: line %d bad boolean expression '%s' for %s\n", fn, linenum,
-            expr, keywords[opcode].name));
+    LOG(9, ("%s: line %d col %d bad boolean expression '%.*s' for %s\n",
+            e->fn, e->line, e->exprcol, (int)e->exprlen, e->expr,
+            keywords[opcode].name));
   }
 
   return s;
 
 } /* parsebool */
 
-/* parses a string into a validated string, putting the result in target
-   and returning TRUE on success, and logging the results as we go. */
-int parsestring(confoptions opcode, const char *expr, const int len,
-                const char *fn, const int linenum, char* target)
+/* Copies the expression into target, undoing the escapes of a quoted
+   string: \" is a quote and \\ a backslash. len is the longest string
+   allowed, so target must have room for len + 1. Returns FALSE, having
+   logged why, if it is too long or empty. */
+static int copystring(confoptions opcode, const cfentry *e, const int len,
+                      char* target)
 {
-  int s = FALSE;
-
-  /* note: whitespace already stripped by extract_expr */
-  /* note: extract_expr can't cope with quoted strings; everything delimited
-           by whitespace */
+  size_t i;
+  int n = 0;
 
-  if ((strlen(expr) > len) || (strlen(expr) == 0))
+  for (i = 0; i < e->exprlen; i++)
   {
-    LOG(1, ("%s: line %d invalid string for option %s\n", fn, linenum,
-            keywords[opcode].name));
+    if ((e->quoted == TRUE) && (e->expr[i] == '\\') &&
+        (i + 1 < e->exprlen) &&
+        ((e->expr[i + 1] == '"') || (e->expr[i + 1] == '\\')))
+    {
+      i++;
+    }
+    if (n == len)
+    {
+      LOG(1, ("%s: line %d col %d string longer than %d for option %s\n",
+              e->fn, e->line, e->exprcol, len, keywords[opcode].name));
+      return FALSE;
+    }
+    target[n++] = e->expr[i];
   }
-  else
+  if (n == 0)
   {
-    LOG(1, ("%s: line %d: valid string '%s' for option %s\n", fn, linenum,
-            expr, keywords[opcode].name));
-    strncpy(target, expr, strlen(expr) + 1);
-    s = TRUE;
+    LOG(1, ("%s: line %d col %d empty string for option %s\n", e->fn,
+            e->line, e->exprcol, keywords[opcode].name));
+    return FALSE;
   }
+  target[n] = '\0';
+  return TRUE;
 
-  return s;
+} /* copystring */
+
+/* parses an expression into a validated string, putting the result in
+   target and returning TRUE on success, and logging the results as we go.
+   In a quoted string \" is a quote and \\ a backslash. len is the longest
+   string allowed, so target must have room for len + 1 */
+int parsestring(confoptions opcode, const cfentry *e, const int len,
+                char* target)
+{
+  if (copystring(opcode, e, len, target) == FALSE)
+  {
+    return FALSE;
+  }
+  LOG(1, ("%s: line %d: valid string '%s' for option %s\n", e->fn, e->line,
+          target, keywords[opcode].name));
+  return TRUE;
 
 } /* parsestring */
 
-/* The config file is processed strictly one line at a time, where a
-   line must be less than CONFIG_FILE_LINELEN characters long including the \n.
-   The \n is mandatory, except for the last line in the file.
- */
-int process_configfile(options *my_options)
+/* parses an expression into a list of CPUs such as 0-3,8, as understood
+   by placement_cpulist(), into target, which is CPULIST_LEN long.
+   target is only changed if the list is good. */
+static int parsecpulist(confoptions opcode, const cfentry *e, char* target)
 {
-  unsigned ret = -1;
-  char line[CONFIG_FILE_LINELEN];
-  char *lp = NULL;
-  char *expr = NULL;
-  char *myoption = NULL;
-  char *fn = NULL; /*global filename. saves typing*/
-  int linenum = 0;
-  int l = 0;
-  confoptions opcode = oBadoption;
-  int s = FALSE; /* status of parse_xx() calls */
-
-  memset(line, 0, CONFIG_FILE_LINELEN);
+  char list[CPULIST_LEN];
 
-  conffile = fopen(global_options->configfilename, "r");
-  if (conffile == NULL)
+  if (copystring(opcode, e, sizeof(list) - 1, list) == FALSE)
   {
-    /* Sometimes this might be better to just LOG and carry on */
-    PANIC(("Config file \"%s\" failed open with error %s\n",
-           global_options->configfilename, strerror(errno)));
+    return FALSE;
   }
+  if (placement_cpulist(list, NULL) < 0)
+  {
+    LOG(9, ("%s: line %d col %d %s='%s': not a list of CPUs like 0-3,8\n",
+            e->fn, e->line, e->exprcol, keywords[opcode].name, list));
+    return FALSE;
+  }
+  strcpy(target, list);
+  LOG(1, ("%s: line %d: valid CPU list '%s' for option %s\n", e->fn,
+          e->line, target, keywords[opcode].name));
+  return TRUE;
+
+} /* parsecpulist */
+
+/* parses an expression into one of a list of named values, putting the
+   value in target and returning TRUE on success, and logging the results
+   as we go. Case is not significant. */
+int parsechoice(confoptions opcode, const cfentry *e, const choice *choices,
+                int* target)
+{
+  unsigned i;
 
-  fn = global_options->configfilename;
-  LOG(9, ("Listing config file lines including literal '\\n'\n"));
-  while ( (lp = fgets(line, CONFIG_FILE_LINELEN, conffile)))
+  for (i = 0; choices[i].name; i++)
   {
+    if ((strlen(choices[i].name) == e->exprlen) &&
+        (strncasecmp(e->expr, choices[i].name, e->exprlen) == 0))
+    {
+      LOG(1, ("%s: line %d %s=%s\n", e->fn, e->line, keywords[opcode].name,
+              choices[i].name));
+      *target = choices[i].value;
+      return TRUE;
+    }
+  }
+  LOG(9, ("%s: line %d col %d bad value '%.*s' for %s\n", e->fn, e->line,
+          e->exprcol, (int)e->exprlen, e->expr, keywords[opcode].name));
+  return FALSE;
 
-    linenum++;
-    lp = line;
+} /* parsechoice */
 
-    if ((strchr(line, '\n') == NULL))
+/* returns the name of value in choices, for logging */
+static const char* choice_name(const choice *choices, unsigned value)
+{
+  unsigned i;
+
+  for (i = 0; choices[i].name; i++)
+  {
+    if (choices[i].value == value)
     {
-      if (!feof(conffile))
-      {
-        LOG(1, ("%s: line %d too long, skipping\n", fn, linenum));
-        lp = fgets(line, CONFIG_FILE_LINELEN, conffile);
-        while ((strchr(line, '\n') == NULL) && !feof(conffile))
-        {
-          /* chomp */
-          lp = fgets(line, CONFIG_FILE_LINELEN, conffile);
-        }
-        continue;
-      }
-      else
-      {
-        if (strlen(line) < CONFIG_FILE_LINELEN - 2)
-        {
-          l = strlen(line);
-          *(line + l) = '\n';
-          *(line + l + 1) = '\000';
-          LOG(9, ("%s: line %d: added missing '\\n' to last line\n",
-                  fn, linenum));
-        }
-        else
-        {
-          LOG(1, ("%s: last line (%d) too long to insert missing '\\n'\n",
-                  fn, linenum));
-        }
-      }
+      return choices[i].name;
     }
+  }
+  return "invalid";
+} /* choice_name */
+
+/* The config file is mapped rather than read, and each line is taken
+   apart where it lies, so there is no limit on line length and nothing
+   is copied until a value is stored. The last line needn't end in \n.
+
+   Once the daemon is running (it holds the lock) a reload reads the file
+   into memory instead: an admin may be rewriting it, and touching a
+   mapped page past the end of a file truncated under us is SIGBUS,
+   which would take the master down. What was read is parsed the same
+   way.
+
+   Returns the number of lines that were rejected, or -1 if the file
+   can't be opened. Only settings in my_options are changed, so a reload
+   can parse into a copy and decide afterwards whether to use it.
+ */
+int process_configfile(options *my_options)
+{
+  int ret = 0;
+  int fd;
+  struct stat st;
+  char *map = NULL;
+  int mapped = FALSE;
+  size_t size = 0;
+  cfscan sc;
+  cfentry e;
+  int got;
+  confoptions opcode = oBadoption;
+  int s = FALSE; /* status of parse_xx() calls */
 
-    /* Don't log line contents because it leads to a very distracting logfile.
-       Uncomment for debugging. */
-    /* LOG(9,("line %d: %s",linenum,lp)) */
-
-    myoption = extract_option(lp, fn, linenum);
-    if (myoption == NULL)
+  fd = open(my_options->configfilename, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) < 0))
+  {
+    LOG(1, ("Config file \"%s\" failed open with error %s\n",
+            my_options->configfilename, strerror(errno)));
+    if (fd >= 0)
     {
-      /* Silently skip, because error already reported. Uncomment to debug */
-      /* LOG(9,("%s: line %d bad option, skipping\n",fn,linenum)); */
-      continue;
+      close(fd);
+    }
+    return -1;
+  }
+  if ((st.st_size > 0) && (lock_acquired == TRUE))
+  {
+    map = read_file(fd, st.st_size, &size);
+    if (map == NULL)
+    {
+      LOG(1, ("Config file \"%s\" failed read with error %s\n",
+              my_options->configfilename, strerror(errno)));
+      close(fd);
+      return -1;
     }
+  }
+  else if (st.st_size > 0)
+  {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+      LOG(1, ("Config file \"%s\" failed mmap with error %s\n",
+              my_options->configfilename, strerror(errno)));
+      close(fd);
+      return -1;
+    }
+    (void)madvise(map, st.st_size, MADV_SEQUENTIAL);
+    mapped = TRUE;
+    size = st.st_size;
+  }
+  close(fd);
 
-    /* LOG(9,("read option '%s', about to parse\n",myoption)); */
+  sc.fn = my_options->configfilename;
+  sc.cur = map;
+  sc.end = (map == NULL) ? NULL : map + size;
+  sc.line = 0;
+  e.fn = sc.fn;
 
-    opcode = parse_option(myoption);
-    if (opcode == oBadoption)
+  LOG(9, ("Listing config file lines\n"));
+  while ((got = next_entry(&sc, &e)) != 0)
+  {
+    if (got < 0)
     {
-      LOG(1, ("%s: line %d: skipping bad or unknown option '%s'\n",
-              fn, linenum, myoption));
+      ret++;
       continue;
     }
 
-    expr = extract_expr(lp, fn, linenum);
-    if (expr == NULL)
+    opcode = parse_option(&e);
+    if (opcode == oBadoption)
     {
-      LOG(1, ("%s: line %d bad expression, skipping\n",
-              fn, linenum));
+      LOG(1, ("%s: line %d col %d: skipping bad or unknown option '%.*s'\n",
+              e.fn, e.line, e.optcol, (int)e.optlen, e.option));
+      ret++;
       continue;
     }
 
-    /* LOG(9,("just read expr '%s', not yet parsed\n",expr)); */
-
     switch (opcode)
     {
 
     case oLoglevel:
-      s = parseint(opcode, expr, 1, 9, fn, linenum, (int*) & global_options->loglevel);
+      s = parseint(opcode, &e, 1, 9, (int*) & my_options->loglevel);
 
-      if (global_options->checkcfg == TRUE)
+      if (my_options->checkcfg == TRUE)
       {
-        global_options->loglevel = MAX_LOGLEVEL;
+        my_options->loglevel = MAX_LOGLEVEL;
         LOG(9, ("%s: line %d: loglevel ignored due to checkconfig (-o). "
-                "Set to %d\n", fn, linenum, MAX_LOGLEVEL));
+                "Set to %d\n", e.fn, e.line, MAX_LOGLEVEL));
         /* Overwrite so we don't make a mess of the special -o option. */
         /* The problem is that checkcfg relies on everything being */
         /* reported at MAX_LOGLEVEL, and changing that partway through */
         /* stops checkcfg from working. */
       }
+      if (my_options == global_options)
+      {
+        log_apply_levels();
+      }
       break;
 
     case oPortnum:
 
-      s = parseint(opcode, expr, 1, 65535, fn, linenum, (int *) & global_options->portnum);
+      s = parseint(opcode, &e, 1, 65535, (int *) & my_options->portnum);
       break;
 
     case oDnslookups:
 
-      s = parsebool(opcode, expr, fn, linenum, (int*) & global_options->dnslookups);
+      s = parsebool(opcode, &e, (int*) & my_options->dnslookups);
       break;
 
     case oForegroundonly:
 
-      s = parsebool(opcode, expr, fn, linenum, (int*) & global_options->foregroundonly);
+      s = parsebool(opcode, &e, (int*) & my_options->foregroundonly);
       break;
 
     case oLogfilename:
 
-      s = parsestring(opcode, expr, FILENAME_LEN, fn, linenum,
-                      (char *) & global_options->logfilename);
+      s = parsestring(opcode, &e, sizeof(my_options->logfilename) - 1,
+                      my_options->logfilename);
       break;
 
     case oConfigfilename:
 
       LOG(1, ("%s: line %d: May not set configfilename from config file\n",
-              fn, linenum));
+              e.fn, e.line));
+      s = FALSE;
       break;
 
     case oMaxchild:
 
-      s = parseint(opcode, expr, 1, ABSOLUTE_MAX_CHILDREN, fn, linenum,
-                   (int*) & global_options->maxchild);
+      s = parseint(opcode, &e, 1, ABSOLUTE_MAX_CHILDREN,
+                   (int*) & my_options->maxchild);
       break;
 
     case oDumpcore:
 
-      s = parsebool(opcode, expr, fn, linenum, (int*) & global_options->dumpcore);
+      s = parsebool(opcode, &e, (int*) & my_options->dumpcore);
       break;
 
     case oTerminate:
 
-      s = parsebool(opcode, expr, fn, linenum, (int*) & global_options->terminate);
+      s = parsebool(opcode, &e, (int*) & my_options->terminate);
       break;
 
     case oCheckcfg:
 
       LOG(1, ("%s: line %d: May not set checkcfg from config file\n",
-              fn, linenum));
+              e.fn, e.line));
+      s = FALSE;
+      break;
+
+    case oLogsync:
+
+      s = parsechoice(opcode, &e, logsync_choices,
+                      (int*) & my_options->logsync);
+      break;
+
+    case oLogbatch:
+
+      s = parseint(opcode, &e, 1, LOG_RING_RECORDS,
+                   (int*) & my_options->logbatch);
+      break;
+
+    case oLogflushms:
+
+      s = parseint(opcode, &e, 1, 60000,
+                   (int*) & my_options->logflushms);
+      break;
+
+    case oLogoverflow:
+
+      s = parsechoice(opcode, &e, logoverflow_choices,
+                      (int*) & my_options->logoverflow);
+      break;
+
+    case oLogformat:
+
+      s = parsechoice(opcode, &e, logformat_choices,
+                      (int*) & my_options->logformat);
+      break;
+
+    case oLoglevelDaemon:
+    case oLoglevelSocket:
+    case oLoglevelConfdata:
+    case oLoglevelLockfile:
+    case oLoglevelChild:
+
+      s = parseint(opcode, &e, 1, 9,
+                   (int*) & my_options->sublevel[opcode - oLoglevelDaemon]);
+      if ((my_options->checkcfg != TRUE) && (my_options == global_options))
+      {
+        log_apply_levels();
+      }
+      break;
+
+    case oLograteConnect:
+    case oLograteRefuse:
+    case oLograteReap:
+    case oLograteAccept:
+
+      s = parseint(opcode, &e, 0, 1000000,
+                   (int*) & my_options->lograte[opcode - oLograteConnect]);
+      break;
+
+    case oLogsampleConnect:
+    case oLogsampleRefuse:
+    case oLogsampleReap:
+    case oLogsampleAccept:
+
+      s = parseint(opcode, &e, 1, 1000000,
+                   (int*) & my_options->logsample[opcode - oLogsampleConnect]);
+      break;
+
+    case oLogsummary:
+
+      s = parseint(opcode, &e, 1, 3600,
+                   (int*) & my_options->logsummary);
+      break;
+
+    case oRusageprefix:
+
+      s = parseint(opcode, &e, 0, 32,
+                   (int*) & my_options->rusageprefix);
+      break;
+
+    case oRusagesummary:
+
+      s = parseint(opcode, &e, 0, 86400,
+                   (int*) & my_options->rusagesummary);
+      break;
+
+    case oAclfile:
+
+      s = parsestring(opcode, &e, sizeof(my_options->aclfile) - 1,
+                      my_options->aclfile);
+      absolute_path(my_options->aclfile, sizeof(my_options->aclfile));
+      break;
+
+    case oAcldefault:
+
+      s = parsechoice(opcode, &e, acl_choices,
+                      (int*) & my_options->acldefault);
+      break;
+
+    case oFdbudget:
+
+      s = parseint(opcode, &e, 0, 1048576,
+                   (int*) & my_options->fdbudget);
+      /* fewer and the daemon can't open its own files */
+      if ((s == TRUE) && (my_options->fdbudget > 0) &&
+          (my_options->fdbudget < FDS_BUDGET_MIN))
+      {
+        LOG(9, ("%s: line %d col %d fdbudget=%u: must be 0 or at least %d\n",
+                e.fn, e.line, e.exprcol, my_options->fdbudget,
+                FDS_BUDGET_MIN));
+        my_options->fdbudget = 0;
+        s = FALSE;
+      }
+      break;
+
+    case oChilddeadline:
+
+      s = parseint(opcode, &e, 0, 604800,
+                   (int*) & my_options->childdeadline);
+      break;
+
+    case oChildcpu:
+
+      s = parseint(opcode, &e, 0, 604800,
+                   (int*) & my_options->childcpu);
+      break;
+
+    case oChildgrace:
+
+      s = parseint(opcode, &e, 1, 3600,
+                   (int*) & my_options->childgrace);
+      break;
+
+    case oPlacement:
+
+      s = parsechoice(opcode, &e, placement_choices,
+                      (int*) & my_options->placement);
+      break;
+
+    case oCpulist:
+
+      s = parsecpulist(opcode, &e, my_options->cpulist);
+      break;
+
+    case oProfilehz:
+
+      s = parseint(opcode, &e, 1, 10000,
+                   (int*) & my_options->profilehz);
+      break;
+
+    case oProfilesamples:
+
+      s = parseint(opcode, &e, 1024, 1048576,
+                   (int*) & my_options->profilesamples);
+      break;
+
+    case oProfilefile:
+
+      s = parsestring(opcode, &e, sizeof(my_options->profilefile) - 1,
+                      my_options->profilefile);
+      break;
+
+    case oProtocol:
+
+      s = parsechoice(opcode, &e, protocol_choices,
+                      (int*) & my_options->protocol);
+      break;
+
+    case oUdpworkers:
+
+      s = parseint(opcode, &e, 1, UDP_MAX_WORKERS,
+                   (int*) & my_options->udpworkers);
+      break;
+
+    case oUdpreuseport:
+
+      s = parsebool(opcode, &e, (int*) & my_options->udpreuseport);
+      break;
+
+    case oUdpgso:
+
+      s = parseint(opcode, &e, 0, UDP_GSO_MAX,
+                   (int*) & my_options->udpgso);
+      /* smaller, and a full reply would be more segments than the
+         kernel will send in one go */
+      if ((s == TRUE) && (my_options->udpgso > 0) &&
+          (my_options->udpgso < UDP_GSO_MIN))
+      {
+        LOG(9, ("%s: line %d col %d udpgso=%u: must be 0 or at least %d\n",
+                e.fn, e.line, e.exprcol, my_options->udpgso, UDP_GSO_MIN));
+        my_options->udpgso = 0;
+        s = FALSE;
+      }
+      break;
+
+    case oUdpgro:
+
+      s = parsebool(opcode, &e, (int*) & my_options->udpgro);
+      break;
+
+    case oUdpsteer:
+
+      s = parsebool(opcode, &e, (int*) & my_options->udpsteer);
       break;
 
+    case oUnixpath:
+
+      s = parsestring(opcode, &e, sizeof(my_options->unixpath) - 1,
+                      my_options->unixpath);
+      break;
+
+    case oUnixonly:
+
+      s = parsebool(opcode, &e, (int*) & my_options->unixonly);
+      break;
+
+    case oUnixmode:
+
+      s = parsemode(opcode, &e, (int*) & my_options->unixmode);
+      break;
+
+    case oUnixgroup:
+
+      s = parsestring(opcode, &e, sizeof(my_options->unixgroup) - 1,
+                      my_options->unixgroup);
+      break;
+
+    case oBusypoll:
+
+      s = parseint(opcode, &e, 0, BUSY_MAX_US,
+                   (int*) & my_options->busypoll);
+      break;
+
+    case oBusyspin:
+
+      s = parseint(opcode, &e, 0, BUSY_MAX_US,
+                   (int*) & my_options->busyspin);
+      break;
+
+    case oBusycpus:
+
+      s = parsecpulist(opcode, &e, my_options->busycpus);
+      break;
+
+
     default:
       PANIC(("Fell through process_config_file() switch statement!\n"));
 
     } /* option handling */
-    free(expr);
+    if (s == FALSE)
+    {
+      ret++;
+    }
   }
 
-  fclose(conffile);
+  if (mapped == TRUE)
+  {
+    munmap(map, st.st_size);
+  }
+  else
+  {
+    free(map);
+  }
   return ret;
 
 } /* process_configfile */
 
+/* Tells both the log and, for the admin command, the requester */
+static void reload_note(FILE *out, const char *f, ...)
+{
+  char msg[LOG_RECORD_LEN];
+  va_list ap;
+
+  va_start(ap, f);
+  vsnprintf(msg, sizeof(msg), f, ap);
+  va_end(ap);
+  LOG(1, ("reload: %s", msg));
+  if (out != NULL)
+  {
+    fputs(msg, out);
+  }
+} /* reload_note */
+
+/* Compares one setting between the running options and a reload. A
+   setting which can't change while running keeps its old value. */
+static void reload_unsigned(FILE *out, const char *name, unsigned old,
+                            unsigned *fresh, int live)
+{
+  if (*fresh == old)
+  {
+    return;
+  }
+  if (live == TRUE)
+  {
+    reload_note(out, "%s changed from %u to %u\n", name, old, *fresh);
+  }
+  else
+  {
+    reload_note(out, "%s needs a restart to change from %u to %u, "
+                "still %u\n", name, old, *fresh, old);
+    *fresh = old;
+  }
+} /* reload_unsigned */
+
+/* Re-reads the config file into a fresh copy of the options, starting
+   again from the defaults and the commandline, and if every line of it
+   is good makes that the global options. The old ones are left as they
+   were if not. Settings which only take effect at startup, such as
+   portnum, are reported and keep their running values.
+
+   Children already running carry on with the options they were forked
+   with, since they have their own copy; the next connection sees the new
+   ones. Log levels are shared, so they change for everyone at once, as
+   with -L.
+
+   Call from the main loop, not a signal handler. Returns TRUE if the new
+   options are in use. out, if not NULL, gets a copy of the report. */
+int reload_configfile(FILE *out)
+{
+  options *old = global_options;
+  options *fresh = NULL;
+  acl *newacl = NULL;
+  unsigned old_fdbudget = old->fdbudget;
+  char name[32];
+  int bad;
+  int i;
+
+  if (strlen(old->configfilename) == 0)
+  {
+    reload_note(out, "no config file to reload\n");
+    return FALSE;
+  }
+
+  fresh = malloc(sizeof(options));
+  if (fresh == NULL)
+  {
+    reload_note(out, "out of memory, configuration unchanged\n");
+    return FALSE;
+  }
+  memcpy(fresh, &cmdline_options, sizeof(options));
+
+  bad = process_configfile(fresh);
+  if (bad != 0)
+  {
+    if (bad < 0)
+    {
+      reload_note(out, "can't read %s, configuration unchanged\n",
+                  old->configfilename);
+    }
+    else
+    {
+      reload_note(out, "%d bad line%s in %s, configuration unchanged\n",
+                  bad, (bad == 1) ? "" : "s", old->configfilename);
+    }
+    free(fresh);
+    return FALSE;
+  }
+
+  reload_unsigned(out, "portnum", old->portnum, &fresh->portnum, FALSE);
+  reload_unsigned(out, "foregroundonly", old->foregroundonly,
+                  &fresh->foregroundonly, FALSE);
+  reload_unsigned(out, "logformat", old->logformat, &fresh->logformat, FALSE);
+  reload_unsigned(out, "rusageprefix", old->rusageprefix,
+                  &fresh->rusageprefix, FALSE);
+  reload_unsigned(out, "terminate", old->terminate, &fresh->terminate, FALSE);
+  reload_unsigned(out, "profilesamples", old->profilesamples,
+                  &fresh->profilesamples, FALSE);
+  /* the sockets and workers are set up once, at the start */
+  reload_unsigned(out, "protocol", old->protocol, &fresh->protocol, FALSE);
+  reload_unsigned(out, "udpworkers", old->udpworkers, &fresh->udpworkers,
+                  FALSE);
+  reload_unsigned(out, "udpreuseport", old->udpreuseport,
+                  &fresh->udpreuseport, FALSE);
+  reload_unsigned(out, "udpgso", old->udpgso, &fresh->udpgso, FALSE);
+  reload_unsigned(out, "udpgro", old->udpgro, &fresh->udpgro, FALSE);
+  reload_unsigned(out, "udpsteer", old->udpsteer, &fresh->udpsteer, FALSE);
+  reload_unsigned(out, "unixonly", old->unixonly, &fresh->unixonly, FALSE);
+  reload_unsigned(out, "unixmode", old->unixmode, &fresh->unixmode, FALSE);
+  if (strcmp(old->unixpath, fresh->unixpath) != 0)
+  {
+    reload_note(out, "unixpath needs a restart to change from \"%s\" "
+                "to \"%s\", still \"%s\"\n", old->unixpath,
+                fresh->unixpath, old->unixpath);
+  }
+  strncpy(fresh->unixpath, old->unixpath, sizeof(fresh->unixpath));
+  if (strcmp(old->unixgroup, fresh->unixgroup) != 0)
+  {
+    reload_note(out, "unixgroup needs a restart to change from \"%s\" "
+                "to \"%s\", still \"%s\"\n", old->unixgroup,
+                fresh->unixgroup, old->unixgroup);
+  }
+  strncpy(fresh->unixgroup, old->unixgroup, sizeof(fresh->unixgroup));
+  /* set on the sockets, and the processes pinned, at the start */
+  reload_unsigned(out, "busypoll", old->busypoll, &fresh->busypoll, FALSE);
+  if (strcmp(old->busycpus, fresh->busycpus) != 0)
+  {
+    reload_note(out, "busycpus needs a restart to change from \"%s\" "
+                "to \"%s\", still \"%s\"\n", old->busycpus,
+                fresh->busycpus, old->busycpus);
+  }
+  strncpy(fresh->busycpus, old->busycpus, sizeof(fresh->busycpus));
+  /* log_start() replaces logfilename with stdout when foregroundonly */
+  if ((old->foregroundonly == FALSE) &&
+      (strcmp(old->logfilename, fresh->logfilename) != 0))
+  {
+    reload_note(out, "logfilename needs a restart to change from \"%s\" "
+                "to \"%s\", still \"%s\"\n", old->logfilename,
+                fresh->logfilename, old->logfilename);
+  }
+  strncpy(fresh->logfilename, old->logfilename, sizeof(fresh->logfilename));
+
+  reload_unsigned(out, "loglevel", old->loglevel, &fresh->loglevel, TRUE);
+  reload_unsigned(out, "maxchild", old->maxchild, &fresh->maxchild, TRUE);
+  reload_unsigned(out, "dnslookups", old->dnslookups, &fresh->dnslookups,
+                  TRUE);
+  reload_unsigned(out, "dumpcore", old->dumpcore, &fresh->dumpcore, TRUE);
+  reload_unsigned(out, "logsync", old->logsync, &fresh->logsync, TRUE);
+  reload_unsigned(out, "logbatch", old->logbatch, &fresh->logbatch, TRUE);
+  reload_unsigned(out, "logflushms", old->logflushms, &fresh->logflushms,
+                  TRUE);
+  reload_unsigned(out, "logoverflow", old->logoverflow, &fresh->logoverflow,
+                  TRUE);
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+  {
+    snprintf(name, sizeof(name), "loglevel_%s", log_subsys_name(i));
+    reload_unsigned(out, name, old->sublevel[i], &fresh->sublevel[i], TRUE);
+  }
+  for (i = 0; i < LOG_CLASSES; i++)
+  {
+    snprintf(name, sizeof(name), "lograte_%s", log_class_name(i));
+    reload_unsigned(out, name, old->lograte[i], &fresh->lograte[i], TRUE);
+    snprintf(name, sizeof(name), "logsample_%s", log_class_name(i));
+    reload_unsigned(out, name, old->logsample[i], &fresh->logsample[i], TRUE);
+  }
+  reload_unsigned(out, "logsummary", old->logsummary, &fresh->logsummary,
+                  TRUE);
+  reload_unsigned(out, "rusagesummary", old->rusagesummary,
+                  &fresh->rusagesummary, TRUE);
+  reload_unsigned(out, "acldefault", old->acldefault, &fresh->acldefault,
+                  TRUE);
+  reload_unsigned(out, "fdbudget", old->fdbudget, &fresh->fdbudget, TRUE);
+  reload_unsigned(out, "childdeadline", old->childdeadline,
+                  &fresh->childdeadline, TRUE);
+  reload_unsigned(out, "childcpu", old->childcpu, &fresh->childcpu, TRUE);
+  reload_unsigned(out, "childgrace", old->childgrace, &fresh->childgrace,
+                  TRUE);
+  reload_unsigned(out, "placement", old->placement, &fresh->placement, TRUE);
+  reload_unsigned(out, "busyspin", old->busyspin, &fresh->busyspin, TRUE);
+  reload_unsigned(out, "profilehz", old->profilehz, &fresh->profilehz, TRUE);
+  if (strcmp(old->profilefile, fresh->profilefile) != 0)
+  {
+    reload_note(out, "profilefile changed from \"%s\" to \"%s\"\n",
+                old->profilefile, fresh->profilefile);
+  }
+  if (strcmp(old->cpulist, fresh->cpulist) != 0)
+  {
+    reload_note(out, "cpulist changed from \"%s\" to \"%s\"\n",
+                old->cpulist, fresh->cpulist);
+  }
+  if (strcmp(old->aclfile, fresh->aclfile) != 0)
+  {
+    reload_note(out, "aclfile changed from \"%s\" to \"%s\"\n",
+                old->aclfile, fresh->aclfile);
+  }
+
+  /* the ACL file is reread even if its name is the same, since that is
+     usually why there is a reload, and it must be good too */
+  if (acl_build(fresh->aclfile, fresh->acldefault, &newacl) != TRUE)
+  {
+    reload_note(out, "bad ACL file %s, configuration unchanged\n",
+                fresh->aclfile);
+    free(fresh);
+    return FALSE;
+  }
+
+  /* the master is single threaded and this isn't called from a signal
+     handler, so nothing can be looking at old any more */
+  global_options = fresh;
+  free(old);
+  acl_use(newacl);
+  placement_start();
+  log_apply_levels();
+  metrics_gauge(MG_MAXCHILD, global_options->maxchild);
+  if ((old_fdbudget != global_options->fdbudget) &&
+      (fds_budget(global_options->fdbudget) < 0))
+  {
+    reload_note(out, "can't set fdbudget: %s\n", strerror(errno));
+  }
+  if (newacl != NULL)
+  {
+    reload_note(out, "%d ACL rules from %s\n", acl_rules(),
+                global_options->aclfile);
+  }
+
+  reload_note(out, "now using %s\n", global_options->configfilename);
+  return TRUE;
+
+} /* reload_configfile */
+
 void log_option_status()
 {
+  int i;
 
   LOG(9, ("loglevel = %i\n", global_options->loglevel));
   LOG(9, ("foregroundonly = %s\n",
@@ -719,6 +1833,67 @@ void log_option_status()
   LOG(9, ("dumpcore = %s\n", (global_options->dumpcore == TRUE) ? "TRUE" : "FALSE"));
   LOG(9, ("terminate = %s\n", (global_options->terminate == TRUE) ? "TRUE" : "FALSE"));
   LOG(9, ("checkcfg = %s\n", (global_options->checkcfg == TRUE) ? "TRUE" : "FALSE"));
+  LOG(9, ("logsync = %s\n",
+          choice_name(logsync_choices, global_options->logsync)));
+  LOG(9, ("logbatch = %i\n", global_options->logbatch));
+  LOG(9, ("logflushms = %i\n", global_options->logflushms));
+  LOG(9, ("logoverflow = %s\n",
+          choice_name(logoverflow_choices, global_options->logoverflow)));
+  LOG(9, ("logformat = %s\n",
+          choice_name(logformat_choices, global_options->logformat)));
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+  {
+    LOG(9, ("loglevel_%s = %i%s\n", log_subsys_name(i), log_levels[i],
+            (global_options->sublevel[i] == 0) ? " (from loglevel)" : ""));
+  }
+  LOG(9, ("compiled-in loglevel limit = %i\n", LOG_COMPILED_LEVEL));
+  for (i = 0; i < LOG_CLASSES; i++)
+  {
+    LOG(9, ("lograte_%s = %u, logsample_%s = %u\n", log_class_name(i),
+            global_options->lograte[i], log_class_name(i),
+            global_options->logsample[i]));
+  }
+  LOG(9, ("logsummary = %u\n", global_options->logsummary));
+  LOG(9, ("rusageprefix = %u\n", global_options->rusageprefix));
+  LOG(9, ("rusagesummary = %u\n", global_options->rusagesummary));
+  LOG(9, ("aclfile = \"%s\"\n",
+          (strlen(global_options->aclfile) == 0) ? "NULL - not set" :
+          global_options->aclfile));
+  LOG(9, ("acldefault = %s\n",
+          choice_name(acl_choices, global_options->acldefault)));
+  LOG(9, ("fdbudget = %u%s\n", global_options->fdbudget,
+          (global_options->fdbudget == 0) ? " (not set)" : ""));
+  LOG(9, ("childdeadline = %u, childcpu = %u, childgrace = %u\n",
+          global_options->childdeadline, global_options->childcpu,
+          global_options->childgrace));
+  LOG(9, ("placement = %s\n",
+          choice_name(placement_choices, global_options->placement)));
+  LOG(9, ("cpulist = \"%s\"\n",
+          (strlen(global_options->cpulist) == 0) ? "NULL - not set" :
+          global_options->cpulist));
+  LOG(9, ("profilehz = %u, profilesamples = %u, profilefile = \"%s\"\n",
+          global_options->profilehz, global_options->profilesamples,
+          global_options->profilefile));
+  LOG(9, ("protocol = %s, udpworkers = %u, udpreuseport = %s, udpgso = %u, "
+          "udpgro = %s, udpsteer = %s\n",
+          choice_name(protocol_choices, global_options->protocol),
+          global_options->udpworkers,
+          (global_options->udpreuseport == TRUE) ? "TRUE" : "FALSE",
+          global_options->udpgso,
+          (global_options->udpgro == TRUE) ? "TRUE" : "FALSE",
+          (global_options->udpsteer == TRUE) ? "TRUE" : "FALSE"));
+  LOG(9, ("unixpath = \"%s\", unixonly = %s, unixmode = %o, "
+          "unixgroup = \"%s\"\n",
+          (strlen(global_options->unixpath) == 0) ? "NULL - not set" :
+          global_options->unixpath,
+          (global_options->unixonly == TRUE) ? "TRUE" : "FALSE",
+          global_options->unixmode,
+          (strlen(global_options->unixgroup) == 0) ? "NULL - not set" :
+          global_options->unixgroup));
+  LOG(9, ("busypoll = %u, busyspin = %u, busycpus = \"%s\"\n",
+          global_options->busypoll, global_options->busyspin,
+          (strlen(global_options->busycpus) == 0) ? "NULL - not set" :
+          global_options->busycpus));
 
 } /* log_option_status */
 
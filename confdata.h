@@ -23,8 +23,13 @@ char * cmdline_message();
 
 void process_cmdline(int argc, char **argv);
 
+/* returns the number of lines rejected, or -1 if the file can't be read */
 int process_configfile(options *my_options);
 
+/* re-reads the config file and, if it is all good, uses it from now on.
+   Returns TRUE if it did. The report is also written to out if not NULL */
+int reload_configfile(FILE *out);
+
 void fill_default_options(options *my_options);
 
 void log_option_status();
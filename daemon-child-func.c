@@ -20,30 +20,56 @@
 #include <stdio.h>
 #include <stdlib.h> /* exit codes and things */
 #include <unistd.h> /* _exit */
+#include <errno.h>
+#define LOG_SUBSYS LOGSUB_CHILD
 #include "log.h"
 #include "global.h"
+#include "metrics.h"
+#include "probes.h"
+#include "flight.h"
 
 void daemon_child_function(FILE *incoming, FILE *outgoing, char *incoming_name)
 {
   int num = 0;
   int ignore;
+  unsigned long long bytes_in = 0;
+  unsigned long long bytes_out = 0;
+  unsigned long long lifetime;
 
-  fprintf(outgoing, "Hello %s\n", incoming_name);
+  PROBE_CHILD_START(getpid(), incoming_name);
+
+  num = fprintf(outgoing, "Hello %s\n", incoming_name);
   ignore = fflush(outgoing);
+  flight_record(FL_WRITE, (ignore != 0) ? errno : 0, fileno(outgoing), num);
+  bytes_out += num;
+  metrics_first_byte();
 
   while ( (num = getc(incoming)) > 0 )
   {
+    bytes_in++;
     if (num == '1')
     {
       break;
     }
     ignore = putc(num, outgoing);
     ignore = fflush(outgoing);
+    bytes_out++;
   }
+  /* the whole conversation, since it goes a byte at a time */
+  flight_record(FL_READ, ferror(incoming) ? errno : 0, fileno(incoming),
+                bytes_in);
+  flight_record(FL_WRITE, ferror(outgoing) ? errno : 0, fileno(outgoing),
+                bytes_out);
   fclose(outgoing); /* and a close_all...? */
   fclose(incoming);
 
+  /* counted in the shared statistics segment, so not lost at _exit() */
+  metrics_add(MC_BYTES_IN, bytes_in);
+  metrics_add(MC_BYTES_OUT, bytes_out);
+  lifetime = metrics_child_done();
+  PROBE_CHILD_END(getpid(), lifetime, bytes_in, bytes_out);
   LOG(9, ("About to _exit() child\n"));
+  log_flush(FALSE); /* _exit() won't, and log records are buffered */
   _exit(EXIT_SUCCESS);
 
 } /* child_function */
@@ -0,0 +1,42 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+
+/* daemon_packet_func.c
+
+   packet function for daemon template in UDP mode, the counterpart of
+   daemon_child_function(). A UDP worker (see udp.c) calls it for each
+   datagram, with any that GRO coalesced already split apart, so it
+   should be quick: the rest of the batch waits for it.
+
+   The reply, if any, goes in out, at most max bytes, and its length is
+   returned; 0 sends nothing. A reply longer than udpgso is sent as
+   udpgso-sized datagrams.
+
+   This one echoes each datagram back to where it came from.
+
+*/
+
+#include <string.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+int daemon_packet_function(const char *in, size_t len, char *out, size_t max,
+                           const struct sockaddr_in *from)
+{
+  if (len > max)
+  {
+    len = max;
+  }
+  memcpy(out, in, len);
+  return (int)len;
+
+} /* daemon_packet_function */
@@ -25,6 +25,8 @@ smallish scope
 
 #include <stdio.h>
 #include <sys/wait.h>
+#include <signal.h>
+#include <sys/resource.h>
 #include <errno.h>
 #include <sys/types.h>  /* pid_t and friends */
 #include <stdlib.h>     /* exit codes */
@@ -35,6 +37,7 @@ smallish scope
 #include <time.h>  /* strftime */
 #include <arpa/inet.h>   /* ntoa etc */
 #include <unistd.h>    /* getpid */
+#include <sys/un.h>
 
 #include "global.h"
 #include "util.h"
@@ -42,15 +45,35 @@ smallish scope
 #include "lockfile.h"
 #include "socket.h"
 #include "confdata.h"
-
-unsigned child_count = 0; /* 0 means no clients, not the first client */
+#include "metrics.h"
+#include "admin.h"
+#include "probes.h"
+#include "childtab.h"
+#include "accounting.h"
+#include "acl.h"
+#include "fds.h"
+#include "placement.h"
+#include "profile.h"
+#include "flight.h"
+#include "udp.h"
+
+/* 0 means no clients, not the first client. Changed by dead_child() in
+   the SIGCHLD handler, so main() blocks SIGCHLD to change it */
+volatile unsigned child_count = 0;
 
 unsigned master_process = TRUE;
 
 int tortu_sock = -1;    /* socket descriptor */
+int local_sock = -1;    /* the AF_UNIX listener, if unixpath is set */
 
 unsigned lock_acquired = FALSE;
 
+/* set by SIGHUP, the main loop rereads the config file */
+static volatile sig_atomic_t reload_pending = FALSE;
+
+/* set by SIGUSR2, the main loop starts the profiler */
+static volatile sig_atomic_t profile_pending = FALSE;
+
 extern void daemon_child_function(FILE *incoming, FILE *outgoing, char *incoming_name);
 
 /* both the initial process and the master daemon process have
@@ -58,29 +81,32 @@ extern void daemon_child_function(FILE *incoming, FILE *outgoing, char *incoming
 
 int dead_child()
 {
-  /* use __WAIT_STATUS_DEFN coz __WAIT_STATUS is a union on some architectures
-     so can't assign it to NULL */
-  __WAIT_STATUS_DEFN res;
+  struct rusage ru;
+  int status;
   pid_t pid;
+  int saved_errno = errno; /* don't upset whatever we interrupted */
 
-  LOG(9, ("About to wait3() in dead_child\n"));
-  /* UNFEATURE don't use wait3,use wait. Check the differences */
-  /* UNFEATURE don't use wait4,use waitpid */
-  /* actually, strace shows that wait3 is a wrapper for wait4 anyway :-) */
-  res = NULL;
-  pid = wait3(res, WNOHANG, (struct rusage *)0);
-  switch (pid)
+  /* SIGCHLDs arriving together are delivered as one, so reap every child
+     that has exited, not just one. Otherwise the rest stay zombies and
+     their slots in child_count are never given back. */
+  for (;;)
   {
+    LOG(9, ("About to wait4() in dead_child\n"));
+    /* wait4 rather than waitpid, for the child's resource usage */
+    pid = wait4(-1, &status, WNOHANG, &ru);
+    if ((pid == 0) || ((pid < 0) && (errno == ECHILD)))
+    {
+      break; /* none left, perhaps reaped by the loop for an earlier signal */
+    }
+    if (pid < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      PANIC(("wait4 reported error %d, %s\n", errno, strerror(errno)));
+    }
 
-  case - 1:
-    PANIC(("wait3 reported error %d, %s\n", errno, strerror(errno)));
-
-  case 0:
-    PANIC(("wait3 reported no child exited, error %d,%s\n",
-           errno, strerror(errno)));
-    /* how serious is this really? */
-
-  default: /* note PANIC above never returns */
     if (child_count == 0)
     {
       PANIC(("dead_child: child count == 0 immediately before decrement\n"));
@@ -90,12 +116,31 @@ int dead_child()
     {
       LOG(9, ("dead_child: child count now 0\n"));
     }
+    metrics_gauge(MG_CHILDREN, child_count);
+    metrics_count(MC_REAPED);
+    PROBE_REAP(pid, child_count);
+    flight_record(FL_REAP, 0, pid, status);
+    metrics_reaped(pid);
+    accounting_reaped(pid, &ru);
+    log_reaped(pid);
+    udp_reaped(pid);
+    LOG_LIMITED(LOGCLASS_REAP, 1, ("child pid %d died\n", pid));
   }
-  LOG(1, ("child pid %d died\n", pid));
+  errno = saved_errno;
   return 0;
 } /* dead_child */
 
 
+static void reload_signal(int signum)
+{
+  reload_pending = TRUE;
+} /* reload_signal */
+
+static void profile_signal(int signum)
+{
+  profile_pending = TRUE;
+} /* profile_signal */
+
 void shutdown_signal(int signum)
 {
 
@@ -108,6 +153,14 @@ void shutdown_signal(int signum)
     PANIC(("invalid signum passed to shutdown_signal\n"));
   }
 
+  /* SIGTERM and SIGINT are how we're asked to stop; the rest mean
+     something went wrong, so keep a record of what led up to it */
+  flight_record(FL_SIGNAL, 0, signum, 0);
+  if ((signum != SIGTERM) && (signum != SIGINT))
+  {
+    flight_dump("fatal signal");
+  }
+
   if (master_process == TRUE)
   {
 
@@ -132,14 +185,25 @@ void shutdown_signal(int signum)
       LOG(1, ("couldn't kill process group from master process\n"));
     }
 
-    res = close(tortu_sock);
-    if (res != 0)
+    if (tortu_sock >= 0)  /* not with unixonly */
+    {
+      res = close(tortu_sock);
+      if (res != 0)
+      {
+        PANIC(("Closing daemon socket gave error %d, %s\n",
+               errno, strerror(errno)));
+      }
+    }
+    if (local_sock >= 0)
     {
-      PANIC(("Closing daemon socket gave error %d, %s\n",
-             errno, strerror(errno)));
+      close(local_sock);
+      socket_finish();
     }
 
     lockfile_remove();
+    log_unshare_levels();
+    admin_finish();
+    metrics_finish();
 
     LOG(9, ("Finishing logging\n"));
     log_finish();
@@ -213,6 +277,32 @@ static int setup_signals()
 
   /*  signal(SIGCHLD,(void *)dead_child); oldfashioned :) */
 
+  sig.sa_handler = &reload_signal;
+  res = sigaction(SIGHUP, &sig, (struct sigaction *)0);
+  if (res < 0)
+  {
+    LOG(1, ("sigaction failed with error %d\n", res));
+    return -errno;
+  }
+
+  sig.sa_handler = &profile_signal;
+  res = sigaction(SIGUSR2, &sig, (struct sigaction *)0);
+  if (res < 0)
+  {
+    LOG(1, ("sigaction failed with error %d\n", res));
+    return -errno;
+  }
+
+  /* a client going away mustn't kill the master, which only hears of it
+     as EPIPE. Children put it back, see child_setup() */
+  sig.sa_handler = SIG_IGN;
+  res = sigaction(SIGPIPE, &sig, (struct sigaction *)0);
+  if (res < 0)
+  {
+    LOG(1, ("sigaction failed with error %d\n", res));
+    return -errno;
+  }
+
   return 0;
 } /* setup_signals */
 
@@ -261,6 +351,112 @@ void fratricide()
 
 } /* fratricide */
 
+/* changes subsystem log levels in the process holding the lockfile, as
+   given by -L. Like fratricide, most of the program isn't set up. */
+void set_remote_levels()
+{
+  volatile unsigned *levels;
+  pid_t pid = -1;
+  int i;
+
+  pid = lockfile_check();
+  if (pid == 0)
+  {
+    PANIC(("Can't set log levels, because nobody holds lockfile\n"));
+  }
+
+  levels = log_map_levels(FALSE);
+  if (levels == NULL)
+  {
+    PANIC(("Can't open %s to set log levels of pid %i, error %d, %s\n",
+           GLOBAL_LEVELS_NAME, pid, errno, strerror(errno)));
+  }
+
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+  {
+    if (global_options->sublevel[i] != 0)
+    {
+      levels[i] = global_options->sublevel[i];
+      LOG(1, ("Set %s loglevel to %u in pid %d\n",
+              log_subsys_name(i), global_options->sublevel[i], pid));
+    }
+  }
+  exit(EXIT_SUCCESS);
+
+} /* set_remote_levels */
+
+/* The start of every child, for a connection or a UDP worker: it isn't
+   the master any more, and each subsystem lets go of the master's
+   state. accepted_us is when the connection was accepted, 0 for a
+   worker */
+static void child_setup(unsigned long long accepted_us, int cpu)
+{
+  struct sigaction sig;
+
+  /* a child serving a client that has gone may as well die, as before */
+  memset(&sig, 0, sizeof(sig));
+  sig.sa_handler = SIG_DFL;
+  (void)sigaction(SIGPIPE, &sig, NULL);
+  master_process = FALSE;
+  flight_forked();
+  childtab_unblock();
+  log_forked(FALSE);
+  metrics_forked(accepted_us);
+  admin_forked();
+  socket_forked();
+  placement_apply(cpu);
+  profile_forked();
+} /* child_setup */
+
+/* Forks UDP worker w, see udp.c. Like a connection child it is counted
+   in child_count and the child table, but it is never refused for
+   maxchild */
+static void start_worker(int w)
+{
+  pid_t pid;
+  int cpu;
+
+  childtab_block(); /* until the new worker is in the table */
+  cpu = placement_worker_cpu(w);
+  if (cpu < 0)
+  {
+    cpu = placement_choose(udp_socket(w));
+  }
+  child_count++;
+  metrics_gauge(MG_CHILDREN, child_count);
+
+  pid = fork();
+  switch (pid)
+  {
+
+  case - 1:
+    child_count--;
+    metrics_gauge(MG_CHILDREN, child_count);
+    metrics_count(MC_FORK_FAILED);
+    flight_record(FL_FORK, errno, -1, cpu);
+    udp_started(w, 0); /* so it is tried again, but not at once */
+    childtab_unblock();
+    LOG(1, ("fork() of UDP worker %d gave error %d, %s\n", w, errno,
+            strerror(errno)));
+    break;
+
+  case 0:
+    child_setup(0, cpu);
+    udp_forked(w);
+    LOG(9, ("Created UDP worker %d\n", w));
+    udp_serve(w); /* never returns */
+    PANIC(("Unreachable code in start_worker reached!\n"));
+
+  default:
+    flight_record(FL_FORK, 0, pid, cpu);
+    childtab_add(pid, 0, 0, metrics_now(), cpu);
+    udp_started(w, pid);
+    childtab_unblock();
+    LOG(2, ("UDP worker %d is pid %d\n", w, pid));
+
+  } /* switch */
+} /* start_worker */
+
 int main(int argc, char **argv)
 
 {
@@ -269,9 +465,19 @@ int main(int argc, char **argv)
   int clisockdes_dup = -1;
   unsigned len = 0;
   pid_t pid = 0;
+  int res = 0;
+  unsigned long long accepted_us = 0; /* when clisockdes was accepted */
+  unsigned long long woke_us = 0;     /* when the master saw it waiting */
+  acl *startacl = NULL;
+  long fdlimit;
+  int wait_ms;
+  int cpu;
+  int w;
+  int local = FALSE;  /* the connection came to the AF_UNIX listener */
 
   struct sockaddr_in sin, child_sin;
-  char incoming_addr[16];    /* UNFEATURE AF_INET6 */
+  struct sockaddr_un child_sun;
+  char incoming_addr[64];    /* UNFEATURE AF_INET6 */
   struct hostent *incoming_dns; /* only in children; can be high-cost */
   char incoming_name[256];  /* plain text hostname from DNS */
 
@@ -306,6 +512,13 @@ int main(int argc, char **argv)
     }
   }
 
+  /* before log_start, which would send the reply to the logfile */
+  if (global_options->admincommand[0] != '\0')
+  {
+    exit((admin_request(global_options->admincommand) == TRUE) ?
+         EXIT_SUCCESS : EXIT_FAILURE);
+  }
+
   /* sets up logging on fd's 0,1 and 2, unless foregroundonly
    * this will close tortu_sock if it is open, so call this first */
   log_start();
@@ -321,7 +534,11 @@ int main(int argc, char **argv)
      confdata.c notices and readdjusts it to MAX_LOGLEVEL */
   if (strlen(global_options->configfilename) > 0)
   {
-    process_configfile(global_options);
+    if (process_configfile(global_options) < 0)
+    {
+      PANIC(("Can't read config file \"%s\"\n",
+             global_options->configfilename));
+    }
     if (global_options->loglevel == MAX_LOGLEVEL)
     {
       LOG(9, ("config file read, settings follow\n"));
@@ -336,6 +553,14 @@ int main(int argc, char **argv)
     }
   }
 
+  /* before checkcfg, so -o checks the ACL file too */
+  if (acl_build(global_options->aclfile, global_options->acldefault,
+                &startacl) != TRUE)
+  {
+    PANIC(("Can't use ACL file \"%s\"\n", global_options->aclfile));
+  }
+  acl_use(startacl);
+
   if (global_options->checkcfg == TRUE)
   {
     LOG(1, ("checkcfg - exiting without runing daemon\n"));
@@ -347,6 +572,11 @@ int main(int argc, char **argv)
     fratricide();
   }
 
+  if (global_options->setlevels == TRUE)
+  {
+    set_remote_levels();
+  }
+
   /* lockfile checking is a special case, where we always want the error
      message to go to stdout regardless of logging options */
   pid = lockfile_check();
@@ -387,15 +617,72 @@ int main(int argc, char **argv)
     LOG(2, ("Not daemonising - foregroundonly flag set\n"));
   }
 
+  if (global_options->fdbudget > 0)
+  {
+    fdlimit = fds_budget(global_options->fdbudget);
+    if (fdlimit < 0)
+    {
+      PANIC(("Can't set fdbudget %u: %s\n", global_options->fdbudget,
+             strerror(errno)));
+    }
+    LOG(2, ("Descriptor budget %ld (fdbudget %u)\n", fdlimit,
+            global_options->fdbudget));
+  }
+
+  placement_start();
+  placement_pin_master(); /* if it is going to spin */
+
+  /* the AF_UNIX listener is for connections, and the children that
+     serve them */
+  if ((global_options->unixpath[0] != '\0') &&
+      (global_options->protocol != PROTOCOL_TCP))
+  {
+    PANIC(("unixpath is a stream listener, and needs protocol tcp\n"));
+  }
+  if ((global_options->unixonly == TRUE) &&
+      (global_options->unixpath[0] == '\0'))
+  {
+    PANIC(("unixonly, but no unixpath to listen on\n"));
+  }
+  /* steering picks one of a group of sockets */
+  if ((global_options->protocol == PROTOCOL_UDP) &&
+      (global_options->udpsteer == TRUE) &&
+      (global_options->udpreuseport == FALSE))
+  {
+    PANIC(("udpsteer needs udpreuseport, for a socket each to steer to\n"));
+  }
+
   /* init_socket should be after become_daemon, since become_daemon
    * closes all open file descriptors */
-  tortu_sock = init_socket((struct sockaddr_in *) & sin);
-  if ( tortu_sock == -1 )
+  if (global_options->unixonly == FALSE)
+  {
+    tortu_sock = init_socket((struct sockaddr_in *) & sin);
+    if ( tortu_sock == -1 )
+    {
+      PANIC(("Can't setup socket in %s\n", argv[0]));
+    }
+  }
+  if (global_options->unixpath[0] != '\0')
+  {
+    local_sock = init_local_socket(global_options->unixpath);
+    if (local_sock == -1)
+    {
+      PANIC(("Can't listen on %s in %s\n", global_options->unixpath,
+             argv[0]));
+    }
+  }
+  if ((global_options->protocol == PROTOCOL_UDP) &&
+      (udp_start(tortu_sock) != TRUE))
   {
-    PANIC(("Can't setup socket in %s\n", argv[0]));
+    PANIC(("Can't setup UDP worker sockets in %s\n", argv[0]));
   }
 
   get_lock_or_die();  /* can't do until we're a daemon */
+  log_share_levels(); /* before any children, so they all see changes */
+  metrics_start();    /* likewise, so children can add to the metrics */
+  profile_init();     /* and can add to a profile */
+  flight_init();
+  admin_start();      /* not fatal if it fails */
 
   /* This loop accepts a connection, applies some basic checks, starts a
   child process if it passes the tests, the child does more acceptance
@@ -404,13 +691,79 @@ int main(int argc, char **argv)
   child gets to do the potentially time-consuming tests, but the parent
   does tests which stop forking denials of service */
 
-  len = sizeof(child_sin);
-
   for (;;)
   {
 
-    LOG(9, ("About to block on filtered_accept()\n"));
-    clisockdes = filtered_accept(tortu_sock, (struct sockaddr *) & child_sin, &len);
+    /* in UDP mode the workers do the serving, and the master only keeps
+       them going and does the housekeeping */
+    if (global_options->protocol == PROTOCOL_UDP)
+    {
+      while ((w = udp_vacant()) >= 0)
+      {
+        start_worker(w);
+      }
+    }
+
+    /* wake at least every logflushms to write out waiting log records,
+       and every second for the watchdog, the profiler or restarting UDP
+       workers if they're on */
+    log_tick();
+    accounting_tick();
+    childtab_tick();
+    profile_tick();
+    wait_ms = global_options->logflushms;
+    if (((global_options->childdeadline > 0) ||
+         (global_options->childcpu > 0) || (profile_active() == TRUE) ||
+         (global_options->protocol == PROTOCOL_UDP)) &&
+        (wait_ms > CHILDTAB_TICK_US / 1000))
+    {
+      wait_ms = CHILDTAB_TICK_US / 1000;
+    }
+    res = wait_for_connection((global_options->protocol == PROTOCOL_UDP) ?
+                              -1 : tortu_sock, local_sock, admin_fd(),
+                              wait_ms);
+    if (res < 0)
+    {
+      PANIC(("wait_for_connection() failed with error %i, %s\n", errno,
+             strerror(errno)));
+    }
+    if (reload_pending == TRUE)
+    {
+      reload_pending = FALSE;
+      flight_record(FL_RELOAD, 0, reload_configfile(NULL), 0);
+    }
+    if (profile_pending == TRUE)
+    {
+      profile_pending = FALSE;
+      (void)profile_begin(PROFILE_SIGNAL_SECS);
+    }
+    if (res & WAIT_ADMIN)
+    {
+      admin_serve();
+    }
+    if (!(res & (WAIT_LISTEN | WAIT_LOCAL)))
+    {
+      continue;
+    }
+
+    /* one connection a time round the loop; if both listeners are ready,
+       take turns */
+    local = ((res & WAIT_LOCAL) &&
+             (!(res & WAIT_LISTEN) || (local == FALSE))) ? TRUE : FALSE;
+
+    LOG(9, ("About to filtered_accept()\n"));
+    if (local == TRUE)
+    {
+      len = sizeof(child_sun);
+      clisockdes = filtered_accept(local_sock, (struct sockaddr *) & child_sun,
+                                   &len);
+    }
+    else
+    {
+      len = sizeof(child_sin);
+      clisockdes = filtered_accept(tortu_sock, (struct sockaddr *) & child_sin,
+                                   &len);
+    }
 
     if (clisockdes < 0)
     {
@@ -421,11 +774,44 @@ int main(int argc, char **argv)
       /* UNFEATURE - are there any errors we want to recover from? */
     }
 
-    /* UNFEATURE cater for AF_INET6 */
-    /* could equally have used getpeername */
-    strncpy(incoming_addr, inet_ntoa(child_sin.sin_addr), sizeof(incoming_addr));
+    accepted_us = metrics_now();
+    woke_us = socket_woke();
+    metrics_count(MC_ACCEPTED);
+
+    if (local == TRUE)
+    {
+      /* a local client has no address, so it is named by its
+         credentials, and checked and accounted as 127.0.0.1 */
+      metrics_count(MC_ACCEPTED_LOCAL);
+      memset(&child_sin, 0, sizeof(child_sin));
+      child_sin.sin_family = AF_INET;
+      child_sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      socket_peer_name(clisockdes, incoming_addr, sizeof(incoming_addr));
+    }
+    else
+    {
+      /* UNFEATURE cater for AF_INET6 */
+      /* could equally have used getpeername */
+      strncpy(incoming_addr, inet_ntoa(child_sin.sin_addr),
+              sizeof(incoming_addr));
+    }
+    flight_record(FL_ACCEPT, 0, clisockdes, child_sin.sin_addr.s_addr);
+
+    LOG_LIMITED(LOGCLASS_CONNECT, 1,
+                ("Connection attempt from %s\n", incoming_addr));
 
-    LOG(1, ("Connection attempt from %s\n", incoming_addr));
+    /* the cheapest check, so first, and silent, so as to tell a denied
+       client nothing */
+    if (acl_check((struct sockaddr *) & child_sin) == FALSE)
+    {
+      LOG_LIMITED(LOGCLASS_REFUSE, 1, ("Connection from %s denied by ACL\n",
+                                       incoming_addr));
+      metrics_count(MC_DENIED);
+      flight_record(FL_DENIED, 0, clisockdes, child_sin.sin_addr.s_addr);
+      close(clisockdes);
+      memset(&incoming_addr, 0, sizeof(incoming_addr));
+      continue;
+    }
 
     /* before we do initial checks, need to be able to talk to the client. This
     will almost always be the case unless the protocol being implemented
@@ -434,15 +820,20 @@ int main(int argc, char **argv)
     clisockdes_dup = dup(clisockdes);
     if (clisockdes_dup < 0)
     {
-      LOG(1, ("dup() failed initialising connection with %d, %s\n", errno, strerror(errno)));
+      LOG_LIMITED(LOGCLASS_REFUSE, 1, ("dup() failed initialising connection "
+                                       "with %d, %s\n", errno, strerror(errno)));
+      metrics_count(MC_DUP_FAILED);
       fprintf(outgoing, "Can't initialise connection\n");
       goto error_shortcut;
     }
     incoming = fdopen(clisockdes_dup, "r");
 
-    if (child_count == global_options->maxchild)
+    if (child_count >= global_options->maxchild) /* maxchild can shrink */
     {
-      LOG(1, ("Maximum children reached, refusing to fork() again\n"));
+      LOG_LIMITED(LOGCLASS_REFUSE, 1, ("Maximum children reached, refusing to "
+                                       "fork() again\n"));
+      metrics_count(MC_REFUSED);
+      flight_record(FL_REFUSED, 0, child_count, 0);
       fprintf(outgoing, "Maximum processes reached, try again later\n");
       goto error_shortcut;
     }
@@ -453,28 +844,43 @@ int main(int argc, char **argv)
 
     /* increment child counter before the fork. SIGCHLD could arrive
        between the fork and the increment, and the signal handler
-       decrements counter. Any other behaviour is a bug */
+       decrements counter. Any other behaviour is a bug. SIGCHLD is
+       blocked first, or a decrement in the handler in the middle of the
+       increment is lost and the slot leaks */
 
+    childtab_block(); /* until the new child is in the table */
+    cpu = placement_choose(clisockdes);
     child_count++;
+    metrics_gauge(MG_CHILDREN, child_count);
+    PROBE_FORK_BEGIN(child_count, child_sin.sin_addr.s_addr);
 
-    switch (fork())
+    pid = fork();
+    switch (pid)
     {
 
     case - 1:
       child_count--;
-      LOG(1, ("fork() parent main loop gave error %d, %s\n", errno, strerror(errno)));
+      metrics_gauge(MG_CHILDREN, child_count);
+      metrics_count(MC_FORK_FAILED);
+      PROBE_FORK_END(-1, metrics_now() - accepted_us);
+      flight_record(FL_FORK, errno, -1, cpu);
+      childtab_unblock();
+      LOG_LIMITED(LOGCLASS_REFUSE, 1, ("fork() parent main loop gave error "
+                                       "%d, %s\n", errno, strerror(errno)));
       break;
 
     case 0:
 
       /* Don't set child_count=0. It's global. If you want a variable to answer
          "how many children does this process have" then create a new one. */
-      master_process = FALSE;
+      child_setup(accepted_us, cpu);
+      childtab_forked();
       close(tortu_sock);
+      close(local_sock);
 
       LOG(9, ("Created new child process\n"));
 
-      if (global_options->dnslookups == TRUE)
+      if ((global_options->dnslookups == TRUE) && (local == FALSE))
       {
         incoming_dns = gethostbyaddr((const char *) & child_sin.sin_addr,
                                      sizeof(&child_sin.sin_addr), AF_INET);
@@ -495,6 +901,7 @@ int main(int argc, char **argv)
         strncpy(incoming_name, incoming_addr, sizeof(incoming_name));
       } /* dns_lookups */
 
+      metrics_record(MH_WAKEUP_TO_HANDLER, metrics_now() - woke_us);
       daemon_child_function(incoming, outgoing, incoming_name); /* never returns */
 
       PANIC(("Unreachable code in main switch reached!\n"));
@@ -503,7 +910,12 @@ int main(int argc, char **argv)
     default:
       /* we're the parent, and no error - just keep going */
 
-      ; /* nop */
+      metrics_record(MH_ACCEPT_TO_FORK, metrics_now() - accepted_us);
+      PROBE_FORK_END(pid, metrics_now() - accepted_us);
+      flight_record(FL_FORK, 0, pid, cpu);
+      childtab_add(pid, child_sin.sin_addr.s_addr, accepted_us,
+                   metrics_now(), cpu);
+      childtab_unblock();
 
     } /* switch */
 
@@ -0,0 +1,213 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* daemonstat.c
+
+   daevel-stat: prints what a running daemon is doing, like vmstat. It maps
+   the daemon's statistics segment (see stats.h) read-only, so taking a
+   reading never involves the daemon at all.
+
+   usage: daevel-stat [-p pid] [interval [count]]
+
+   pid defaults to the one in the lockfile. The first line covers the
+   time since the daemon started, and each later one the last interval
+   seconds (default 1). Without count it runs until the daemon exits.
+
+   Columns are children running, then per second connections accepted,
+   refused (maxchild reached), accept() errors squashed, children reaped,
+   kB read from and written to clients; then in microseconds the 99th
+   percentile of accept to fork, and of fork to first byte, and the
+   median and 99th percentile connection lifetime, and the 99th
+   percentile from poll() seeing work to the handler starting.
+
+   If there is no daemon, or its segment isn't one this build
+   understands, it says so on stderr and exits 1.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "global.h"
+#include "stats.h"
+
+#define DAEMONSTAT_HEADER_EVERY 20  /* lines between column headings */
+
+/* what we remember between readings */
+typedef struct
+{
+  double when;  /* seconds */
+  unsigned long long total[METRIC_COUNTERS];
+  unsigned long long bucket[METRIC_HISTOGRAMS][METRIC_BUCKETS];
+}
+reading;
+
+static void take_reading(const stats_segment *seg, reading *r)
+{
+  struct timespec now;
+  int h;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  r->when = now.tv_sec + now.tv_nsec / 1e9;
+  stats_totals(seg, r->total);
+  for (h = 0; h < METRIC_HISTOGRAMS; h++)
+  {
+    memcpy(r->bucket[h], seg->histogram[h].bucket, sizeof(r->bucket[h]));
+  }
+} /* take_reading */
+
+/* p-th quantile of histogram h over the values recorded between then and
+   now. Buckets can be a little ahead of count, so count them instead. */
+static unsigned long long interval_quantile(const reading *now,
+    const reading *then, int h, double q)
+{
+  unsigned long long delta[METRIC_BUCKETS];
+  unsigned long long n = 0;
+  unsigned b;
+
+  for (b = 0; b < METRIC_BUCKETS; b++)
+  {
+    delta[b] = now->bucket[h][b] - then->bucket[h][b];
+    n += delta[b];
+  }
+  return stats_quantile(delta, n, q);
+} /* interval_quantile */
+
+static void print_header()
+{
+  printf("%6s %8s %7s %7s %7s %8s %8s %8s %8s %8s %8s %9s\n",
+         "child", "conn/s", "refd/s", "sqsh/s", "reap/s", "kBin/s",
+         "kBout/s", "a2f_p99", "ffb_p99", "life_p50", "life_p99",
+         "wake_p99");
+} /* print_header */
+
+static void print_line(const stats_segment *seg, const reading *now,
+                       const reading *then)
+{
+  double secs = now->when - then->when;
+
+  if (secs <= 0)
+  {
+    secs = 1;
+  }
+#define RATE(c) ((now->total[c] - then->total[c]) / secs)
+  printf("%6ld %8.1f %7.1f %7.1f %7.1f %8.1f %8.1f %8llu %8llu %8llu %8llu "
+         "%9llu\n",
+         seg->gauge[MG_CHILDREN], RATE(MC_ACCEPTED), RATE(MC_REFUSED),
+         RATE(MC_SQUASHED), RATE(MC_REAPED), RATE(MC_BYTES_IN) / 1024,
+         RATE(MC_BYTES_OUT) / 1024,
+         interval_quantile(now, then, MH_ACCEPT_TO_FORK, 0.99),
+         interval_quantile(now, then, MH_FORK_TO_FIRST_BYTE, 0.99),
+         interval_quantile(now, then, MH_LIFETIME, 0.5),
+         interval_quantile(now, then, MH_LIFETIME, 0.99),
+         interval_quantile(now, then, MH_WAKEUP_TO_HANDLER, 0.99));
+#undef RATE
+  fflush(stdout);
+} /* print_line */
+
+static void usage()
+{
+  fprintf(stderr, "usage: daevel-stat [-p pid] [interval [count]]\n");
+  fprintf(stderr, "       -p pid    daemon to watch, default from %s\n",
+          GLOBAL_LOCKFILE_NAME);
+  fprintf(stderr, "       interval  seconds between lines, default 1\n");
+  fprintf(stderr, "       count     lines to print, default until the"
+          " daemon exits\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  static reading r[2];
+  const stats_segment *seg;
+  struct timespec pause;
+  char why[FILENAME_LEN + 100];
+  pid_t pid = 0;
+  double interval = 1;
+  long count = -1;
+  long lines = 0;
+  int cur = 0;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "p:h")) != -1)
+  {
+    switch (ch)
+    {
+    case 'p':
+      pid = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc)
+  {
+    interval = atof(argv[optind++]);
+    if (interval <= 0)
+      usage();
+  }
+  if (optind < argc)
+  {
+    count = atol(argv[optind++]);
+    if (count <= 0)
+      usage();
+  }
+
+  if (pid == 0)
+  {
+    pid = stats_daemon_pid();
+    if (pid == 0)
+    {
+      fprintf(stderr, "daevel-stat: no daemon holds %s\n",
+              GLOBAL_LOCKFILE_NAME);
+      exit(EXIT_FAILURE);
+    }
+  }
+  seg = stats_attach(pid, why, sizeof(why));
+  if (seg == NULL)
+  {
+    fprintf(stderr, "daevel-stat: %s\n", why);
+    exit(EXIT_FAILURE);
+  }
+
+  /* first line is everything since the daemon started */
+  take_reading(seg, &r[cur]);
+  memset(&r[1 - cur], 0, sizeof(reading));
+  r[1 - cur].when = r[cur].when - (time(NULL) - seg->started);
+  pause.tv_sec = (time_t)interval;
+  pause.tv_nsec = (long)((interval - pause.tv_sec) * 1e9);
+
+  for (;;)
+  {
+    if ((lines++ % DAEMONSTAT_HEADER_EVERY) == 0)
+    {
+      print_header();
+    }
+    print_line(seg, &r[cur], &r[1 - cur]);
+    if ((count > 0) && (lines >= count))
+    {
+      break;
+    }
+    nanosleep(&pause, NULL);
+    if (seg->magic != STATS_MAGIC)
+    {
+      fprintf(stderr, "daevel-stat: daemon pid %d has exited\n", (int)pid);
+      break;
+    }
+    cur = 1 - cur;
+    take_reading(seg, &r[cur]);
+  }
+  return 0;
+
+} /* main */
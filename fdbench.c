@@ -0,0 +1,202 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* fdbench.c
+
+   daevel-fdbench: times each way fds.c has of closing, or marking
+   close-on-exec, every descriptor from 3 up, which is what close_all()
+   does when the daemon starts, daemonises and stops.
+
+   usage: daevel-fdbench [-n nofile] [-o open] [-r reps]
+
+   The soft RLIMIT_NOFILE is raised to nofile (default the hard limit),
+   which is what makes the loop slow. Each rep is a fresh child with open
+   descriptors (default 16) spread over the whole range, so the last one
+   is near nofile. Prints the median and worst time of each method in
+   microseconds, one per line.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "fds.h"
+
+#define FDBENCH_MAX_REPS 1000
+
+static double now_us()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+} /* now_us */
+
+static int by_value(const void *a, const void *b)
+{
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+} /* by_value */
+
+/* In a child, opens nopen descriptors spread up to nofile and times
+   closing them all. Returns microseconds, or -1 if the method failed. */
+static double one_rep(int how, int cloexec, long nofile, int nopen,
+                      volatile double *result)
+{
+  pid_t pid;
+  int status;
+  int fd;
+  int i;
+
+  *result = -1;
+  pid = fork();
+  if (pid < 0)
+  {
+    fprintf(stderr, "daevel-fdbench: fork failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0)
+  {
+    double start;
+
+    fd = open("/dev/null", O_RDONLY);
+    for (i = 0; i < nopen; i++)
+    {
+      (void)dup2(fd, 3 + (int)((nofile - 4) * (i + 1) / nopen));
+    }
+    start = now_us();
+    if (((cloexec == 0) ? fds_close(3, how) : fds_cloexec(3, how)) >= 0)
+    {
+      *result = now_us() - start;
+    }
+    _exit(0);
+  }
+  (void)waitpid(pid, &status, 0);
+  return *result;
+} /* one_rep */
+
+static void usage()
+{
+  fprintf(stderr, "usage: daevel-fdbench [-n nofile] [-o open] [-r reps]\n");
+  fprintf(stderr, "       -n nofile  descriptor limit, default the hard"
+          " RLIMIT_NOFILE\n");
+  fprintf(stderr, "       -o open    descriptors open, default 16\n");
+  fprintf(stderr, "       -r reps    runs of each method, default 5\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  static double times[FDBENCH_MAX_REPS];
+  volatile double *result;
+  struct rlimit rl;
+  long nofile = 0;
+  int nopen = 16;
+  int reps = 5;
+  int cloexec;
+  int how;
+  int ok;
+  int ch;
+  int r;
+
+  while ((ch = getopt(argc, argv, "n:o:r:h")) != -1)
+  {
+    switch (ch)
+    {
+    case 'n':
+      nofile = atol(optarg);
+      break;
+    case 'o':
+      nopen = atoi(optarg);
+      break;
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((nofile < 0) || (nopen <= 0) || (reps <= 0) ||
+      (reps > FDBENCH_MAX_REPS))
+  {
+    usage();
+  }
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+  {
+    fprintf(stderr, "daevel-fdbench: getrlimit: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (nofile == 0)
+  {
+    nofile = (long)rl.rlim_max;
+  }
+  rl.rlim_cur = (rlim_t)nofile;
+  if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+  {
+    fprintf(stderr, "daevel-fdbench: can't set RLIMIT_NOFILE to %ld: %s\n",
+            nofile, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  if (nopen > nofile - 4)
+  {
+    nopen = (int)(nofile - 4);
+  }
+
+  result = mmap(NULL, sizeof(double), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (result == MAP_FAILED)
+  {
+    fprintf(stderr, "daevel-fdbench: mmap: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  printf("# nofile=%ld open=%d reps=%d\n", nofile, nopen, reps);
+  printf("# %-9s %-12s %12s %12s\n", "op", "method", "median_us", "max_us");
+  for (cloexec = 0; cloexec < 2; cloexec++)
+  {
+    for (how = FDS_CLOSE_RANGE; how < FDS_METHODS; how++)
+    {
+      ok = 1;
+      for (r = 0; r < reps; r++)
+      {
+        times[r] = one_rep(how, cloexec, nofile, nopen, result);
+        if (times[r] < 0)
+        {
+          ok = 0;
+          break;
+        }
+      }
+      if (ok == 0)
+      {
+        printf("%-11s %-12s %12s %12s\n", (cloexec == 0) ? "close" : "cloexec",
+               fds_method_name(how), "unsupported", "-");
+        continue;
+      }
+      qsort(times, reps, sizeof(double), by_value);
+      printf("%-11s %-12s %12.1f %12.1f\n", (cloexec == 0) ? "close" : "cloexec",
+             fds_method_name(how), times[reps / 2], times[reps - 1]);
+    }
+  }
+  return 0;
+
+} /* main */
@@ -0,0 +1,240 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* fds.c
+
+   Getting rid of inherited file descriptors. The old way, close() on
+   every number up to sysconf(_SC_OPEN_MAX), is one syscall per possible
+   descriptor: with RLIMIT_NOFILE at a million, a million syscalls and
+   seconds of startup and shutdown, nearly all of them EBADF.
+
+   So try close_range(), which does the lot in one syscall. Kernels
+   before 5.9 don't have it, so then read FDS_DIR and close only what is
+   really open. If /proc isn't mounted, eg in a chroot, fall back to the
+   loop.
+
+   The descriptor reading FDS_DIR is skipped, and goes with closedir().
+   Closing the others while reading is safe, because the kernel lists
+   them in numeric order from where the last read stopped.
+
+   Also here is the fdbudget option, the soft RLIMIT_NOFILE, which
+   children inherit, so that no process runs the system out of
+   descriptors for everyone else.
+
+*/
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "fds.h"
+
+#ifndef CLOSE_RANGE_CLOEXEC
+#define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+static const char *method_names[FDS_METHODS] =
+  {
+    "any", "close_range", "proc", "loop"
+  };
+
+const char* fds_method_name(int how)
+{
+  if ((how < 0) || (how >= FDS_METHODS))
+  {
+    return "unknown";
+  }
+  return method_names[how];
+} /* fds_method_name */
+
+/* What to do to each descriptor. Returns -1 with errno set on failure. */
+static int fd_close(int fd)
+{
+  /* EBADF is what we expect most of, EINTR still closes on Linux */
+  if ((close(fd) < 0) && (errno == EIO))
+  {
+    return -1;
+  }
+  return 0;
+} /* fd_close */
+
+static int fd_cloexec(int fd)
+{
+  int flags;
+
+  flags = fcntl(fd, F_GETFD);
+  if (flags < 0)
+  {
+    return (errno == EBADF) ? 0 : -1;
+  }
+  if (flags & FD_CLOEXEC)
+  {
+    return 0;
+  }
+  return fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+} /* fd_cloexec */
+
+static int by_close_range(int startfd, unsigned flags)
+{
+#ifdef SYS_close_range
+  return (int)syscall(SYS_close_range, (unsigned)startfd, ~0U, flags);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+} /* by_close_range */
+
+static int by_proc(int startfd, int (*each)(int))
+{
+  struct dirent *d;
+  DIR *dir;
+  int dirfd_no;
+  int res = 0;
+  int fd;
+
+  dir = opendir(FDS_DIR);
+  if (dir == NULL)
+  {
+    return -1;
+  }
+  dirfd_no = dirfd(dir);
+  while ((d = readdir(dir)) != NULL)
+  {
+    if (d->d_name[0] == '.')
+    {
+      continue;
+    }
+    fd = atoi(d->d_name);
+    if ((fd >= startfd) && (fd != dirfd_no) && (each(fd) < 0))
+    {
+      res = -1;
+    }
+  }
+  closedir(dir);
+  return res;
+} /* by_proc */
+
+static int by_loop(int startfd, int (*each)(int))
+{
+  long max;
+  int res = 0;
+  int i;
+
+  max = sysconf(_SC_OPEN_MAX);
+  if (max <= 0)
+  {
+    if (max == 0)
+    {
+      errno = EINVAL;
+    }
+    return -1;
+  }
+  for (i = startfd; i < max; i++)
+  {
+    if (each(i) < 0)
+    {
+      res = -1;
+    }
+  }
+  return res;
+} /* by_loop */
+
+static int fds_do(int startfd, int how, unsigned range_flags,
+                  int (*each)(int))
+{
+  if ((how == FDS_ANY) || (how == FDS_CLOSE_RANGE))
+  {
+    if (by_close_range(startfd, range_flags) == 0)
+    {
+      return FDS_CLOSE_RANGE;
+    }
+    /* ENOSYS from old kernels, EINVAL from ones without the flag */
+    if ((how == FDS_CLOSE_RANGE) || ((errno != ENOSYS) && (errno != EINVAL)))
+    {
+      return -1;
+    }
+  }
+  if ((how == FDS_ANY) || (how == FDS_PROC))
+  {
+    if (by_proc(startfd, each) == 0)
+    {
+      return FDS_PROC;
+    }
+    /* no /proc, or no descriptor left to read it with */
+    if (how == FDS_PROC)
+    {
+      return -1;
+    }
+  }
+  if ((how == FDS_ANY) || (how == FDS_LOOP))
+  {
+    if (by_loop(startfd, each) == 0)
+    {
+      return FDS_LOOP;
+    }
+    return -1;
+  }
+  errno = EINVAL;
+  return -1;
+} /* fds_do */
+
+/* Closes every descriptor >= startfd */
+int fds_close(int startfd, int how)
+{
+  return fds_do(startfd, how, 0, fd_close);
+} /* fds_close */
+
+/* Marks every descriptor >= startfd close-on-exec, for when a child is
+   about to exec() something but still needs its descriptors until then */
+int fds_cloexec(int startfd, int how)
+{
+  return fds_do(startfd, how, CLOSE_RANGE_CLOEXEC, fd_cloexec);
+} /* fds_cloexec */
+
+/* Sets the soft RLIMIT_NOFILE to n, or as near as the hard limit
+   allows. n == 0 puts back the limit from before the first call, so a
+   reload can take fdbudget away again. Returns the soft limit now in
+   force, or -1 with errno set */
+long fds_budget(unsigned n)
+{
+  static rlim_t original;
+  static int saved = 0;
+  struct rlimit rl;
+
+  if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+  {
+    return -1;
+  }
+  if (saved == 0)
+  {
+    original = rl.rlim_cur;
+    saved = 1;
+  }
+  if ((n > 0) || (rl.rlim_cur != original))
+  {
+    rl.rlim_cur = (n > 0) ? n : original;
+    if ((rl.rlim_max != RLIM_INFINITY) && (rl.rlim_cur > rl.rlim_max))
+    {
+      rl.rlim_cur = rl.rlim_max;
+    }
+    if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+    {
+      return -1;
+    }
+  }
+  return (rl.rlim_cur == RLIM_INFINITY) ? LONG_MAX : (long)rl.rlim_cur;
+} /* fds_budget */
@@ -0,0 +1,35 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* fds.h
+
+   Closing, or marking close-on-exec, every file descriptor from some
+   number up. No logging, so daevel-fdbench can use it too.
+
+*/
+
+/* ways of doing it, fastest first */
+#define FDS_ANY 0          /* the fastest that works here */
+#define FDS_CLOSE_RANGE 1  /* close_range(), one syscall, Linux >= 5.9 */
+#define FDS_PROC 2         /* only the descriptors listed in FDS_DIR */
+#define FDS_LOOP 3         /* every number up to sysconf(_SC_OPEN_MAX) */
+#define FDS_METHODS 4
+
+#define FDS_DIR "/proc/self/fd"
+
+/* Both return the way that worked, or -1 with errno set */
+int fds_close(int startfd, int how);
+int fds_cloexec(int startfd, int how);
+const char* fds_method_name(int how);
+
+#define FDS_BUDGET_MIN 16  /* the least fdbudget the daemon can run with */
+
+long fds_budget(unsigned n);
@@ -0,0 +1,330 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* flight.c
+
+   A flight recorder: each process keeps its last FLIGHT_EVENTS events
+   (accepts, forks, reaps, reads and writes, errors, signals) in a ring
+   in its own memory, so that when it dies there is a record of what
+   led up to it even though loglevel 9 was off. panic(), and
+   shutdown_signal() for the signals that mean something went wrong,
+   write the ring to GLOBAL_FLIGHT_NAME.<pid>; the admin command
+   "flight" shows the master's.
+
+   Recording an event is claiming a slot and five stores, with the time
+   from the CPU's cycle counter where there is one, so it is cheap
+   enough to leave on; "./microbench flight_record" says how cheap.
+   Signal handlers such as dead_child() record events too, and may
+   interrupt one being recorded, so the slot is claimed with a single
+   instruction that reads and increments the count. Each process is
+   single threaded, so on x86 that needn't lock the bus, which halves
+   the cost. Cycles are turned into times when the ring is written,
+   against the clock read by flight_init().
+
+   Writing the ring can happen in a signal handler, so it only uses
+   open(), write() and snprintf() of numbers, which in glibc doesn't
+   allocate.
+
+   A new child starts with an empty ring, so each file is one process's
+   story. The files outlive the processes that wrote them, so that they
+   can be looked at, but flight_init() removes all but the newest
+   FLIGHT_FILES_KEPT of them so that a daemon that keeps crashing
+   doesn't fill /tmp.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FLIGHT_CLOCK() __rdtsc()
+#define FLIGHT_XADD 1
+#else
+#define FLIGHT_CLOCK() flight_ns()
+#define FLIGHT_XADD 0
+#endif
+
+#include "global.h"
+#include "flight.h"
+#include "log.h"
+
+typedef struct
+{
+  unsigned long long when;  /* FLIGHT_CLOCK() */
+  long long a;
+  long long b;
+  int type;                 /* FL_xx */
+  int err;                  /* errno, or 0 */
+}
+flight_event;
+
+static flight_event ring[FLIGHT_EVENTS];
+static unsigned next = 0;          /* total recorded; & for the slot */
+static int recording = FALSE;
+static unsigned long long clock0;  /* FLIGHT_CLOCK() and ... */
+static unsigned long long ns0;     /* ... flight_ns() at flight_init() */
+
+static const char *type_names[FL_TYPES] =
+{
+  "?", "forked", "accept", "accept_error", "exhausted", "denied", "refused",
+  "fork", "reap", "kill", "read", "write", "admin", "reload", "signal",
+  "panic"
+};
+
+static unsigned long long flight_ns()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000000 + now.tv_nsec;
+} /* flight_ns */
+
+/* Removes the files left by processes that have gone, all but the
+   newest FLIGHT_FILES_KEPT */
+static void remove_old_dumps()
+{
+  const char *base = strrchr(GLOBAL_FLIGHT_NAME, '/') + 1;
+  char dirname[FILENAME_LEN];
+  char pattern[FILENAME_LEN];
+  char name[FILENAME_LEN];
+  int pids[FLIGHT_FILES_KEPT + 1];      /* newest first */
+  time_t times[FLIGHT_FILES_KEPT + 1];
+  int kept = 0;
+  int removed = 0;
+  struct dirent *d;
+  struct stat st;
+  DIR *dir;
+  char extra;
+  int pid;
+  int i;
+
+  snprintf(dirname, sizeof(dirname), "%.*s",
+           (int)(base - GLOBAL_FLIGHT_NAME), GLOBAL_FLIGHT_NAME);
+  snprintf(pattern, sizeof(pattern), "%s.%%d%%c", base);  /* nothing after */
+  dir = opendir(dirname);
+  if (dir == NULL)
+  {
+    return;
+  }
+  while ((d = readdir(dir)) != NULL)
+  {
+    if ((sscanf(d->d_name, pattern, &pid, &extra) != 1) || (pid <= 0))
+    {
+      continue;
+    }
+    if ((kill(pid, 0) == 0) || (errno != ESRCH))
+    {
+      continue;
+    }
+    snprintf(name, sizeof(name), "%s.%d", GLOBAL_FLIGHT_NAME, pid);
+    if (lstat(name, &st) != 0)
+    {
+      continue;
+    }
+    for (i = kept; (i > 0) && (times[i - 1] < st.st_mtime); i--)
+    {
+      pids[i] = pids[i - 1];
+      times[i] = times[i - 1];
+    }
+    pids[i] = pid;
+    times[i] = st.st_mtime;
+    if (kept < FLIGHT_FILES_KEPT)
+    {
+      kept++;
+      continue;
+    }
+    /* one too many now, so the oldest goes */
+    snprintf(name, sizeof(name), "%s.%d", GLOBAL_FLIGHT_NAME,
+             pids[FLIGHT_FILES_KEPT]);
+    if (unlink(name) == 0)
+    {
+      removed++;
+    }
+  }
+  closedir(dir);
+  if (removed > 0)
+  {
+    LOG(2, ("Removed %d old flight recorder files, kept the newest %d\n",
+            removed, kept));
+  }
+} /* remove_old_dumps */
+
+/* Called by the master once it is the daemon. Until then nothing is
+   recorded, and a PANIC writes no file */
+void flight_init()
+{
+  remove_old_dumps();
+  clock0 = FLIGHT_CLOCK();
+  ns0 = flight_ns();
+  next = 0;
+  recording = TRUE;
+} /* flight_init */
+
+/* Called in each new child */
+void flight_forked()
+{
+  next = 0;
+  flight_record(FL_FORKED, 0, getpid(), 0);
+} /* flight_forked */
+
+/* Returns next and increments it, safe against signal handlers */
+static unsigned claim()
+{
+#if FLIGHT_XADD
+  unsigned i = 1;
+
+  __asm__ volatile("xaddl %0, %1" : "+r" (i), "+m" (next));
+  return i;
+#else
+  return __sync_fetch_and_add(&next, 1);
+#endif
+} /* claim */
+
+void flight_record(int type, int err, long long a, long long b)
+{
+  flight_event *e = &ring[claim() & (FLIGHT_EVENTS - 1)];
+
+  e->when = FLIGHT_CLOCK();
+  e->a = a;
+  e->b = b;
+  e->type = type;
+  e->err = err;
+} /* flight_record */
+
+/* write() all of buf to fd, or give up; or if out isn't NULL, add it
+   to out instead */
+static void put(int fd, FILE *out, const char *buf, int len)
+{
+  ssize_t n;
+
+  if (out != NULL)
+  {
+    fwrite(buf, 1, len, out);
+    return;
+  }
+  while (len > 0)
+  {
+    n = write(fd, buf, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+} /* put */
+
+/* Writes the ring to fd (or out, see put()), oldest first, with times
+   in microseconds before now. Async-signal-safe when writing to fd, see
+   the top of the file */
+static void write_ring(int fd, FILE *out, const char *why)
+{
+  char line[160];
+  unsigned long long now_clock = FLIGHT_CLOCK();
+  unsigned long long now_ns = flight_ns();
+  unsigned long long ago;
+  double ns_per_tick;
+  unsigned total = next;
+  unsigned first;
+  unsigned i;
+  flight_event *e;
+  uint32_t addr;
+  int n;
+
+  ns_per_tick = (now_clock > clock0) ?
+                (double)(now_ns - ns0) / (now_clock - clock0) : 1.0;
+  first = (total > FLIGHT_EVENTS) ? total - FLIGHT_EVENTS : 0;
+
+  n = snprintf(line, sizeof(line), "flight recorder of pid %d, last %u "
+               "events of %u: ", (int)getpid(), total - first, total);
+  put(fd, out, line, n);
+  n = strlen(why);
+  put(fd, out, why, n);
+  if ((n == 0) || (why[n - 1] != '\n'))
+  {
+    put(fd, out, "\n", 1);
+  }
+  for (i = first; i < total; i++)
+  {
+    e = &ring[i & (FLIGHT_EVENTS - 1)];
+    ago = (now_clock > e->when) ?
+          (unsigned long long)((now_clock - e->when) * ns_per_tick) : 0;
+    n = snprintf(line, sizeof(line), "-%llu.%03lluus %s",
+                 ago / 1000, ago % 1000,
+                 ((e->type > 0) && (e->type < FL_TYPES)) ?
+                 type_names[e->type] : "?");
+    if ((e->type == FL_ACCEPT) || (e->type == FL_DENIED))
+    {
+      /* b is an s_addr, in network order, widened to a long long; as a
+         number it is the same on any machine once ntohl() has it */
+      addr = ntohl((uint32_t)e->b);
+      n += snprintf(line + n, sizeof(line) - n, " a=%lld b=%u.%u.%u.%u",
+                    e->a, (unsigned)(addr >> 24) & 0xff,
+                    (unsigned)(addr >> 16) & 0xff,
+                    (unsigned)(addr >> 8) & 0xff, (unsigned)addr & 0xff);
+    }
+    else
+    {
+      n += snprintf(line + n, sizeof(line) - n, " a=%lld b=%lld",
+                    e->a, e->b);
+    }
+    if (e->err != 0)
+    {
+      n += snprintf(line + n, sizeof(line) - n, " errno=%d", e->err);
+    }
+    line[n++] = '\n';
+    put(fd, out, line, n);
+  }
+} /* write_ring */
+
+/* Writes the ring to GLOBAL_FLIGHT_NAME.<pid>. Called by panic() and
+   shutdown_signal(), so async-signal-safe */
+void flight_dump(const char *why)
+{
+  char name[FILENAME_LEN];
+  int fd;
+
+  if (recording != TRUE)
+  {
+    return;
+  }
+  snprintf(name, sizeof(name), "%s.%d", GLOBAL_FLIGHT_NAME, (int)getpid());
+  /* a predictable name in /tmp, so never through a link someone else
+     has put there */
+  (void)unlink(name);
+  fd = open(name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+  if (fd < 0)
+  {
+    return;
+  }
+  write_ring(fd, NULL, why);
+  close(fd);
+} /* flight_dump */
+
+/* The admin command "flight" */
+void flight_write(FILE *out, const char *args)
+{
+  write_ring(-1, out, "snapshot");
+} /* flight_write */
@@ -0,0 +1,43 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* flight.h
+
+*/
+
+#include <stdio.h>
+
+#define FLIGHT_EVENTS 4096  /* kept per process, a power of 2 */
+#define FLIGHT_FILES_KEPT 16 /* of dead processes, at startup */
+
+/* event types, and what a and b are for each */
+#define FL_FORKED 1       /* a new child: a pid */
+#define FL_ACCEPT 2       /* a fd, b client IPv4 address */
+#define FL_ACCEPT_ERROR 3 /* accept() failed, squashed or not: err */
+#define FL_EXHAUSTED 4    /* accept() out of descriptors: err */
+#define FL_DENIED 5       /* by the ACL: b client IPv4 address */
+#define FL_REFUSED 6      /* maxchild reached: a children */
+#define FL_FORK 7         /* a child pid or -1, b its CPU; err if failed */
+#define FL_REAP 8         /* a pid, b wait status */
+#define FL_KILL 9         /* by the watchdog: a pid, b signal */
+#define FL_READ 10        /* a fd, b bytes */
+#define FL_WRITE 11       /* a fd, b bytes */
+#define FL_ADMIN 12       /* an admin request */
+#define FL_RELOAD 13      /* a TRUE if it worked */
+#define FL_SIGNAL 14      /* a signal */
+#define FL_PANIC 15
+#define FL_TYPES 16
+
+void flight_init();
+void flight_forked();
+void flight_record(int type, int err, long long a, long long b);
+void flight_dump(const char *why);
+void flight_write(FILE *out, const char *args);
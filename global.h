@@ -30,10 +30,81 @@ Keep this small as poss.
 #define MIN_LOGLEVEL 1
 #define MAX_LOGLEVEL 9
 
+/* Logging subsystems, each with its own runtime log level. A .c file
+   says which one it belongs to by defining LOG_SUBSYS before including
+   log.h; the default is LOGSUB_DAEMON. */
+#define LOGSUB_DAEMON 0
+#define LOGSUB_SOCKET 1
+#define LOGSUB_CONFDATA 2
+#define LOGSUB_LOCKFILE 3
+#define LOGSUB_CHILD 4
+#define LOG_SUBSYSTEMS 5
+
+/* Classes of message that can come in floods, eg one per connection.
+   Each class is rate limited and sampled separately, see LOG_LIMITED in
+   log.h. */
+#define LOGCLASS_CONNECT 0 /* a connection was accepted */
+#define LOGCLASS_REFUSE 1  /* a connection was turned away */
+#define LOGCLASS_REAP 2    /* a child died */
+#define LOGCLASS_ACCEPT 3  /* accept() errors squashed by filtered_accept,
+                              and UDP workers' socket errors */
+#define LOG_CLASSES 4
+
+/* the running daemon's subsystem log levels, shared so that -L can
+   change them. UNFEATURE - same problems as GLOBAL_LOCKFILE_NAME */
+#define GLOBAL_LEVELS_NAME "/tmp/daevel.levels"
+
+/* values for logsync: when log batches are fdatasync()ed */
+#define LOGSYNC_NONE 0   /* never; the OS writes them back when it likes */
+#define LOGSYNC_GROUP 1  /* after every batch (group commit) */
+#define LOGSYNC_PANIC 2  /* only for the last message before a PANIC */
+
+/* values for logformat */
+#define LOGFORMAT_TEXT 0
+#define LOGFORMAT_BINARY 1  /* see logbin.h; read it with daevel-logcat */
+
+/* values for logoverflow: what log_msg does when the log ring is full */
+#define LOGOVERFLOW_DROP 0   /* lose the message, and count it */
+#define LOGOVERFLOW_BLOCK 1  /* wait while the ring is written out */
+
+/* values for acldefault: what happens to a client no ACL rule matches */
+#define ACL_ALLOW 0
+#define ACL_DENY 1
+
+/* values for placement: which CPU each child runs on, see placement.c */
+#define PLACEMENT_NONE 0         /* wherever the scheduler likes */
+#define PLACEMENT_ROUNDROBIN 1
+#define PLACEMENT_LEASTLOADED 2
+#define PLACEMENT_INCOMING 3     /* where its packets arrived */
+#define CPULIST_LEN 256
+
+/* values for protocol */
+#define PROTOCOL_TCP 0   /* a child forked for each connection */
+#define PROTOCOL_UDP 1   /* long-lived workers answering datagrams, udp.c */
+
+#define UNIX_PATH_LEN 108  /* sun_path in struct sockaddr_un on Linux */
+#define GROUPNAME_LEN 64
+
+/* the most busypoll and busyspin can be, microseconds */
+#define BUSY_MAX_US 1000000
+
 #define GLOBAL_LOCKFILE_NAME "/tmp/daevel.pid"
 /* UNFEATURE - make it configurable, and */
 /* also portable to funny OSs */
 
+/* the running daemon's admin socket, see admin.c. UNFEATURE - same
+   problems as GLOBAL_LOCKFILE_NAME */
+#define GLOBAL_ADMIN_NAME "/tmp/daevel.admin"
+#define ADMIN_LINE_LEN 256   /* longest admin command line */
+
+/* flight recorder dumps, see flight.c, with ".<pid>" added. UNFEATURE -
+   same problems as GLOBAL_LOCKFILE_NAME */
+#define GLOBAL_FLIGHT_NAME "/tmp/daevel.flight"
+
+/* the running daemon's statistics segment, see stats.h. %d is its pid.
+   UNFEATURE - same problems as GLOBAL_LOCKFILE_NAME */
+#define GLOBAL_STATS_NAME "/tmp/daevel.stats.%d"
+
 extern int logfile;         /* file descriptors */
 
 /* This holds values for all commandline and config file options, or
@@ -51,16 +122,49 @@ typedef struct
   unsigned dumpcore; /* PANIC routine dumps core rather than exit() */
   unsigned terminate; /* kill running copy of myself, using lockfile pid */
   unsigned checkcfg; /* run all configuration logic, then exit */
+  unsigned logsync; /* LOGSYNC_xx, durability of log batches */
+  unsigned logbatch; /* write log ring out when this many records wait */
+  unsigned logflushms; /* ... or when the oldest has waited this long */
+  unsigned logoverflow; /* LOGOVERFLOW_xx, policy when log ring is full */
+  unsigned logformat; /* LOGFORMAT_xx */
+  unsigned sublevel[LOG_SUBSYSTEMS]; /* per LOGSUB_xx, 0 to follow loglevel */
+  unsigned setlevels; /* give running copy of myself the -L sublevels */
+  char admincommand[ADMIN_LINE_LEN]; /* -a, send to running copy of myself */
+  unsigned lograte[LOG_CLASSES]; /* per LOGCLASS_xx, lines/second, 0 for all */
+  unsigned logsample[LOG_CLASSES]; /* per LOGCLASS_xx, log 1 line in n */
+  unsigned logsummary; /* seconds between "suppressed" summary lines */
+  unsigned rusageprefix; /* bits of client address to account CPU by */
+  unsigned rusagesummary; /* seconds between rusage summaries, 0 for none */
+  char aclfile[FILENAME_LEN]; /* allow/deny rules, see acl.c; "" for none */
+  unsigned acldefault; /* ACL_xx, for clients no rule matches */
+  unsigned fdbudget; /* soft RLIMIT_NOFILE, 0 to leave it alone */
+  unsigned childdeadline; /* seconds a child may run, 0 for no limit */
+  unsigned childcpu; /* CPU seconds a child may use, 0 for no limit */
+  unsigned childgrace; /* seconds from SIGTERM to SIGKILL for those */
+  unsigned placement; /* PLACEMENT_xx */
+  char cpulist[CPULIST_LEN]; /* eg "0-3,8", CPUs for placement; "" for all */
+  unsigned profilehz; /* samples a second of CPU, see profile.c */
+  unsigned profilesamples; /* most samples one profile can hold */
+  char profilefile[FILENAME_LEN]; /* where folded stacks are written */
+  unsigned protocol; /* PROTOCOL_xx */
+  unsigned udpworkers; /* processes answering datagrams */
+  unsigned udpreuseport; /* a socket each, rather than one shared */
+  unsigned udpgso; /* segment size for large replies, 0 for no GSO */
+  unsigned udpgro; /* have the kernel coalesce arriving datagrams */
+  unsigned udpsteer; /* each datagram to the worker on the CPU it came in on */
+  char unixpath[UNIX_PATH_LEN]; /* AF_UNIX listener, "@name" abstract; "" none */
+  unsigned unixonly; /* no TCP listener, only unixpath */
+  unsigned unixmode; /* permissions of unixpath */
+  char unixgroup[GROUPNAME_LEN]; /* group of unixpath, "" to leave it */
+  unsigned busypoll; /* SO_BUSY_POLL microseconds, 0 for none */
+  unsigned busyspin; /* microseconds to spin before sleeping, 0 for none */
+  char busycpus[CPULIST_LEN]; /* CPUs for the spinning processes; "" none */
 }
 options;
 options* global_options;
 
 extern unsigned lock_acquired;
 
-/* used in both util.c and confdata.c (and modified in confdata.c) */
+/* used in admin.c */
 #define WHITESPACE " \n\r\t"
 
-#define INT_BASE10 "1234567890+-"
-
-#define CONFIG_FILE_LINELEN 255
-
@@ -34,6 +34,7 @@
 
 #include "global.h"
 #include "lockfile.h"
+#define LOG_SUBSYS LOGSUB_LOCKFILE
 #include "log.h"
 
 void get_lock_or_die()
@@ -14,6 +14,54 @@
    Module to provide both a bare-bones logging (PANIC macro) and a more
    sophisticated facility (LOG macro).
 
+   log_msg() does not write to the logfile itself. Each line is formatted
+   into the next record of an in-memory ring and the ring is written out
+   in batches with one writev(), a "group commit". A batch goes out when
+   logbatch records are waiting, when the main loop calls log_tick() and
+   logflushms milliseconds have passed since the last batch, or whenever
+   log_flush() is called. The logsync option says whether a batch is
+   followed by fdatasync(): never, after every batch, or only for the
+   final message written by panic().
+
+   The ring lives in a MAP_SHARED region set up in log_start(), before
+   any fork(), so every child appends to the same ring as the master.
+   Records are claimed with compare-and-swap and published by setting
+   their sequence number last, so neither another process nor a signal
+   handler (eg dead_child) can tear a record, and appending costs no
+   system calls. Only the master (the "drainer") writes the ring to the
+   logfile; children leave their records for it.
+
+   If a child dies between claiming a record and publishing it, the
+   drainer notices the record is stuck, checks that its owner no longer
+   exists and writes a note in its place, so records published after it
+   are not held up. Records a child did publish are never lost with the
+   child, because they are already in shared memory.
+
+   With logformat=binary, records are logbin.h records instead of text:
+   the id of the format string, a coarse timestamp and the raw arguments,
+   so there is no printf and no localtime() on the hot path. The first
+   time a process logs with a format string it also queues a FORMAT
+   record carrying the text, for daevel-logcat to decode with later, and
+   tries again next time if the ring was too full to take it.
+
+   LOG compares each line against the runtime level of its subsystem in
+   log_levels[]. Until the daemon holds its lock that array is private;
+   then log_share_levels() moves it into GLOBAL_LEVELS_NAME, mapped
+   MAP_SHARED, so a second copy run with -L can change the levels of the
+   master and every child without restarting anything.
+
+   LOG_LIMITED lines also pass through log_admit(), which keeps a token
+   bucket and a 1-in-N sampling counter for each LOGCLASS_xx, private to
+   the process. What it turns away is counted and reported every
+   logsummary seconds by log_tick(), so a flood shows up in the log as a
+   few lines plus a count instead of filling the disk. dead_child() logs
+   reaps through it from the SIGCHLD handler, so SIGCHLD is blocked
+   while the counters change.
+
+   Each process that logs owns a producer slot holding its dropped-record
+   counter. Drops are reported by the drainer, and a child's slot is
+   released when dead_child() reaps it.
+
 */
 
 #include <stdio.h>
@@ -25,47 +73,172 @@
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
+#include <sys/uio.h> /* writev */
+#include <signal.h>  /* kill */
+#include <sys/mman.h>
 #include "global.h"
 #include "util.h"
 #include "log.h"
+#include "probes.h"
+#include "logbin.h"
+#include "flight.h"
+#include "metrics.h"
 
 char GLOBAL_LINE[255] = "";  /* For PANIC macro. ANSI C macros do not allow */
 char GLOBAL_FILE[255] = "";  /* variable arguments (...), unlike gcc. */
+unsigned GLOBAL_LEVEL = 0;  /* For LOG macro. Level of the line being logged */
 
 int logfile = -1;         /* file descriptor */
 
 static int logfile_istty = FALSE;
 /* set in log_start, avoids ioctl failure and errno reset in log_msg */
 
+typedef struct
+{
+  volatile unsigned seq;  /* n+1 once record n is complete */
+  volatile pid_t owner;   /* process that claimed it */
+  unsigned len;
+  char text[LOG_RECORD_LEN];
+}
+log_record;
+
+typedef struct
+{
+  volatile pid_t pid;  /* 0 for a free slot */
+  volatile unsigned dropped; /* records lost to overflow */
+}
+log_producer;
+
+typedef struct
+{
+  volatile unsigned head; /* next record to be written */
+  char pad1[60];          /* keep producers' tail off the drainer's line */
+  volatile unsigned tail; /* next record to be claimed */
+  char pad2[60];
+  volatile int flushing;
+  log_producer producer[LOG_PRODUCERS];
+  log_record rec[LOG_RING_RECORDS];
+}
+log_ring;
+
+static log_ring *ring = NULL;  /* shared with every child */
+static int log_drainer = FALSE;  /* we write the ring to the logfile */
+static log_producer *producer = NULL;  /* our slot in ring->producer */
+static unsigned stuck_head = 0;  /* record the drainer is waiting for */
+static struct timespec stuck_since;
+static struct timespec last_flush;
+
+/* "YYYY-mm-dd HH:MM:SS pid=n (ppid) " is rebuilt once a second, not
+   once a line */
+static char prefix[LOG_RECORD_LEN / 4];
+static unsigned prefix_len = 0;
+static time_t prefix_time = -1;
+static pid_t log_pid = -1;
+static pid_t log_ppid = -1;
+
+#ifdef CLOCK_REALTIME_COARSE
+#define LOG_CLOCK CLOCK_REALTIME_COARSE  /* no better than a tick, but cheap */
+#else
+#define LOG_CLOCK CLOCK_REALTIME
+#endif
+
+/* A format string this process has met, and the kinds of its arguments */
+typedef struct
+{
+  const char * volatile fmt;  /* NULL for a free entry */
+  uint32_t id;
+  int nargs;  /* -1 if it can't be encoded, see logbin.h */
+  unsigned char kinds[LOGBIN_MAX_ARGS];
+}
+log_fmt;
+
+#define FMT_BUSY ((const char *)1)  /* entry being filled in */
+
+static log_fmt fmt_cache[LOG_FMT_CACHE];
+
+static int log_direct(int sync, unsigned level, const char *f, ...);
+static void log_summarise();
+static long ms_since(struct timespec *then);
+
+static unsigned private_levels[LOG_SUBSYSTEMS];
+volatile unsigned *log_levels = private_levels;
+static int levels_shared = FALSE;
+
+static const char *subsys_names[LOG_SUBSYSTEMS] =
+{
+  "daemon", "socket", "confdata", "lockfile", "child"
+};
+
+/* rate limiting state for one LOGCLASS_xx */
+typedef struct
+{
+  unsigned long tokens; /* thousandths of a line */
+  struct timespec refilled; /* tv_sec 0 until first used */
+  unsigned long seen; /* lines offered, for sampling */
+  unsigned long suppressed; /* since the last summary */
+}
+log_limit;
+
+static log_limit limits[LOG_CLASSES];
+static struct timespec last_summary;
+
+static const char *class_names[LOG_CLASSES] =
+{
+  "connect", "refuse", "reap", "accept"
+};
+
+/* Formats the text panic() logs into out. Returns FALSE if panic() was
+   called directly rather than by PANIC, so there is no file and line. */
+int panic_vformat(char *out, size_t len, const char* f, va_list ap)
+{
+  char msg[255];
+
+  memset(msg, 0, sizeof(msg));
+  vsnprintf(msg, sizeof(msg), f, ap);
+  if ( (strlen(GLOBAL_FILE) > 0) && (strlen(GLOBAL_LINE) > 0) )
+  {
+    snprintf(out, len,
+             "PANIC in line %s of %s: %s", GLOBAL_LINE, GLOBAL_FILE, msg);
+    return TRUE;
+  }
+  snprintf(out, len,
+           "Programmer error: call PANIC not panic() when trying to log %s", msg);
+  return FALSE;
+} /* panic_vformat */
+
 /* panic */
 void panic(const char* f, ...)
 {
   va_list ap;
-  char msg[255];
   char msg2[255];
+  int ok;
 
-  memset(msg, 0, sizeof(msg));
   memset(msg2, 0, sizeof(msg2));
 
   va_start(ap, f);
-  vsnprintf(msg, sizeof(msg), f, ap);
+  ok = panic_vformat(msg2, sizeof(msg2), f, ap);
   va_end(ap);
-  if ( (strlen(GLOBAL_FILE) > 0) && (strlen(GLOBAL_LINE) > 0) )
+  if (ok == FALSE)
   {
-    snprintf(msg2, sizeof(msg2),
-             "PANIC in line %s of %s: %s", GLOBAL_LINE, GLOBAL_FILE, msg);
-  }
-  else
-  {
-    snprintf(msg2, sizeof(msg2),
-             "Programmer error: call PANIC not panic() when trying to log %s", msg);
     abort();
   }
 
+  PROBE_PANIC(msg2);
+  flight_record(FL_PANIC, errno, 0, 0);
+  flight_dump(msg2);
+
   /* can't call log_msg before or during log_start */
-  if (logfile > -1)
+  GLOBAL_LEVEL = 0;
+  if ((logfile > -1) && (log_drainer == TRUE))
   {
-    log_msg(msg2);
+    log_msg("%s", msg2);
+    /* synchronous, whatever the batching options say */
+    log_flush((global_options->logsync == LOGSYNC_NONE) ? FALSE : TRUE);
+  }
+  else if (logfile > -1)
+  {
+    /* a child can't drain the ring, and the master may never get to it */
+    log_direct(TRUE, 0, "%s", msg2);
   }
   else
   {
@@ -76,6 +249,8 @@ void panic(const char* f, ...)
     }
   }
 
+  metrics_abandon();  /* no metrics_finish() on this way out */
+
   if (global_options->dumpcore == TRUE)
   {
     abort();
@@ -87,15 +262,30 @@ void panic(const char* f, ...)
 
 } /* panic */
 
+/* registered with atexit(), so exit() from anywhere doesn't lose records
+   still in the ring. Children _exit(), and flush for themselves. */
+static void log_atexit()
+{
+  log_flush(FALSE);
+} /* log_atexit */
+
 /* log_start: close all, then open 0, 1 and 2 */
 void log_start()
 {
 
-  /* global var, avoids annoying error with -F foreground (and strace -f) */
-  if (isatty(logfile) == 1)
+  ring = shared_alloc(sizeof(log_ring));
+  if (ring == NULL)
   {
-    logfile_istty = TRUE;
+    PANIC(("Cannot map shared log ring, error %d, %s\n",
+           errno, strerror(errno)));
   }
+  if (atexit(log_atexit) != 0)
+  {
+    PANIC(("atexit() failed registering log flush\n"));
+  }
+  log_forked(TRUE);
+  log_apply_levels();
+  clock_gettime(CLOCK_MONOTONIC, &last_flush);
 
   if (global_options->foregroundonly == FALSE)
   {
@@ -128,6 +318,12 @@ void log_start()
            global_options->logfilename, errno, strerror(errno)));
   }
 
+  /* global var, avoids annoying error with -F foreground (and strace -f) */
+  if (isatty(logfile) == 1)
+  {
+    logfile_istty = TRUE;
+  }
+
   if (!dup(1))
   {
     PANIC(("dup() failed with rare error %d, %s\n", errno, strerror(errno)));
@@ -139,13 +335,8 @@ void log_start()
 void log_finish()
 {
 
-  if (logfile_istty == TRUE)
-  {
-    if (fsync(logfile))
-    {
-      PANIC(("Cannot sync() logfile in log_finish\n"));
-    }
-  }
+  log_summarise();
+  log_flush(FALSE);
   if (close(logfile))
   {
     PANIC(("Cannot close() logfile in log_finish\n"));
@@ -153,89 +344,953 @@ void log_finish()
   logfile = -1;
 } /* log_finish */
 
+/* Returns the LOGSUB_xx for name, or -1 */
+int log_subsys(const char *name)
+{
+  int i;
 
-/* log_msg. writes to logfile (which may be a file, or /dev/console for debug)
-   Errors are handled where possible, but you can't exactly write a log entry.
-*/
-void log_msg(const char* f, ...)
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+  {
+    if (strcasecmp(name, subsys_names[i]) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+} /* log_subsys */
+
+const char* log_subsys_name(int subsys)
+{
+  if ((subsys < 0) || (subsys >= LOG_SUBSYSTEMS))
+  {
+    return "invalid";
+  }
+  return subsys_names[subsys];
+} /* log_subsys_name */
+
+/* Sets the runtime level of each subsystem from the options: its own
+   level if one was given, otherwise loglevel */
+void log_apply_levels()
+{
+  int i;
+
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+  {
+    if (global_options->sublevel[i] != 0)
+    {
+      log_levels[i] = global_options->sublevel[i];
+    }
+    else
+    {
+      log_levels[i] = global_options->loglevel;
+    }
+  }
+} /* log_apply_levels */
+
+/* Maps the levels file, creating it if create==TRUE. Returns NULL on
+   failure. Can't LOG, because -L uses it before logging is set up.
+   The name is predictable, so it is made afresh rather than opened
+   whatever is there, and never through a symlink someone has planted. */
+volatile unsigned* log_map_levels(int create)
+{
+  void *p;
+  int fd;
+  size_t len = sizeof(unsigned) * LOG_SUBSYSTEMS;
+
+  if (create == TRUE)
+  {
+    (void)unlink(GLOBAL_LEVELS_NAME);
+    fd = open(GLOBAL_LEVELS_NAME, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW,
+              0600);
+  }
+  else
+  {
+    fd = open(GLOBAL_LEVELS_NAME, O_RDWR | O_NOFOLLOW);
+  }
+  if (fd < 0)
+  {
+    return NULL;
+  }
+  if ((create == TRUE) && (ftruncate(fd, len) < 0))
+  {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  return (p == MAP_FAILED) ? NULL : (volatile unsigned *)p;
+} /* log_map_levels */
+
+/* Called by the master once it holds the lock, before any connection
+   children exist. Not fatal if it fails; levels just can't change. */
+void log_share_levels()
+{
+  volatile unsigned *shared;
+  int i;
+
+  shared = log_map_levels(TRUE);
+  if (shared == NULL)
+  {
+    LOG(1, ("Can't share log levels through %s, error %d, %s. "
+            "-L won't work\n", GLOBAL_LEVELS_NAME, errno, strerror(errno)));
+    return;
+  }
+  for (i = 0; i < LOG_SUBSYSTEMS; i++)
+  {
+    shared[i] = log_levels[i];
+  }
+  log_levels = shared;
+  levels_shared = TRUE;
+  LOG(9, ("Sharing log levels through %s\n", GLOBAL_LEVELS_NAME));
+} /* log_share_levels */
+
+/* Called by the master on shutdown */
+void log_unshare_levels()
+{
+  if (levels_shared == TRUE)
+  {
+    if (unlink(GLOBAL_LEVELS_NAME) != 0)
+    {
+      LOG(1, ("Couldn't remove %s, error %d, %s\n", GLOBAL_LEVELS_NAME,
+              errno, strerror(errno)));
+    }
+    levels_shared = FALSE;
+  }
+} /* log_unshare_levels */
+
+const char* log_class_name(int class)
+{
+  if ((class < 0) || (class >= LOG_CLASSES))
+  {
+    return "invalid";
+  }
+  return class_names[class];
+} /* log_class_name */
+
+/* Blocks SIGCHLD, whose handler also uses limits[], saving the mask in
+   old. The caller may have it blocked already, or be the handler, so
+   limits_unblock() puts back old rather than unblocking */
+static void limits_block(sigset_t *old)
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &set, old);
+} /* limits_block */
+
+static void limits_unblock(const sigset_t *old)
+{
+  sigprocmask(SIG_SETMASK, old, NULL);
+} /* limits_unblock */
+
+/* Returns TRUE if a line of this class may be logged now: it is the
+   1-in-logsample line and the bucket, refilled at lograte lines a second
+   up to a second's worth, holds a whole line. */
+int log_admit(int class)
+{
+  log_limit *l = &limits[class];
+  unsigned rate = global_options->lograte[class];
+  unsigned sample = global_options->logsample[class];
+  unsigned long full = 1000UL * rate;
+  struct timespec now;
+  sigset_t old;
+  int admit = TRUE;
+  long ms;
+
+  if ((sample <= 1) && (rate == 0))
+  {
+    return TRUE;  /* not limited, and nothing to count */
+  }
+  limits_block(&old);
+  if ((sample > 1) && ((l->seen++ % sample) != 0))
+  {
+    admit = FALSE;
+  }
+  else if (rate > 0)
+  {
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    if (l->refilled.tv_sec == 0)
+    {
+      l->tokens = full;
+    }
+    else
+    {
+      ms = (now.tv_sec - l->refilled.tv_sec) * 1000 +
+           (now.tv_nsec - l->refilled.tv_nsec) / 1000000;
+      if (ms > 1000)
+      {
+        ms = 1000;
+      }
+      if (ms > 0)
+      {
+        l->tokens += ms * rate;
+      }
+    }
+    if (l->tokens > full)
+    {
+      l->tokens = full;
+    }
+    l->refilled = now;
+
+    if (l->tokens < 1000)
+    {
+      admit = FALSE;
+    }
+    else
+    {
+      l->tokens -= 1000;
+    }
+  }
+  if (admit == FALSE)
+  {
+    l->suppressed++;
+  }
+  limits_unblock(&old);
+  return admit;
+} /* log_admit */
+
+/* Logs how many lines of each class log_admit() turned away since the
+   last summary */
+static void log_summarise()
+{
+  long secs = (ms_since(&last_summary) + 500) / 1000;
+  unsigned long suppressed[LOG_CLASSES];
+  sigset_t old;
+  int i;
+
+  limits_block(&old);
+  for (i = 0; i < LOG_CLASSES; i++)
+  {
+    suppressed[i] = limits[i].suppressed;
+    limits[i].suppressed = 0;
+  }
+  limits_unblock(&old);
+  for (i = 0; i < LOG_CLASSES; i++)
+  {
+    if (suppressed[i] > 0)
+    {
+      LOG(1, ("suppressed %lu similar '%s' messages in the last %lds\n",
+              suppressed[i], class_names[i], secs));
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &last_summary);
+} /* log_summarise */
+
+/* Finds a free producer slot for this process. Falls back to slot 0,
+   shared by everyone, if they are all taken. */
+static void producer_claim()
+{
+  unsigned i;
+
+  for (i = 1; i < LOG_PRODUCERS; i++)
+  {
+    if (__sync_bool_compare_and_swap(&ring->producer[i].pid, 0, log_pid))
+    {
+      producer = &ring->producer[i];
+      producer->dropped = 0;
+      return;
+    }
+  }
+  producer = &ring->producer[0];
+} /* producer_claim */
+
+/* Who we are, for the line prefix and the owner of records we claim */
+static void log_whoami()
+{
+  log_pid = getpid();
+  log_ppid = getppid();
+  prefix_time = -1;
+} /* log_whoami */
+
+/* Called in log_start, and in the child after every fork(). master is TRUE
+   for the process that writes the ring to the logfile, and FALSE for
+   connection children. */
+void log_forked(int master)
+{
+  log_whoami();
+  log_drainer = master;
+  producer_claim();
+  memset(limits, 0, sizeof(limits));
+  clock_gettime(CLOCK_MONOTONIC, &last_summary);
+} /* log_forked */
+
+/* Called by become_daemon() in the daemon. It carries on for the process
+   that called log_start(), which exits at once, so it takes over that
+   process's producer slot rather than claiming another */
+void log_daemonised()
+{
+  log_whoami();
+  producer->pid = log_pid;
+} /* log_daemonised */
+
+/* Called by dead_child() with each reaped pid. Reports anything the child
+   dropped and frees its producer slot. */
+void log_reaped(pid_t pid)
+{
+  unsigned i;
+  unsigned dropped;
+
+  if (ring == NULL)
+  {
+    return;
+  }
+  for (i = 1; i < LOG_PRODUCERS; i++)
+  {
+    if (ring->producer[i].pid == pid)
+    {
+      dropped = __sync_lock_test_and_set(&ring->producer[i].dropped, 0);
+      ring->producer[i].pid = 0;
+      if (dropped > 0)
+      {
+        LOG(1, ("log ring full, child pid %d dropped %u records\n",
+                pid, dropped));
+      }
+      return;
+    }
+  }
+} /* log_reaped */
+
+/* Refreshes the cached line prefix if the second has changed */
+static void log_prefix(time_t now)
 {
-  va_list ap;
-  char str[400];
-  char str2[400];
-  unsigned res = 0;
-  unsigned str2_count = 0;
-  time_t now = time(NULL);
   struct tm *tm;
-  pid_t mypid = getpid();
-  pid_t parentpid = getppid();
-  int ignore;
+  unsigned res = 0;
 
-  memset(str, 0, sizeof(str));
-  memset(str2, 0, sizeof(str2));
+  if (now == prefix_time)
+  {
+    return;
+  }
 
   /* timestamp, not including "\n" from strftime */
 #define TIMESTAMPL 26 /* width of time string output */
 
   if (now == -1)
   {
-    snprintf(str2, TIMESTAMPL, "Invalid time() result!   ");
+    snprintf(prefix, TIMESTAMPL, "Invalid time() result!   ");
   }
   else
   {
     tm = localtime(&now);  /* no error values, and always > NULL */
     /* year according to ISO8601 */
-    res = strftime(str2, TIMESTAMPL, "%G-%m-%d %H:%M:%S ", tm);
+    res = strftime(prefix, TIMESTAMPL, "%G-%m-%d %H:%M:%S ", tm);
     /* The Linux strftime man page of 29 Mar [19]99 claims zero returned if
        zero bytes written to string, but zero is returned on successful
        write! Assuming for now that <0 means error. Need to verify */
     if (res < 0)
     {
-      snprintf(str2, TIMESTAMPL, "Invalid strftime() res!  ");
+      snprintf(prefix, TIMESTAMPL, "Invalid strftime() res!  ");
     }
   }
 
-  /* pid display field 5 chars for 16-bit, 11 for 32-bit pids, add one for spacing */
-#define MAX_PID_LEN sizeof(pid_t)/2*3
-
-  str2_count = strlen(str2);
-  strncpy(str, "pid=%i \x0", 6 + MAX_PID_LEN);
-  if (mypid >= 0)
+  prefix_len = strlen(prefix);
+  if (log_pid >= 0)
   {
-    snprintf(&str2[str2_count], strlen(str) + MAX_PID_LEN - 2, str, mypid);
+    snprintf(&prefix[prefix_len], sizeof(prefix) - prefix_len, "pid=%i ", log_pid);
   }
   else
   {
-    snprintf(&str2[str2_count], strlen(str) + MAX_PID_LEN - 2, "bad getpid ");
+    snprintf(&prefix[prefix_len], sizeof(prefix) - prefix_len, "bad getpid ");
   }
 
-  str2_count = strlen(str2);
-  strncpy(str, "(%i) \0x0", 3 + MAX_PID_LEN);
-  if (parentpid >= 0)
+  prefix_len = strlen(prefix);
+  if (log_ppid >= 0)
   {
-    snprintf(&str2[str2_count], strlen(str) + MAX_PID_LEN - 2, str, parentpid);
+    snprintf(&prefix[prefix_len], sizeof(prefix) - prefix_len, "(%i) ", log_ppid);
   }
   else
   {
-    snprintf(&str2[str2_count], strlen(str) + MAX_PID_LEN - 2, "bad ppid");
+    snprintf(&prefix[prefix_len], sizeof(prefix) - prefix_len, "bad ppid");
   }
 
-  str2_count = strlen(str2);
-  va_start(ap, f);
-  vsnprintf(&str2[str2_count], (sizeof(str2) - str2_count), f, ap);
+  prefix_len = strlen(prefix);
+  prefix_time = now;
+} /* log_prefix */
 
+/* Returns the next free record in the ring, or NULL if it is full. The
+   owner is set just after the claim, so until then a claimed record has
+   owner 0, see ring_release() */
+static log_record* ring_claim(unsigned *n)
+{
+  unsigned tail;
+
+  for (;;)
+  {
+    tail = ring->tail;
+    if (tail - ring->head >= LOG_RING_RECORDS)
+    {
+      return NULL;
+    }
+    if (__sync_bool_compare_and_swap(&ring->tail, tail, tail + 1))
+    {
+      *n = tail;
+      ring->rec[tail % LOG_RING_RECORDS].owner = log_pid;
+      return &ring->rec[tail % LOG_RING_RECORDS];
+    }
+  }
+} /* ring_claim */
+
+/* The drainer is done with count records from head. Clears their owner
+   before moving ring->head past them, so whoever claims one next is
+   never taken for the last owner */
+static void ring_release(unsigned head, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+  {
+    ring->rec[(head + i) % LOG_RING_RECORDS].owner = 0;
+  }
+  __sync_synchronize();
+} /* ring_release */
+
+/* writev() the whole of iov, coping with short writes and EINTR */
+static int write_records(struct iovec *iov, int count)
+{
+  ssize_t res;
+  size_t bytes = 0;
+  int i;
+
+  if (PROBE_ENABLED(log_write))
+  {
+    for (i = 0; i < count; i++)
+    {
+      bytes += iov[i].iov_len;
+    }
+    PROBE_LOG_WRITE(count, bytes);
+  }
+
+  while (count > 0)
+  {
+    res = writev(logfile, iov, count);
+    if (res < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    while ((count > 0) && ((size_t)res >= iov->iov_len))
+    {
+      res -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if (count > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + res;
+      iov->iov_len -= res;
+    }
+  }
+  return 0;
+} /* write_records */
+
+/* Finds the cache entry for format f. Format strings are literals, so
+   the address is as good as the text. Sets *fresh TRUE the first time
+   this process meets f, when the caller must write a FORMAT record and
+   then call fmt_publish(). If the cache is full, f is parsed into
+   scratch every time. */
+static log_fmt* fmt_lookup(const char *f, log_fmt *scratch, int *fresh)
+{
+  log_fmt *lf = NULL;
+  unsigned i;
+  unsigned probe;
+
+  *fresh = FALSE;
+  i = ((unsigned long)f >> 3) % LOG_FMT_CACHE;
+  for (probe = 0; probe < LOG_FMT_CACHE; probe++)
+  {
+    lf = &fmt_cache[(i + probe) % LOG_FMT_CACHE];
+    if (lf->fmt == f)
+    {
+      return lf;
+    }
+    /* claim it first, so a signal handler logging now can't take it */
+    if ((lf->fmt == NULL) &&
+        __sync_bool_compare_and_swap(&lf->fmt, NULL, FMT_BUSY))
+    {
+      break;
+    }
+    lf = NULL;
+  }
+  if (lf == NULL)
+  {
+    lf = scratch;
+  }
+
+  lf->id = logbin_format_id(f);
+  lf->nargs = logbin_parse_format(f, lf->kinds);
+  *fresh = TRUE;
+  return lf;  /* still FMT_BUSY, so nobody else finds it yet */
+
+} /* fmt_lookup */
+
+/* Called once the FORMAT record for a fresh entry lf is written, or
+   dropped (written FALSE). Only a written one makes f known; otherwise
+   logcat would never be told it, so the entry is given back and the next
+   line with f tries again. The caller still needs lf for this line, so
+   in that case it gets a copy in scratch. Returns the entry to use. */
+static log_fmt* fmt_publish(log_fmt *lf, const char *f, log_fmt *scratch,
+                            int written)
+{
+  if (lf == scratch)
+  {
+    return lf;
+  }
+  if (written == TRUE)
+  {
+    __sync_synchronize();
+    lf->fmt = f;
+    return lf;
+  }
+  memcpy(scratch, lf, sizeof(log_fmt));
+  __sync_synchronize();
+  lf->fmt = NULL;
+  return scratch;
+} /* fmt_publish */
+
+/* Fills in the parts of a binary header every record shares */
+static void binary_header(logbin_header *h, uint32_t magic, unsigned level,
+                          uint32_t fmtid)
+{
+  struct timespec now;
+
+  clock_gettime(LOG_CLOCK, &now);
+  h->magic = magic;
+  h->level = level;
+  h->nargs = 0;
+  h->fmtid = fmtid;
+  h->pid = log_pid;
+  h->ppid = log_ppid;
+  h->sec = now.tv_sec;
+  h->nsec = now.tv_nsec;
+} /* binary_header */
+
+/* Formats a FORMAT record for f, whose entry is lf, into buf, returning
+   its length */
+static unsigned binary_format(char *buf, unsigned size, log_fmt *lf,
+                              const char *f)
+{
+  logbin_header h;
+  unsigned len;
+
+  binary_header(&h, LOGBIN_FORMAT, 0, lf->id);
+  len = strlen(f);
+  if (len > size - sizeof(h))
+  {
+    len = size - sizeof(h);
+  }
+  h.len = sizeof(h) + len;
+  memcpy(buf, &h, sizeof(h));
+  memcpy(buf + sizeof(h), f, len);
+  return h.len;
+} /* binary_format */
+
+/* Packs the arguments for lf into an EVENT record in buf, returning its
+   length. Arguments that don't fit are left out, and nargs says so. */
+static unsigned binary_event(char *buf, unsigned size, unsigned level,
+                             log_fmt *lf, va_list ap)
+{
+  logbin_header h;
+  char *p = buf + sizeof(h);
+  char *end = buf + size;
+  int32_t i32;
+  int64_t i64;
+  uint64_t u64;
+  uint16_t slen;
+  double d;
+  const char *str;
+  int i;
+
+  binary_header(&h, LOGBIN_EVENT, level, lf->id);
+  for (i = 0; i < lf->nargs; i++)
+  {
+    switch (lf->kinds[i])
+    {
+    case LOGBIN_INT:
+      i32 = va_arg(ap, int);
+      if (p + sizeof(i32) > end)
+        break;
+      memcpy(p, &i32, sizeof(i32));
+      p += sizeof(i32);
+      h.nargs++;
+      continue;
+
+    case LOGBIN_LONG:
+    case LOGBIN_LLONG:
+      i64 = (lf->kinds[i] == LOGBIN_LONG) ? va_arg(ap, long) : va_arg(ap, long long);
+      if (p + sizeof(i64) > end)
+        break;
+      memcpy(p, &i64, sizeof(i64));
+      p += sizeof(i64);
+      h.nargs++;
+      continue;
+
+    case LOGBIN_DOUBLE:
+      d = va_arg(ap, double);
+      if (p + sizeof(d) > end)
+        break;
+      memcpy(p, &d, sizeof(d));
+      p += sizeof(d);
+      h.nargs++;
+      continue;
+
+    case LOGBIN_PTR:
+      u64 = (uint64_t)(unsigned long)va_arg(ap, void *);
+      if (p + sizeof(u64) > end)
+        break;
+      memcpy(p, &u64, sizeof(u64));
+      p += sizeof(u64);
+      h.nargs++;
+      continue;
+
+    case LOGBIN_STRING:
+      str = va_arg(ap, const char *);
+      if (str == NULL)
+        str = "(null)";
+      if (p + sizeof(slen) > end)
+        break;
+      slen = strnlen(str, end - p - sizeof(slen));
+      memcpy(p, &slen, sizeof(slen));
+      memcpy(p + sizeof(slen), str, slen);
+      p += sizeof(slen) + slen;
+      h.nargs++;
+      continue;
+    }
+    break; /* out of room */
+  }
+
+  h.len = p - buf;
+  memcpy(buf, &h, sizeof(h));
+  return h.len;
+} /* binary_event */
+
+/* An EVENT for a line which could only be formatted as text, see logbin.h */
+static unsigned binary_text(char *buf, unsigned size, unsigned level,
+                            const char *text)
+{
+  logbin_header h;
+  uint16_t slen;
+
+  binary_header(&h, LOGBIN_EVENT, level, LOGBIN_PREFORMATTED);
+  slen = strnlen(text, size - sizeof(h) - sizeof(slen));
+  h.nargs = 1;
+  h.len = sizeof(h) + sizeof(slen) + slen;
+  memcpy(buf, &h, sizeof(h));
+  memcpy(buf + sizeof(h), &slen, sizeof(slen));
+  memcpy(buf + sizeof(h) + sizeof(slen), text, slen);
+  return h.len;
+} /* binary_text */
+
+/* Formats a line into buf, returning its length: text with the usual
+   prefix, or a binary EVENT for logformat=binary. lf is from
+   fmt_lookup(), and only needed for binary. */
+static unsigned log_encode(char *buf, unsigned size, unsigned level,
+                           log_fmt *lf, const char *f, va_list ap)
+{
+  char text[LOG_RECORD_LEN];
+
+  if (global_options->logformat != LOGFORMAT_BINARY)
+  {
+    log_prefix(time(NULL));
+    memcpy(buf, prefix, prefix_len);
+    vsnprintf(&buf[prefix_len], size - prefix_len, f, ap);
+    return strlen(buf);
+  }
+
+  if (lf->nargs >= 0)
+  {
+    return binary_event(buf, size, level, lf, ap);
+  }
+
+  /* rare, so the printf is tolerable */
+  vsnprintf(text, sizeof(text), f, ap);
+  return binary_text(buf, size, level, text);
+} /* log_encode */
+
+/* Writes a line straight to the logfile rather than through the ring,
+   followed by fdatasync() if sync==TRUE. Used by the drainer for its own
+   notes (at level 1), and by a child's panic() (level 0). Returns 0 on
+   success. */
+static int log_direct(int sync, unsigned level, const char *f, ...)
+{
+  char line[LOG_RECORD_LEN];
+  struct iovec iov;
+  log_fmt scratch;
+  log_fmt *lf = NULL;
+  va_list ap;
+  int fresh = FALSE;
+  int res;
+
+  if (global_options->logformat == LOGFORMAT_BINARY)
+  {
+    lf = fmt_lookup(f, &scratch, &fresh);
+    if (fresh == TRUE)
+    {
+      iov.iov_base = line;
+      iov.iov_len = binary_format(line, sizeof(line), lf, f);
+      lf = fmt_publish(lf, f, &scratch,
+                       (write_records(&iov, 1) == 0) ? TRUE : FALSE);
+    }
+  }
+
+  va_start(ap, f);
+  iov.iov_base = line;
+  iov.iov_len = log_encode(line, sizeof(line), level, lf, f, ap);
   va_end(ap);
+  res = write_records(&iov, 1);
+  if ((res == 0) && (sync == TRUE) && (logfile_istty == FALSE))
+  {
+    (void)fdatasync(logfile);
+  }
+  return res;
+} /* log_direct */
+
+static long ms_since(struct timespec *then)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - then->tv_sec) * 1000 +
+         (now.tv_nsec - then->tv_nsec) / 1000000;
+} /* ms_since */
+
+/* The record at head has been claimed but not published. Returns TRUE if
+   it has been that way for LOG_STUCK_MS and the process that claimed it
+   no longer exists, in which case it never will be published. */
+static int record_abandoned(unsigned head)
+{
+  pid_t owner;
+
+  if (stuck_head != head + 1)
+  {
+    stuck_head = head + 1;
+    clock_gettime(CLOCK_MONOTONIC, &stuck_since);
+    return FALSE;
+  }
+  if (ms_since(&stuck_since) < LOG_STUCK_MS)
+  {
+    return FALSE;
+  }
+  owner = ring->rec[head % LOG_RING_RECORDS].owner;
+  if (owner == 0)
+  {
+    return FALSE; /* claimed a moment ago, the owner not yet set */
+  }
+  if ((kill(owner, 0) == 0) || (errno != ESRCH))
+  {
+    return FALSE; /* alive, perhaps stopped. Keep waiting */
+  }
+  return TRUE;
+} /* record_abandoned */
+
+/* log_flush. The drainer writes out every complete record in the ring;
+   for anyone else this does nothing. sync==TRUE forces an fdatasync()
+   afterwards whatever logsync says.
+
+   Write errors are ignored, and the records stay in the ring for the next
+   attempt. We have no way of reporting these errors, and it is better to
+   attempt to continue operation in the hope that the logfile comes good
+   than just halt the daemon without explanation */
+void log_flush(int sync)
+{
+  struct iovec iov[LOG_FLUSH_IOV];
+  log_record *rec;
+  unsigned head;
+  unsigned dropped;
+  unsigned i;
+  int count;
+  int written = FALSE;
+  int saved_errno = errno;
+
+  if ((logfile < 0) || (ring == NULL) || (log_drainer == FALSE))
+  {
+    return;
+  }
+  if (__sync_lock_test_and_set(&ring->flushing, 1))
+  {
+    return; /* we interrupted a flush. It will pick our record up */
+  }
+
+  head = ring->head;
+  while (head != ring->tail)
+  {
+    count = 0;
+    while ((count < LOG_FLUSH_IOV) && (head + count != ring->tail) &&
+           (ring->rec[(head + count) % LOG_RING_RECORDS].seq == head + count + 1))
+    {
+      rec = &ring->rec[(head + count) % LOG_RING_RECORDS];
+      iov[count].iov_base = rec->text;
+      iov[count].iov_len = rec->len;
+      count++;
+    }
+    if (count == 0)
+    {
+      /* next record claimed but not finished, by whoever we interrupted
+         or by another process */
+      if (record_abandoned(head) == FALSE)
+      {
+        break;
+      }
+      (void)log_direct(FALSE, 1, "log record from pid %d lost: "
+                       "process died while writing it\n",
+                       ring->rec[head % LOG_RING_RECORDS].owner);
+      written = TRUE;
+      ring_release(head, 1);
+      ring->head = ++head;
+      continue;
+    }
+    if (write_records(iov, count) < 0)
+    {
+      break;
+    }
+    written = TRUE;
+    ring_release(head, count);
+    head += count;
+    ring->head = head;
+  }
+
+  for (i = 0; i < LOG_PRODUCERS; i++)
+  {
+    if (ring->producer[i].dropped == 0)
+    {
+      continue;
+    }
+    dropped = __sync_lock_test_and_set(&ring->producer[i].dropped, 0);
+    if (log_direct(FALSE, 1, "log ring full, pid %d dropped %u records\n",
+                   ring->producer[i].pid, dropped) == 0)
+    {
+      written = TRUE;
+    }
+  }
+
+  /* no fdatasync if to stdout - annoying error with strace */
+  if ((logfile_istty == FALSE) &&
+      ((sync == TRUE) ||
+       ((written == TRUE) && (global_options->logsync == LOGSYNC_GROUP))))
+  {
+    (void)fdatasync(logfile);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &last_flush);
+  __sync_lock_release(&ring->flushing);
+  errno = saved_errno;
+
+} /* log_flush */
+
+/* log_tick. Called by the main loop at least every logflushms, and
+   writes out anything that has been waiting that long */
+void log_tick()
+{
+  if (ms_since(&last_summary) >= 1000L * global_options->logsummary)
+  {
+    log_summarise();
+  }
+  if ((ring == NULL) || (ring->head == ring->tail))
+  {
+    return;
+  }
+  if (ms_since(&last_flush) >= (long)global_options->logflushms)
+  {
+    log_flush(FALSE);
+  }
+} /* log_tick */
+
+/* Claims a record in the ring, applying the logoverflow policy if it is
+   full. A child can't write the ring out itself, so it waits up to
+   LOG_BLOCK_MS for the master before giving up; the master writes it
+   out while it waits. Returns NULL, having
+   counted the drop, if there is no room. */
+static log_record* log_claim(unsigned *n)
+{
+  log_record *rec;
+  struct timespec pause;
+  unsigned waited = 0;
+
+  rec = ring_claim(n);
+  if ((rec == NULL) && (global_options->logoverflow == LOGOVERFLOW_BLOCK))
+  {
+    pause.tv_sec = 0;
+    pause.tv_nsec = 1000000;
+    while ((rec == NULL) && (waited++ < LOG_BLOCK_MS))
+    {
+      if (log_drainer == TRUE)
+      {
+        /* nobody else will empty it. This makes room unless the head
+           record is still being written, so wait for that */
+        log_flush(FALSE);
+        rec = ring_claim(n);
+        if (rec != NULL)
+        {
+          break;
+        }
+      }
+      nanosleep(&pause, NULL);
+      rec = ring_claim(n);
+    }
+  }
+  if (rec == NULL)
+  {
+    __sync_fetch_and_add(&producer->dropped, 1);
+  }
+  return rec;
+} /* log_claim */
+
+/* log_msg. queues a line for the logfile (which may be a file, or
+   /dev/console for debug). When the ring is full the logoverflow option
+   decides between dropping the line (counted, and reported by the
+   drainer) and blocking while the ring is written out.
+*/
+void log_msg(const char* f, ...)
+{
+  va_list ap;
+  log_record *rec;
+  log_fmt scratch;
+  log_fmt *lf = NULL;
+  unsigned level = GLOBAL_LEVEL;
+  unsigned n = 0;
+  int fresh = FALSE;
+  int saved_errno = errno;
+
+  if (ring == NULL)
+  {
+    return; /* before log_start */
+  }
+
+  if (global_options->logformat == LOGFORMAT_BINARY)
+  {
+    lf = fmt_lookup(f, &scratch, &fresh);
+    if (fresh == TRUE)
+    {
+      rec = log_claim(&n);
+      if (rec != NULL)
+      {
+        rec->len = binary_format(rec->text, sizeof(rec->text), lf, f);
+        __sync_synchronize();
+        rec->seq = n + 1;
+      }
+      lf = fmt_publish(lf, f, &scratch, (rec != NULL) ? TRUE : FALSE);
+    }
+  }
 
-  /* ignore errors with write() and fsync() here. We have no way of
-  reporting these errors, and it is better to attempt to continue
-  operation in the hope that the logfile comes good than just halt the
-  daemon without explanation */
+  rec = log_claim(&n);
+  if (rec == NULL)
+  {
+    errno = saved_errno;
+    return;
+  }
+
+  va_start(ap, f);
+  rec->len = log_encode(rec->text, sizeof(rec->text), level, lf, f, ap);
+  va_end(ap);
+  PROBE_LOG(level, f, rec->len);
 
-  ignore = write(logfile, str2, strlen(str2));
+  __sync_synchronize();
+  rec->seq = n + 1;
 
-  if (logfile_istty == FALSE)
+  if (ring->tail - ring->head >= global_options->logbatch)
   {
-    /* no fsync if to stdout - annoying error with strace */
-    ignore = fsync(logfile);
+    log_flush(FALSE);
   }
+  errno = saved_errno;
 
 } /* log_msg */
@@ -13,21 +13,69 @@
 
 */
 
+#include <stdarg.h>
+
 /* prototypes */
 
 void panic(const char* f, ...);
+int panic_vformat(char *out, size_t len, const char* f, va_list ap);
 void log_start();
 void log_finish();
 void log_msg(const char* f, ...);
+void log_flush(int sync);
+void log_tick();
+void log_forked(int master);
+void log_daemonised();
+void log_reaped(pid_t pid);
+void log_apply_levels();
+volatile unsigned* log_map_levels(int create);
+void log_share_levels();
+void log_unshare_levels();
+int log_subsys(const char *name);
+const char* log_subsys_name(int subsys);
+int log_admit(int class);
+const char* log_class_name(int class);
+
+#define LOG_RING_RECORDS 1024 /* records held between group commits */
+#define LOG_RECORD_LEN 400    /* longest log line, timestamp included */
+#define LOG_FLUSH_IOV 64      /* records handed to each writev() */
+#define LOG_PRODUCERS (ABSOLUTE_MAX_CHILDREN + 2) /* slot 0 is shared */
+#define LOG_STUCK_MS 1000     /* unpublished this long, check the owner */
+#define LOG_BLOCK_MS 1000     /* longest a child waits for ring space */
+#define LOG_FMT_CACHE 512     /* format strings remembered for binary logs */
+
+/* LOG lines above LOG_COMPILED_LEVEL are compiled out altogether, eg
+   make CFLAGS="-O2 -DLOG_COMPILED_LEVEL=2" for a release build. The rest
+   are checked against the runtime level of the subsystem of the file
+   they are in, see LOGSUB_xx in global.h. */
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL MAX_LOGLEVEL
+#endif
+
+#ifndef LOG_SUBSYS
+#define LOG_SUBSYS LOGSUB_DAEMON
+#endif
+
+extern volatile unsigned *log_levels;  /* indexed by LOGSUB_xx */
 
 #define LOG(level, body) \
-if (global_options->loglevel >= level) log_msg body;
+if (((level) <= LOG_COMPILED_LEVEL) && (log_levels[LOG_SUBSYS] >= (level))) \
+  GLOBAL_LEVEL = level, log_msg body;
+
+/* LOG for lines that can come in floods. A line that passes the level
+   check is logged only if log_admit() lets its LOGCLASS_xx through, and
+   is otherwise counted towards a periodic "suppressed" summary. */
+#define LOG_LIMITED(class, level, body) \
+if (((level) <= LOG_COMPILED_LEVEL) && (log_levels[LOG_SUBSYS] >= (level)) \
+    && (log_admit(class) == TRUE)) \
+  GLOBAL_LEVEL = level, log_msg body;
 
 #define TO_STRING(s) XTO_STRING(s)
 #define XTO_STRING(s) #s
 
 extern char GLOBAL_LINE[255];  /* For PANIC macro. ANSI C macros do not allow */
 extern char GLOBAL_FILE[255];  /* variable arguments (...), unlike gcc. */
+extern unsigned GLOBAL_LEVEL;  /* Level of the LOG() line being logged */
 
 /* PANIC is more elegant with gcc macro extensions. But we only use ANSI C */
 #define PANIC(args) \
@@ -0,0 +1,122 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* logbin.c
+
+   Format string handling for the binary log format. Linked into both the
+   daemon and daevel-logcat, so it must not use LOG or PANIC.
+
+*/
+
+#include <string.h>
+#include "logbin.h"
+
+/* Works out the kind of each argument printf would take for format f,
+   putting them in kinds[]. Returns the number of arguments, or -1 if f
+   uses something we don't encode (%n, '*' widths, long double, or more
+   than LOGBIN_MAX_ARGS arguments). */
+int logbin_parse_format(const char *f, unsigned char *kinds)
+{
+  int n = 0;
+  int longs = 0;
+
+  while ((f = strchr(f, '%')) != NULL)
+  {
+    f++;
+    if (*f == '%')
+    {
+      f++;
+      continue;
+    }
+    f += strspn(f, "-+ #0'123456789.");
+    if (*f == '*')
+    {
+      return -1;
+    }
+
+    longs = 0;
+    while (strchr("hlLqjzt", *f) && (*f != '\0'))
+    {
+      if (*f == 'L')
+      {
+        return -1;
+      }
+      if (*f == 'q')
+      {
+        longs++;  /* BSD for ll */
+      }
+      if (*f != 'h')
+      {
+        longs++;
+      }
+      f++;
+    }
+
+    if (n == LOGBIN_MAX_ARGS)
+    {
+      return -1;
+    }
+
+    switch (*f)
+    {
+    case 'd':
+    case 'i':
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+      kinds[n++] = (longs > 1) ? LOGBIN_LLONG :
+                   ((longs > 0) ? LOGBIN_LONG : LOGBIN_INT);
+      break;
+
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+      kinds[n++] = LOGBIN_DOUBLE;
+      break;
+
+    case 's':
+      kinds[n++] = LOGBIN_STRING;
+      break;
+
+    case 'p':
+      kinds[n++] = LOGBIN_PTR;
+      break;
+
+    default:  /* %n, wide characters, or something we don't recognise */
+      return -1;
+    }
+    f++;
+  }
+
+  return n;
+
+} /* logbin_parse_format */
+
+/* FNV-1a of the format text. Never returns LOGBIN_PREFORMATTED. */
+uint32_t logbin_format_id(const char *f)
+{
+  uint32_t h = 2166136261u;
+
+  while (*f != '\0')
+  {
+    h ^= (unsigned char) * f++;
+    h *= 16777619u;
+  }
+  return (h == LOGBIN_PREFORMATTED) ? 1 : h;
+
+} /* logbin_format_id */
@@ -0,0 +1,66 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* logbin.h
+
+   The binary log format (logformat=binary), shared by log.c which writes
+   it and logcat.c which turns it back into text.
+
+   A logfile is a sequence of records, each starting with a logbin_header.
+   A FORMAT record carries the text of a format string after the header,
+   and introduces its fmtid. An EVENT record carries the raw arguments for
+   the format string fmtid, packed one after the other: 4 bytes for
+   LOGBIN_INT, 8 for LOGBIN_LONG, LOGBIN_LLONG, LOGBIN_DOUBLE and LOGBIN_PTR,
+   and for
+   LOGBIN_STRING a 2-byte length followed by that many bytes with no
+   '\0'. fmtid is a hash of the format text, so every process arrives at
+   the same id for the same format without talking to the others.
+
+   fmtid 0 is reserved for lines that could not be encoded (for example
+   a format using %n or too many arguments). Those are formatted as text
+   as before, and the text is the single LOGBIN_STRING argument of "%s".
+
+   Everything is in host byte order, so decode on the same architecture.
+*/
+
+#include <stdint.h>
+
+#define LOGBIN_EVENT 0x45564c44   /* "DLVE" on little-endian */
+#define LOGBIN_FORMAT 0x46564c44  /* "DLVF" */
+
+#define LOGBIN_MAX_ARGS 16
+#define LOGBIN_PREFORMATTED 0     /* fmtid of lines encoded as text */
+
+/* argument kinds */
+#define LOGBIN_INT 1      /* int, char, short */
+#define LOGBIN_LONG 2     /* long, and size_t etc which are long-sized */
+#define LOGBIN_DOUBLE 3
+#define LOGBIN_STRING 4
+#define LOGBIN_PTR 5
+#define LOGBIN_LLONG 6    /* long long */
+
+typedef struct
+{
+  uint32_t magic;   /* LOGBIN_EVENT or LOGBIN_FORMAT */
+  uint16_t len;     /* whole record, header included */
+  uint8_t level;    /* LOG() level, 0 for PANIC and internal notes */
+  uint8_t nargs;    /* arguments actually present in an EVENT */
+  uint32_t fmtid;
+  int32_t pid;
+  int32_t ppid;
+  uint32_t nsec;
+  int64_t sec;      /* CLOCK_REALTIME, coarse where the OS has one */
+}
+logbin_header;
+
+/* prototypes */
+int logbin_parse_format(const char *f, unsigned char *kinds);
+uint32_t logbin_format_id(const char *f);
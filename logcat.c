@@ -0,0 +1,426 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* logcat.c
+
+   daevel-logcat: turns a logfile written with logformat=binary back into
+   the same text the daemon writes with logformat=text, optionally
+   keeping only some of the lines.
+
+   usage: daevel-logcat [-p pid] [-l level] [-s start] [-e end] [file]
+
+   start and end are "YYYY-mm-dd HH:MM:SS", "YYYY-mm-dd" or seconds since
+   the epoch, in local time like the logfile itself. file defaults to
+   ./logfile, and "-" means stdin. Text lines in the file, such as those
+   logged before the config file switched to binary, are copied through
+   unchanged when no filter is given.
+
+   Its own errors go to stderr: LOG would write them into a logfile,
+   possibly the one being read.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "logbin.h"
+
+#define LOGCAT_BUFLEN 65536
+#define LOGCAT_MAX_RECORD 4096  /* anything longer is taken as corruption */
+#define LOGCAT_FORMATS 4096     /* hash buckets for format strings */
+
+/* a format string met in a FORMAT record */
+typedef struct fmt_entry
+{
+  uint32_t id;
+  char *text;
+  int nargs;
+  unsigned char kinds[LOGBIN_MAX_ARGS];
+  struct fmt_entry *next;
+}
+fmt_entry;
+
+static fmt_entry *formats[LOGCAT_FORMATS];
+
+/* filters; -1 for not set */
+static long want_pid = -1;
+static long want_level = -1;
+static long long want_start = -1;
+static long long want_end = -1;
+
+static fmt_entry* find_format(uint32_t id)
+{
+  fmt_entry *fe;
+
+  for (fe = formats[id % LOGCAT_FORMATS]; fe != NULL; fe = fe->next)
+  {
+    if (fe->id == id)
+    {
+      return fe;
+    }
+  }
+  return NULL;
+} /* find_format */
+
+/* Remembers a format. Every process that meets a format writes it out,
+   so most of these are repeats. */
+static void add_format(uint32_t id, const char *text, unsigned len)
+{
+  fmt_entry *fe;
+
+  if (find_format(id) != NULL)
+  {
+    return;
+  }
+  fe = malloc(sizeof(fmt_entry));
+  if (fe != NULL)
+  {
+    fe->text = malloc(len + 1);
+  }
+  if ((fe == NULL) || (fe->text == NULL))
+  {
+    fprintf(stderr, "daevel-logcat: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(fe->text, text, len);
+  fe->text[len] = '\0';
+  fe->id = id;
+  fe->nargs = logbin_parse_format(fe->text, fe->kinds);
+  fe->next = formats[id % LOGCAT_FORMATS];
+  formats[id % LOGCAT_FORMATS] = fe;
+} /* add_format */
+
+/* Appends to out what printf would have made of fmt, taking arguments
+   from the packed args. Arguments missing from the record print as "?". */
+static void render(char *out, size_t outlen, const fmt_entry *fe,
+                   const char *args, const char *end, unsigned nargs)
+{
+  char spec[32];
+  const char *f = fe->text;
+  const char *start;
+  size_t used = strlen(out);
+  size_t speclen;
+  unsigned argn = 0;
+  int32_t i32;
+  int64_t i64;
+  uint64_t u64;
+  uint16_t slen;
+  double d;
+  char str[LOGCAT_MAX_RECORD];
+
+  while ((*f != '\0') && (used + 1 < outlen))
+  {
+    if (*f != '%')
+    {
+      out[used++] = *f++;
+      continue;
+    }
+    if (*(f + 1) == '%')
+    {
+      out[used++] = '%';
+      f += 2;
+      continue;
+    }
+
+    /* find the end of the conversion spec, same grammar as logbin.c */
+    start = f++;
+    f += strspn(f, "-+ #0'123456789.");
+    f += strspn(f, "hlLqjzt");
+    if (*f != '\0')
+    {
+      f++;
+    }
+    speclen = f - start;
+    if (speclen >= sizeof(spec))
+    {
+      speclen = sizeof(spec) - 1;
+    }
+    memcpy(spec, start, speclen);
+    spec[speclen] = '\0';
+
+    if ((argn >= nargs) || ((int)argn >= fe->nargs))
+    {
+      out[used++] = '?';
+      continue;
+    }
+
+    out[used] = '\0';
+    switch (fe->kinds[argn++])
+    {
+    case LOGBIN_INT:
+      memcpy(&i32, args, sizeof(i32));
+      args += sizeof(i32);
+      snprintf(out + used, outlen - used, spec, (int)i32);
+      break;
+
+    case LOGBIN_LONG:
+      memcpy(&i64, args, sizeof(i64));
+      args += sizeof(i64);
+      snprintf(out + used, outlen - used, spec, (long)i64);
+      break;
+
+    case LOGBIN_LLONG:
+      memcpy(&i64, args, sizeof(i64));
+      args += sizeof(i64);
+      snprintf(out + used, outlen - used, spec, (long long)i64);
+      break;
+
+    case LOGBIN_DOUBLE:
+      memcpy(&d, args, sizeof(d));
+      args += sizeof(d);
+      snprintf(out + used, outlen - used, spec, d);
+      break;
+
+    case LOGBIN_PTR:
+      memcpy(&u64, args, sizeof(u64));
+      args += sizeof(u64);
+      snprintf(out + used, outlen - used, spec, (void *)(unsigned long)u64);
+      break;
+
+    case LOGBIN_STRING:
+      memcpy(&slen, args, sizeof(slen));
+      args += sizeof(slen);
+      if (args + slen > end)
+      {
+        slen = end - args;
+      }
+      memcpy(str, args, slen);
+      str[slen] = '\0';
+      args += slen;
+      snprintf(out + used, outlen - used, spec, str);
+      break;
+    }
+    used = strlen(out);
+  }
+  out[used] = '\0';
+} /* render */
+
+/* Prints one EVENT record as a text line, if it passes the filters */
+static void print_event(const logbin_header *h, const char *rec)
+{
+  static const fmt_entry preformatted =
+  {
+    LOGBIN_PREFORMATTED, "%s", 1, { LOGBIN_STRING }, NULL
+  };
+  const fmt_entry *fe;
+  char line[LOGCAT_MAX_RECORD * 2];
+  time_t sec = (time_t)h->sec;
+  struct tm *tm;
+
+  if ((want_pid >= 0) && (h->pid != want_pid))
+    return;
+  if ((want_level >= 0) && (h->level > want_level))
+    return;
+  if ((want_start >= 0) && (h->sec < want_start))
+    return;
+  if ((want_end >= 0) && (h->sec > want_end))
+    return;
+
+  tm = localtime(&sec);
+  strftime(line, 26, "%G-%m-%d %H:%M:%S ", tm);
+  snprintf(line + strlen(line), sizeof(line) - strlen(line), "pid=%i (%i) ",
+           (int)h->pid, (int)h->ppid);
+
+  if (h->fmtid == LOGBIN_PREFORMATTED)
+  {
+    fe = &preformatted;
+  }
+  else
+  {
+    fe = find_format(h->fmtid);
+  }
+  if (fe == NULL)
+  {
+    snprintf(line + strlen(line), sizeof(line) - strlen(line),
+             "<unknown format %08x>\n", (unsigned)h->fmtid);
+  }
+  else
+  {
+    render(line, sizeof(line), fe, rec + sizeof(*h), rec + h->len, h->nargs);
+  }
+  fputs(line, stdout);
+} /* print_event */
+
+/* Returns the length including '\n' of the printable line at p, or 0 */
+static size_t text_line(const char *p, size_t len)
+{
+  size_t i;
+
+  for (i = 0; (i < len) && (i < LOGCAT_MAX_RECORD); i++)
+  {
+    if (p[i] == '\n')
+    {
+      return i + 1;
+    }
+    if (((unsigned char)p[i] < ' ') && (p[i] != '\t'))
+    {
+      return 0;
+    }
+  }
+  return 0;
+} /* text_line */
+
+/* Parses "YYYY-mm-dd HH:MM:SS", "YYYY-mm-dd" or epoch seconds. -1 if bad */
+static long long parse_time(const char *s)
+{
+  struct tm tm;
+  int n;
+
+  memset(&tm, 0, sizeof(tm));
+  n = sscanf(s, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+             &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+  if ((n == 3) || (n == 6))
+  {
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    return (long long)mktime(&tm);
+  }
+  if ((n == 1) && (strspn(s, "0123456789") == strlen(s)))
+  {
+    return atoll(s);
+  }
+  return -1;
+} /* parse_time */
+
+static void usage()
+{
+  fprintf(stderr, "usage: daevel-logcat [-p pid] [-l level] [-s start]"
+          " [-e end] [file]\n");
+  fprintf(stderr, "       -p pid    only lines logged by process pid\n");
+  fprintf(stderr, "       -l n      only lines logged at level n or"
+          " below (0 is PANIC)\n");
+  fprintf(stderr, "       -s time   only lines at or after time\n");
+  fprintf(stderr, "       -e time   only lines at or before time\n");
+  fprintf(stderr, "       time is \"YYYY-mm-dd HH:MM:SS\", \"YYYY-mm-dd\""
+          " or seconds since the epoch\n");
+  fprintf(stderr, "       file defaults to ./logfile, - for stdin\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  static char buf[LOGCAT_BUFLEN];
+  const char *fn = "./logfile";
+  FILE *in;
+  logbin_header h;
+  size_t have = 0;
+  size_t pos = 0;
+  size_t n;
+  unsigned long skipped = 0;
+  int ch;
+  int eof = 0;
+
+  while ((ch = getopt(argc, argv, "p:l:s:e:h")) != -1)
+  {
+    switch (ch)
+    {
+    case 'p':
+      want_pid = atol(optarg);
+      break;
+    case 'l':
+      want_level = atol(optarg);
+      break;
+    case 's':
+      if ((want_start = parse_time(optarg)) < 0)
+        usage();
+      break;
+    case 'e':
+      if ((want_end = parse_time(optarg)) < 0)
+        usage();
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind < argc)
+  {
+    fn = argv[optind];
+  }
+
+  in = (strcmp(fn, "-") == 0) ? stdin : fopen(fn, "r");
+  if (in == NULL)
+  {
+    perror(fn);
+    exit(EXIT_FAILURE);
+  }
+
+  for (;;)
+  {
+    /* keep at least one whole record in the buffer */
+    if ((eof == 0) && (have - pos < LOGCAT_MAX_RECORD))
+    {
+      memmove(buf, buf + pos, have - pos);
+      have -= pos;
+      pos = 0;
+      n = fread(buf + have, 1, sizeof(buf) - have, in);
+      have += n;
+      if (n == 0)
+      {
+        eof = 1;
+      }
+    }
+    if (have - pos < sizeof(h))
+    {
+      break;
+    }
+
+    memcpy(&h, buf + pos, sizeof(h));
+    if (((h.magic != LOGBIN_EVENT) && (h.magic != LOGBIN_FORMAT)) ||
+        (h.len < sizeof(h)) || (h.len > LOGCAT_MAX_RECORD))
+    {
+      /* a text line, written before the config file chose binary or by
+         an earlier run, or else damage. Look for the next record */
+      n = text_line(buf + pos, have - pos);
+      if (n > 0)
+      {
+        if ((want_pid < 0) && (want_level < 0) && (want_start < 0) &&
+            (want_end < 0))
+        {
+          fwrite(buf + pos, 1, n, stdout);
+        }
+        pos += n;
+        continue;
+      }
+      pos++;
+      skipped++;
+      continue;
+    }
+    if (h.len > have - pos)
+    {
+      break; /* truncated last record, eg the daemon is still writing */
+    }
+
+    if (h.magic == LOGBIN_FORMAT)
+    {
+      add_format(h.fmtid, buf + pos + sizeof(h), h.len - sizeof(h));
+    }
+    else
+    {
+      print_event(&h, buf + pos);
+    }
+    pos += h.len;
+  }
+
+  if (skipped > 0)
+  {
+    fprintf(stderr, "daevel-logcat: skipped %lu bytes that were not binary"
+            " log records\n", skipped);
+  }
+  if (in != stdin)
+  {
+    fclose(in);
+  }
+  return 0;
+
+} /* main */
@@ -0,0 +1,461 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* metrics.c
+
+   Counters, gauges and latency histograms for the daemon, served as text
+   by the admin socket (see admin.c).
+
+   Some of the numbers can only be measured in the children, such as how
+   long a child takes to write its first byte, so all of them live in the
+   statistics segment described in stats.h, set up by metrics_start()
+   before the first fork(). Each process adds to the counters in its own
+   slot of the segment; histograms are shared, updated with atomic adds.
+   daevel-stat reads the same segment without involving the daemon.
+
+   The exposition format is one "name value" or "name{label} value" line
+   per number, with "# TYPE" comments, close enough to Prometheus text
+   format that its tools can scrape it through a socket forwarder.
+   Histograms give the cumulative count up to the top of each non-empty
+   bucket, plus p50, p99 and p99.9.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+
+#include "global.h"
+#include "metrics.h"
+#include "log.h"
+#include "util.h"
+
+static stats_segment *metrics = NULL;
+static stats_slot *my_slot = NULL;
+static char stats_name[FILENAME_LEN];
+
+static const char *counter_names[METRIC_COUNTERS] =
+{
+  "daevel_connections_accepted_total",
+  "daevel_connections_refused_total",
+  "daevel_dup_failures_total",
+  "daevel_fork_failures_total",
+  "daevel_children_reaped_total",
+  "daevel_accept_errors_squashed_total",
+  "daevel_admin_requests_total",
+  "daevel_bytes_in_total",
+  "daevel_bytes_out_total",
+  "daevel_connections_denied_total",
+  "daevel_accept_exhausted_total",
+  "daevel_children_over_deadline_total",
+  "daevel_children_over_cpu_total",
+  "daevel_children_killed_total",
+  "daevel_children_placed_total",
+  "daevel_children_placed_incoming_total",
+  "daevel_children_placed_incoming_miss_total",
+  "daevel_children_placement_failed_total",
+  "daevel_udp_received_total",
+  "daevel_udp_sent_total",
+  "daevel_udp_batches_total",
+  "daevel_udp_dropped_total",
+  "daevel_accepted_local_total",
+  "daevel_busy_spin_hits_total",
+  "daevel_busy_spin_misses_total",
+  "daevel_udp_cross_cpu_batches_total"
+};
+
+static const char *gauge_names[METRIC_GAUGES] =
+{
+  "daevel_children",
+  "daevel_maxchild"
+};
+
+static const char *histogram_names[METRIC_HISTOGRAMS] =
+{
+  "daevel_accept_to_fork_us",
+  "daevel_fork_to_first_byte_us",
+  "daevel_connection_lifetime_us",
+  "daevel_child_cpu_user_us",
+  "daevel_child_cpu_sys_us",
+  "daevel_child_maxrss_kb",
+  "daevel_child_minor_faults",
+  "daevel_child_major_faults",
+  "daevel_child_context_switches",
+  "daevel_child_wall_us",
+  "daevel_wakeup_to_handler_us"
+};
+
+/* times of this connection, in a child */
+static unsigned long long child_accepted = 0;
+static unsigned long long child_forked = 0;
+
+/* Maps the statistics segment. Falls back to anonymous shared memory,
+   which works for everything but daevel-stat, if the file can't be made.
+   The name is predictable, so the file is made afresh, never opened
+   through a symlink someone has planted there. */
+static stats_segment* map_segment()
+{
+  void *p;
+  int fd;
+
+  snprintf(stats_name, sizeof(stats_name), GLOBAL_STATS_NAME, (int)getpid());
+  (void)unlink(stats_name);
+  fd = open(stats_name, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+  if ((fd >= 0) && (ftruncate(fd, sizeof(stats_segment)) == 0))
+  {
+    p = mmap(NULL, sizeof(stats_segment), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+    if (p != MAP_FAILED)
+    {
+      return p;
+    }
+  }
+  LOG(1, ("Can't share statistics through %s, error %d, %s. "
+          "daevel-stat won't work\n", stats_name, errno, strerror(errno)));
+  if (fd >= 0)
+  {
+    close(fd);
+    unlink(stats_name);
+  }
+  stats_name[0] = '\0';
+  return shared_alloc(sizeof(stats_segment));
+} /* map_segment */
+
+/* Removes the segments of daemons that died without removing their own,
+   killed or panicking before they could, so they don't pile up. A
+   segment whose pid is still running, or belongs to someone else, stays */
+static void remove_stale()
+{
+  const char *base = strrchr(GLOBAL_STATS_NAME, '/') + 1;
+  char dirname[FILENAME_LEN];
+  char pattern[FILENAME_LEN];
+  char name[FILENAME_LEN];
+  struct dirent *d;
+  DIR *dir;
+  char extra;
+  int pid;
+
+  snprintf(dirname, sizeof(dirname), "%.*s",
+           (int)(base - GLOBAL_STATS_NAME), GLOBAL_STATS_NAME);
+  snprintf(pattern, sizeof(pattern), "%s%%c", base);  /* nothing after %d */
+  dir = opendir(dirname);
+  if (dir == NULL)
+  {
+    return;
+  }
+  while ((d = readdir(dir)) != NULL)
+  {
+    if ((sscanf(d->d_name, pattern, &pid, &extra) != 1) || (pid <= 0) ||
+        (pid == (int)getpid()))
+    {
+      continue;
+    }
+    if ((kill(pid, 0) == 0) || (errno != ESRCH))
+    {
+      continue;
+    }
+    snprintf(name, sizeof(name), GLOBAL_STATS_NAME, pid);
+    if (unlink(name) == 0)
+    {
+      LOG(2, ("Removed %s, left by a daemon that didn't finish\n", name));
+    }
+  }
+  closedir(dir);
+} /* remove_stale */
+
+/* Call once in the master, before any children are forked */
+void metrics_start()
+{
+  remove_stale();
+  metrics = map_segment();
+  if (metrics == NULL)
+  {
+    PANIC(("Cannot map shared metrics, error %d, %s\n",
+           errno, strerror(errno)));
+  }
+  memset(metrics, 0, sizeof(stats_segment));
+  metrics->version = STATS_VERSION;
+  metrics->size = sizeof(stats_segment);
+  metrics->pid = getpid();
+  metrics->started = time(NULL);
+  metrics->gauge[MG_MAXCHILD] = global_options->maxchild;
+  my_slot = &metrics->slot[STATS_SLOT_MASTER];
+  my_slot->pid = metrics->pid;
+  __sync_synchronize();
+  metrics->magic = STATS_MAGIC;  /* daevel-stat may look now */
+} /* metrics_start */
+
+/* Called by the master on shutdown */
+void metrics_finish()
+{
+  if (metrics != NULL)
+  {
+    metrics->magic = 0;  /* tells daevel-stat we've gone */
+    if ((stats_name[0] != '\0') && (unlink(stats_name) != 0))
+    {
+      LOG(1, ("Couldn't remove %s, error %d, %s\n", stats_name,
+              errno, strerror(errno)));
+    }
+  }
+} /* metrics_finish */
+
+/* For panic(), which exits without the shutdown metrics_finish() is part
+   of. Only the master removes the segment; a child panicking leaves it
+   to the master */
+void metrics_abandon()
+{
+  if ((metrics != NULL) && (stats_name[0] != '\0') &&
+      (metrics->pid == getpid()))
+  {
+    metrics->magic = 0;
+    unlink(stats_name);
+    stats_name[0] = '\0';
+  }
+} /* metrics_abandon */
+
+void metrics_add(int counter, unsigned long long n)
+{
+  if (my_slot != NULL)
+  {
+    __sync_fetch_and_add(&my_slot->counter[counter], n);
+  }
+} /* metrics_add */
+
+void metrics_count(int counter)
+{
+  metrics_add(counter, 1);
+} /* metrics_count */
+
+void metrics_gauge(int gauge, long value)
+{
+  if (metrics != NULL)
+  {
+    metrics->gauge[gauge] = value;
+  }
+} /* metrics_gauge */
+
+/* Counts an accept() error that filtered_accept() squashed */
+void metrics_squashed(int err)
+{
+  if (metrics != NULL)
+  {
+    metrics_count(MC_SQUASHED);
+    if ((err >= 0) && (err < METRIC_ERRNOS))
+    {
+      __sync_fetch_and_add(&metrics->squashed[err], 1);
+    }
+  }
+} /* metrics_squashed */
+
+void metrics_record(int histogram, unsigned long long usec)
+{
+  stats_histogram *h;
+  unsigned long long old;
+
+  if (metrics == NULL)
+  {
+    return;
+  }
+  h = &metrics->histogram[histogram];
+  __sync_fetch_and_add(&h->bucket[stats_bucket(usec)], 1);
+  __sync_fetch_and_add(&h->count, 1);
+  __sync_fetch_and_add(&h->sum, usec);
+  old = h->max;
+  while ((usec > old) && !__sync_bool_compare_and_swap(&h->max, old, usec))
+  {
+    old = h->max;
+  }
+} /* metrics_record */
+
+/* For reading a histogram in the master */
+const stats_histogram* metrics_histogram(int histogram)
+{
+  return (metrics == NULL) ? NULL : &metrics->histogram[histogram];
+} /* metrics_histogram */
+
+/* Microseconds on the monotonic clock */
+unsigned long long metrics_now()
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (unsigned long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+} /* metrics_now */
+
+/* Called in a new child with the time its connection was accepted */
+void metrics_forked(unsigned long long accepted)
+{
+  pid_t me = getpid();
+  int i;
+
+  child_accepted = accepted;
+  child_forked = metrics_now();
+  if (metrics == NULL)
+  {
+    return;
+  }
+
+  /* everyone shares the retired slot if there's no free one; they only
+     ever add to it atomically, so the counts stay right */
+  my_slot = &metrics->slot[STATS_SLOT_RETIRED];
+  for (i = STATS_SLOT_RETIRED + 1; i < STATS_SLOTS; i++)
+  {
+    if ((metrics->slot[i].pid == 0) &&
+        __sync_bool_compare_and_swap(&metrics->slot[i].pid, 0, me))
+    {
+      my_slot = &metrics->slot[i];
+      break;
+    }
+  }
+} /* metrics_forked */
+
+/* Called by a child once it has written to its client, only counting the
+   first time */
+void metrics_first_byte()
+{
+  if (child_forked != 0)
+  {
+    metrics_record(MH_FORK_TO_FIRST_BYTE, metrics_now() - child_forked);
+    child_forked = 0;
+  }
+} /* metrics_first_byte */
+
+/* Called by a child just before it exits. Returns microseconds since its
+   connection was accepted. */
+unsigned long long metrics_child_done()
+{
+  unsigned long long lifetime = 0;
+
+  if (child_accepted != 0)
+  {
+    lifetime = metrics_now() - child_accepted;
+    metrics_record(MH_LIFETIME, lifetime);
+    child_accepted = 0;
+  }
+  return lifetime;
+} /* metrics_child_done */
+
+/* Called by dead_child() with each reaped pid. Moves what the child
+   counted into the retired slot, and frees its slot. */
+void metrics_reaped(pid_t pid)
+{
+  stats_slot *dead;
+  stats_slot *retired;
+  int i;
+  int c;
+
+  if (metrics == NULL)
+  {
+    return;
+  }
+  retired = &metrics->slot[STATS_SLOT_RETIRED];
+  for (i = STATS_SLOT_RETIRED + 1; i < STATS_SLOTS; i++)
+  {
+    dead = &metrics->slot[i];
+    if (dead->pid == pid)
+    {
+      __sync_fetch_and_add(&metrics->fold_seq, 1);
+      for (c = 0; c < METRIC_COUNTERS; c++)
+      {
+        __sync_fetch_and_add(&retired->counter[c], dead->counter[c]);
+        dead->counter[c] = 0;
+      }
+      __sync_fetch_and_add(&metrics->fold_seq, 1);
+      dead->pid = 0;
+      return;
+    }
+  }
+} /* metrics_reaped */
+
+/* stats_quantile(), but no more than the largest value seen */
+static unsigned long long quantile(const stats_histogram *h, double q,
+                                   unsigned long long count)
+{
+  unsigned long long v = stats_quantile(h->bucket, count, q);
+
+  return (v < h->max) ? v : h->max;
+} /* quantile */
+
+static void write_histogram(FILE *out, const char *name,
+                            const stats_histogram *h)
+{
+  unsigned long long count = h->count;
+  unsigned long long seen = 0;
+  unsigned b;
+
+  fprintf(out, "# TYPE %s histogram\n", name);
+  for (b = 0; b < METRIC_BUCKETS; b++)
+  {
+    if (h->bucket[b] != 0)
+    {
+      seen += h->bucket[b];
+      fprintf(out, "%s_bucket{le=\"%llu\"} %llu\n", name,
+              stats_bucket_top(b), seen);
+    }
+  }
+  fprintf(out, "%s_bucket{le=\"+Inf\"} %llu\n", name, seen);
+  fprintf(out, "%s_count %llu\n", name, count);
+  fprintf(out, "%s_sum %llu\n", name, h->sum);
+  if (seen > 0)
+  {
+    fprintf(out, "%s{quantile=\"0.5\"} %llu\n", name, quantile(h, 0.5, seen));
+    fprintf(out, "%s{quantile=\"0.99\"} %llu\n", name, quantile(h, 0.99, seen));
+    fprintf(out, "%s{quantile=\"0.999\"} %llu\n", name,
+            quantile(h, 0.999, seen));
+    fprintf(out, "%s_max %llu\n", name, h->max);
+  }
+} /* write_histogram */
+
+/* Writes every metric to out in the text exposition format */
+void metrics_write(FILE *out)
+{
+  unsigned long long total[METRIC_COUNTERS];
+  int i;
+
+  if (metrics == NULL)
+  {
+    return;
+  }
+  stats_totals(metrics, total);
+  for (i = 0; i < METRIC_COUNTERS; i++)
+  {
+    fprintf(out, "# TYPE %s counter\n", counter_names[i]);
+    fprintf(out, "%s %llu\n", counter_names[i], total[i]);
+  }
+  fprintf(out, "# TYPE daevel_accept_errors_squashed counter\n");
+  for (i = 0; i < METRIC_ERRNOS; i++)
+  {
+    if (metrics->squashed[i] != 0)
+    {
+      fprintf(out, "daevel_accept_errors_squashed{errno=\"%d\",error=\"%s\"}"
+              " %llu\n", i, strerror(i), metrics->squashed[i]);
+    }
+  }
+  for (i = 0; i < METRIC_GAUGES; i++)
+  {
+    fprintf(out, "# TYPE %s gauge\n", gauge_names[i]);
+    fprintf(out, "%s %ld\n", gauge_names[i], metrics->gauge[i]);
+  }
+  fprintf(out, "# TYPE daevel_uptime_seconds gauge\n");
+  fprintf(out, "daevel_uptime_seconds %ld\n",
+          (long)(time(NULL) - metrics->started));
+  for (i = 0; i < METRIC_HISTOGRAMS; i++)
+  {
+    write_histogram(out, histogram_names[i], &metrics->histogram[i]);
+  }
+} /* metrics_write */
@@ -0,0 +1,34 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* metrics.h
+
+*/
+
+#include <stdio.h>
+
+#include "stats.h"
+
+void metrics_start();
+void metrics_count(int counter);
+void metrics_add(int counter, unsigned long long n);
+void metrics_gauge(int gauge, long value);
+void metrics_record(int histogram, unsigned long long usec);
+void metrics_squashed(int err);
+unsigned long long metrics_now();
+void metrics_forked(unsigned long long accepted);
+void metrics_first_byte();
+unsigned long long metrics_child_done();
+void metrics_reaped(pid_t pid);
+void metrics_finish();
+void metrics_abandon();
+void metrics_write(FILE *out);
+const stats_histogram* metrics_histogram(int histogram);
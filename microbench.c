@@ -0,0 +1,599 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* microbench.c
+
+   Microbenchmarks of the functions on the daemon's hot paths, so that a
+   change to one of them comes with numbers. "make bench" builds and runs
+   them.
+
+   usage: microbench [-r reps] [-m ms] [name ...]
+
+   Each benchmark is warmed up, then timed over reps runs (default 11) of
+   about ms milliseconds each (default 20), with the number of operations
+   per run worked out during the warmup. Prints the fastest, median and
+   slowest run in nanoseconds per operation, the spread between fastest
+   and slowest as a percentage of the median, and on x86 the median in
+   TSC cycles per operation. TSC cycles tick at a fixed rate, so they are
+   only CPU cycles when the CPU runs at its nominal clock.
+
+   With names, only the benchmarks whose names start with one of them are
+   run. It links with everything in the daemon except daemon.c, so it
+   defines daemon.c's globals itself. Logging goes to /dev/null and the
+   results to stdout.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MB_CYCLES() __rdtsc()
+#define MB_HAVE_CYCLES 1
+#else
+#define MB_CYCLES() 0ULL
+#define MB_HAVE_CYCLES 0
+#endif
+
+#include "global.h"
+#include "log.h"
+#include "util.h"
+#include "socket.h"
+#include "confdata.h"
+#include "metrics.h"
+#include "acl.h"
+#include "flight.h"
+
+#define MB_MAX_REPS 101
+#define MB_WARMUP_MS 50
+#define MB_WARMUP_ROUNDS 6  /* doublings at least, however slow */
+#define MB_BIG_CONF_LINES 10000  /* entries in process_configfile_big */
+#define MB_ACL_RULES 100000      /* prefixes in acl_check's ACL */
+#define MB_ACL_ADDRS 4096        /* clients it checks, round and round */
+
+/* daemon.c's globals */
+volatile unsigned child_count = 0;
+unsigned master_process = TRUE;
+int tortu_sock = -1;
+unsigned lock_acquired = FALSE;
+
+typedef struct
+{
+  const char *name;
+  const char *what;
+  void (*setup)();
+  void (*run)(long ops);
+  void (*teardown)();
+}
+microbench;
+
+static volatile long sink;  /* results go here, so they aren't optimised out */
+static struct sockaddr_in acl_addr[MB_ACL_ADDRS];
+static FILE *results;
+
+/* -------- the benchmarks -------- */
+
+static void run_log_enabled(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    LOG(1, ("Connection attempt from %s, %ld\n", "192.168.1.1", i));
+  }
+} /* run_log_enabled */
+
+static void run_log_filtered(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    LOG(9, ("Connection attempt from %s, %ld\n", "192.168.1.1", i));
+  }
+} /* run_log_filtered */
+
+static unsigned saved_logformat;
+
+static void setup_log_binary()
+{
+  saved_logformat = global_options->logformat;
+  global_options->logformat = LOGFORMAT_BINARY;
+} /* setup_log_binary */
+
+static void teardown_log_binary()
+{
+  log_flush(FALSE);
+  global_options->logformat = saved_logformat;
+} /* teardown_log_binary */
+
+static int bench_panic_format(char *out, size_t len, const char *f, ...)
+{
+  va_list ap;
+  int ok;
+
+  va_start(ap, f);
+  ok = panic_vformat(out, len, f, ap);
+  va_end(ap);
+  return ok;
+} /* bench_panic_format */
+
+/* what PANIC does, short of logging and exiting */
+static void run_panic_format(long ops)
+{
+  char msg2[255];
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    strncpy(GLOBAL_FILE, __FILE__, 200);
+    strncpy(GLOBAL_LINE, TO_STRING(__LINE__), 200);
+    memset(msg2, 0, sizeof(msg2));
+    sink += bench_panic_format(msg2, sizeof(msg2), "Cannot open %s, error %d, "
+                               "%s\n", "logfile", ENOSPC, strerror(ENOSPC));
+    strncpy(GLOBAL_FILE, "", 1);
+    strncpy(GLOBAL_LINE, "", 1);
+  }
+} /* run_panic_format */
+
+/* filtered_accept's list */
+static int squash_errors[] = { SOCKET_SQUASHED_ERRORS };
+
+static void run_isset_first(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    sink += INT_ISSET(squash_errors, ECONNREFUSED);
+  }
+} /* run_isset_first */
+
+static void run_isset_miss(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    sink += INT_ISSET(squash_errors, EMFILE);
+  }
+} /* run_isset_miss */
+
+static char conf_name[FILENAME_LEN];
+static char saved_conf_name[FILENAME_LEN];
+
+/* a config file of the usual size, comments included */
+static void setup_configfile()
+{
+  FILE *f;
+
+  snprintf(conf_name, sizeof(conf_name), "/tmp/microbench.%d.conf",
+           (int)getpid());
+  f = fopen(conf_name, "w");
+  if (f == NULL)
+  {
+    PANIC(("Can't create %s, error %d, %s\n", conf_name, errno,
+           strerror(errno)));
+  }
+  fprintf(f, "# daemon configuration\n\n"
+          "# where to listen\nportnum = 3000\n\n"
+          "# children\nmaxchild = 50\n"
+          "   # indented comment\n"
+          "loglevel = 1\n"
+          "logsync = none\n"
+          "logbatch = 64\n"
+          "logflushms = 100\n"
+          "logformat = text\n"
+          "loglevel_socket = 2\n"
+          "lograte_connect = 100\n"
+          "logsample_reap = 1\n"
+          "logsummary = 10\n"
+          "rusageprefix = 24\n"
+          "rusagesummary = 60\n");
+  fclose(f);
+  strcpy(saved_conf_name, global_options->configfilename);
+  strcpy(global_options->configfilename, conf_name);
+} /* setup_configfile */
+
+/* a config file of the size an allow-list or route table makes */
+static void setup_configfile_big()
+{
+  FILE *f;
+  int i;
+
+  snprintf(conf_name, sizeof(conf_name), "/tmp/microbench.%d.conf",
+           (int)getpid());
+  f = fopen(conf_name, "w");
+  if (f == NULL)
+  {
+    PANIC(("Can't create %s, error %d, %s\n", conf_name, errno,
+           strerror(errno)));
+  }
+  for (i = 0; i < MB_BIG_CONF_LINES; i++)
+  {
+    if (i % 10 == 0)
+    {
+      fprintf(f, "# entry %d\n", i);
+    }
+    fprintf(f, "lograte_connect = %d\n", i % 1000);
+  }
+  fclose(f);
+  strcpy(saved_conf_name, global_options->configfilename);
+  strcpy(global_options->configfilename, conf_name);
+} /* setup_configfile_big */
+
+static void run_configfile(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    sink += process_configfile(global_options);
+  }
+} /* run_configfile */
+
+static void teardown_configfile()
+{
+  unlink(conf_name);
+  strcpy(global_options->configfilename, saved_conf_name);
+  /* back to what the benchmarks before expect */
+  global_options->loglevel = 1;
+  log_apply_levels();
+} /* teardown_configfile */
+
+static int listener = -1;
+
+/* a listening socket that never has a connection, so every accept()
+   fails with EAGAIN, which filtered_accept() squashes */
+static void setup_accept()
+{
+  struct sockaddr_in sin;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  listener = socket(AF_INET, SOCK_STREAM, 0);
+  if ((listener < 0) ||
+      (bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0) ||
+      (listen(listener, 5) < 0) ||
+      (fcntl(listener, F_SETFL, O_NONBLOCK) < 0))
+  {
+    PANIC(("Can't make a listening socket, error %d, %s\n", errno,
+           strerror(errno)));
+  }
+} /* setup_accept */
+
+static void run_accept(long ops)
+{
+  struct sockaddr_in sin;
+  socklen_t len;
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    len = sizeof(sin);
+    sink += filtered_accept(listener, (struct sockaddr *)&sin, &len);
+  }
+} /* run_accept */
+
+static void teardown_accept()
+{
+  close(listener);
+  listener = -1;
+} /* teardown_accept */
+
+/* an ACL of MB_ACL_RULES random IPv4 prefixes, /8 to /32, checked
+   against addresses of which about half are inside one of them */
+static void setup_acl()
+{
+  FILE *f;
+  acl *a;
+  unsigned long addr;
+  int bits;
+  int i;
+
+  snprintf(conf_name, sizeof(conf_name), "/tmp/microbench.%d.acl",
+           (int)getpid());
+  f = fopen(conf_name, "w");
+  if (f == NULL)
+  {
+    PANIC(("Can't create %s, error %d, %s\n", conf_name, errno,
+           strerror(errno)));
+  }
+  srandom(1);
+  for (i = 0; i < MB_ACL_RULES; i++)
+  {
+    addr = ((unsigned long)random() << 1) ^ random();
+    bits = 8 + random() % 25;
+    fprintf(f, "%s %lu.%lu.%lu.%lu/%d\n", (i % 2) ? "allow" : "deny",
+            (addr >> 24) & 255, (addr >> 16) & 255, (addr >> 8) & 255,
+            addr & 255, bits);
+    if (i < MB_ACL_ADDRS)
+    {
+      /* a rule's prefix, or anywhere */
+      if (i % 2 == 0)
+      {
+        addr ^= random() & ((bits == 32) ? 0 : (0xffffffffUL >> bits));
+      }
+      else
+      {
+        addr = ((unsigned long)random() << 1) ^ random();
+      }
+      memset(&acl_addr[i], 0, sizeof(acl_addr[i]));
+      acl_addr[i].sin_family = AF_INET;
+      acl_addr[i].sin_addr.s_addr = htonl((unsigned)addr);
+    }
+  }
+  fclose(f);
+  if (acl_build(conf_name, ACL_ALLOW, &a) != TRUE)
+  {
+    PANIC(("Can't build the ACL in %s\n", conf_name));
+  }
+  acl_use(a);
+} /* setup_acl */
+
+static void run_acl(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    sink += acl_check((struct sockaddr *)&acl_addr[i % MB_ACL_ADDRS]);
+  }
+} /* run_acl */
+
+static void teardown_acl()
+{
+  acl_use(NULL);
+  unlink(conf_name);
+} /* teardown_acl */
+
+static void run_flight(long ops)
+{
+  long i;
+
+  for (i = 0; i < ops; i++)
+  {
+    flight_record(FL_READ, 0, 4, i);
+  }
+} /* run_flight */
+
+static microbench benches[] =
+{
+  { "log_msg", "LOG() at an enabled level, text format",
+    NULL, run_log_enabled, NULL },
+  { "log_msg_binary", "LOG() at an enabled level, binary format",
+    setup_log_binary, run_log_enabled, teardown_log_binary },
+  { "log_filtered", "LOG() above the loglevel",
+    NULL, run_log_filtered, NULL },
+  { "panic_format", "PANIC's message formatting",
+    NULL, run_panic_format, NULL },
+  { "int_isset_first", "INT_ISSET() matching the first entry",
+    NULL, run_isset_first, NULL },
+  { "int_isset_miss", "INT_ISSET() matching nothing",
+    NULL, run_isset_miss, NULL },
+  { "process_configfile", "parsing a 20 line config file",
+    setup_configfile, run_configfile, teardown_configfile },
+  { "process_configfile_big", "parsing a config file of 10000 entries",
+    setup_configfile_big, run_configfile, teardown_configfile },
+  { "filtered_accept", "accept() failing EAGAIN, squashed",
+    setup_accept, run_accept, teardown_accept },
+  { "acl_check", "an IPv4 client against 100000 prefixes",
+    setup_acl, run_acl, teardown_acl },
+  { "flight_record", "recording a flight recorder event",
+    NULL, run_flight, NULL },
+};
+
+#define MB_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/* -------- the harness -------- */
+
+static double now_ns()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+} /* now_ns */
+
+static int by_value(const void *a, const void *b)
+{
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+
+  return (da < db) ? -1 : ((da > db) ? 1 : 0);
+} /* by_value */
+
+/* Runs b until MB_WARMUP_MS have gone, and at least MB_WARMUP_ROUNDS
+   times, doubling the operations each time. The first call isn't timed,
+   since it may do one-off work like building a table, and a run sized
+   from it would be one operation. Returns the operations that take
+   about run_ms. */
+static long warmup(const microbench *b, double run_ms)
+{
+  double start;
+  double t;
+  double per_op = 0;
+  long ops = 1;
+  int rounds = 0;
+
+  b->run(1);
+  start = now_ns();
+  while ((rounds < MB_WARMUP_ROUNDS) ||
+         (now_ns() - start < MB_WARMUP_MS * 1e6))
+  {
+    t = now_ns();
+    b->run(ops);
+    per_op = (now_ns() - t) / ops;
+    rounds++;
+    if (ops < (1L << 30))
+    {
+      ops *= 2;
+    }
+  }
+  if (per_op <= 0)
+  {
+    per_op = 1;
+  }
+  ops = (long)(run_ms * 1e6 / per_op);
+  return (ops < 1) ? 1 : ops;
+} /* warmup */
+
+static void measure(const microbench *b, int reps, double run_ms)
+{
+  double ns[MB_MAX_REPS];
+  double cycles[MB_MAX_REPS];
+  unsigned long long c;
+  double t;
+  long ops;
+  int r;
+
+  if (b->setup != NULL)
+  {
+    b->setup();
+  }
+  ops = warmup(b, run_ms);
+  for (r = 0; r < reps; r++)
+  {
+    t = now_ns();
+    c = MB_CYCLES();
+    b->run(ops);
+    cycles[r] = (double)(MB_CYCLES() - c) / ops;
+    ns[r] = (now_ns() - t) / ops;
+  }
+  if (b->teardown != NULL)
+  {
+    b->teardown();
+  }
+  log_flush(FALSE);
+
+  qsort(ns, reps, sizeof(double), by_value);
+  qsort(cycles, reps, sizeof(double), by_value);
+  fprintf(results, "%-20s %10ld %10.1f %10.1f %10.1f %7.1f%%", b->name, ops,
+          ns[0], ns[reps / 2], ns[reps - 1],
+          100 * (ns[reps - 1] - ns[0]) / ns[reps / 2]);
+  if (MB_HAVE_CYCLES)
+  {
+    fprintf(results, " %10.0f", cycles[reps / 2]);
+  }
+  else
+  {
+    fprintf(results, " %10s", "-");
+  }
+  fprintf(results, "  %s\n", b->what);
+  fflush(results);
+} /* measure */
+
+static int wanted(const char *name, int argc, char **argv)
+{
+  int i;
+
+  if (optind >= argc)
+  {
+    return TRUE;
+  }
+  for (i = optind; i < argc; i++)
+  {
+    if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+    {
+      return TRUE;
+    }
+  }
+  return FALSE;
+} /* wanted */
+
+static void usage()
+{
+  fprintf(stderr, "usage: microbench [-r reps] [-m ms] [name ...]\n");
+  fprintf(stderr, "       -r reps  timed runs of each, default 11\n");
+  fprintf(stderr, "       -m ms    length of each run, default 20\n");
+  fprintf(stderr, "       name     only benchmarks starting with name\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  double run_ms = 20;
+  int reps = 11;
+  int devnull;
+  unsigned i;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "r:m:h")) != -1)
+  {
+    switch (ch)
+    {
+    case 'r':
+      reps = atoi(optarg);
+      break;
+    case 'm':
+      run_ms = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((reps <= 0) || (reps > MB_MAX_REPS) || (run_ms <= 0))
+  {
+    usage();
+  }
+
+  /* results on the real stdout, the log on /dev/null as fd 1 */
+  results = fdopen(dup(1), "w");
+  devnull = open("/dev/null", O_WRONLY);
+  if ((results == NULL) || (devnull < 0) || (dup2(devnull, 1) < 0))
+  {
+    fprintf(stderr, "microbench: can't redirect stdout: %s\n",
+            strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  close(devnull);
+
+  global_options = malloc(sizeof(options));
+  if (global_options == NULL)
+  {
+    fprintf(stderr, "microbench: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  initialise_options(global_options);
+  fill_default_options(global_options);
+  global_options->foregroundonly = TRUE;
+  global_options->loglevel = 1;
+  log_start();
+  metrics_start();
+
+  fprintf(results, "# %-18s %10s %10s %10s %10s %8s %10s\n", "benchmark",
+          "ops/run", "min_ns", "median_ns", "max_ns", "spread",
+          "cycles");
+  for (i = 0; i < MB_BENCHES; i++)
+  {
+    if (wanted(benches[i].name, argc, argv) == TRUE)
+    {
+      measure(&benches[i], reps, run_ms);
+    }
+  }
+
+  metrics_finish();
+  log_finish();
+  return 0;
+
+} /* main */
@@ -0,0 +1,402 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* placement.c
+
+   Which CPU each connection child runs on. Left alone, children inherit
+   the master's affinity and the scheduler spreads them over every CPU,
+   so a child's cache and memory are often on a different socket from
+   the CPU that took the interrupt for its connection. The placement
+   option picks one CPU per child from the cpulist option (by default
+   every CPU the master may use), in the master before fork(), and the
+   child pins itself there straight after:
+
+       roundrobin   the next CPU in the list
+       leastloaded  the CPU in the list running fewest of our children,
+                    counted from the child table
+       incoming     the CPU the kernel says handled the connection's
+                    packets (SO_INCOMING_CPU), so usually the same as
+                    the NIC queue's interrupt; leastloaded if that isn't
+                    known or isn't in the list
+
+   The pinned child also asks for local memory allocation (MPOL_LOCAL),
+   whatever policy the master was started with, so that the pages it
+   touches come from the node of the CPU it is on.
+
+   Counts of children placed, by CPU and NUMA node, are given by the
+   admin command "placement", and the totals are counters in the
+   statistics segment, so runs with different policies can be compared.
+
+   busycpus are dedicated to the processes that spin waiting for work
+   (see busyspin in socket.c): in TCP mode the master runs on the first
+   of them, and UDP workers are pinned to them in turn. Nothing else is
+   placed there, and connection children, which would otherwise inherit
+   the master's pinning, go back to the CPUs the master started with,
+   less busycpus. With udpsteer the UDP workers are pinned in turn to
+   the CPUs in the list even without busycpus, so that each has a CPU
+   for packets to be steered by (see socket_steer()).
+
+*/
+
+#define _GNU_SOURCE  /* sched_setaffinity() and CPU_xx */
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include "global.h"
+#include "placement.h"
+#include "childtab.h"
+#include "metrics.h"
+#include "log.h"
+
+#define MPOL_LOCAL_VALUE 4  /* MPOL_LOCAL, an enum so there's no #ifdef */
+
+static int cpus[PLACEMENT_CPUS];             /* the CPUs to use, ascending */
+static int ncpus = 0;
+static unsigned char usable[PLACEMENT_CPUS]; /* TRUE if in cpus[] */
+static int node[PLACEMENT_CPUS];             /* NUMA node, -1 if unknown */
+static unsigned long long placed[PLACEMENT_CPUS]; /* children put there */
+static unsigned load[PLACEMENT_CPUS];        /* see placement_choose */
+static unsigned next = 0;                    /* round robin, and ties */
+static cpu_set_t home;                       /* the master's at the start */
+static cpu_set_t others;                     /* home less busycpus */
+static int busy[PLACEMENT_CPUS];             /* busycpus, ascending */
+static int nbusy = 0;
+static int pinned = FALSE;                   /* the master is on busy[0] */
+
+static const char *policy_names[] =
+{
+  "none", "roundrobin", "leastloaded", "incoming"
+};
+
+/* Parses a list of CPUs like "0-3,8,10-11" into want[PLACEMENT_CPUS],
+   which may be NULL to just check it. Returns how many CPUs it names,
+   or -1 if it isn't a list of CPUs. */
+int placement_cpulist(const char *s, unsigned char *want)
+{
+  long from;
+  long to;
+  char *end;
+  int n = 0;
+
+  if (want != NULL)
+  {
+    memset(want, FALSE, PLACEMENT_CPUS);
+  }
+  while (*s != '\0')
+  {
+    from = strtol(s, &end, 10);
+    if ((end == s) || (from < 0) || (from >= PLACEMENT_CPUS))
+    {
+      return -1;
+    }
+    to = from;
+    s = end;
+    if (*s == '-')
+    {
+      s++;
+      to = strtol(s, &end, 10);
+      if ((end == s) || (to < from) || (to >= PLACEMENT_CPUS))
+      {
+        return -1;
+      }
+      s = end;
+    }
+    for (; from <= to; from++)
+    {
+      if (want != NULL)
+      {
+        want[from] = TRUE;
+      }
+      n++;
+    }
+    if (*s == ',')
+    {
+      s++;
+    }
+    else if (*s != '\0')
+    {
+      return -1;
+    }
+  }
+  return n;
+} /* placement_cpulist */
+
+/* The NUMA node of cpu from sysfs, or -1 if there isn't one */
+static int cpu_node(int cpu)
+{
+  char path[64];
+  struct dirent *d;
+  DIR *dir;
+  int n = -1;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+  dir = opendir(path);
+  if (dir == NULL)
+  {
+    return -1;
+  }
+  while ((d = readdir(dir)) != NULL)
+  {
+    if ((strncmp(d->d_name, "node", 4) == 0) &&
+        (sscanf(d->d_name + 4, "%d", &n) == 1))
+    {
+      break;
+    }
+    n = -1;
+  }
+  closedir(dir);
+  return n;
+} /* cpu_node */
+
+/* Works out the CPUs to use from cpulist, busycpus and the master's own
+   affinity, as it was before placement_pin_master(). Called at startup
+   and after a reload */
+void placement_start()
+{
+  unsigned char want[PLACEMENT_CPUS];
+  unsigned char spin[PLACEMENT_CPUS];
+  int c;
+
+  if (strlen(global_options->cpulist) > 0)
+  {
+    (void)placement_cpulist(global_options->cpulist, want);
+  }
+  else
+  {
+    memset(want, TRUE, sizeof(want));
+  }
+  memset(spin, FALSE, sizeof(spin));
+  if (strlen(global_options->busycpus) > 0)
+  {
+    (void)placement_cpulist(global_options->busycpus, spin);
+  }
+  if (pinned == FALSE)
+  {
+    CPU_ZERO(&home);
+    if (sched_getaffinity(0, sizeof(home), &home) < 0)
+    {
+      LOG(1, ("Can't get CPU affinity, children not placed\n"));
+    }
+  }
+
+  ncpus = 0;
+  nbusy = 0;
+  CPU_ZERO(&others);
+  for (c = 0; (c < PLACEMENT_CPUS) && (c < CPU_SETSIZE); c++)
+  {
+    if (!CPU_ISSET(c, &home))
+    {
+      usable[c] = FALSE;
+      continue;
+    }
+    if (spin[c] == TRUE)
+    {
+      busy[nbusy++] = c;
+      usable[c] = FALSE;
+      continue;
+    }
+    CPU_SET(c, &others);
+    usable[c] = want[c];
+    if (usable[c] == TRUE)
+    {
+      cpus[ncpus++] = c;
+      node[c] = cpu_node(c);
+    }
+  }
+  if ((strlen(global_options->busycpus) > 0) && (nbusy == 0))
+  {
+    LOG(1, ("busycpus \"%s\" has none of the CPUs the daemon may use, "
+            "nothing pinned\n", global_options->busycpus));
+  }
+  if ((nbusy > 0) && (CPU_COUNT(&others) == 0) &&
+      (global_options->protocol == PROTOCOL_TCP))
+  {
+    LOG(1, ("busycpus \"%s\" leaves no other CPUs, so children will "
+            "share them with the spinning\n", global_options->busycpus));
+  }
+
+  if (global_options->placement == PLACEMENT_NONE)
+  {
+    return;
+  }
+  if (ncpus == 0)
+  {
+    LOG(1, ("cpulist \"%s\" has none of the CPUs the daemon may use, "
+            "children not placed\n", global_options->cpulist));
+    return;
+  }
+  LOG(2, ("Placing children %s over %d CPUs\n",
+          policy_names[global_options->placement], ncpus));
+} /* placement_start */
+
+/* The CPU in the list running fewest of our children. Ties go round,
+   so that an idle daemon still spreads children */
+static int least_loaded()
+{
+  int best = -1;
+  int i;
+  int c;
+
+  childtab_load(load, PLACEMENT_CPUS);
+  next++;
+  for (i = 0; i < ncpus; i++)
+  {
+    c = cpus[(next + i) % ncpus];
+    if ((best < 0) || (load[c] < load[best]))
+    {
+      best = c;
+    }
+  }
+  return best;
+} /* least_loaded */
+
+/* Called in the master with SIGCHLD blocked, before forking a child for
+   connection fd. Returns the CPU the child should run on, or -1 */
+int placement_choose(int fd)
+{
+  int cpu = -1;
+#ifdef SO_INCOMING_CPU
+  socklen_t len = sizeof(cpu);
+#endif
+
+  if ((global_options->placement == PLACEMENT_NONE) || (ncpus == 0))
+  {
+    return -1;
+  }
+
+  switch (global_options->placement)
+  {
+  case PLACEMENT_ROUNDROBIN:
+    cpu = cpus[next++ % ncpus];
+    break;
+
+  case PLACEMENT_INCOMING:
+#ifdef SO_INCOMING_CPU
+    if ((getsockopt(fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) &&
+        (cpu >= 0) && (cpu < PLACEMENT_CPUS) && (usable[cpu] == TRUE))
+    {
+      metrics_count(MC_PLACED_NIC);
+      break;
+    }
+#endif
+    metrics_count(MC_PLACED_NIC_MISS);
+    cpu = least_loaded();
+    break;
+
+  default:
+    cpu = least_loaded();
+    break;
+  }
+
+  placed[cpu]++;
+  metrics_count(MC_PLACED);
+  return cpu;
+} /* placement_choose */
+
+/* In TCP mode, pins the master, which spins on the listeners, to the
+   first of busycpus. Called once, after placement_start() */
+void placement_pin_master()
+{
+  cpu_set_t set;
+
+  if ((nbusy == 0) || (global_options->protocol != PROTOCOL_TCP))
+  {
+    return;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(busy[0], &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0)
+  {
+    LOG(1, ("Can't pin the master to CPU %d, error %d, %s\n", busy[0],
+            errno, strerror(errno)));
+    return;
+  }
+  pinned = TRUE;
+  LOG(2, ("Master pinned to CPU %d\n", busy[0]));
+} /* placement_pin_master */
+
+/* The CPU UDP worker w is pinned to, from busycpus or for udpsteer, or
+   -1 if it is placed like any other child */
+int placement_worker_cpu(int w)
+{
+  if (nbusy > 0)
+  {
+    return busy[w % nbusy];
+  }
+  if ((global_options->udpsteer == TRUE) && (ncpus > 0))
+  {
+    return cpus[w % ncpus];
+  }
+  return -1;
+} /* placement_worker_cpu */
+
+/* Called in the new child, pins it to cpu. If cpu is -1 it stays where
+   the master is, or if the master is pinned, goes back where it was */
+void placement_apply(int cpu)
+{
+  cpu_set_t set;
+
+  if ((cpu < 0) && (pinned == TRUE))
+  {
+    (void)sched_setaffinity(0, sizeof(others), &others);
+    return;
+  }
+  if (cpu < 0)
+  {
+    return;
+  }
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) < 0)
+  {
+    metrics_count(MC_PLACE_FAILED);
+    LOG(2, ("Can't run on CPU %d, staying where I am\n", cpu));
+    return;
+  }
+#ifdef SYS_set_mempolicy
+  /* now the CPU is fixed, its node is the local one. Fails harmlessly
+     on kernels without NUMA */
+  (void)syscall(SYS_set_mempolicy, MPOL_LOCAL_VALUE, NULL, 0);
+#endif
+} /* placement_apply */
+
+/* The admin command "placement" */
+void placement_write(FILE *out, const char *args)
+{
+  int i;
+  int c;
+
+  fprintf(out, "placement %s over %d CPUs%s%s\n",
+          policy_names[global_options->placement], ncpus,
+          (strlen(global_options->cpulist) > 0) ? ", cpulist " : "",
+          global_options->cpulist);
+  if (nbusy > 0)
+  {
+    fprintf(out, "busycpus %s, master %s\n", global_options->busycpus,
+            (pinned == TRUE) ? "pinned" : "not pinned");
+  }
+  childtab_block();
+  childtab_load(load, PLACEMENT_CPUS);
+  childtab_unblock();
+  fprintf(out, "%-5s %-5s %10s %14s\n", "cpu", "node", "children", "placed");
+  for (i = 0; i < ncpus; i++)
+  {
+    c = cpus[i];
+    fprintf(out, "%-5d %-5d %10u %14llu\n", c, node[c], load[c], placed[c]);
+  }
+} /* placement_write */
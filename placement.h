@@ -0,0 +1,26 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* placement.h
+
+*/
+
+#include <stdio.h>
+
+#define PLACEMENT_CPUS 1024  /* CPUs numbered from here up are ignored */
+
+int placement_cpulist(const char *s, unsigned char *want);
+void placement_start();
+int placement_choose(int fd);
+void placement_apply(int cpu);
+void placement_pin_master();
+int placement_worker_cpu(int w);
+void placement_write(FILE *out, const char *args);
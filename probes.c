@@ -0,0 +1,43 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* probes.c
+
+   The semaphores for the probes in probes.h. A tracer finds them through
+   the ELF notes <sys/sdt.h> writes, and increments one while it is
+   attached to that probe.
+
+*/
+
+#include "probes.h"
+
+#ifdef DAEVEL_PROBES
+
+#define PROBE_SEMAPHORE_DEFINE(name) \
+unsigned short daevel_##name##_semaphore \
+  __attribute__((unused)) __attribute__((section(".probes"))) = 0;
+
+PROBE_SEMAPHORE_DEFINE(accept)
+PROBE_SEMAPHORE_DEFINE(fork_begin)
+PROBE_SEMAPHORE_DEFINE(fork_end)
+PROBE_SEMAPHORE_DEFINE(reap)
+PROBE_SEMAPHORE_DEFINE(child_start)
+PROBE_SEMAPHORE_DEFINE(child_end)
+PROBE_SEMAPHORE_DEFINE(log)
+PROBE_SEMAPHORE_DEFINE(log_write)
+PROBE_SEMAPHORE_DEFINE(panic)
+
+#else
+
+/* ANSI C doesn't allow an empty translation unit */
+static int no_probes __attribute__((unused)) = 0;
+
+#endif
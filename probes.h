@@ -0,0 +1,115 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* probes.h
+
+   Static tracepoints (USDT probes, as used by systemtap, bpftrace, perf
+   and dtrace) at the interesting points of the daemon. Provider is
+   "daevel". For example
+
+     bpftrace -e 'usdt:./daemon:daevel:fork_end { @ = hist(arg1); }'
+
+   When nothing is attached a probe is a nop instruction plus a test of
+   its semaphore, and the arguments are not even worked out. Probes need
+   <sys/sdt.h> (systemtap-sdt-dev or systemtap-sdt-devel) when building;
+   without it, or with -DNO_PROBES, they compile to nothing.
+
+   The probes and their arguments. Times are microseconds, addresses are
+   IPv4 in network byte order.
+
+   accept(fd, errno, addr)       filtered_accept() returning. fd is -1 on
+                                 error, and errno is after squashing
+   fork_begin(children, addr)    master about to fork() for a connection
+   fork_end(pid, usec)           fork() returned in the master. pid is -1
+                                 if it failed; usec is since accept()
+   reap(pid, children)           dead_child() reaped pid, leaving children
+   child_start(pid, name)        daemon_child_function() entered. name is
+                                 the client's hostname or address string
+   child_end(pid, usec, in, out) daemon_child_function() about to _exit().
+                                 usec since accept(), bytes in and out
+   log(level, format, len)       log_msg() queued a line of len bytes
+                                 (text or binary) from format
+   log_write(records, bytes)     the master wrote a batch to the logfile
+   panic(text)                   PANIC, just before exiting
+
+*/
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define DAEVEL_PROBES 1
+#endif
+#endif
+
+#ifdef DAEVEL_PROBES
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+/* one per probe, in probes.c, set by the tracer when it attaches */
+#define PROBE_SEMAPHORE(name) \
+extern unsigned short daevel_##name##_semaphore;
+
+PROBE_SEMAPHORE(accept)
+PROBE_SEMAPHORE(fork_begin)
+PROBE_SEMAPHORE(fork_end)
+PROBE_SEMAPHORE(reap)
+PROBE_SEMAPHORE(child_start)
+PROBE_SEMAPHORE(child_end)
+PROBE_SEMAPHORE(log)
+PROBE_SEMAPHORE(log_write)
+PROBE_SEMAPHORE(panic)
+
+#define PROBE_ENABLED(name) __builtin_expect(daevel_##name##_semaphore, 0)
+
+#define PROBE_ACCEPT(fd, err, addr) \
+if (PROBE_ENABLED(accept)) STAP_PROBE3(daevel, accept, fd, err, addr)
+#define PROBE_FORK_BEGIN(children, addr) \
+if (PROBE_ENABLED(fork_begin)) STAP_PROBE2(daevel, fork_begin, children, addr)
+#define PROBE_FORK_END(pid, usec) \
+if (PROBE_ENABLED(fork_end)) STAP_PROBE2(daevel, fork_end, pid, usec)
+#define PROBE_REAP(pid, children) \
+if (PROBE_ENABLED(reap)) STAP_PROBE2(daevel, reap, pid, children)
+#define PROBE_CHILD_START(pid, name) \
+if (PROBE_ENABLED(child_start)) STAP_PROBE2(daevel, child_start, pid, name)
+#define PROBE_CHILD_END(pid, usec, in, out) \
+if (PROBE_ENABLED(child_end)) \
+  STAP_PROBE4(daevel, child_end, pid, usec, in, out)
+#define PROBE_LOG(level, format, len) \
+if (PROBE_ENABLED(log)) STAP_PROBE3(daevel, log, level, format, len)
+#define PROBE_LOG_WRITE(records, bytes) \
+if (PROBE_ENABLED(log_write)) STAP_PROBE2(daevel, log_write, records, bytes)
+#define PROBE_PANIC(text) \
+if (PROBE_ENABLED(panic)) STAP_PROBE1(daevel, panic, text)
+
+#else
+
+/* arguments are "used", so no unused variable warnings, but never run */
+#define PROBE_ENABLED(name) 0
+#define PROBE_ACCEPT(fd, err, addr) \
+if (0) (void)(fd), (void)(err), (void)(addr)
+#define PROBE_FORK_BEGIN(children, addr) \
+if (0) (void)(children), (void)(addr)
+#define PROBE_FORK_END(pid, usec) \
+if (0) (void)(pid), (void)(usec)
+#define PROBE_REAP(pid, children) \
+if (0) (void)(pid), (void)(children)
+#define PROBE_CHILD_START(pid, name) \
+if (0) (void)(pid), (void)(name)
+#define PROBE_CHILD_END(pid, usec, in, out) \
+if (0) (void)(pid), (void)(usec), (void)(in), (void)(out)
+#define PROBE_LOG(level, format, len) \
+if (0) (void)(level), (void)(format), (void)(len)
+#define PROBE_LOG_WRITE(records, bytes) \
+if (0) (void)(records), (void)(bytes)
+#define PROBE_PANIC(text) \
+if (0) (void)(text)
+
+#endif /* DAEVEL_PROBES */
@@ -0,0 +1,612 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* profile.c
+
+   A sampling profiler, for when perf can't be attached. The admin
+   command "profile 30", or SIGUSR2 for PROFILE_SIGNAL_SECS, samples the
+   master and every child for that many seconds, profilehz times a
+   second of CPU each uses, and afterwards writes the stacks seen to
+   profilefile in the folded format flamegraph.pl and speedscope read:
+
+       daemon;main;wait_for_connection;poll 12
+       child;main;daemon_child_function;_IO_getc 3
+
+   one line per distinct stack, root first, then how many samples had
+   it. The first frame says which kind of process it came from.
+
+   Each process has its own CPU-time timer (timer_create() on
+   CLOCK_PROCESS_CPUTIME_ID) raising SIGPROF. The handler takes the next
+   slot, with an atomic add, in a ring of profilesamples samples that
+   the master mmap()ed shared before anything was forked, and fills it
+   with backtrace(). Nothing is allocated, locked or printed there;
+   backtrace() is called once beforehand, since the first call loads
+   libgcc. When the ring is full further samples are dropped and
+   counted.
+
+   Timers aren't inherited across fork(), so a child forked while
+   profiling starts its own, and the master sends a SIGPROF to the
+   children already running, which their handler takes as the cue to
+   start one. A child waiting for its client uses no CPU and so takes
+   no samples, which is the point: the profile shows where CPU goes.
+
+   The handler times itself, so the report can say what profiling cost
+   as a share of the CPU time it sampled.
+
+   Functions are named from the daemon's own ELF symbol table, read
+   from /proc/self/exe when the profile is written, so static ones are
+   too; anything outside it, such as libc, is named by dladdr(). A
+   stripped binary gives addresses.
+
+*/
+
+#define _GNU_SOURCE  /* dladdr() */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <link.h>    /* ElfW() */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "global.h"
+#include "profile.h"
+#include "childtab.h"
+#include "metrics.h"
+#include "log.h"
+
+/* ELF32_ST_TYPE or ELF64_ST_TYPE, whichever ElfW(Sym) is */
+#define ELFW_ST_TYPE(info) _ElfW(ELF, __ELF_NATIVE_CLASS, ST_TYPE)(info)
+
+#define PROFILE_SKIP 2  /* frames for the handler and the signal trampoline */
+#define PROFILE_SETTLE_US 200000ULL  /* for children to see it's over */
+
+/* values for profile_ring.state */
+#define PROFILE_OFF 0
+#define PROFILE_ON 1
+#define PROFILE_DONE 2
+
+typedef struct
+{
+  unsigned long long started_us;  /* metrics_now() */
+  unsigned long long until_us;    /* sampling stops then */
+  unsigned long long next;        /* next free sample */
+  unsigned long long dropped;     /* samples lost, the ring being full */
+  unsigned long long handler_ns;  /* time spent taking samples */
+  unsigned long long interval_ns; /* CPU time between samples */
+  unsigned hz;
+  volatile int state;             /* PROFILE_xx */
+}
+profile_ring;
+
+typedef struct
+{
+  volatile pid_t pid;   /* who took it; written last, 0 until then */
+  int master;           /* TRUE if the master took it */
+  int depth;            /* frames in pc[] */
+  int pad;
+  void *pc[PROFILE_DEPTH];
+}
+profile_sample;
+
+typedef struct
+{
+  unsigned long addr;   /* as in the file, before relocation */
+  unsigned long size;
+  const char *name;     /* into the mapped file */
+}
+profile_symbol;
+
+static profile_ring *ring = NULL;
+static profile_sample *samples = NULL;
+static unsigned long long capacity = 0;
+static int is_master = FALSE;
+static timer_t timer;
+static int have_timer = FALSE;
+static int armed = FALSE;
+
+static profile_symbol *symbols = NULL;
+static size_t nsymbols = 0;
+static unsigned long bias = 0;  /* where the daemon was loaded */
+static int symbols_tried = FALSE;
+
+/* Starts this process's CPU-time timer. timer_create() isn't on the
+   list of async-signal-safe functions, but for SIGEV_SIGNAL glibc's is
+   just the system call, and a child only gets here once */
+static void arm(unsigned long long interval_ns)
+{
+  struct sigevent sev;
+  struct itimerspec its;
+
+  if (have_timer == FALSE)
+  {
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGPROF;
+    if (timer_create(CLOCK_PROCESS_CPUTIME_ID, &sev, &timer) < 0)
+    {
+      return;
+    }
+    have_timer = TRUE;
+  }
+  its.it_interval.tv_sec = interval_ns / 1000000000ULL;
+  its.it_interval.tv_nsec = interval_ns % 1000000000ULL;
+  its.it_value = its.it_interval;
+  if (timer_settime(timer, 0, &its, NULL) == 0)
+  {
+    armed = TRUE;
+  }
+} /* arm */
+
+static void disarm()
+{
+  struct itimerspec its;
+
+  if (have_timer == TRUE)
+  {
+    memset(&its, 0, sizeof(its));
+    (void)timer_settime(timer, 0, &its, NULL);
+  }
+  armed = FALSE;
+} /* disarm */
+
+/* SIGPROF, in any process. Must stay async-signal-safe */
+static void profile_signal(int signum)
+{
+  struct timespec t0;
+  struct timespec t1;
+  unsigned long long now_us;
+  unsigned long long i;
+  profile_sample *s;
+  int saved_errno = errno;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  now_us = (unsigned long long)t0.tv_sec * 1000000 + t0.tv_nsec / 1000;
+  if ((ring == NULL) || (ring->state != PROFILE_ON) ||
+      (now_us >= ring->until_us))
+  {
+    if (armed == TRUE)
+    {
+      disarm();
+    }
+    errno = saved_errno;
+    return;
+  }
+  if (armed == FALSE)
+  {
+    arm(ring->interval_ns);  /* the master's cue, see the top of the file */
+    errno = saved_errno;
+    return;
+  }
+
+  i = __sync_fetch_and_add(&ring->next, 1);
+  if (i >= capacity)
+  {
+    __sync_fetch_and_add(&ring->dropped, 1);
+  }
+  else
+  {
+    s = &samples[i];
+    s->master = is_master;
+    s->depth = backtrace(s->pc, PROFILE_DEPTH);
+    __sync_synchronize();
+    s->pid = getpid();
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  __sync_fetch_and_add(&ring->handler_ns,
+                       (unsigned long long)(t1.tv_sec - t0.tv_sec) *
+                       1000000000 + t1.tv_nsec - t0.tv_nsec);
+  errno = saved_errno;
+} /* profile_signal */
+
+/* Called by the master before the first fork(). Not fatal if it fails,
+   there's just no profiler */
+void profile_init()
+{
+  struct sigaction sa;
+  void *warm[2];
+  size_t size;
+
+  capacity = global_options->profilesamples;
+  size = sizeof(profile_ring) + capacity * sizeof(profile_sample);
+  ring = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+              -1, 0);
+  if (ring == MAP_FAILED)
+  {
+    ring = NULL;
+    LOG(1, ("No profiler: can't map %lu bytes, error %d, %s\n",
+            (unsigned long)size, errno, strerror(errno)));
+    return;
+  }
+  samples = (profile_sample *)(ring + 1);
+  ring->state = PROFILE_OFF;
+  is_master = TRUE;
+
+  (void)backtrace(warm, 2);  /* now, rather than first in the handler */
+
+  sigemptyset(&sa.sa_mask);
+  sa.sa_handler = &profile_signal;
+  /* or a child reading from its client would see EINTR */
+  sa.sa_flags = SA_RESTART;
+  if (sigaction(SIGPROF, &sa, NULL) < 0)
+  {
+    LOG(1, ("No profiler: sigaction gave error %d, %s\n", errno,
+            strerror(errno)));
+    munmap(ring, size);
+    ring = NULL;
+  }
+} /* profile_init */
+
+/* Called in each new child */
+void profile_forked()
+{
+  is_master = FALSE;
+  have_timer = FALSE;  /* the master's, not ours */
+  armed = FALSE;
+  if ((ring != NULL) && (ring->state == PROFILE_ON))
+  {
+    arm(ring->interval_ns);
+  }
+} /* profile_forked */
+
+/* Starts the master and all children sampling for secs seconds.
+   Returns FALSE if they already are, or there is no profiler */
+int profile_begin(unsigned secs)
+{
+  unsigned long long used;
+  unsigned long long i;
+
+  if ((ring == NULL) || (ring->state == PROFILE_ON))
+  {
+    return FALSE;
+  }
+  used = (ring->next < capacity) ? ring->next : capacity;
+  for (i = 0; i < used; i++)
+  {
+    samples[i].pid = 0;
+  }
+  ring->next = 0;
+  ring->dropped = 0;
+  ring->handler_ns = 0;
+  ring->hz = global_options->profilehz;
+  ring->interval_ns = 1000000000ULL / ring->hz;
+  ring->started_us = metrics_now();
+  ring->until_us = ring->started_us + 1000000ULL * secs;
+  __sync_synchronize();
+  ring->state = PROFILE_ON;
+
+  arm(ring->interval_ns);
+  childtab_block();
+  childtab_kill(SIGPROF);
+  childtab_unblock();
+  LOG(1, ("Profiling for %us at %uHz\n", secs, ring->hz));
+  return TRUE;
+} /* profile_begin */
+
+int profile_active()
+{
+  return ((ring != NULL) && (ring->state == PROFILE_ON)) ? TRUE : FALSE;
+} /* profile_active */
+
+static int symbol_compare(const void *a, const void *b)
+{
+  const profile_symbol *x = a;
+  const profile_symbol *y = b;
+
+  return (x->addr < y->addr) ? -1 : (x->addr > y->addr);
+} /* symbol_compare */
+
+/* Reads the function symbols of the daemon itself, once. The file stays
+   mapped, since the names point into it */
+static void load_symbols()
+{
+  ElfW(Ehdr) *eh;
+  ElfW(Shdr) *sh;
+  ElfW(Sym) *sym;
+  Dl_info info;
+  struct stat st;
+  const char *strtab;
+  char *image;
+  size_t i;
+  size_t n;
+  int want;
+  int fd;
+
+  symbols_tried = TRUE;
+  fd = open("/proc/self/exe", O_RDONLY);
+  if (fd < 0)
+  {
+    return;
+  }
+  if (fstat(fd, &st) < 0)
+  {
+    close(fd);
+    return;
+  }
+  image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED)
+  {
+    return;
+  }
+  eh = (ElfW(Ehdr) *)image;
+  if ((st.st_size < (off_t)sizeof(*eh)) ||
+      (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0) ||
+      (eh->e_shoff + eh->e_shnum * sizeof(*sh) > (size_t)st.st_size))
+  {
+    munmap(image, st.st_size);
+    return;
+  }
+  if ((eh->e_type == ET_DYN) && (dladdr((void *)&profile_init, &info) != 0))
+  {
+    bias = (unsigned long)info.dli_fbase;
+  }
+
+  /* the full table if it's there, else the dynamic one */
+  sh = (ElfW(Shdr) *)(image + eh->e_shoff);
+  for (want = SHT_SYMTAB; ; want = SHT_DYNSYM)
+  {
+    for (i = 0; (i < eh->e_shnum) && (sh[i].sh_type != want); i++)
+      ;
+    if ((i < eh->e_shnum) || (want == SHT_DYNSYM))
+    {
+      break;
+    }
+  }
+  if (i == eh->e_shnum)
+  {
+    munmap(image, st.st_size);
+    return;
+  }
+
+  sym = (ElfW(Sym) *)(image + sh[i].sh_offset);
+  strtab = image + sh[sh[i].sh_link].sh_offset;
+  n = sh[i].sh_size / sizeof(*sym);
+  symbols = malloc(n * sizeof(profile_symbol));
+  if (symbols == NULL)
+  {
+    munmap(image, st.st_size);
+    return;
+  }
+  for (i = 0; i < n; i++)
+  {
+    if ((ELFW_ST_TYPE(sym[i].st_info) == STT_FUNC) && (sym[i].st_value != 0))
+    {
+      symbols[nsymbols].addr = sym[i].st_value;
+      symbols[nsymbols].size = sym[i].st_size;
+      symbols[nsymbols].name = strtab + sym[i].st_name;
+      nsymbols++;
+    }
+  }
+  qsort(symbols, nsymbols, sizeof(profile_symbol), symbol_compare);
+} /* load_symbols */
+
+/* The name of the function containing pc, in buf if there isn't one */
+static const char *symbol_name(void *pc, char *buf, size_t len)
+{
+  unsigned long a = (unsigned long)pc - bias;
+  const char *slash;
+  Dl_info info;
+  size_t lo = 0;
+  size_t hi = nsymbols;
+  size_t mid;
+
+  /* the last symbol at or before a */
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (symbols[mid].addr <= a)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  if ((lo > 0) && (a < symbols[lo - 1].addr + symbols[lo - 1].size))
+  {
+    return symbols[lo - 1].name;
+  }
+
+  if (dladdr(pc, &info) != 0)
+  {
+    if (info.dli_sname != NULL)
+    {
+      return info.dli_sname;
+    }
+    if (info.dli_fname != NULL)
+    {
+      slash = strrchr(info.dli_fname, '/');
+      snprintf(buf, len, "[%s]", (slash == NULL) ? info.dli_fname : slash + 1);
+      return buf;
+    }
+  }
+  snprintf(buf, len, "%p", pc);
+  return buf;
+} /* symbol_name */
+
+static int sample_compare(const void *a, const void *b)
+{
+  const profile_sample *x = *(const profile_sample **)a;
+  const profile_sample *y = *(const profile_sample **)b;
+
+  if (x->master != y->master)
+  {
+    return x->master - y->master;
+  }
+  if (x->depth != y->depth)
+  {
+    return x->depth - y->depth;
+  }
+  return memcmp(x->pc, y->pc, x->depth * sizeof(void *));
+} /* sample_compare */
+
+/* Writes the samples taken as folded stacks. Returns the number of
+   distinct stacks */
+static int write_folded(FILE *out)
+{
+  profile_sample **sorted;
+  profile_sample *s;
+  unsigned long long used;
+  unsigned long long n = 0;
+  unsigned long long i;
+  unsigned long long run;
+  char buf[32];
+  int stacks = 0;
+  int f;
+
+  if (symbols_tried == FALSE)
+  {
+    load_symbols();
+  }
+  used = (ring->next < capacity) ? ring->next : capacity;
+  sorted = malloc((used + 1) * sizeof(profile_sample *));
+  if (sorted == NULL)
+  {
+    return 0;
+  }
+  for (i = 0; i < used; i++)
+  {
+    if (samples[i].pid != 0)
+    {
+      sorted[n++] = &samples[i];
+    }
+  }
+  qsort(sorted, n, sizeof(profile_sample *), sample_compare);
+
+  for (i = 0; i < n; i += run)
+  {
+    for (run = 1; (i + run < n) &&
+         (sample_compare(&sorted[i], &sorted[i + run]) == 0); run++)
+      ;
+    s = sorted[i];
+    fprintf(out, "%s", (s->master == TRUE) ? "daemon" : "child");
+    for (f = s->depth - 1; f >= PROFILE_SKIP; f--)
+    {
+      /* return addresses are just after the call, which may be the next
+         function; the interrupted one is exact */
+      fprintf(out, ";%s", symbol_name((f == PROFILE_SKIP) ? s->pc[f] :
+                                      (char *)s->pc[f] - 1,
+                                      buf, sizeof(buf)));
+    }
+    fprintf(out, " %llu\n", run);
+    stacks++;
+  }
+  free(sorted);
+  return stacks;
+} /* write_folded */
+
+/* One line on what the last profile found and cost */
+static void summary(FILE *out)
+{
+  unsigned long long taken = (ring->next < capacity) ? ring->next : capacity;
+
+  fprintf(out, "%llu samples at %uHz, %llu dropped, %lluns each to take, "
+          "%.3f%% of the CPU time sampled\n", taken, ring->hz, ring->dropped,
+          (taken > 0) ? ring->handler_ns / taken : 0,
+          (taken > 0) ? 100.0 * ring->handler_ns /
+          (taken * ring->interval_ns) : 0.0);
+} /* summary */
+
+/* Called from the master's main loop. Writes profilefile once the
+   children have had time to see that sampling is over */
+void profile_tick()
+{
+  char line[LOG_RECORD_LEN];
+  FILE *f;
+  int stacks;
+
+  if ((ring == NULL) || (ring->state != PROFILE_ON) ||
+      (metrics_now() < ring->until_us + PROFILE_SETTLE_US))
+  {
+    return;
+  }
+  disarm();  /* in case the master was idle at the end */
+  ring->state = PROFILE_DONE;
+
+  f = fopen(global_options->profilefile, "w");
+  if (f == NULL)
+  {
+    LOG(1, ("Can't write profile to %s, error %d, %s\n",
+            global_options->profilefile, errno, strerror(errno)));
+    return;
+  }
+  stacks = write_folded(f);
+  fclose(f);
+
+  f = fmemopen(line, sizeof(line), "w");
+  if (f != NULL)
+  {
+    summary(f);
+    fclose(f);
+    LOG(1, ("Profile of %d stacks written to %s: %s",
+            stacks, global_options->profilefile, line));
+  }
+} /* profile_tick */
+
+/* The admin command "profile [seconds]" */
+void profile_write(FILE *out, const char *args)
+{
+  unsigned long long now;
+  char *end;
+  long secs;
+
+  if (ring == NULL)
+  {
+    fprintf(out, "no profiler, see the log\n");
+    return;
+  }
+  if (*args != '\0')
+  {
+    secs = strtol(args, &end, 10);
+    if ((end == args) || (secs < 1) || (secs > 3600))
+    {
+      fprintf(out, "usage: profile [seconds], 1 to 3600\n");
+    }
+    else if (profile_begin(secs) != TRUE)
+    {
+      fprintf(out, "already profiling\n");
+    }
+    else
+    {
+      fprintf(out, "profiling for %lds at %uHz, then written to %s\n",
+              secs, ring->hz, global_options->profilefile);
+    }
+    return;
+  }
+
+  switch (ring->state)
+  {
+  case PROFILE_OFF:
+    fprintf(out, "not profiled yet, \"profile <seconds>\" starts\n");
+    break;
+
+  case PROFILE_ON:
+    now = metrics_now();
+    fprintf(out, "profiling, %llus to go, %llu samples so far\n",
+            (ring->until_us > now) ? (ring->until_us - now) / 1000000 : 0,
+            ring->next);
+    break;
+
+  default:
+    summary(out);
+    (void)write_folded(out);
+    break;
+  }
+} /* profile_write */
@@ -0,0 +1,26 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* profile.h
+
+*/
+
+#include <stdio.h>
+
+#define PROFILE_DEPTH 32         /* stack frames kept per sample */
+#define PROFILE_SIGNAL_SECS 10   /* how long SIGUSR2 profiles for */
+
+void profile_init();
+void profile_forked();
+int profile_begin(unsigned secs);
+void profile_tick();
+int profile_active();
+void profile_write(FILE *out, const char *args);
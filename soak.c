@@ -0,0 +1,440 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* soak.c
+
+   daevel-soak: churns short connections through a running daemon while
+   killing its children at random, and checks that the daemon's books
+   still balance. "make soak" starts a daemon, runs it, and stops it.
+
+   usage: daevel-soak [-h host] [-p port] [-c conns] [-e epochs]
+                      [-s secs] [-k kills] [-q secs]
+
+   Each epoch runs conns client threads (default 64) for secs seconds
+   (default 5), each making connection after connection, while kills
+   children a second (default 5) get SIGKILL. Then the load stops and,
+   once every child has gone (waiting up to -q secs, default 10), these
+   must all hold exactly:
+
+     - the children gauge, which is child_count, is 0
+     - the master has no children left, zombie or otherwise
+     - accepted = refused + denied + dup failures + fork failures +
+       reaped, so every child forked was reaped and counted once
+     - the master has as many open descriptors as before the first epoch
+
+   Each epoch prints its connections a second, errors (which include the
+   connections whose child was killed), kills and the checks; the last
+   line says how throughput changed from the first epoch to the last.
+   Exits 1 if any check failed in any epoch.
+
+   Needs /proc, and permission to signal the daemon's children; if it
+   can't read what it needs there it says so on stderr and stops.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "stats.h"
+
+#define SOAK_MAX_THREADS 1024
+#define SOAK_MAX_EPOCHS 10000
+#define SOAK_PAYLOAD "soak\n"
+#define SOAK_IO_TIMEOUT 5   /* seconds, so a lost child can't hang a client */
+
+typedef struct
+{
+  pthread_t thread;
+  unsigned long long done;
+  unsigned long long errors;
+}
+soak_thread;
+
+typedef struct
+{
+  int live;      /* children of the master still running */
+  int zombies;   /* exited but not reaped */
+}
+child_census;
+
+static struct sockaddr_in target;
+static volatile int loading = FALSE;
+static pid_t master;
+
+static double now_secs()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* now_secs */
+
+/* One connection of the echo protocol. Returns FALSE if it went wrong. */
+static int one_connection()
+{
+  struct timeval tv;
+  char buf[256];
+  ssize_t n;
+  size_t got = 0;
+  int one = 1;
+  int fd;
+
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return FALSE;
+  }
+  tv.tv_sec = SOAK_IO_TIMEOUT;
+  tv.tv_usec = 0;
+  (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  (void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if ((connect(fd, (struct sockaddr *)&target, sizeof(target)) < 0) ||
+      (write(fd, SOAK_PAYLOAD "1", strlen(SOAK_PAYLOAD) + 1) < 0))
+  {
+    close(fd);
+    return FALSE;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    got += n;
+  }
+  close(fd);
+  /* "Hello <addr>\n" and the echo, then a close rather than an error */
+  return ((n == 0) && (got > strlen(SOAK_PAYLOAD))) ? TRUE : FALSE;
+} /* one_connection */
+
+static void* soak_client(void *arg)
+{
+  soak_thread *t = arg;
+
+  while (loading == TRUE)
+  {
+    if (one_connection() == TRUE)
+    {
+      t->done++;
+    }
+    else
+    {
+      t->errors++;
+    }
+  }
+  return NULL;
+} /* soak_client */
+
+/* Counts the master's children from /proc/<pid>/stat. If victims isn't
+   NULL, also fills it with up to max live ones. */
+static child_census census(pid_t *victims, int max)
+{
+  child_census c = { 0, 0 };
+  struct dirent *d;
+  char path[sizeof("/proc//stat") + NAME_MAX];
+  char line[512];
+  char *p;
+  char state;
+  int ppid;
+  FILE *f;
+  DIR *dir;
+
+  dir = opendir("/proc");
+  if (dir == NULL)
+  {
+    fprintf(stderr, "daevel-soak: can't read /proc: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  while ((d = readdir(dir)) != NULL)
+  {
+    if ((d->d_name[0] < '0') || (d->d_name[0] > '9'))
+    {
+      continue;
+    }
+    snprintf(path, sizeof(path), "/proc/%s/stat", d->d_name);
+    f = fopen(path, "r");
+    if (f == NULL)
+    {
+      continue;  /* gone already */
+    }
+    p = fgets(line, sizeof(line), f);
+    fclose(f);
+    /* "pid (comm) state ppid ...", and comm can hold anything */
+    if ((p == NULL) || ((p = strrchr(line, ')')) == NULL) ||
+        (sscanf(p + 1, " %c %d", &state, &ppid) != 2) || (ppid != master))
+    {
+      continue;
+    }
+    if (state == 'Z')
+    {
+      c.zombies++;
+    }
+    else
+    {
+      if ((victims != NULL) && (c.live < max))
+      {
+        victims[c.live] = atoi(d->d_name);
+      }
+      c.live++;
+    }
+  }
+  closedir(dir);
+  return c;
+} /* census */
+
+static int open_fds(pid_t pid)
+{
+  struct dirent *d;
+  char path[64];
+  DIR *dir;
+  int n = 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/fd", (int)pid);
+  dir = opendir(path);
+  if (dir == NULL)
+  {
+    fprintf(stderr, "daevel-soak: can't read %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  while ((d = readdir(dir)) != NULL)
+  {
+    if (d->d_name[0] != '.')
+    {
+      n++;
+    }
+  }
+  closedir(dir);
+  return n;
+} /* open_fds */
+
+/* SIGKILLs one of the master's children at random. Returns TRUE if it
+   found one to kill. */
+static int kill_random_child()
+{
+  pid_t victims[ABSOLUTE_MAX_CHILDREN];
+  child_census c;
+  int n;
+
+  c = census(victims, ABSOLUTE_MAX_CHILDREN);
+  n = (c.live < ABSOLUTE_MAX_CHILDREN) ? c.live : ABSOLUTE_MAX_CHILDREN;
+  if (n == 0)
+  {
+    return FALSE;
+  }
+  return (kill(victims[random() % n], SIGKILL) == 0) ? TRUE : FALSE;
+} /* kill_random_child */
+
+static void usage()
+{
+  fprintf(stderr, "usage: daevel-soak [-h host] [-p port] [-c conns]"
+          " [-e epochs] [-s secs] [-k kills] [-q secs]\n");
+  fprintf(stderr, "       -h host    daemon, default 127.0.0.1\n");
+  fprintf(stderr, "       -p port    default 3000\n");
+  fprintf(stderr, "       -c conns   client threads, default 64\n");
+  fprintf(stderr, "       -e epochs  default 10\n");
+  fprintf(stderr, "       -s secs    of load in each epoch, default 5\n");
+  fprintf(stderr, "       -k kills   children killed a second, default 5\n");
+  fprintf(stderr, "       -q secs    wait for children to go, default 10\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  static soak_thread threads[SOAK_MAX_THREADS];
+  static double rate[SOAK_MAX_EPOCHS];
+  unsigned long long total[METRIC_COUNTERS];
+  unsigned long long done;
+  unsigned long long errors;
+  unsigned long long unbalanced;
+  const stats_segment *seg;
+  struct timespec pause;
+  struct hostent *he;
+  child_census c;
+  const char *host = "127.0.0.1";
+  char why[FILENAME_LEN + 100];
+  double start;
+  double secs = 5;
+  double quiesce = 10;
+  double kills = 5;
+  double next_kill;
+  int port = 3000;
+  int nthreads = 64;
+  int epochs = 10;
+  int baseline_fds;
+  int fds;
+  int killed;
+  int failed = 0;
+  int ok;
+  int e;
+  int t;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "h:p:c:e:s:k:q:")) != -1)
+  {
+    switch (ch)
+    {
+    case 'h':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 'c':
+      nthreads = atoi(optarg);
+      break;
+    case 'e':
+      epochs = atoi(optarg);
+      break;
+    case 's':
+      secs = atof(optarg);
+      break;
+    case 'k':
+      kills = atof(optarg);
+      break;
+    case 'q':
+      quiesce = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((port <= 0) || (port > 65535) || (nthreads <= 0) ||
+      (nthreads > SOAK_MAX_THREADS) || (epochs <= 0) ||
+      (epochs > SOAK_MAX_EPOCHS) || (secs <= 0) || (kills < 0) ||
+      (quiesce <= 0))
+  {
+    usage();
+  }
+
+  he = gethostbyname(host);
+  if ((he == NULL) || (he->h_addrtype != AF_INET))
+  {
+    fprintf(stderr, "daevel-soak: can't resolve %s\n", host);
+    exit(EXIT_FAILURE);
+  }
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(port);
+  memcpy(&target.sin_addr, he->h_addr_list[0], sizeof(target.sin_addr));
+
+  master = stats_daemon_pid();
+  if (master == 0)
+  {
+    fprintf(stderr, "daevel-soak: no daemon holds %s\n", GLOBAL_LOCKFILE_NAME);
+    exit(EXIT_FAILURE);
+  }
+  seg = stats_attach(master, why, sizeof(why));
+  if (seg == NULL)
+  {
+    fprintf(stderr, "daevel-soak: %s\n", why);
+    exit(EXIT_FAILURE);
+  }
+  srandom((unsigned)time(NULL));
+  signal(SIGPIPE, SIG_IGN);
+  baseline_fds = open_fds(master);
+  pause.tv_sec = 0;
+  pause.tv_nsec = 10000000;
+
+  printf("# daemon pid %d, maxchild %ld, %d clients, %.1fs epochs,"
+         " %.1f kills/s\n", (int)master, seg->gauge[MG_MAXCHILD], nthreads,
+         secs, kills);
+  printf("# %5s %9s %8s %6s %6s %6s %6s %6s %4s %s\n", "epoch", "conn/s",
+         "errors", "killed", "gauge", "live", "zombie", "fds", "bal", "ok");
+  for (e = 0; e < epochs; e++)
+  {
+    memset(threads, 0, sizeof(soak_thread) * nthreads);
+    loading = TRUE;
+    for (t = 0; t < nthreads; t++)
+    {
+      if (pthread_create(&threads[t].thread, NULL, soak_client,
+                         &threads[t]) != 0)
+      {
+        fprintf(stderr, "daevel-soak: can't start thread %d\n", t);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    start = now_secs();
+    next_kill = start;
+    killed = 0;
+    while (now_secs() - start < secs)
+    {
+      if ((kills > 0) && (now_secs() >= next_kill))
+      {
+        killed += kill_random_child();
+        next_kill += 1 / kills;
+      }
+      nanosleep(&pause, NULL);
+    }
+    loading = FALSE;
+    done = 0;
+    errors = 0;
+    for (t = 0; t < nthreads; t++)
+    {
+      pthread_join(threads[t].thread, NULL);
+      done += threads[t].done;
+      errors += threads[t].errors;
+    }
+    rate[e] = done / (now_secs() - start);
+
+    /* every child should now go, and the master should reap them all */
+    start = now_secs();
+    do
+    {
+      nanosleep(&pause, NULL);
+      c = census(NULL, 0);
+    }
+    while (((c.live > 0) || (c.zombies > 0) ||
+            (seg->gauge[MG_CHILDREN] != 0)) &&
+           (now_secs() - start < quiesce));
+    if (seg->magic != STATS_MAGIC)
+    {
+      printf("daemon pid %d has exited\n", (int)master);
+      return 1;
+    }
+
+    stats_totals(seg, total);
+    unbalanced = total[MC_ACCEPTED] - total[MC_REFUSED] - total[MC_DENIED] -
+                 total[MC_DUP_FAILED] - total[MC_FORK_FAILED] -
+                 total[MC_REAPED];
+    fds = open_fds(master);
+    ok = ((seg->gauge[MG_CHILDREN] == 0) && (c.live == 0) &&
+          (c.zombies == 0) && (unbalanced == 0) && (fds == baseline_fds)) ?
+         TRUE : FALSE;
+    if (ok == FALSE)
+    {
+      failed++;
+    }
+    printf("%7d %9.1f %8llu %6d %6ld %6d %6d %6d %4lld %s\n", e + 1, rate[e],
+           errors, killed, seg->gauge[MG_CHILDREN], c.live, c.zombies, fds,
+           (long long)unbalanced, (ok == TRUE) ? "ok" : "FAIL");
+    fflush(stdout);
+  }
+
+  printf("# throughput %.1f conn/s first epoch, %.1f last, %+.1f%%;"
+         " %d of %d epochs failed\n", rate[0], rate[epochs - 1],
+         (rate[0] > 0) ? 100 * (rate[epochs - 1] - rate[0]) / rate[0] : 0.0,
+         failed, epochs);
+  return (failed > 0) ? 1 : 0;
+
+} /* main */
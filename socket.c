@@ -13,8 +13,51 @@
 
    Socket handling functions.
 
+   Running out of descriptors (EMFILE, ENFILE) or kernel memory (ENOBUFS,
+   ENOMEM) in accept() leaves the connection queued, so poll() says the
+   listening socket is ready again at once and the main loop would spin.
+   Instead one connection is shed: a descriptor kept in reserve for the
+   purpose is closed, which lets accept() succeed, and the connection is
+   closed straight away, so the client hears at once rather than timing
+   out. Then the listening socket is left out of the poll() for a
+   backoff that doubles from ACCEPT_BACKOFF_MIN_MS to
+   ACCEPT_BACKOFF_MAX_MS while it keeps happening, and is reset by the
+   first accept() that works. Children finishing give descriptors back,
+   so the daemon recovers by itself.
+
+   With unixpath there is an AF_UNIX stream listener as well (or instead,
+   with unixonly), for clients on the same host, which then skip the TCP
+   stack. Its connections go through filtered_accept() and the same
+   children as TCP ones. A name starting with '@' is in the abstract
+   namespace, which has no file, permissions or clean-up. Otherwise the
+   socket file is made with unixmode and unixgroup; one left by a daemon
+   that died is removed at the start, but not one that something still
+   accepts on, or anything that isn't a socket. Clients have no address,
+   so they are named by their SO_PEERCRED credentials instead, see
+   socket_peer_name().
+
+   For the latency-sensitive, busyspin trades CPU for wakeup latency:
+   socket_poll() polls without sleeping for up to busyspin microseconds
+   before it sleeps in poll(), so work arriving soon after the last is
+   seen without a trip through the scheduler. The master spins on the
+   listeners, and UDP workers on their sockets; how often the spin found
+   work, and how long from then to the handler, are in the metrics.
+   busypoll sets SO_BUSY_POLL (and SO_PREFER_BUSY_POLL) on the sockets,
+   so that a read that would block polls the device queue instead of
+   waiting for its interrupt. Connections inherit it from the listener,
+   so a child's reads in the handler busy poll too.
+
+   The kernel shares what arrives for an SO_REUSEPORT group out between
+   its sockets by a hash of the addresses, wherever the processes
+   reading them run. socket_steer() replaces the hash with a classic BPF
+   program that picks the socket whose reader is pinned to the CPU that
+   received the packet, so it is handled on the CPU whose cache already
+   has it, from interrupt to handler.
+
 */
 
+#define _GNU_SOURCE  /* struct ucred */
+#include <stdio.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>   /* ntoa etc */
 #include <errno.h>
@@ -24,20 +67,104 @@
 #include <string.h>
 #include <netinet/in.h>
 #include <unistd.h>
+#include <poll.h>
+#include <grp.h>
+#include <stddef.h>     /* offsetof */
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <linux/filter.h>  /* struct sock_filter, SKF_AD_CPU */
 
 #include "global.h"
 #include "socket.h"
 #include "util.h"
+#include "metrics.h"
+#include "probes.h"
+#include "flight.h"
+#define LOG_SUBSYS LOGSUB_SOCKET
 #include "log.h"
 
-/* Set up a listening socket. returns -1 for failure, positive socket
-   descriptor for success */
+#define ACCEPT_BACKOFF_MIN_MS 10
+#define ACCEPT_BACKOFF_MAX_MS 1000
+
+static int reserve_fd = -1;   /* given up to shed a connection, see above */
+static int backoff_ms = 0;    /* 0 when accept() last worked */
+static unsigned long long paused_until = 0;  /* metrics_now() */
+static char local_file[UNIX_PATH_LEN];  /* to remove at the end, or "" */
+static unsigned long long woke_us = 0;  /* see socket_woke() */
+
+/* older headers don't have these, and setsockopt() says if the kernel
+   doesn't either */
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+/* Opens the reserve descriptor, if it isn't open. Fails quietly, eg
+   with ENFILE, in which case it is tried again next time */
+static void reserve_open()
+{
+  if (reserve_fd < 0)
+  {
+    reserve_fd = open("/dev/null", O_RDONLY);
+  }
+} /* reserve_open */
+
+/* Children don't accept(), so don't need the reserve */
+void socket_forked()
+{
+  if (reserve_fd >= 0)
+  {
+    close(reserve_fd);
+    reserve_fd = -1;
+  }
+} /* socket_forked */
+
+/* Sets busypoll on fd, see the top of this file. Raising SO_BUSY_POLL
+   needs CAP_NET_ADMIN, and the kernel may not have it at all, so that
+   is logged once and the daemon carries on with only busyspin */
+static void busy_socket(int fd)
+{
+  static int warned = FALSE;
+  int us = (int)global_options->busypoll;
+  int one = 1;
+
+  if (us == 0)
+  {
+    return;
+  }
+  if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &us, sizeof(us)) < 0)
+  {
+    if (warned == FALSE)
+    {
+      LOG(1, ("SO_BUSY_POLL not available, error %d, %s; carrying on "
+              "without\n", errno, strerror(errno)));
+      warned = TRUE;
+    }
+    return;
+  }
+  if ((setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one,
+                  sizeof(one)) < 0) && (warned == FALSE))
+  {
+    LOG(2, ("SO_PREFER_BUSY_POLL not available, error %d, %s\n", errno,
+            strerror(errno)));
+    warned = TRUE;
+  }
+} /* busy_socket */
+
+/* Set up a listening socket, or a bound one for protocol udp. returns -1
+   for failure, positive socket descriptor for success */
 int init_socket(struct sockaddr_in *sin)
 {
   struct hostent *h;
   char hostname[MAXHOSTLEN];
   int sockdes = -1;
   int ret = -1;
+  int one = 1;
 
   if (sin == NULL)
   {
@@ -69,13 +196,28 @@ int init_socket(struct sockaddr_in *sin)
   sin->sin_addr.s_addr = 0;
   /* UNFEATURE should allow for binding to other or multiple addresses */
 
-  sockdes = socket(sin->sin_family, SOCK_STREAM, 0);
+  sockdes = socket(sin->sin_family,
+                   (global_options->protocol == PROTOCOL_UDP) ?
+                   SOCK_DGRAM : SOCK_STREAM, 0);
   if (sockdes == -1)
   {
     LOG(1, ("failed to allocate socket\n"));
     return -1;
   }
 
+  /* UDP workers with a socket each all bind the port, and the kernel
+     shares datagrams out between them by a hash of the addresses */
+  if ((global_options->protocol == PROTOCOL_UDP) &&
+      (global_options->udpreuseport == TRUE) &&
+      (setsockopt(sockdes, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == -1))
+  {
+    LOG(1, ("SO_REUSEPORT failed with error %d, %s\n", errno,
+            strerror(errno)));
+    return -1;
+  }
+
+  busy_socket(sockdes);
+
   ret = bind( sockdes, (struct sockaddr*)sin, sizeof(struct sockaddr) );
   if (ret == -1)
   {
@@ -83,6 +225,19 @@ int init_socket(struct sockaddr_in *sin)
     return -1;
   }
 
+  if (global_options->protocol == PROTOCOL_UDP)
+  {
+    /* the workers don't block in it either, see udp_serve() */
+    if (fcntl(sockdes, F_SETFL, fcntl(sockdes, F_GETFL) | O_NONBLOCK) == -1)
+    {
+      LOG(1, ("fcntl O_NONBLOCK failed with error %d, %s\n", errno,
+              strerror(errno)));
+      return -1;
+    }
+    LOG(1, ("%s bound to UDP port %i\n", hostname, global_options->portnum));
+    return sockdes;
+  }
+
   ret = listen(sockdes, 5);
   if (ret == -1)
   {
@@ -90,12 +245,284 @@ int init_socket(struct sockaddr_in *sin)
     return -1;
   }
 
+  /* main() waits in wait_for_connection() rather than accept(), so that
+     it can do housekeeping between connections. A connection that is
+     reset between poll() and accept() must not block us, so accept()
+     returns EWOULDBLOCK instead, which filtered_accept() squashes */
+  if (fcntl(sockdes, F_SETFL, fcntl(sockdes, F_GETFL) | O_NONBLOCK) == -1)
+  {
+    LOG(1, ("fcntl O_NONBLOCK failed with error %d, %s\n", errno,
+            strerror(errno)));
+    return -1;
+  }
+
+  reserve_open();
   LOG(1, ("%s listening on port %i\n", hostname, global_options->portnum));
   return sockdes;
 
 } /*init_socket*/
 
 
+/* Attaches a program to the SO_REUSEPORT group that s belongs to, which
+   sends a packet to the i-th socket to join the group if cpu[i] is the
+   CPU that received it. Packets from CPUs with no socket of their own
+   get a number past the end, which makes the kernel use its hash. A -1
+   in cpu[] is a socket nothing is steered to, and if two sockets have
+   the same CPU the first gets everything. The numbering is the whole
+   group's, so a socket still held by a worker of a daemon that has just
+   stopped throws it out until that worker exits. Returns FALSE, and
+   the group keeps the hash, if the kernel can't do it */
+int socket_steer(int s, const int *cpu, int n)
+{
+  struct sock_filter code[2 * SOCKET_STEER_MAX + 2];
+  struct sock_fprog prog;
+  int len = 0;
+  int i;
+
+  if ((n <= 0) || (n > SOCKET_STEER_MAX))
+  {
+    return FALSE;
+  }
+  code[len++] = (struct sock_filter)
+                BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+  for (i = 0; i < n; i++)
+  {
+    if (cpu[i] < 0)
+    {
+      continue;
+    }
+    code[len++] = (struct sock_filter)
+                  BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, cpu[i], 0, 1);
+    code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, i);
+  }
+  code[len++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, n);
+
+  prog.len = len;
+  prog.filter = code;
+  if (setsockopt(s, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog,
+                 sizeof(prog)) < 0)
+  {
+    LOG(1, ("SO_ATTACH_REUSEPORT_CBPF failed with error %d, %s; leaving "
+            "the kernel's hash\n", errno, strerror(errno)));
+    return FALSE;
+  }
+  return TRUE;
+} /* socket_steer */
+
+/* Fills sun from path, a file or "@name" in the abstract namespace.
+   Returns the length to bind() with, or -1 if path is too long */
+static int local_address(const char *path, struct sockaddr_un *sun)
+{
+  size_t len = strlen(path);
+
+  memset(sun, 0, sizeof(struct sockaddr_un));
+  sun->sun_family = AF_UNIX;
+  if (len >= sizeof(sun->sun_path))
+  {
+    return -1;
+  }
+  memcpy(sun->sun_path, path, len);
+  if (path[0] == '@')
+  {
+    sun->sun_path[0] = '\0';  /* the name is exactly len bytes, no NUL */
+    return (int)(offsetof(struct sockaddr_un, sun_path) + len);
+  }
+  return (int)sizeof(struct sockaddr_un);
+} /* local_address */
+
+/* Removes path if it is a socket left by a daemon that died. Returns
+   FALSE if something is there that must be left alone */
+static int local_clear(const char *path, struct sockaddr_un *sun, int len)
+{
+  struct stat st;
+  int live;
+  int fd;
+
+  if (lstat(path, &st) < 0)
+  {
+    return (errno == ENOENT) ? TRUE : FALSE;
+  }
+  if (!S_ISSOCK(st.st_mode))
+  {
+    LOG(1, ("%s exists and isn't a socket, not replacing it\n", path));
+    return FALSE;
+  }
+  /* only a live listener accepts, or has a full backlog */
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return FALSE;
+  }
+  live = ((connect(fd, (struct sockaddr *)sun, len) == 0) ||
+          (errno == EAGAIN)) ? TRUE : FALSE;
+  close(fd);
+  if (live == TRUE)
+  {
+    LOG(1, ("%s is in use by another process\n", path));
+    return FALSE;
+  }
+  if (unlink(path) < 0)
+  {
+    LOG(1, ("Can't remove stale socket %s, error %d, %s\n", path, errno,
+            strerror(errno)));
+    return FALSE;
+  }
+  LOG(2, ("Removed stale socket %s\n", path));
+  return TRUE;
+} /* local_clear */
+
+/* Set up the AF_UNIX listener on path, see the top of this file.
+   returns -1 for failure, positive socket descriptor for success */
+int init_local_socket(const char *path)
+{
+  struct sockaddr_un sun;
+  struct group *gr = NULL;
+  mode_t oldmask;
+  int sockdes = -1;
+  int len;
+  int ret;
+
+  len = local_address(path, &sun);
+  if (len < 0)
+  {
+    LOG(1, ("unixpath %s is too long for a socket\n", path));
+    return -1;
+  }
+  if (path[0] != '@')
+  {
+    if ((global_options->unixgroup[0] != '\0') &&
+        ((gr = getgrnam(global_options->unixgroup)) == NULL))
+    {
+      LOG(1, ("unixgroup %s isn't a group\n", global_options->unixgroup));
+      return -1;
+    }
+    if (local_clear(path, &sun, len) != TRUE)
+    {
+      return -1;
+    }
+  }
+
+  sockdes = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sockdes == -1)
+  {
+    LOG(1, ("failed to allocate AF_UNIX socket\n"));
+    return -1;
+  }
+
+  /* the file gets unixmode from the start, so there's no moment when
+     anyone else may connect */
+  oldmask = umask(0777 & ~global_options->unixmode);
+  ret = bind(sockdes, (struct sockaddr *)&sun, len);
+  umask(oldmask);
+  if (ret == -1)
+  {
+    LOG(1, ("Error %d binding to %s: %s\n", errno, path, strerror(errno)));
+    close(sockdes);
+    return -1;
+  }
+  if (path[0] != '@')
+  {
+    strncpy(local_file, path, sizeof(local_file) - 1);
+  }
+  if ((gr != NULL) && (chown(path, (uid_t)-1, gr->gr_gid) == -1))
+  {
+    LOG(1, ("Can't give %s to group %s, error %d, %s\n", path,
+            global_options->unixgroup, errno, strerror(errno)));
+    close(sockdes);
+    return -1;
+  }
+
+  /* a connect() to a full AF_UNIX backlog fails at once with EAGAIN,
+     rather than being tried again later as a TCP SYN is, so it is as
+     long as the system allows */
+  if ((listen(sockdes, SOMAXCONN) == -1) ||
+      (fcntl(sockdes, F_SETFL, fcntl(sockdes, F_GETFL) | O_NONBLOCK) == -1))
+  {
+    LOG(1, ("listen on %s failed with error %d, %s\n", path, errno,
+            strerror(errno)));
+    close(sockdes);
+    return -1;
+  }
+
+  LOG(1, ("listening on %s%s\n", path,
+          (path[0] == '@') ? " (abstract)" : ""));
+  return sockdes;
+
+} /* init_local_socket */
+
+/* Called by the master on shutdown, once the listener is closed */
+void socket_finish()
+{
+  if ((local_file[0] != '\0') && (unlink(local_file) != 0))
+  {
+    LOG(1, ("Couldn't remove %s, error %d, %s\n", local_file, errno,
+            strerror(errno)));
+  }
+  local_file[0] = '\0';
+} /* socket_finish */
+
+/* Writes the credentials of the client connected to AF_UNIX socket fd
+   to name, to stand in for its address in logs and as its name */
+void socket_peer_name(int fd, char *name, size_t len)
+{
+  struct ucred cred;
+  socklen_t credlen = sizeof(cred);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0)
+  {
+    snprintf(name, len, "local");
+    return;
+  }
+  snprintf(name, len, "uid=%u,gid=%u,pid=%d", (unsigned)cred.uid,
+           (unsigned)cred.gid, (int)cred.pid);
+} /* socket_peer_name */
+
+/* accept() on s failed with err. If that was for want of descriptors,
+   uses the reserve one to accept and close a connection, so it doesn't
+   stay queued keeping s ready. Returns TRUE if one was shed */
+int socket_shed(int s, int err)
+{
+  int shed = FALSE;
+  int fd;
+
+  if (((err == EMFILE) || (err == ENFILE)) && (reserve_fd >= 0))
+  {
+    close(reserve_fd);
+    reserve_fd = -1;
+    fd = accept(s, NULL, NULL);
+    if (fd >= 0)
+    {
+      close(fd);
+      shed = TRUE;
+    }
+    reserve_open();
+  }
+  return shed;
+} /* socket_shed */
+
+/* accept() failed with err, one of exhausted_errors. Sheds a connection
+   if the reserve descriptor makes that possible, and pauses accepting */
+static void accept_exhausted(int s, int err)
+{
+  int shed;
+
+  metrics_count(MC_FD_EXHAUSTED);
+  shed = socket_shed(s, err);
+
+  backoff_ms = (backoff_ms == 0) ? ACCEPT_BACKOFF_MIN_MS : backoff_ms * 2;
+  if (backoff_ms > ACCEPT_BACKOFF_MAX_MS)
+  {
+    backoff_ms = ACCEPT_BACKOFF_MAX_MS;
+  }
+  paused_until = metrics_now() + 1000ULL * backoff_ms;
+  flight_record(FL_EXHAUSTED, err, backoff_ms, shed == TRUE);
+  LOG_LIMITED(LOGCLASS_REFUSE, 1, ("accept() failed with error %d, %s: %s, "
+                                   "not accepting for %dms\n", err,
+                                   strerror(err), (shed == TRUE) ?
+                                   "shed a connection" : "nothing shed",
+                                   backoff_ms));
+} /* accept_exhausted */
+
 /* accept() returns lots of errors. This squashes a range of errors
    which experience says we can ignore into EAGAIN. Some valid but rare
    inputs to accept() are rejected as errors, because they probably will
@@ -112,17 +539,15 @@ int filtered_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
      why it differs from other BSD socket implementations (such as BSD:)
   */
 
-  static int squash_errors[] =
-  {
-    ECONNREFUSED,
-    ECONNRESET,
-    EHOSTDOWN,
-    EHOSTUNREACH,
-    EINTR,
-    ENETDOWN,
-    ENETUNREACH,
-    ENOTCONN,
-    EWOULDBLOCK
+  static int squash_errors[] = { SOCKET_SQUASHED_ERRORS };
+
+  /* running out of resources, which accept_exhausted() deals with */
+  static int exhausted_errors[] =
+  {
+    EMFILE,
+    ENFILE,
+    ENOBUFS,
+    ENOMEM
   };
 
   if ( (s == 0) || \
@@ -134,15 +559,164 @@ int filtered_accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 
   ret = accept(s, addr, addrlen);
   if (ret == -1)
+  {
+    flight_record(FL_ACCEPT_ERROR, errno, s, 0);
+  }
+  if ((ret == -1) && (INT_ISSET(exhausted_errors, errno) > -1))
+  {
+    accept_exhausted(s, errno);
+    errno = EAGAIN;
+  }
+  else if (ret == -1)
   {
     ret2 = INT_ISSET(squash_errors, errno);
     if ( ret2 > -1 )
     {
-      LOG(9, ("Squashed error %i into EAGAIN\n", errno));
+      LOG_LIMITED(LOGCLASS_ACCEPT, 9,
+                  ("Squashed error %i into EAGAIN\n", errno));
+      metrics_squashed(errno);
       errno = EAGAIN;
     }
   }
+  else
+  {
+    backoff_ms = 0;
+    /* BSD-derived stacks pass the listening socket's O_NONBLOCK on to
+       the accepted one, and children expect blocking stdio */
+    (void)fcntl(ret, F_SETFL, fcntl(ret, F_GETFL) & ~O_NONBLOCK);
+  }
 
+  PROBE_ACCEPT(ret, (ret < 0) ? errno : 0,
+               ((ret >= 0) && (addr->sa_family == AF_INET)) ?
+               ((struct sockaddr_in *)addr)->sin_addr.s_addr : 0);
   return ret;
 
 } /* filtered_accept */
+
+/* poll(), but if spin is TRUE and busyspin is set, polls without
+   sleeping for up to busyspin microseconds first. The time it returned
+   with something ready is kept for socket_woke() */
+int socket_poll(struct pollfd *pfd, int n, int timeout_ms, int spin)
+{
+  unsigned long long start;
+  unsigned long long now;
+  unsigned long long limit = global_options->busyspin;
+  int ret;
+
+  if ((spin == TRUE) && (limit > 0) && (timeout_ms != 0))
+  {
+    if ((timeout_ms > 0) && (limit > (unsigned long long)timeout_ms * 1000))
+    {
+      limit = (unsigned long long)timeout_ms * 1000;
+    }
+    start = metrics_now();
+    do
+    {
+      ret = poll(pfd, n, 0);
+      if (ret != 0)
+      {
+        if (ret > 0)
+        {
+          woke_us = metrics_now();
+          metrics_count(MC_BUSY_SPUN);
+        }
+        return ret;
+      }
+      now = metrics_now();
+    }
+    while (now - start < limit);
+    metrics_count(MC_BUSY_SLEPT);
+    if (timeout_ms > 0)
+    {
+      timeout_ms -= (int)((now - start) / 1000);
+      if (timeout_ms <= 0)
+      {
+        return 0;
+      }
+    }
+  }
+  ret = poll(pfd, n, timeout_ms);
+  if (ret > 0)
+  {
+    woke_us = metrics_now();
+  }
+  return ret;
+} /* socket_poll */
+
+/* When the last socket_poll() in this process found something ready,
+   by metrics_now(), for the wakeup to handler histogram */
+unsigned long long socket_woke()
+{
+  return woke_us;
+} /* socket_woke */
+
+/* Waits up to timeout_ms for a connection on listening socket s or the
+   AF_UNIX listener local, or a request on the admin socket; any of them
+   may be -1. Returns WAIT_LISTEN, WAIT_LOCAL and/or WAIT_ADMIN for
+   whichever are ready, 0 for timeout or a signal (usually SIGCHLD), and
+   -1 for other errors. While accepting is paused s and local are left
+   out, and the wait ends no later than the pause. */
+int wait_for_connection(int s, int local, int admin, int timeout_ms)
+{
+  struct pollfd pfd[3];
+  unsigned long long now;
+  int ret = -1;
+
+  if (paused_until != 0)
+  {
+    now = metrics_now();
+    if (now < paused_until)
+    {
+      if ((paused_until - now) / 1000 + 1 < (unsigned long long)timeout_ms)
+      {
+        timeout_ms = (int)((paused_until - now) / 1000 + 1);
+      }
+      s = -1;  /* poll() ignores them */
+      local = -1;
+    }
+    else
+    {
+      paused_until = 0;
+    }
+  }
+
+  pfd[0].fd = s;
+  pfd[0].events = POLLIN;
+  pfd[0].revents = 0;
+  pfd[1].fd = admin;  /* poll() ignores it if negative */
+  pfd[1].events = POLLIN;
+  pfd[1].revents = 0;
+  pfd[2].fd = local;
+  pfd[2].events = POLLIN;
+  pfd[2].revents = 0;
+
+  /* nothing to spin for when only the admin socket is watched */
+  ret = socket_poll(pfd, 3, timeout_ms, ((s >= 0) || (local >= 0)) ?
+                    TRUE : FALSE);
+  if (ret == -1)
+  {
+    if (errno == EINTR)
+    {
+      return 0;
+    }
+    LOG(1, ("poll() on listening socket failed with error %d, %s\n",
+            errno, strerror(errno)));
+    return -1;
+  }
+
+  ret = 0;
+  if (pfd[0].revents != 0)
+  {
+    ret |= WAIT_LISTEN;
+  }
+  if (pfd[1].revents != 0)
+  {
+    ret |= WAIT_ADMIN;
+  }
+  if (pfd[2].revents != 0)
+  {
+    ret |= WAIT_LOCAL;
+  }
+  return ret;
+
+} /* wait_for_connection */
@@ -14,10 +14,31 @@
 */
 
 #include <netinet/in.h>
+#include <poll.h>
 
 int init_socket(struct sockaddr_in *sin);
 int filtered_accept(int s, struct sockaddr *addr, socklen_t *addrlen);
-
+int init_local_socket(const char *path);
+int wait_for_connection(int s, int local, int admin, int timeout_ms);
+void socket_forked();
+int socket_shed(int s, int err);
+void socket_finish();
+void socket_peer_name(int fd, char *name, size_t len);
+int socket_poll(struct pollfd *pfd, int n, int timeout_ms, int spin);
+int socket_steer(int s, const int *cpu, int n);
+unsigned long long socket_woke();
+
+/* wait_for_connection results */
+#define WAIT_LISTEN 1
+#define WAIT_ADMIN 2
+#define WAIT_LOCAL 4
+
+#define SOCKET_STEER_MAX 64  /* sockets socket_steer() can steer to */
+
+/* the accept() errors filtered_accept() ignores, for it and microbench */
+#define SOCKET_SQUASHED_ERRORS \
+  ECONNREFUSED, ECONNRESET, EHOSTDOWN, EHOSTUNREACH, EINTR, ENETDOWN, \
+  ENETUNREACH, ENOTCONN, EWOULDBLOCK, ECONNABORTED, EPROTO
 
 
 
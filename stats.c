@@ -0,0 +1,176 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* stats.c
+
+   Reading the statistics segment, see stats.h. Linked into both the
+   daemon and the programs that watch it (daevel-stat, daevel-soak), so it
+   must not use LOG or PANIC.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "global.h"
+#include "stats.h"
+
+/* Returns the bucket for v. Values below 2 * METRIC_SUB_BUCKETS have a
+   bucket each; above that, the top METRIC_SUB_BITS + 1 bits of v choose
+   one of the METRIC_SUB_BUCKETS buckets for its power of two. */
+unsigned stats_bucket(unsigned long long v)
+{
+  unsigned msb;
+
+  if (v < 2 * METRIC_SUB_BUCKETS)
+  {
+    return (unsigned)v;
+  }
+  msb = 63 - __builtin_clzll(v);
+  if (msb >= METRIC_MAX_BITS)
+  {
+    return METRIC_BUCKETS - 1;
+  }
+  return (msb - METRIC_SUB_BITS) * METRIC_SUB_BUCKETS +
+         (unsigned)(v >> (msb - METRIC_SUB_BITS));
+} /* stats_bucket */
+
+/* Returns the highest value that goes in bucket b */
+unsigned long long stats_bucket_top(unsigned b)
+{
+  unsigned msb;
+  unsigned long long m;
+
+  if (b < 2 * METRIC_SUB_BUCKETS)
+  {
+    return b;
+  }
+  msb = b / METRIC_SUB_BUCKETS + METRIC_SUB_BITS - 1;
+  m = b % METRIC_SUB_BUCKETS + METRIC_SUB_BUCKETS;
+  return ((m + 1) << (msb - METRIC_SUB_BITS)) - 1;
+} /* stats_bucket_top */
+
+/* Returns the top of the lowest bucket with at least q of the count
+   values in bucket[] at or below it, 0 if there are none */
+unsigned long long stats_quantile(const unsigned long long *bucket,
+                                  unsigned long long count, double q)
+{
+  unsigned long long want = (unsigned long long)(q * count + 0.5);
+  unsigned long long seen = 0;
+  unsigned b;
+
+  if (count == 0)
+  {
+    return 0;
+  }
+  if (want == 0)
+  {
+    want = 1;
+  }
+  for (b = 0; b < METRIC_BUCKETS; b++)
+  {
+    seen += bucket[b];
+    if (seen >= want)
+    {
+      return stats_bucket_top(b);
+    }
+  }
+  return stats_bucket_top(METRIC_BUCKETS - 1);
+} /* stats_quantile */
+
+/* Adds up each counter over every slot, consistently with any fold of a
+   dead child's slot going on at the same time */
+void stats_totals(const stats_segment *seg,
+                  unsigned long long total[METRIC_COUNTERS])
+{
+  unsigned seq;
+  int s;
+  int c;
+
+  do
+  {
+    while ((seq = seg->fold_seq) & 1)
+      ; /* a fold takes a few hundred nanoseconds */
+    __sync_synchronize();
+    memset(total, 0, sizeof(unsigned long long) * METRIC_COUNTERS);
+    for (s = 0; s < STATS_SLOTS; s++)
+    {
+      for (c = 0; c < METRIC_COUNTERS; c++)
+      {
+        total[c] += seg->slot[s].counter[c];
+      }
+    }
+    __sync_synchronize();
+  }
+  while (seg->fold_seq != seq);
+} /* stats_totals */
+
+/* The pid in the lockfile, which is the master's, or 0 if there is none */
+pid_t stats_daemon_pid()
+{
+  char str[50];
+  ssize_t n;
+  int fd;
+
+  fd = open(GLOBAL_LOCKFILE_NAME, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  n = read(fd, str, sizeof(str) - 1);
+  close(fd);
+  if (n <= 0)
+  {
+    return 0;
+  }
+  str[n] = '\0';
+  return (pid_t)atoi(str);
+} /* stats_daemon_pid */
+
+/* Maps the segment of daemon pid read-only. Returns NULL, with the reason
+   in why, if it can't or the segment isn't one it understands. */
+const stats_segment* stats_attach(pid_t pid, char *why, size_t len)
+{
+  char name[FILENAME_LEN];
+  const stats_segment *seg;
+  void *p;
+  int fd;
+
+  snprintf(name, sizeof(name), GLOBAL_STATS_NAME, (int)pid);
+  fd = open(name, O_RDONLY);
+  if (fd < 0)
+  {
+    snprintf(why, len, "can't open %s: %s", name, strerror(errno));
+    return NULL;
+  }
+  p = mmap(NULL, sizeof(stats_segment), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    snprintf(why, len, "can't map %s: %s", name, strerror(errno));
+    return NULL;
+  }
+  seg = p;
+  if ((seg->magic != STATS_MAGIC) || (seg->version != STATS_VERSION) ||
+      (seg->size != sizeof(stats_segment)) || (seg->pid != pid))
+  {
+    snprintf(why, len, "%s is not the statistics of a running daemon pid %d"
+             " of this version", name, (int)pid);
+    munmap(p, sizeof(stats_segment));
+    return NULL;
+  }
+  return seg;
+} /* stats_attach */
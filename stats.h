@@ -0,0 +1,150 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* stats.h
+
+   The statistics segment, shared by metrics.c in the daemon which writes
+   it and daemonstat.c which reads it.
+
+   The master creates the segment as the file GLOBAL_STATS_NAME (with its
+   pid filled in) and maps it MAP_SHARED before forking any children, so
+   every process writes into the same pages and daevel-stat can map them
+   read-only by finding the pid in the lockfile.
+
+   Counters are kept per process, in slots. Each slot fills whole cache
+   lines, so a child adding to its own counters never invalidates the
+   line another process is adding to. Slot STATS_SLOT_MASTER is the
+   master's, STATS_SLOT_RETIRED holds what dead children counted, and the
+   rest are claimed by children as they start. The total of a counter is
+   the sum over every slot.
+
+   When dead_child() reaps a child it folds the child's slot into
+   STATS_SLOT_RETIRED. fold_seq is odd while that is happening, so a
+   reader that sees it odd, or changed over its read, reads again.
+
+   Histograms are updated by the master and children alike, with atomic
+   adds straight into the shared buckets. They are written once or twice
+   per connection, so sharing their cache lines costs little.
+
+   Everything is in host byte order.
+*/
+
+#include <sys/types.h>
+#include <time.h>
+
+#define STATS_MAGIC 0x54534c44    /* "DLST" on little-endian */
+#define STATS_VERSION 10
+#define STATS_CACHE_LINE 64
+
+/* counters, only ever go up */
+#define MC_ACCEPTED 0      /* connections accepted */
+#define MC_REFUSED 1       /* turned away because maxchild reached */
+#define MC_DUP_FAILED 2    /* dup() of the client socket failed */
+#define MC_FORK_FAILED 3   /* fork() failed */
+#define MC_REAPED 4        /* children reaped by dead_child() */
+#define MC_SQUASHED 5      /* accept() errors squashed, all errnos */
+#define MC_ADMIN 6         /* admin socket requests */
+#define MC_BYTES_IN 7      /* read from clients by children */
+#define MC_BYTES_OUT 8     /* written to clients by children */
+#define MC_DENIED 9        /* turned away by the ACL, see acl.c */
+#define MC_FD_EXHAUSTED 10 /* accept() out of descriptors or memory */
+#define MC_DEADLINE 11     /* children sent SIGTERM over childdeadline */
+#define MC_CPU_BUDGET 12   /* children sent SIGTERM over childcpu */
+#define MC_WATCHDOG_KILL 13 /* ... and SIGKILL after childgrace */
+#define MC_PLACED 14       /* children given a CPU, see placement.c */
+#define MC_PLACED_NIC 15   /* ... the one their packets arrived on */
+#define MC_PLACED_NIC_MISS 16 /* ... wanted to, but it wasn't usable */
+#define MC_PLACE_FAILED 17 /* children that couldn't move to their CPU */
+#define MC_UDP_RX 18       /* datagrams read by UDP workers, see udp.c */
+#define MC_UDP_TX 19       /* ... and replies sent */
+#define MC_UDP_BATCHES 20  /* recvmmsg() calls that returned datagrams */
+#define MC_UDP_DROPPED 21  /* replies not sent, the socket buffer full */
+#define MC_ACCEPTED_LOCAL 22 /* of MC_ACCEPTED, on the AF_UNIX listener */
+#define MC_BUSY_SPUN 23    /* waits that found work while spinning, ... */
+#define MC_BUSY_SLEPT 24   /* ... and that spun busyspin and slept */
+#define MC_UDP_CROSS_CPU 25 /* batches received on another CPU, see udp.c */
+#define METRIC_COUNTERS 26
+
+/* gauges, set to the current value by the master */
+#define MG_CHILDREN 0      /* connection children running */
+#define MG_MAXCHILD 1      /* the maxchild option */
+#define METRIC_GAUGES 2
+
+/* histograms, in microseconds unless they say otherwise */
+#define MH_ACCEPT_TO_FORK 0     /* accept() returning to fork() returning */
+#define MH_FORK_TO_FIRST_BYTE 1 /* fork() to the child's first write */
+#define MH_LIFETIME 2           /* accept() to the child exiting */
+#define MH_CHILD_USER 3         /* from wait4() rusage of each child: */
+#define MH_CHILD_SYS 4          /*   CPU time */
+#define MH_CHILD_MAXRSS 5       /*   peak resident set, kB */
+#define MH_CHILD_MINFLT 6       /*   minor page faults, mostly COW */
+#define MH_CHILD_MAJFLT 7       /*   major page faults */
+#define MH_CHILD_CSW 8          /*   voluntary + involuntary switches */
+#define MH_CHILD_WALL 9         /* fork() to reaped, seen by the master */
+#define MH_WAKEUP_TO_HANDLER 10 /* poll() seeing work to the handler */
+#define METRIC_HISTOGRAMS 11
+
+/* Histogram buckets are HDR-style: each power of two is split into
+   METRIC_SUB_BUCKETS linear buckets, so any value is known to within
+   1/METRIC_SUB_BUCKETS of itself. Values above 2^METRIC_MAX_BITS
+   microseconds (about 12 days) go in the last bucket. */
+#define METRIC_SUB_BITS 3
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BITS)
+#define METRIC_MAX_BITS 40
+#define METRIC_BUCKETS ((METRIC_MAX_BITS - METRIC_SUB_BITS + 1) * \
+                        METRIC_SUB_BUCKETS)
+
+#define METRIC_ERRNOS 256  /* squashed accept() errors counted by errno */
+
+#define STATS_SLOT_MASTER 0
+#define STATS_SLOT_RETIRED 1
+#define STATS_SLOTS (ABSOLUTE_MAX_CHILDREN + 2)
+
+typedef struct
+{
+  volatile pid_t pid;  /* owner, 0 if free */
+  unsigned long long counter[METRIC_COUNTERS];
+}
+__attribute__((aligned(STATS_CACHE_LINE))) stats_slot;
+
+typedef struct
+{
+  unsigned long long count;
+  unsigned long long sum;
+  unsigned long long max;
+  unsigned long long bucket[METRIC_BUCKETS];
+}
+stats_histogram;
+
+typedef struct
+{
+  unsigned magic;       /* STATS_MAGIC while the daemon runs, then 0 */
+  unsigned version;     /* STATS_VERSION */
+  unsigned size;        /* sizeof(stats_segment) */
+  pid_t pid;            /* the master */
+  time_t started;
+  volatile unsigned fold_seq;
+  long gauge[METRIC_GAUGES];
+  unsigned long long squashed[METRIC_ERRNOS];
+  stats_histogram histogram[METRIC_HISTOGRAMS];
+  stats_slot slot[STATS_SLOTS];
+}
+stats_segment;
+
+/* stats.c, used by the daemon and the programs that read the segment */
+unsigned stats_bucket(unsigned long long v);
+unsigned long long stats_bucket_top(unsigned b);
+unsigned long long stats_quantile(const unsigned long long *bucket,
+                                  unsigned long long count, double q);
+void stats_totals(const stats_segment *seg,
+                  unsigned long long total[METRIC_COUNTERS]);
+pid_t stats_daemon_pid();
+const stats_segment* stats_attach(pid_t pid, char *why, size_t len);
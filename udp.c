@@ -0,0 +1,496 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* udp.c
+
+   UDP mode (protocol=udp). There are no connections to fork a child
+   for, so the master instead starts udpworkers long-lived workers when
+   it starts, and starts a worker again when one dies, though not more
+   than once every UDP_RESPAWN_US, so that one crashing at once doesn't
+   fork in a loop. Workers are in the child table like any other child,
+   so they are placed, profiled and accounted the same way, but the
+   watchdog leaves them alone since they are meant to run for ever.
+
+   By default the workers share the one socket the master bound. With
+   udpreuseport each has its own, all bound to the port with
+   SO_REUSEPORT, and the kernel shares datagrams out between them by a
+   hash of the addresses, so they don't contend for one receive queue.
+   The master opens them all at the start and keeps them, so a worker
+   started again gets the same socket, and what was queued for the one
+   that died isn't lost.
+
+   A worker reads up to UDP_BATCH datagrams with each recvmmsg() and
+   sends the replies with one sendmmsg(), so a busy worker makes two
+   system calls a batch rather than two a datagram.
+   daemon_packet_function() in daemon-packet-func.c is called for each
+   datagram, like daemon_child_function() is for each connection.
+
+   With udpgro the kernel may coalesce datagrams from one sender into
+   one buffer, with the size of each in a control message, which is
+   split here before the handler sees it. With udpgso, a reply longer
+   than udpgso is sent as one buffer that the kernel (or the NIC) cuts
+   into udpgso-sized datagrams, rather than being fragmented at the IP
+   layer.
+
+   A worker doesn't block in recvmmsg(): it waits in poll() for up to
+   UDP_POLL_MS, so that it notices its master has gone, and a full
+   socket buffer drops replies rather than holding up the next batch,
+   as the network would have. With busyspin it spins in socket_poll()
+   first, and with busycpus it is pinned to one of them.
+
+   With udpsteer (and udpreuseport) each worker is pinned to a CPU, and
+   a program attached to the sockets has the kernel give each datagram
+   to the worker on the CPU that received it, rather than share them
+   out by a hash; see socket_steer(). Batches whose last datagram came
+   in on a CPU other than the worker's are counted, with or without
+   udpsteer, so the two can be compared.
+
+*/
+
+#define _GNU_SOURCE  /* recvmmsg() and sendmmsg() */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "udp.h"
+#include "socket.h"
+#include "metrics.h"
+#include "flight.h"
+#include "placement.h"
+#define LOG_SUBSYS LOGSUB_SOCKET
+#include "log.h"
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103   /* linux/udp.h, which glibc doesn't always have */
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define UDP_BUFFER 65536  /* each datagram's buffer, a GRO one fits too */
+#define UDP_POLL_MS 1000
+
+typedef struct
+{
+  int sock;
+  pid_t pid;                       /* 0 while it isn't running */
+  unsigned long long started_us;   /* metrics_now() */
+  unsigned long long restart_us;   /* when it may be started again */
+}
+udp_worker;
+
+/* a control message buffer, aligned as one */
+typedef union
+{
+  char buf[CMSG_SPACE(sizeof(int))];
+  struct cmsghdr align;
+}
+udp_control;
+
+extern int daemon_packet_function(const char *in, size_t len, char *out,
+                                  size_t max, const struct sockaddr_in *from);
+
+static udp_worker workers[UDP_MAX_WORKERS];
+static int nworkers = 0;
+static int gro = FALSE;    /* udpgro, and the kernel took it */
+
+/* a worker's batch, in and out */
+static struct mmsghdr rx[UDP_BATCH];
+static struct iovec rx_iov[UDP_BATCH];
+static struct sockaddr_in rx_from[UDP_BATCH];
+static udp_control rx_control[UDP_BATCH];
+static char *rx_buf = NULL;
+static struct mmsghdr tx[UDP_BATCH];
+static struct iovec tx_iov[UDP_BATCH];
+static struct sockaddr_in tx_to[UDP_BATCH];
+static udp_control tx_control[UDP_BATCH];
+static char *tx_buf = NULL;
+
+/* Called by the master with the socket init_socket() bound. Opens a
+   socket for each other worker if udpreuseport. Returns FALSE if it
+   can't */
+int udp_start(int first)
+{
+  struct sockaddr_in sin;
+  int cpu[UDP_MAX_WORKERS];
+  int steered = FALSE;
+  int one = 1;
+  int w;
+
+  nworkers = global_options->udpworkers;
+  for (w = 0; w < nworkers; w++)
+  {
+    memset(&workers[w], 0, sizeof(udp_worker));
+    workers[w].sock = first;
+    if ((w > 0) && (global_options->udpreuseport == TRUE))
+    {
+      workers[w].sock = init_socket(&sin);
+      if (workers[w].sock < 0)
+      {
+        return FALSE;
+      }
+    }
+  }
+
+  if (global_options->udpgro == TRUE)
+  {
+    gro = TRUE;
+    for (w = 0; w < nworkers; w++)
+    {
+      if (setsockopt(workers[w].sock, SOL_UDP, UDP_GRO, &one,
+                     sizeof(one)) < 0)
+      {
+        LOG(1, ("UDP_GRO not available, error %d, %s; carrying on "
+                "without\n", errno, strerror(errno)));
+        gro = FALSE;
+        break;
+      }
+    }
+  }
+  /* the sockets joined the group in worker order, so socket w is worker
+     w's, and the worker will be pinned to cpu[w] */
+  if ((global_options->udpsteer == TRUE) && (nworkers > 1))
+  {
+    for (w = 0; w < nworkers; w++)
+    {
+      cpu[w] = placement_worker_cpu(w);
+    }
+    steered = socket_steer(first, cpu, nworkers);
+  }
+  LOG(2, ("%d UDP workers on %s, udpgso %u, GRO %s, %s\n", nworkers,
+          (global_options->udpreuseport == TRUE) ? "a socket each" :
+          "one socket", global_options->udpgso, (gro == TRUE) ? "on" : "off",
+          (steered == TRUE) ? "steered by CPU" : "hashed"));
+  return TRUE;
+} /* udp_start */
+
+/* Returns a worker that should be running and isn't, or -1 if there is
+   none. One reaped while we look is found next time round */
+int udp_vacant()
+{
+  unsigned long long now = metrics_now();
+  int w;
+
+  for (w = 0; w < nworkers; w++)
+  {
+    if ((workers[w].pid == 0) && (now >= workers[w].restart_us))
+    {
+      return w;
+    }
+  }
+  return -1;
+} /* udp_vacant */
+
+int udp_socket(int w)
+{
+  return workers[w].sock;
+} /* udp_socket */
+
+/* The master forked worker w as pid. Call with SIGCHLD blocked */
+void udp_started(int w, pid_t pid)
+{
+  workers[w].pid = pid;
+  workers[w].started_us = metrics_now();
+  workers[w].restart_us = workers[w].started_us + UDP_RESPAWN_US;
+} /* udp_started */
+
+/* Called by dead_child() with each reaped pid */
+void udp_reaped(pid_t pid)
+{
+  int w;
+
+  for (w = 0; w < nworkers; w++)
+  {
+    if (workers[w].pid == pid)
+    {
+      workers[w].pid = 0;
+      return;
+    }
+  }
+} /* udp_reaped */
+
+/* Called in worker w, which only needs its own socket */
+void udp_forked(int w)
+{
+  int i;
+
+  for (i = 0; i < nworkers; i++)
+  {
+    if (workers[i].sock != workers[w].sock)
+    {
+      close(workers[i].sock);
+    }
+  }
+} /* udp_forked */
+
+/* Sends the n replies in tx */
+static void send_batch(int s, int n)
+{
+  unsigned long long bytes = 0;
+  int dropped = 0;
+  int sent = 0;
+  int done = 0;
+  int err = 0;
+  int r;
+  int i;
+
+  while (done < n)
+  {
+    r = sendmmsg(s, tx + done, n - done, MSG_DONTWAIT);
+    if (r > 0)
+    {
+      for (i = done; i < done + r; i++)
+      {
+        bytes += tx[i].msg_len;
+      }
+      sent += r;
+      done += r;
+      continue;
+    }
+    if ((r < 0) && (errno == EINTR))
+    {
+      continue;
+    }
+    err = errno;
+    if ((r < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+                    (errno == ENOBUFS)))
+    {
+      dropped += n - done;  /* the socket buffer is full */
+      break;
+    }
+    /* just this reply can't go, eg EMSGSIZE; the rest may */
+    LOG_LIMITED(LOGCLASS_ACCEPT, 1, ("sendmmsg() to %s failed with error "
+                                     "%d, %s\n", inet_ntoa(tx_to[done].sin_addr),
+                                     errno, strerror(errno)));
+    dropped++;
+    done++;
+  }
+  metrics_add(MC_UDP_TX, sent);
+  metrics_add(MC_BYTES_OUT, bytes);
+  if (dropped > 0)
+  {
+    metrics_add(MC_UDP_DROPPED, dropped);
+  }
+  flight_record(FL_WRITE, err, s, sent);
+} /* send_batch */
+
+/* Makes tx[n] the reply of len bytes already in its buffer, to to */
+static void queue_reply(int n, const struct sockaddr_in *to, size_t len)
+{
+  struct cmsghdr *cm;
+  unsigned short segment = global_options->udpgso;
+
+  tx_to[n] = *to;
+  tx_iov[n].iov_len = len;
+  tx[n].msg_hdr.msg_control = NULL;
+  tx[n].msg_hdr.msg_controllen = 0;
+  if ((segment > 0) && (len > segment))
+  {
+    tx[n].msg_hdr.msg_control = tx_control[n].buf;
+    tx[n].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(segment));
+    cm = CMSG_FIRSTHDR(&tx[n].msg_hdr);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(segment));
+    memcpy(CMSG_DATA(cm), &segment, sizeof(segment));
+  }
+} /* queue_reply */
+
+/* The size of the datagrams GRO coalesced into rx[i], or 0 if it is one */
+static size_t gro_segment(int i)
+{
+  struct cmsghdr *cm;
+  int size;
+
+  for (cm = CMSG_FIRSTHDR(&rx[i].msg_hdr); cm != NULL;
+       cm = CMSG_NXTHDR(&rx[i].msg_hdr, cm))
+  {
+    if ((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO))
+    {
+      memcpy(&size, CMSG_DATA(cm), sizeof(size));
+      return (size > 0) ? (size_t)size : 0;
+    }
+  }
+  return 0;
+} /* gro_segment */
+
+/* Counts the batch just read from s if the kernel received its last
+   datagram on a CPU other than this one */
+static void note_cpu(int s)
+{
+#ifdef SO_INCOMING_CPU
+  socklen_t len = sizeof(int);
+  int cpu = -1;
+
+  if ((getsockopt(s, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &len) == 0) &&
+      (cpu >= 0) && (cpu != sched_getcpu()))
+  {
+    metrics_count(MC_UDP_CROSS_CPU);
+  }
+#endif
+} /* note_cpu */
+
+/* Answers the n datagrams recvmmsg() put in rx. woke is when the
+   worker found them waiting */
+static void answer_batch(int s, int n, unsigned long long woke)
+{
+  unsigned long long bytes = 0;
+  size_t len;
+  size_t segment;
+  size_t off;
+  size_t part;
+  int datagrams = 0;
+  int queued = 0;
+  int reply;
+  int i;
+
+  for (i = 0; i < n; i++)
+  {
+    len = rx[i].msg_len;
+    bytes += len;
+    if (rx[i].msg_hdr.msg_flags & MSG_TRUNC)
+    {
+      LOG_LIMITED(LOGCLASS_ACCEPT, 1, ("datagram from %s truncated, "
+                                       "dropped\n",
+                                       inet_ntoa(rx_from[i].sin_addr)));
+      continue;
+    }
+    segment = (gro == TRUE) ? gro_segment(i) : 0;
+    if (segment == 0)
+    {
+      segment = len;
+    }
+    off = 0;
+    do
+    {
+      part = (len - off < segment) ? len - off : segment;
+      if (datagrams == 0)
+      {
+        metrics_record(MH_WAKEUP_TO_HANDLER, metrics_now() - woke);
+      }
+      reply = daemon_packet_function(rx_buf + i * UDP_BUFFER + off, part,
+                                     tx_buf + queued * UDP_BUFFER,
+                                     UDP_MAX_DATAGRAM, &rx_from[i]);
+      datagrams++;
+      if (reply > 0)
+      {
+        queue_reply(queued++, &rx_from[i], reply);
+        if (queued == UDP_BATCH)
+        {
+          send_batch(s, queued);
+          queued = 0;
+        }
+      }
+      off += part;
+    }
+    while (off < len);
+  }
+  if (queued > 0)
+  {
+    send_batch(s, queued);
+  }
+  metrics_count(MC_UDP_BATCHES);
+  metrics_add(MC_UDP_RX, datagrams);
+  metrics_add(MC_BYTES_IN, bytes);
+  flight_record(FL_READ, 0, s, datagrams);
+} /* answer_batch */
+
+/* The body of worker w. Never returns */
+void udp_serve(int w)
+{
+  struct pollfd pfd;
+  pid_t master = getppid();
+  unsigned long long woke;
+  int s = workers[w].sock;
+  int n;
+  int i;
+
+  rx_buf = malloc(UDP_BATCH * UDP_BUFFER);
+  tx_buf = malloc(UDP_BATCH * UDP_BUFFER);
+  if ((rx_buf == NULL) || (tx_buf == NULL))
+  {
+    PANIC(("UDP worker %d: out of memory for buffers\n", w));
+  }
+  memset(rx, 0, sizeof(rx));
+  memset(tx, 0, sizeof(tx));
+  for (i = 0; i < UDP_BATCH; i++)
+  {
+    rx_iov[i].iov_base = rx_buf + i * UDP_BUFFER;
+    rx[i].msg_hdr.msg_iov = &rx_iov[i];
+    rx[i].msg_hdr.msg_iovlen = 1;
+    rx[i].msg_hdr.msg_name = &rx_from[i];
+    tx_iov[i].iov_base = tx_buf + i * UDP_BUFFER;
+    tx[i].msg_hdr.msg_iov = &tx_iov[i];
+    tx[i].msg_hdr.msg_iovlen = 1;
+    tx[i].msg_hdr.msg_name = &tx_to[i];
+    tx[i].msg_hdr.msg_namelen = sizeof(tx_to[i]);
+  }
+  LOG(9, ("UDP worker %d serving socket %d\n", w, s));
+
+  for (;;)
+  {
+    pfd.fd = s;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    n = socket_poll(&pfd, 1, UDP_POLL_MS, TRUE);
+    if (getppid() != master)
+    {
+      LOG(1, ("UDP worker %d: master has gone, exiting\n", w));
+      log_flush(FALSE);
+      _exit(EXIT_SUCCESS);
+    }
+    if (n <= 0)
+    {
+      continue;  /* nothing yet, or a signal such as SIGPROF */
+    }
+
+    /* a full batch means there may well be more waiting, and the wait
+       for the next is from when it is asked for */
+    woke = socket_woke();
+    do
+    {
+      for (i = 0; i < UDP_BATCH; i++)
+      {
+        rx_iov[i].iov_len = UDP_BUFFER;
+        rx[i].msg_hdr.msg_namelen = sizeof(rx_from[i]);
+        rx[i].msg_hdr.msg_control = rx_control[i].buf;
+        rx[i].msg_hdr.msg_controllen = sizeof(rx_control[i].buf);
+        rx[i].msg_hdr.msg_flags = 0;
+      }
+      n = recvmmsg(s, rx, UDP_BATCH, MSG_DONTWAIT, NULL);
+      if (n < 0)
+      {
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        {
+          flight_record(FL_READ, errno, s, 0);
+          LOG_LIMITED(LOGCLASS_ACCEPT, 1, ("recvmmsg() failed with error %d, "
+                                           "%s\n", errno, strerror(errno)));
+        }
+        break;
+      }
+      note_cpu(s);
+      answer_batch(s, n, woke);
+      woke = metrics_now();
+    }
+    while (n == UDP_BATCH);
+  }
+} /* udp_serve */
@@ -0,0 +1,31 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* udp.h
+
+*/
+
+#include <sys/types.h>
+
+#define UDP_MAX_WORKERS 64
+#define UDP_BATCH 32            /* datagrams a recvmmsg() or sendmmsg() */
+#define UDP_MAX_DATAGRAM 65507  /* largest UDP payload over IPv4 */
+#define UDP_GSO_MIN 1024        /* so a largest reply is <= 64 segments */
+#define UDP_GSO_MAX 8972        /* a 9000 byte jumbo frame's payload */
+#define UDP_RESPAWN_US 1000000ULL /* least time between a worker's starts */
+
+int udp_start(int first);
+int udp_vacant();
+int udp_socket(int w);
+void udp_started(int w, pid_t pid);
+void udp_reaped(pid_t pid);
+void udp_forked(int w);
+void udp_serve(int w);
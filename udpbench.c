@@ -0,0 +1,534 @@
+/*
+ * (C) Dan Shearer 2003-2008
+ *
+ * This program is open source software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 3 of the License, or (at your option) any later version. You
+ * should have received a copy of the license with this program; if
+ * not, go to http://www.fsf.org.
+*/
+
+/* udpbench.c
+
+   daevel-udpbench: packets-a-second load generator for UDP mode
+   (protocol=udp), where daemon_packet_function() echoes each datagram.
+
+   usage: daevel-udpbench [-h host] [-p port] [-t threads] [-c window]
+                          [-r rate] [-d secs] [-s bytes] [-b batch] [-j]
+
+   Each thread has its own connected socket, so to the daemon it is one
+   sender (and with udpreuseport is always answered by the same worker),
+   and sends and receives up to batch datagrams a system call with
+   sendmmsg() and recvmmsg(), so that the client is not what limits the
+   rate.
+
+   Closed loop (the default): window datagrams are kept outstanding, each
+   sent again as soon as its echo is back. Open loop (-r rate): datagrams
+   are sent at rate a second whatever comes back, up to window of them
+   outstanding, and latency is measured from when each should have been
+   sent, as daevel-bench does for connections.
+
+   A datagram whose echo hasn't come in UDPB_LOSS_MS is lost, and its
+   place in the window is used again; an echo that turns up after that
+   is counted as stale. Each datagram starts with a header saying where
+   in the window it was sent from. A daemon with udpgso sends a long
+   echo as several datagrams, only the first of which has the header;
+   the rest are only counted in the bytes.
+
+   Prints datagrams echoed and bytes a second, losses, and latency
+   percentiles in microseconds. -j prints one line of JSON instead, for
+   bench-matrix.sh.
+
+*/
+
+#define _GNU_SOURCE  /* sendmmsg() and recvmmsg() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "global.h"
+#include "stats.h"
+
+#define UDPB_MAX_THREADS 256
+#define UDPB_MAX_BATCH 256
+#define UDPB_MAX_PAYLOAD 65507
+#define UDPB_LOSS_MS 200     /* no echo by then, and it was lost */
+#define UDPB_DRAIN_SECS 1    /* wait for stragglers at the end */
+#define UDPB_MAGIC 0x44565542  /* "BUVD" */
+
+/* at the start of every datagram sent */
+typedef struct
+{
+  unsigned magic;
+  unsigned slot;                 /* in the sending thread's window */
+  unsigned long long seq;
+}
+udpb_header;
+
+typedef struct
+{
+  unsigned long long seq;        /* 0 while the slot is free */
+  unsigned long long start_us;   /* intended send, for latency */
+  unsigned long long sent_us;    /* actual send, for losses */
+}
+udpb_slot;
+
+typedef struct
+{
+  pthread_t thread;
+  int id;
+  int window;
+  double rate;                   /* datagrams a second, 0 closed loop */
+  int fd;
+  udpb_slot *slots;
+  int *free_slots;               /* a stack of them */
+  int nfree;
+  unsigned long long seq;
+  /* results */
+  unsigned long long sent;
+  unsigned long long done;
+  unsigned long long lost;
+  unsigned long long stale;
+  unsigned long long errors;
+  unsigned long long bytes;      /* echoed back */
+  unsigned long long late;       /* open loop sends over 1ms late */
+  unsigned long long bucket[METRIC_BUCKETS];
+}
+udpb_thread;
+
+static struct sockaddr_in target;
+static size_t payload_len = 64;
+static int batch = 32;
+static int nthreads = 4;
+static unsigned long long stop_us;       /* nothing new sent after */
+static unsigned long long drain_us;      /* stop waiting after */
+
+static unsigned long long now_us()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* now_us */
+
+static void slot_free(udpb_thread *t, int i)
+{
+  t->slots[i].seq = 0;
+  t->free_slots[t->nfree++] = i;
+} /* slot_free */
+
+/* Sends n datagrams from the free slots, started at start, or every
+   interval from start in open loop. Returns how many went */
+static int send_some(udpb_thread *t, char *buf, struct mmsghdr *msg, int n,
+                     unsigned long long start, unsigned long long interval)
+{
+  unsigned long long now = now_us();
+  udpb_header *h;
+  int slot[UDPB_MAX_BATCH];
+  int sent;
+  int i;
+
+  for (i = 0; i < n; i++)
+  {
+    slot[i] = t->free_slots[--t->nfree];
+    h = (udpb_header *)(buf + i * payload_len);
+    h->magic = UDPB_MAGIC;
+    h->slot = slot[i];
+    h->seq = ++t->seq;
+    t->slots[slot[i]].seq = h->seq;
+    t->slots[slot[i]].start_us = start + i * interval;
+    t->slots[slot[i]].sent_us = now;
+    if ((interval > 0) && (now - t->slots[slot[i]].start_us > 1000))
+    {
+      t->late++;
+    }
+  }
+  sent = sendmmsg(t->fd, msg, n, MSG_DONTWAIT);
+  if (sent < 0)
+  {
+    if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) &&
+        (errno != ENOBUFS))
+    {
+      t->errors++;  /* eg ECONNREFUSED, from an ICMP for an earlier one */
+    }
+    sent = 0;
+  }
+  for (i = sent; i < n; i++)
+  {
+    slot_free(t, slot[i]);
+  }
+  t->sent += sent;
+  return sent;
+} /* send_some */
+
+/* Reads whatever echoes are waiting */
+static void receive(udpb_thread *t, char *buf, struct mmsghdr *msg)
+{
+  unsigned long long now;
+  udpb_header h;
+  int n;
+  int i;
+
+  do
+  {
+    for (i = 0; i < batch; i++)
+    {
+      msg[i].msg_hdr.msg_flags = 0;
+    }
+    n = recvmmsg(t->fd, msg, batch, MSG_DONTWAIT, NULL);
+    if (n < 0)
+    {
+      if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+      {
+        t->errors++;
+      }
+      return;
+    }
+    now = now_us();
+    for (i = 0; i < n; i++)
+    {
+      t->bytes += msg[i].msg_len;
+      if (msg[i].msg_len < sizeof(h))
+      {
+        continue;
+      }
+      memcpy(&h, buf + i * UDPB_MAX_PAYLOAD, sizeof(h));
+      if (h.magic != UDPB_MAGIC)
+      {
+        continue;  /* the rest of a GSO echo */
+      }
+      if ((h.slot >= (unsigned)t->window) || (t->slots[h.slot].seq != h.seq))
+      {
+        t->stale++;
+        continue;
+      }
+      t->bucket[stats_bucket(now - t->slots[h.slot].start_us)]++;
+      t->done++;
+      slot_free(t, h.slot);
+    }
+  }
+  while (n == batch);
+} /* receive */
+
+/* Frees the slots of datagrams that have waited too long */
+static void expire(udpb_thread *t, unsigned long long now)
+{
+  int i;
+
+  for (i = 0; i < t->window; i++)
+  {
+    if ((t->slots[i].seq != 0) &&
+        (now - t->slots[i].sent_us > UDPB_LOSS_MS * 1000ULL))
+    {
+      t->lost++;
+      slot_free(t, i);
+    }
+  }
+} /* expire */
+
+static void* udpb_run(void *arg)
+{
+  udpb_thread *t = arg;
+  static __thread struct mmsghdr txmsg[UDPB_MAX_BATCH];
+  static __thread struct iovec txiov[UDPB_MAX_BATCH];
+  static __thread struct mmsghdr rxmsg[UDPB_MAX_BATCH];
+  static __thread struct iovec rxiov[UDPB_MAX_BATCH];
+  char *txbuf = malloc(batch * payload_len);
+  char *rxbuf = malloc(batch * UDPB_MAX_PAYLOAD);
+  unsigned long long next = now_us();  /* open loop: next send due */
+  unsigned long long interval = 0;
+  unsigned long long last_expire = 0;
+  unsigned long long now;
+  struct pollfd pfd;
+  size_t j;
+  int timeout;
+  int n;
+  int i;
+
+  if ((txbuf == NULL) || (rxbuf == NULL))
+  {
+    fprintf(stderr, "daevel-udpbench: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < batch; i++)
+  {
+    /* no one would mistake the rest of the payload for a header */
+    for (j = sizeof(udpb_header); j < payload_len; j++)
+    {
+      txbuf[i * payload_len + j] = 'a' + (j % 26);
+    }
+    txiov[i].iov_base = txbuf + i * payload_len;
+    txiov[i].iov_len = payload_len;
+    txmsg[i].msg_hdr.msg_iov = &txiov[i];
+    txmsg[i].msg_hdr.msg_iovlen = 1;
+    rxiov[i].iov_base = rxbuf + i * UDPB_MAX_PAYLOAD;
+    rxiov[i].iov_len = UDPB_MAX_PAYLOAD;
+    rxmsg[i].msg_hdr.msg_iov = &rxiov[i];
+    rxmsg[i].msg_hdr.msg_iovlen = 1;
+  }
+  if (t->rate > 0)
+  {
+    interval = (unsigned long long)(1e6 / t->rate);
+    if (interval == 0)
+    {
+      interval = 1;
+    }
+    next += interval * t->id / nthreads;  /* don't all start at once */
+  }
+
+  for (;;)
+  {
+    now = now_us();
+    if (now < stop_us)
+    {
+      if (t->rate > 0)
+      {
+        /* every send that is due, as if it had gone on time */
+        while ((next <= now) && (t->nfree > 0))
+        {
+          n = (int)((now - next) / interval) + 1;
+          n = (n > batch) ? batch : n;
+          n = (n > t->nfree) ? t->nfree : n;
+          if (send_some(t, txbuf, txmsg, n, next, interval) < n)
+          {
+            break;  /* the socket buffer is full, try again soon */
+          }
+          next += n * interval;
+        }
+      }
+      else
+      {
+        while (t->nfree > 0)
+        {
+          n = (t->nfree > batch) ? batch : t->nfree;
+          if (send_some(t, txbuf, txmsg, n, now, 0) < n)
+          {
+            break;
+          }
+        }
+      }
+    }
+    if ((now >= stop_us) && ((t->nfree == t->window) || (now >= drain_us)))
+    {
+      break;
+    }
+    if (now - last_expire >= 10000)
+    {
+      expire(t, now_us());  /* now is older than the latest sends */
+      last_expire = now;
+    }
+
+    timeout = 10;
+    if ((t->rate > 0) && (now < stop_us) && (t->nfree > 0))
+    {
+      /* rounded up, or a thread spins for the last millisecond */
+      timeout = (next > now) ? (int)((next - now + 999) / 1000) : 0;
+    }
+    pfd.fd = t->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout) > 0)
+    {
+      receive(t, rxbuf, rxmsg);
+    }
+  }
+  t->lost += t->window - t->nfree;  /* still outstanding after the drain */
+  free(txbuf);
+  free(rxbuf);
+  return NULL;
+} /* udpb_run */
+
+static void usage()
+{
+  fprintf(stderr, "usage: daevel-udpbench [-h host] [-p port] [-t threads]"
+          " [-c window] [-r rate] [-d secs] [-s bytes] [-b batch] [-j]\n");
+  fprintf(stderr, "       -h host     daemon to load, default 127.0.0.1\n");
+  fprintf(stderr, "       -p port     default 3000\n");
+  fprintf(stderr, "       -t threads  default 4\n");
+  fprintf(stderr, "       -c window   datagrams outstanding at once,"
+          " default 64\n");
+  fprintf(stderr, "       -r rate     open loop at rate datagrams/s,"
+          " default closed loop\n");
+  fprintf(stderr, "       -d secs     how long to run, default 10\n");
+  fprintf(stderr, "       -s bytes    datagram size, default 64, at least"
+          " %lu\n", (unsigned long)sizeof(udpb_header));
+  fprintf(stderr, "       -b batch    datagrams a system call, default 32\n");
+  fprintf(stderr, "       -j          print results as one line of JSON\n");
+  exit(EXIT_FAILURE);
+} /* usage */
+
+int main(int argc, char **argv)
+{
+  static udpb_thread threads[UDPB_MAX_THREADS];
+  static unsigned long long bucket[METRIC_BUCKETS];
+  struct hostent *he;
+  const char *host = "127.0.0.1";
+  unsigned long long start;
+  unsigned long long sent = 0;
+  unsigned long long done = 0;
+  unsigned long long lost = 0;
+  unsigned long long stale = 0;
+  unsigned long long errors = 0;
+  unsigned long long bytes = 0;
+  unsigned long long late = 0;
+  double secs = 10;
+  double rate = 0;
+  int port = 3000;
+  int window = 64;
+  int json = FALSE;
+  int t;
+  int i;
+  int b;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "h:p:t:c:r:d:s:b:j")) != -1)
+  {
+    switch (ch)
+    {
+    case 'h':
+      host = optarg;
+      break;
+    case 'p':
+      port = atoi(optarg);
+      break;
+    case 't':
+      nthreads = atoi(optarg);
+      break;
+    case 'c':
+      window = atoi(optarg);
+      break;
+    case 'r':
+      rate = atof(optarg);
+      break;
+    case 'd':
+      secs = atof(optarg);
+      break;
+    case 's':
+      payload_len = (size_t)atol(optarg);
+      break;
+    case 'b':
+      batch = atoi(optarg);
+      break;
+    case 'j':
+      json = TRUE;
+      break;
+    default:
+      usage();
+    }
+  }
+  if ((port <= 0) || (port > 65535) || (nthreads <= 0) ||
+      (nthreads > UDPB_MAX_THREADS) || (window <= 0) || (rate < 0) ||
+      (secs <= 0) || (payload_len < sizeof(udpb_header)) ||
+      (payload_len > UDPB_MAX_PAYLOAD) || (batch <= 0) ||
+      (batch > UDPB_MAX_BATCH))
+  {
+    usage();
+  }
+  if (window < nthreads)
+  {
+    nthreads = window;
+  }
+
+  he = gethostbyname(host);
+  if ((he == NULL) || (he->h_addrtype != AF_INET))
+  {
+    fprintf(stderr, "daevel-udpbench: can't resolve %s\n", host);
+    exit(EXIT_FAILURE);
+  }
+  memset(&target, 0, sizeof(target));
+  target.sin_family = AF_INET;
+  target.sin_port = htons(port);
+  memcpy(&target.sin_addr, he->h_addr_list[0], sizeof(target.sin_addr));
+
+  start = now_us();
+  stop_us = start + (unsigned long long)(secs * 1e6);
+  drain_us = stop_us + UDPB_DRAIN_SECS * 1000000ULL;
+  for (t = 0; t < nthreads; t++)
+  {
+    threads[t].id = t;
+    threads[t].window = window / nthreads + ((t < window % nthreads) ? 1 : 0);
+    threads[t].rate = rate / nthreads;
+    threads[t].slots = calloc(threads[t].window, sizeof(udpb_slot));
+    threads[t].free_slots = calloc(threads[t].window, sizeof(int));
+    threads[t].fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((threads[t].slots == NULL) || (threads[t].free_slots == NULL) ||
+        (threads[t].fd < 0) ||
+        (connect(threads[t].fd, (struct sockaddr *)&target,
+                 sizeof(target)) < 0))
+    {
+      fprintf(stderr, "daevel-udpbench: can't set up thread %d: %s\n", t,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    for (i = threads[t].window - 1; i >= 0; i--)
+    {
+      slot_free(&threads[t], i);
+    }
+    if (pthread_create(&threads[t].thread, NULL, udpb_run, &threads[t]) != 0)
+    {
+      fprintf(stderr, "daevel-udpbench: can't start thread %d: %s\n", t,
+              strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+  }
+  for (t = 0; t < nthreads; t++)
+  {
+    pthread_join(threads[t].thread, NULL);
+    sent += threads[t].sent;
+    done += threads[t].done;
+    lost += threads[t].lost;
+    stale += threads[t].stale;
+    errors += threads[t].errors;
+    bytes += threads[t].bytes;
+    late += threads[t].late;
+    for (b = 0; b < METRIC_BUCKETS; b++)
+    {
+      bucket[b] += threads[t].bucket[b];
+    }
+  }
+
+  if (json == TRUE)
+  {
+    printf("{\"mode\":\"%s\",\"threads\":%d,\"window\":%d,\"rate\":%.0f,"
+           "\"secs\":%.1f,\"payload\":%lu,\"batch\":%d,\"sent\":%llu,"
+           "\"done\":%llu,\"pkt_per_s\":%.1f,\"bytes_per_s\":%.0f,"
+           "\"lost\":%llu,\"stale\":%llu,\"errors\":%llu,\"late\":%llu,"
+           "\"p50_us\":%llu,\"p99_us\":%llu,\"p999_us\":%llu}\n",
+           (rate > 0) ? "open" : "closed", nthreads, window, rate, secs,
+           (unsigned long)payload_len, batch, sent, done, done / secs,
+           bytes / secs, lost, stale, errors, late,
+           stats_quantile(bucket, done, 0.5), stats_quantile(bucket, done, 0.99),
+           stats_quantile(bucket, done, 0.999));
+    return 0;
+  }
+  printf("%s loop, %d threads, window %d, %.1fs, %lu byte datagrams, "
+         "batches of %d\n", (rate > 0) ? "open" : "closed", nthreads, window,
+         secs, (unsigned long)payload_len, batch);
+  if (rate > 0)
+  {
+    printf("target rate      %10.1f pkt/s (%llu sends over 1ms late)\n",
+           rate, late);
+  }
+  printf("sent             %10llu\n", sent);
+  printf("echoed           %10llu (%.1f pkt/s, %.1f kB/s)\n", done,
+         done / secs, bytes / secs / 1024);
+  printf("lost             %10llu (stale %llu, errors %llu)\n", lost, stale,
+         errors);
+  printf("latency us  p50  %10llu\n", stats_quantile(bucket, done, 0.5));
+  printf("            p99  %10llu\n", stats_quantile(bucket, done, 0.99));
+  printf("            p99.9%10llu\n", stats_quantile(bucket, done, 0.999));
+  return 0;
+
+} /* main */
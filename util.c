@@ -20,44 +20,32 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
 #include "global.h"
 #include "log.h"
 #include "util.h"
+#include "fds.h"
 
-/* close all possible file descriptors in this process > specified value,
-   except nominated descriptor (usually the connected socket) */
+/* close all possible file descriptors in this process >= specified value.
+   See fds.c for how; no longer a syscall per possible descriptor */
 int close_all(int startfd)
 {
+  int how;
 
-  long max = 0;
-  int i = 0;
-
-  max = sysconf(_SC_OPEN_MAX);
-  if ((startfd < 0) || (startfd > max))
+  if (startfd < 0)
   {
     PANIC(("startfd parameter out of range in close_all()\n"));
   }
 
-  if (max == 0)
+  how = fds_close(startfd, FDS_ANY);
+  if (how < 0)
   {
-    LOG(1, ("sysconf() failed strangely: value not available\n"));
+    LOG(1, ("Closing descriptors from %d failed with error %d, %s\n",
+            startfd, errno, strerror(errno)));
     return -1;
   }
-  else if (max == -1)
-  {
-    LOG(1, ("sysconf() failed with an error\n"));
-    return -1;
-  }
-
-  for (i = startfd;i < max;i++)
-  {
-    /* UNFEATURE should check for EIO (abort) & EINTR (retry) but
-       ignore EBADF */
-    close(i);
-  }
-
   return 0;
 
 } /* close_all */
@@ -105,6 +93,7 @@ int become_daemon()
       PANIC(("fork() succeeded but setsid() in child failed strangely with"
              " error %d, %s\n", errno, strerror(errno)));
     };
+    log_daemonised();
     ismaster = 1; /* should have been already, anyway */
     (void)chdir("/"); /* so we don't prevent filesystems unmounting */
     /* close file descriptors other than log to avoid resource depletion */
@@ -130,10 +119,56 @@ int become_daemon()
 
 } /* become_daemon */
 
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON  /* older BSDs */
+#endif
 
+/* Allocates len bytes of zeroed memory which stays shared with every
+   process fork()ed afterwards. Returns NULL on failure. */
+void *shared_alloc(size_t len)
+{
+  void *p;
 
+  p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+           -1, 0);
+  if (p == MAP_FAILED)
+  {
+    LOG(1, ("mmap() of %lu shared bytes failed with error %d, %s\n",
+            (unsigned long)len, errno, strerror(errno)));
+    return NULL;
+  }
+  return p;
 
+} /* shared_alloc */
 
+/* Reads fd, whose size fstat() gave as size, into memory from malloc().
+   It may have shrunk since, so *got may be less; any more there is left.
+   For files that can change under us, where a mapping would turn a
+   truncation into SIGBUS. Returns NULL, with errno set, on failure. */
+char *read_file(int fd, size_t size, size_t *got)
+{
+  char *buf;
+  ssize_t n;
 
+  *got = 0;
+  buf = malloc((size > 0) ? size : 1);
+  if (buf == NULL)
+  {
+    return NULL;
+  }
+  while ((*got < size) && ((n = read(fd, buf + *got, size - *got)) != 0))
+  {
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      free(buf);
+      return NULL;
+    }
+    *got += n;
+  }
+  return buf;
 
-
+} /* read_file */
@@ -17,6 +17,8 @@
 int close_all(int startfd);
 int int_isset(int *iset, int target, int num);
 int become_daemon();
+void *shared_alloc(size_t len);
+char *read_file(int fd, size_t size, size_t *got);
 
 /* Returns first offset for int target == iset[offset], -1 for no match.*/
 /* This is styled after FD_ISSET */